@@ -0,0 +1,109 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "activityprofile.h"
+
+namespace RecAnalystWrapper {
+
+ActivityProfiler::ActivityProfiler(unsigned int repeatWindow) : mRepeatWindow(repeatWindow),
+  mDuration(0), mUnattributedActions(0), mUnattributedCounts(256) {}
+
+void ActivityProfiler::profile(const std::string& fileName) {
+  reset();
+  BodyParser parser(fileName);
+  parser.parse(*this);
+  mDuration = parser.time();
+}
+
+void ActivityProfiler::reset() {
+  mDuration = 0;
+  mUnattributedActions = 0;
+  mUnattributedCounts.assign(256, 0);
+  mPlayers.clear();
+}
+
+bool ActivityProfiler::onSync(const SyncEvent& sync) {
+  mDuration = sync.time;
+  return true;
+}
+
+bool ActivityProfiler::onCommand(const CommandEvent& command) {
+  if (command.player < 0) {
+    ++mUnattributedActions;
+    ++mUnattributedCounts[static_cast<unsigned int>(command.type)];
+    return true;
+  }
+  PlayerActivity& activity = mPlayers[command.player];
+  activity.player = command.player;
+  unsigned int type = static_cast<unsigned int>(command.type);
+  unsigned int hash = 2166136261u;  // FNV-1a over the payload
+  for (unsigned int i = 0; i < command.length; ++i) {
+    hash = (hash ^ command.data[i]) * 16777619u;
+  }
+  activity.times.push_back(command.time);
+  ++activity.commandCounts[type];
+  if (type != activity.lastType || hash != activity.lastHash ||
+      command.time - activity.lastTime > mRepeatWindow) {
+    activity.effectiveTimes.push_back(command.time);
+  }
+  activity.lastTime = command.time;
+  activity.lastType = type;
+  activity.lastHash = hash;
+  return true;
+}
+
+// times are in game order, so a single sweep over the bucket boundaries suffices
+void ActivityProfiler::bucketize(const std::vector<unsigned int>& times, unsigned int bucketWidth,
+    std::vector<unsigned int>& counts) {
+  const unsigned int* t = times.data();
+  const unsigned int* end = t + times.size();
+  unsigned long long boundary = bucketWidth;
+  for (size_t bucket = 0; bucket < counts.size() && t != end; ++bucket, boundary += bucketWidth) {
+    const unsigned int* first = t;
+    while (t != end && *t < boundary) {
+      ++t;
+    }
+    counts[bucket] += static_cast<unsigned int>(t - first);
+  }
+  if (t != end && !counts.empty()) {
+    counts.back() += static_cast<unsigned int>(end - t);
+  }
+}
+
+bool ActivityProfiler::series(int player, unsigned int bucketWidth, ActivitySeries& series) const {
+  auto it = mPlayers.find(player);
+  if (it == mPlayers.end() || bucketWidth == 0) {
+    return false;
+  }
+  size_t buckets = mDuration / bucketWidth + 1;
+  series.bucketWidth = bucketWidth;
+  series.actions.assign(buckets, 0);
+  series.effectiveActions.assign(buckets, 0);
+  bucketize(it->second.times, bucketWidth, series.actions);
+  bucketize(it->second.effectiveTimes, bucketWidth, series.effectiveActions);
+  return true;
+}
+
+double ActivityProfiler::averageApm(int player, bool effective) const {
+  auto it = mPlayers.find(player);
+  if (it == mPlayers.end() || mDuration == 0) {
+    return 0.0;
+  }
+  size_t actions = effective ? it->second.effectiveTimes.size() : it->second.times.size();
+  return actions * 60000.0 / mDuration;
+}
+
+} // namespace
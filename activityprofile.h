@@ -0,0 +1,78 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ACTIVITYPROFILE_H_
+#define _ACTIVITYPROFILE_H_
+#include <map>
+#include <string>
+#include <vector>
+#include "bodyparser.h"
+
+namespace RecAnalystWrapper {
+
+struct ActivitySeries {
+  unsigned int bucketWidth;  // miliseconds
+  std::vector<unsigned int> actions;  // commands per bucket
+  std::vector<unsigned int> effectiveActions;  // commands per bucket without repeats
+  ActivitySeries() : bucketWidth(0) {}
+  double apm(size_t bucket) const { return actions[bucket] * 60000.0 / bucketWidth; }
+  double eapm(size_t bucket) const { return effectiveActions[bucket] * 60000.0 / bucketWidth; }
+};
+
+struct PlayerActivity {
+  int player;
+  std::vector<unsigned int> times;  // command times in game order
+  std::vector<unsigned int> effectiveTimes;
+  std::vector<unsigned int> commandCounts;  // commands per BodyCommand type
+  unsigned int lastTime;
+  unsigned int lastType;
+  unsigned int lastHash;
+  PlayerActivity() : player(0), commandCounts(256), lastTime(0), lastType(256), lastHash(0) {}
+};
+
+typedef std::map<int, PlayerActivity> PlayerActivities;  // player's index to activity map
+
+// Builds per-player APM and eAPM profiles from the body command stream. Commands
+// which repeat the player's previous command within repeatWindow are not effective.
+// Only commands carrying a player index can be attributed, see BodyParser::commandPlayer().
+class ActivityProfiler : public BodyVisitor {
+public:
+  static const unsigned int DEFAULT_REPEAT_WINDOW = 500;
+  explicit ActivityProfiler(unsigned int repeatWindow = DEFAULT_REPEAT_WINDOW);
+  void profile(const std::string& fileName);
+  void reset();
+  bool onSync(const SyncEvent& sync);
+  bool onCommand(const CommandEvent& command);
+  const PlayerActivities& players() const { return mPlayers; }
+  unsigned int duration() const { return mDuration; }
+  unsigned int unattributedActions() const { return mUnattributedActions; }
+  // per BodyCommand type, shows which commands the unattributed actions are
+  const std::vector<unsigned int>& unattributedCounts() const { return mUnattributedCounts; }
+  bool series(int player, unsigned int bucketWidth, ActivitySeries& series) const;
+  double averageApm(int player, bool effective = false) const;
+  static void bucketize(const std::vector<unsigned int>& times, unsigned int bucketWidth,
+    std::vector<unsigned int>& counts);
+private:
+  unsigned int mRepeatWindow;
+  unsigned int mDuration;
+  unsigned int mUnattributedActions;
+  std::vector<unsigned int> mUnattributedCounts;
+  PlayerActivities mPlayers;
+};
+
+} // namespace
+
+#endif  //_ACTIVITYPROFILE_H_
@@ -0,0 +1,395 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <tuple>
+#include "batch.h"
+#include "fileutil.h"
+#include "recanalystwrap.h"
+#include "statsaggregator.h"
+
+namespace RecAnalystWrapper {
+
+static const char PARTIAL_HEADER[] = "recanalyst-partial";
+static const char OUTPUT_HEADER[] = "recanalyst-batch";
+static const int FORMAT_VERSION = 2;
+
+// Fields are tab separated, tabs, line breaks and backslashes inside them are escaped
+static std::string escapeField(const std::string& text) {
+  std::string result;
+  result.reserve(text.size());
+  for (auto it = text.cbegin(); it != text.cend(); ++it) {
+    switch (*it) {
+      case '\\': result += "\\\\"; break;
+      case '\t': result += "\\t"; break;
+      case '\n': result += "\\n"; break;
+      case '\r': result += "\\r"; break;
+      default: result += *it;
+    }
+  }
+  return result;
+}
+
+static std::string unescapeField(const std::string& text) {
+  std::string result;
+  result.reserve(text.size());
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '\\' || i + 1 == text.size()) {
+      result += text[i];
+      continue;
+    }
+    switch (text[++i]) {
+      case 't': result += '\t'; break;
+      case 'n': result += '\n'; break;
+      case 'r': result += '\r'; break;
+      default: result += text[i];
+    }
+  }
+  return result;
+}
+
+static std::vector<std::string> splitFields(const std::string& line) {
+  std::vector<std::string> fields;
+  std::size_t start = 0, tab;
+  while ((tab = line.find('\t', start)) != std::string::npos) {
+    fields.push_back(line.substr(start, tab - start));
+    start = tab + 1;
+  }
+  fields.push_back(line.substr(start));
+  return fields;
+}
+
+static void writeFile(const std::string& fileName, const std::string& content) {
+  std::string tempName = fileName + ".tmp";
+  {
+    std::ofstream stream(tempName, std::ios::binary | std::ios::trunc);
+    stream.write(content.data(), content.size());
+    if (!stream) {
+      throw ERecAnalystException("Unable to create file: " + tempName);
+    }
+  }
+  if (!replaceFile(tempName, fileName)) {
+    throw ERecAnalystException("Unable to write file: " + fileName);
+  }
+}
+
+Manifest readManifest(const std::string& fileName) {
+  std::ifstream stream(fileName);
+  if (!stream) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+  }
+  Manifest manifest;
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    ManifestEntry entry;
+    std::size_t tab = line.find('\t');
+    if (tab != std::string::npos && replayHashFromString(line.substr(0, tab), entry.hash)) {
+      entry.hashed = true;
+      entry.path = line.substr(tab + 1);
+    } else {
+      entry.path = line;
+    }
+    manifest.push_back(entry);
+  }
+  return manifest;
+}
+
+void writeManifest(const std::string& fileName, const Manifest& manifest) {
+  std::string content;
+  for (auto it = manifest.cbegin(); it != manifest.cend(); ++it) {
+    if (it->hashed) {
+      content += replayHashToString(it->hash) + "\t";
+    }
+    content += it->path + "\n";
+  }
+  writeFile(fileName, content);
+}
+
+void hashManifest(Manifest& manifest) {
+  for (auto it = manifest.begin(); it != manifest.end(); ++it) {
+    if (it->hashed) {
+      continue;
+    }
+    try {
+      it->hash = hashReplayFile(it->path);
+      it->hashed = true;
+    } catch (const ERecAnalystException&) {
+      // reported as an error by the shard the path hash assigns it to
+    }
+  }
+}
+
+static ReplayHash entryHash(const ManifestEntry& entry) {
+  return entry.hashed ? entry.hash : hashReplayData(entry.path.data(), entry.path.size());
+}
+
+unsigned int shardOf(const ManifestEntry& entry, unsigned int shards) {
+  return static_cast<unsigned int>(entryHash(entry).prefix() % shards);
+}
+
+// Replay and player records of an analyzed replay
+static std::string replayRecord(const std::string& hash, const std::string& path, const RecAnalyst& recAnalyst) {
+  std::ostringstream out;
+  const GameSettings& gs = recAnalyst.gameSettings();
+  out << "replay\t" << hash << '\t' << static_cast<int>(gs.gameVersion) << '\t' << gs.mapId << '\t'
+    << gs.playTime << '\t' << (gs.extra.hasData ? 1 : 0) << '\t' << escapeField(std::string(gs.map))
+    << '\t' << path << '\n';
+  const Players& players = recAnalyst.players();
+  for (auto it = players.cbegin(); it != players.cend(); ++it) {
+    const Player& p = it->second;
+    const Achievement& a = p.achievement;
+    out << "player\t" << hash << '\t' << p.index << '\t' << p.team << '\t'
+      << static_cast<int>(p.civId) << '\t' << (p.human ? 1 : 0) << '\t' << (a.victory ? 1 : 0) << '\t'
+      << static_cast<int>(a.result) << '\t' << p.feudalTime << '\t' << p.castleTime << '\t'
+      << p.imperialTime << '\t' << a.totalScore << '\t' << a.militaryStats.militaryScore << '\t'
+      << a.economyStats.economyScore << '\t' << a.technologyStats.technologyScore << '\t'
+      << a.societyStats.societyScore << '\t' << escapeField(std::string(p.name)) << '\n';
+  }
+  return out.str();
+}
+
+void runShard(const Manifest& manifest, unsigned int shard, unsigned int shards,
+    const std::string& partialFileName, const PrefetchOptions& options, PrefetchReport* report) {
+  if (shards == 0 || shard >= shards) {
+    throw ERecAnalystException("Invalid shard " + std::to_string(shard) + " of " + std::to_string(shards));
+  }
+  std::vector<ManifestEntry> entries;
+  for (auto it = manifest.cbegin(); it != manifest.cend(); ++it) {
+    ManifestEntry entry = *it;
+    if (!entry.hashed) {
+      try {
+        entry.hash = hashReplayFile(entry.path);
+        entry.hashed = true;
+      } catch (const ERecAnalystException&) {
+      }
+    }
+    if (shardOf(entry, shards) == shard) {
+      entries.push_back(entry);
+    }
+  }
+  std::sort(entries.begin(), entries.end(), [](const ManifestEntry& a, const ManifestEntry& b) {
+    ReplayHash ha = entryHash(a), hb = entryHash(b);
+    return (ha != hb) ? ha < hb : a.path < b.path;
+  });
+
+  // records are filled in by the parser threads and written in entry order
+  std::vector<std::string> records(entries.size());
+  std::vector<std::string> fileNames;
+  std::vector<std::size_t> fileEntries;
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    const ManifestEntry& entry = entries[i];
+    if (entry.hashed && i > 0 && entries[i - 1].hashed && entries[i - 1].hash == entry.hash) {
+      records[i] = "duplicate\t" + replayHashToString(entry.hash) + "\t" + escapeField(entry.path) + "\n";
+    } else {
+      fileNames.push_back(entry.path);
+      fileEntries.push_back(i);
+    }
+  }
+  PrefetchReport prefetchReport = analyzeFiles(fileNames,
+    [&](std::size_t index, const AnalyzeStatus& status, RecAnalyst& recAnalyst) {
+      const ManifestEntry& entry = entries[fileEntries[index]];
+      std::string hash = replayHashToString(entryHash(entry));
+      std::string path = escapeField(entry.path);
+      records[fileEntries[index]] = status.ok() ? replayRecord(hash, path, recAnalyst) :
+        "error\t" + hash + "\t" + std::to_string(status.code()) + "\t" + path + "\n";
+    }, options);
+  if (report != NULL) {
+    *report = prefetchReport;
+  }
+
+  std::ostringstream out;
+  out << PARTIAL_HEADER << '\t' << FORMAT_VERSION << '\t' << shard << '\t' << shards << '\n';
+  for (auto it = records.cbegin(); it != records.cend(); ++it) {
+    out << *it;
+  }
+  writeFile(partialFileName, out.str());
+}
+
+  enum class RecordKind {
+    REPLAY,
+    FAILED,
+    DUPLICATE
+  };
+
+// Replay line of a partial file with the player lines that follow it
+struct PartialRecord {
+  ReplayHash hash;
+  RecordKind kind;
+  std::string path;
+  std::vector<std::string> lines;
+  bool operator<(const PartialRecord& other) const {
+    return std::tie(hash, kind, path) < std::tie(other.hash, other.kind, other.path);
+  }
+};
+
+static unsigned long fieldNumber(const std::string& field) {
+  return std::strtoul(field.c_str(), NULL, 10);
+}
+
+// Feeds a replay record back into the statistics aggregator
+static void addRecordStats(const PartialRecord& record, StatsAggregator& stats) {
+  std::vector<std::string> replay = splitFields(record.lines[0]);
+  GameSettings gameSettings;
+  gameSettings.gameVersion = static_cast<GameVersion>(fieldNumber(replay[2]));
+  gameSettings.mapId = static_cast<int>(fieldNumber(replay[3]));
+  gameSettings.playTime = fieldNumber(replay[4]);
+  gameSettings.extra.hasData = replay[5] == "1";
+  gameSettings.map = unescapeField(replay[6]);
+  Players players;
+  for (std::size_t i = 1; i < record.lines.size(); ++i) {
+    std::vector<std::string> f = splitFields(record.lines[i]);
+    Player& p = players[static_cast<int>(fieldNumber(f[2]))];
+    p.index = static_cast<int>(fieldNumber(f[2]));
+    p.team = static_cast<int>(fieldNumber(f[3]));
+    p.civId = static_cast<Civilization>(fieldNumber(f[4]));
+    p.human = f[5] == "1";
+    p.achievement.victory = f[6] == "1";
+    p.achievement.result = static_cast<GameResult>(fieldNumber(f[7]));
+    p.feudalTime = fieldNumber(f[8]);
+    p.castleTime = fieldNumber(f[9]);
+    p.imperialTime = fieldNumber(f[10]);
+    p.achievement.totalScore = fieldNumber(f[11]);
+    p.achievement.militaryStats.militaryScore = fieldNumber(f[12]);
+    p.achievement.economyStats.economyScore = fieldNumber(f[13]);
+    p.achievement.technologyStats.technologyScore = fieldNumber(f[14]);
+    p.achievement.societyStats.societyScore = fieldNumber(f[15]);
+    p.name = unescapeField(f[16]);
+  }
+  stats.add(gameSettings, players);
+}
+
+void mergePartials(const std::vector<std::string>& partialFileNames, const std::string& outputFileName) {
+  std::vector<PartialRecord> records;
+  std::set<unsigned int> shardsSeen;
+  unsigned int shards = 0;
+  for (auto name = partialFileNames.cbegin(); name != partialFileNames.cend(); ++name) {
+    std::ifstream stream(*name, std::ios::binary);
+    if (!stream) {
+      throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+    }
+    std::string line;
+    std::vector<std::string> header;
+    if (std::getline(stream, line)) {
+      header = splitFields(line);
+    }
+    if (header.size() != 4 || header[0] != PARTIAL_HEADER || fieldNumber(header[1]) != FORMAT_VERSION) {
+      throw ERecAnalystException("Not a partial result file: " + *name);
+    }
+    unsigned int shard = fieldNumber(header[2]);
+    if (shards == 0) {
+      shards = fieldNumber(header[3]);
+    }
+    if (fieldNumber(header[3]) != shards || shard >= shards || !shardsSeen.insert(shard).second) {
+      throw ERecAnalystException("Partial result file of another run or a repeated shard: " + *name);
+    }
+    while (std::getline(stream, line)) {
+      std::vector<std::string> f = splitFields(line);
+      ReplayHash hash;
+      if (f.size() < 3 || !replayHashFromString(f[1], hash)) {
+        throw ERecAnalystException("Malformed partial result file: " + *name);
+      }
+      if (f[0] == "player") {
+        if (f.size() != 17 || records.empty() || records.back().kind != RecordKind::REPLAY ||
+            records.back().hash != hash) {
+          throw ERecAnalystException("Malformed partial result file: " + *name);
+        }
+        records.back().lines.push_back(line);
+        continue;
+      }
+      PartialRecord record;
+      record.hash = hash;
+      if (f[0] == "replay" && f.size() == 8) {
+        record.kind = RecordKind::REPLAY;
+      } else if (f[0] == "error" && f.size() == 4) {
+        record.kind = RecordKind::FAILED;
+      } else if (f[0] == "duplicate" && f.size() == 3) {
+        record.kind = RecordKind::DUPLICATE;
+      } else {
+        throw ERecAnalystException("Malformed partial result file: " + *name);
+      }
+      record.path = f.back();
+      record.lines.push_back(line);
+      records.push_back(record);
+    }
+  }
+  if (shards == 0 || shardsSeen.size() != shards) {
+    throw ERecAnalystException("Missing partial result files, " + std::to_string(shardsSeen.size()) +
+      " of " + std::to_string(shards) + " shards");
+  }
+  std::sort(records.begin(), records.end());
+
+  unsigned long long analyzed = 0, failed = 0, duplicates = 0;
+  std::map<int, unsigned long long> errors;
+  StatsAggregator stats;
+  for (auto it = records.cbegin(); it != records.cend(); ++it) {
+    if (it->kind == RecordKind::REPLAY) {
+      ++analyzed;
+      addRecordStats(*it, stats);
+    } else if (it->kind == RecordKind::FAILED) {
+      ++failed;
+      ++errors[static_cast<int>(std::strtol(splitFields(it->lines[0])[2].c_str(), NULL, 10))];
+    } else {
+      ++duplicates;
+    }
+  }
+
+  std::ostringstream out;
+  out << OUTPUT_HEADER << '\t' << FORMAT_VERSION << '\n';
+  out << "replays\t" << records.size() << '\n';
+  out << "analyzed\t" << analyzed << '\n';
+  out << "failed\t" << failed << '\n';
+  out << "duplicates\t" << duplicates << '\n';
+  for (auto it = errors.cbegin(); it != errors.cend(); ++it) {
+    out << "errors\t" << it->first << '\t' << it->second << '\t' << recanalyst_errmsg(it->first) << '\n';
+  }
+  for (auto it = records.cbegin(); it != records.cend(); ++it) {
+    for (auto line = it->lines.cbegin(); line != it->lines.cend(); ++line) {
+      out << *line << '\n';
+    }
+  }
+  // cells in key order, the aggregator's hash order depends on its history
+  std::vector<const StatsAggregator::Cells::value_type*> cells;
+  for (auto it = stats.cells().cbegin(); it != stats.cells().cend(); ++it) {
+    cells.push_back(&*it);
+  }
+  std::sort(cells.begin(), cells.end(), [](const StatsAggregator::Cells::value_type* a,
+      const StatsAggregator::Cells::value_type* b) {
+    return std::tie(a->first.civ, a->first.version, a->first.map) <
+      std::tie(b->first.civ, b->first.version, b->first.map);
+  });
+  for (auto it = cells.cbegin(); it != cells.cend(); ++it) {
+    const CivStats& s = (*it)->second;
+    out << "stats\t" << static_cast<int>((*it)->first.civ) << '\t' << static_cast<int>((*it)->first.version)
+      << '\t' << s.players << '\t' << s.wins << '\t' << s.losses << '\t'
+      << s.feudalTime.valueAtQuantile(0.5) << '\t' << s.castleTime.valueAtQuantile(0.5) << '\t'
+      << s.imperialTime.valueAtQuantile(0.5) << '\t' << s.score(StatsScore::TOTAL).valueAtQuantile(0.5)
+      << '\t' << escapeField((*it)->first.map) << '\n';
+  }
+  writeFile(outputFileName, out.str());
+}
+
+} // namespace
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+#include <string>
+#include <vector>
+#include "prefetch.h"
+#include "replayhash.h"
+
+namespace RecAnalystWrapper {
+
+// Replay listed in a manifest, a manifest line is either a path or "<hash>\t<path>"
+struct ManifestEntry {
+  ReplayHash hash;
+  bool hashed;  // hash is known, otherwise the shard runner hashes the file
+  std::string path;
+  ManifestEntry() : hash(), hashed(false) {}
+};
+
+typedef std::vector<ManifestEntry> Manifest;
+
+Manifest readManifest(const std::string& fileName);
+void writeManifest(const std::string& fileName, const Manifest& manifest);
+// Hashes the entries without a hash so the nodes do not each read every file,
+// entries that cannot be read are left unhashed
+void hashManifest(Manifest& manifest);
+
+// Shard a replay belongs to, replays that cannot be read go by the hash of their path
+unsigned int shardOf(const ManifestEntry& entry, unsigned int shards);
+
+// Analyzes the replays of one shard and writes them to a partial result file.
+// Replays with the same content are analyzed once, the first path in order wins.
+// Analysis runs in the prefetch pipeline, its report is stored in report if given.
+void runShard(const Manifest& manifest, unsigned int shard, unsigned int shards,
+  const std::string& partialFileName, const PrefetchOptions& options = PrefetchOptions(),
+  PrefetchReport* report = NULL);
+
+// Combines the partial files of every shard of a run into one result file with the
+// replays in hash order, the error counts and the per civ statistics. The output
+// depends only on the replays, not on the number of shards or the order of the files.
+void mergePartials(const std::vector<std::string>& partialFileNames, const std::string& outputFileName);
+
+} // namespace
+
+#endif  //_BATCH_H_
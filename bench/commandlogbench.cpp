@@ -0,0 +1,213 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Measures the command log against the raw body it was extracted from: size
+// ratio and decoding speed against re-parsing the body.
+// usage: commandlogbench [-n iterations] [-synthetic minutes] file...
+// -synthetic writes a four player body of the given length to the temp directory
+// and includes it, for trees without replays at hand.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "../bodyparser.h"
+#include "../commandlog.h"
+#include "../recanalystwrap.h"
+#include "fakerecanalyst.h"
+
+using namespace RecAnalystWrapper;
+
+static void putInt32(std::vector<unsigned char>& out, int value) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(&value);
+  out.insert(out.end(), p, p + 4);
+}
+
+static void putFloat(std::vector<unsigned char>& out, float value) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(&value);
+  out.insert(out.end(), p, p + 4);
+}
+
+static void putCommand(std::vector<unsigned char>& body, const std::vector<unsigned char>& payload) {
+  putInt32(body, static_cast<int>(BodyOperation::COMMAND));
+  putInt32(body, static_cast<int>(payload.size()));
+  body.insert(body.end(), payload.begin(), payload.end());
+  putInt32(body, 0);
+}
+
+// Command mix and id ranges roughly as in ranked 1v1 and team games
+static std::string writeSyntheticBody(unsigned int minutes) {
+  std::vector<unsigned char> file;
+  putInt32(file, 12);  // header length, the header is a placeholder
+  putInt32(file, 0);
+  putInt32(file, 0);
+  Lcg lcg(minutes);
+  std::vector<unsigned char> payload;
+  for (unsigned int time = 0; time < minutes * 60000;) {
+    unsigned int delta = 100 + lcg.next(60);
+    time += delta;
+    putInt32(file, static_cast<int>(BodyOperation::SYNC));
+    putInt32(file, static_cast<int>(delta));
+    putInt32(file, 1);
+    file.insert(file.end(), 12, 0);
+    for (int player = 1; player <= 4; ++player) {
+      if (lcg.next(8) != 0) {
+        continue;
+      }
+      int base = 2000 + player * 500 + static_cast<int>(time / 2000);
+      unsigned int kind = lcg.next(100);
+      payload.clear();
+      if (kind < 60) {
+        unsigned int units = 1 + lcg.next(12);
+        payload.push_back(static_cast<unsigned char>(kind < 40 ? BodyCommand::MOVE : BodyCommand::INTERACT));
+        payload.push_back(static_cast<unsigned char>(player));
+        payload.insert(payload.end(), 2, 0);
+        putInt32(payload, kind < 40 ? -1 : 500 + static_cast<int>(lcg.next(3000)));
+        payload.push_back(static_cast<unsigned char>(units));
+        payload.insert(payload.end(), 3, 0);
+        putFloat(payload, 20.0f + lcg.next(8000) / 100.0f);
+        putFloat(payload, 20.0f + lcg.next(8000) / 100.0f);
+        int unit = base + static_cast<int>(lcg.next(200));
+        for (unsigned int i = 0; i < units; ++i) {
+          putInt32(payload, unit + static_cast<int>(i * (1 + lcg.next(3))));
+        }
+      } else if (kind < 80) {
+        payload.push_back(static_cast<unsigned char>(BodyCommand::TRAIN));
+        payload.insert(payload.end(), 3, 0);
+        putInt32(payload, base - 400 + static_cast<int>(lcg.next(8)));
+        payload.push_back(static_cast<unsigned char>(lcg.next(4) == 0 ? 83 : 4));
+        payload.insert(payload.end(), 1, 0);
+        payload.push_back(static_cast<unsigned char>(1 + lcg.next(5)));
+        payload.insert(payload.end(), 1, 0);
+      } else if (kind < 88) {
+        unsigned int units = 1 + lcg.next(3);
+        payload.push_back(static_cast<unsigned char>(BodyCommand::BUILD));
+        payload.push_back(static_cast<unsigned char>(units));
+        payload.push_back(static_cast<unsigned char>(player));
+        payload.push_back(0);
+        putFloat(payload, static_cast<float>(20 + lcg.next(80)));
+        putFloat(payload, static_cast<float>(20 + lcg.next(80)));
+        putInt32(payload, 70 + static_cast<int>(lcg.next(4)));
+        putInt32(payload, -1);
+        putInt32(payload, -1);
+        int unit = base + static_cast<int>(lcg.next(200));
+        for (unsigned int i = 0; i < units; ++i) {
+          putInt32(payload, unit + static_cast<int>(i));
+        }
+      } else if (kind < 94) {
+        payload.push_back(static_cast<unsigned char>(BodyCommand::RESEARCH));
+        payload.insert(payload.end(), 3, 0);
+        putInt32(payload, base - 400 + static_cast<int>(lcg.next(8)));
+        payload.push_back(static_cast<unsigned char>(player));
+        payload.push_back(0);
+        payload.push_back(static_cast<unsigned char>(lcg.next(250)));
+        payload.push_back(0);
+        putInt32(payload, -1);
+      } else {
+        payload.push_back(static_cast<unsigned char>(BodyCommand::STOP));
+        payload.push_back(1);
+        payload.insert(payload.end(), 2, 0);
+        putInt32(payload, base + static_cast<int>(lcg.next(200)));
+      }
+      putCommand(file, payload);
+    }
+  }
+  std::string fileName = (std::filesystem::temp_directory_path() /
+    ("commandlogbench-" + std::to_string(minutes) + ".mgx")).string();
+  std::FILE* out = std::fopen(fileName.c_str(), "wb");
+  if (out == NULL || std::fwrite(file.data(), 1, file.size(), out) != file.size()) {
+    throw ERecAnalystException("Unable to write " + fileName);
+  }
+  std::fclose(out);
+  return fileName;
+}
+
+// Sums up the command bytes, parsing is what the log saves a reader
+struct CommandBytes : public BodyVisitor {
+  unsigned long long bytes;
+  unsigned int count;
+  CommandBytes() : bytes(0), count(0) {}
+  bool onCommand(const CommandEvent& command) {
+    bytes += 12 + command.length;
+    ++count;
+    return true;
+  }
+};
+
+int main(int argc, char* argv[]) {
+  int iterations = 10;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-synthetic") == 0 && i + 1 < argc) {
+      files.push_back(writeSyntheticBody(std::atoi(argv[++i])));
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.empty() || iterations <= 0) {
+    std::fprintf(stderr, "usage: commandlogbench [-n iterations] [-synthetic minutes] file...\n");
+    return 1;
+  }
+
+  std::printf("%-28s %9s %10s %10s %10s %8s %8s %10s %10s\n", "file", "commands", "body KB",
+    "cmd KB", "log KB", "body/log", "cmd/log", "parse MB/s", "decode MB/s");
+  for (auto it = files.cbegin(); it != files.cend(); ++it) {
+    try {
+      CommandLogWriter writer;
+      writer.extract(*it);
+      std::vector<unsigned char> log;
+      writer.finish(log);
+      unsigned long long body;
+      CommandBytes commands;
+      auto start = std::chrono::steady_clock::now();
+      for (int n = 0; n < iterations; ++n) {
+        BodyParser parser(*it);
+        commands = CommandBytes();
+        parser.parse(commands);
+        body = parser.layout().fileSize - parser.layout().bodyOffset;
+      }
+      double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      CommandLog reader;
+      reader.assign(log);
+      CommandBytes decoded;
+      start = std::chrono::steady_clock::now();
+      for (int n = 0; n < iterations; ++n) {
+        decoded = CommandBytes();
+        reader.replay(decoded);
+      }
+      double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (decoded.bytes != commands.bytes || decoded.count != commands.count) {
+        std::fprintf(stderr, "%s: the log does not decode to the body's commands\n", it->c_str());
+        return 1;
+      }
+      std::string name = std::filesystem::path(*it).filename().string();
+      std::printf("%-28s %9u %10.1f %10.1f %10.1f %8.2f %8.2f %10.1f %10.1f\n", name.c_str(), commands.count,
+        body / 1024.0, commands.bytes / 1024.0, log.size() / 1024.0,
+        log.empty() ? 0.0 : static_cast<double>(body) / log.size(),
+        log.empty() ? 0.0 : static_cast<double>(commands.bytes) / log.size(),
+        body * iterations / parseSeconds / 1e6, body * iterations / decodeSeconds / 1e6);
+    } catch (const ERecAnalystException& e) {
+      std::fprintf(stderr, "%s: %s\n", it->c_str(), e.what());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,389 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Deterministic stand-in for the recanalyst library, linked instead of the
+// import library it lets the wrapper be measured without the real analyzer.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#define DLLIMPORT
+#include "../recanalyst.h"
+#include "fakerecanalyst.h"
+
+struct recanalyst {
+  bool analyzed;
+};
+
+namespace RecAnalystWrapper {
+
+static const char* const CIVILIZATIONS[] = {
+  "Britons", "Franks", "Goths", "Teutons", "Japanese", "Chinese", "Byzantines", "Persians",
+  "Saracens", "Turks", "Vikings", "Mongols", "Celts", "Spanish", "Aztecs", "Mayans", "Huns",
+  "Koreans"
+};
+
+static const char* const RESEARCHES[] = {
+  "Feudal Age", "Castle Age", "Imperial Age", "Loom", "Wheelbarrow", "Hand Cart",
+  "Double-Bit Axe", "Bow Saw", "Horse Collar", "Gold Mining", "Fletching", "Bodkin Arrow",
+  "Forging", "Iron Casting", "Scale Mail Armor", "Ballistics", "Conscription", "Husbandry"
+};
+
+static const char* const WORDS[] = {
+  "gg", "wp", "rush", "boom", "fast", "castle", "attack", "help", "gold", "wood", "now",
+  "flank", "pocket", "trade", "market", "wall", "tower", "scouts", "archers", "knights"
+};
+
+template <typename T, size_t N>
+inline size_t count(T (&)[N]) { return N; }
+
+// Everything the fake library enumerates, rebuilt by setFakeGame()
+struct FakeData {
+  FakeGame game;
+  std::vector<RECANALYST_INITIALSTATE> initialStates;
+  std::vector<RECANALYST_MILITARYSTATS> militaryStats;
+  std::vector<RECANALYST_ECONOMYSTATS> economyStats;
+  std::vector<RECANALYST_TECHNOLOGYSTATS> technologyStats;
+  std::vector<RECANALYST_SOCIETYSTATS> societyStats;
+  std::vector<RECANALYST_ACHIEVEMENT> achievements;
+  std::vector<RECANALYST_PLAYER> players;
+  std::vector<RECANALYST_CHATMESSAGE> preGameChatMessages;
+  std::vector<RECANALYST_CHATMESSAGE> inGameChatMessages;
+  std::vector<RECANALYST_TRIBUTE> tributes;
+  std::vector<RECANALYST_RESEARCH> researches;
+  std::vector<CHAR> map;
+  FakeData() { build(FakeGame()); }
+  void build(const FakeGame& game);
+};
+
+static void randomMessage(Lcg& lcg, char* buffer, size_t size) {
+  size_t length = 0;
+  unsigned int words = 2 + lcg.next(10);
+  for (unsigned int i = 0; i < words; ++i) {
+    const char* word = WORDS[lcg.next(count(WORDS))];
+    size_t n = std::strlen(word);
+    if (length + n + 2 > size) {
+      break;
+    }
+    if (length > 0) {
+      buffer[length++] = ' ';
+    }
+    std::memcpy(buffer + length, word, n);
+    length += n;
+  }
+  buffer[length] = '\0';
+}
+
+void FakeData::build(const FakeGame& g) {
+  game = g;
+  if (game.players < 1) {
+    game.players = 1;
+  } else if (game.players > 8) {
+    game.players = 8;
+  }
+  Lcg lcg(game.seed);
+  int total = game.players + game.coopingPlayers;
+  initialStates.assign(total, RECANALYST_INITIALSTATE());
+  militaryStats.assign(total, RECANALYST_MILITARYSTATS());
+  economyStats.assign(total, RECANALYST_ECONOMYSTATS());
+  technologyStats.assign(total, RECANALYST_TECHNOLOGYSTATS());
+  societyStats.assign(total, RECANALYST_SOCIETYSTATS());
+  achievements.assign(total, RECANALYST_ACHIEVEMENT());
+  players.assign(total, RECANALYST_PLAYER());
+  for (int i = 0; i < total; ++i) {
+    bool cooping = i >= game.players;
+    RECANALYST_INITIALSTATE& is = initialStates[i];
+    is.dwFood = is.dwWood = 200;
+    is.dwStone = 150;
+    is.dwGold = 100;
+    is.dwPopulation = is.dwCivilianPop = 4;
+    is.dwHouseCapacity = 5;
+    is.ptPosition.x = lcg.next(220);
+    is.ptPosition.y = lcg.next(220);
+    std::strcpy(is.szStartingAge, "Dark Age");
+    militaryStats[i].wMilitaryScore = static_cast<WORD>(lcg.next(5000));
+    economyStats[i].wEconomyScore = static_cast<WORD>(lcg.next(5000));
+    economyStats[i].dwFoodCollected = lcg.next(60000);
+    technologyStats[i].wTechnologyScore = static_cast<WORD>(lcg.next(5000));
+    technologyStats[i].dwFeudalAge = 600000 + lcg.next(300000);
+    societyStats[i].wSocietyScore = static_cast<WORD>(lcg.next(5000));
+    RECANALYST_ACHIEVEMENT& a = achievements[i];
+    a.bVictory = i % 2;
+    a.dwTotalScore = lcg.next(20000);
+    a.lpMilitaryStats = &militaryStats[i];
+    a.lpEconomyStats = &economyStats[i];
+    a.lpTechnologyStats = &technologyStats[i];
+    a.lpSocietyStats = &societyStats[i];
+    RECANALYST_PLAYER& p = players[i];
+    int index = cooping ? (i - game.players) % game.players + 1 : i + 1;
+    std::snprintf(p.szName, sizeof(p.szName), cooping ? "Cooping player %d" : "Player %d", i + 1);
+    p.dwIndex = index;
+    p.bHuman = TRUE;
+    p.dwTeam = (index - 1) % 2 + 1;
+    p.bOwner = i == 0;
+    p.dwCivId = 1 + lcg.next(count(CIVILIZATIONS));
+    std::strcpy(p.szCivilization, CIVILIZATIONS[p.dwCivId - 1]);
+    p.dwColor = index - 1;
+    p.bIsCooping = cooping;
+    p.dwFeudalTime = technologyStats[i].dwFeudalAge;
+    p.dwCastleTime = p.dwFeudalTime + 500000 + lcg.next(200000);
+    p.dwImperialTime = p.dwCastleTime + 900000 + lcg.next(400000);
+    p.lpInitialState = &initialStates[i];
+    p.lpAchievement = &achievements[i];
+  }
+
+  preGameChatMessages.assign(game.preGameChatMessages, RECANALYST_CHATMESSAGE());
+  for (auto it = preGameChatMessages.begin(); it != preGameChatMessages.end(); ++it) {
+    it->dwColor = 1 + lcg.next(game.players);
+    randomMessage(lcg, it->szMessage, sizeof(it->szMessage));
+  }
+  inGameChatMessages.assign(game.inGameChatMessages, RECANALYST_CHATMESSAGE());
+  DWORD time = 0;
+  for (auto it = inGameChatMessages.begin(); it != inGameChatMessages.end(); ++it) {
+    time += lcg.next(20000);
+    it->dwTime = time;
+    it->dwColor = 1 + lcg.next(game.players);
+    randomMessage(lcg, it->szMessage, sizeof(it->szMessage));
+  }
+  tributes.assign(game.tributes, RECANALYST_TRIBUTE());
+  time = 0;
+  for (auto it = tributes.begin(); it != tributes.end(); ++it) {
+    time += lcg.next(60000);
+    it->dwTime = time;
+    it->dwPlayerFrom = 1 + lcg.next(game.players);
+    it->dwPlayerTo = 1 + lcg.next(game.players);
+    it->byResource = static_cast<BYTE>(lcg.next(4));
+    it->dwAmount = 100 * (1 + lcg.next(10));
+    it->fFee = 0.3f;
+  }
+  researches.assign(game.researches, RECANALYST_RESEARCH());
+  time = 0;
+  for (auto it = researches.begin(); it != researches.end(); ++it) {
+    time += lcg.next(10000);
+    unsigned int id = lcg.next(count(RESEARCHES));
+    it->dwTime = time;
+    it->dwId = 101 + id;
+    it->dwPlayerId = 1 + lcg.next(game.players);
+    std::strcpy(it->szName, RESEARCHES[id]);
+  }
+  map.resize(game.mapBytes);
+  for (auto it = map.begin(); it != map.end(); ++it) {
+    *it = static_cast<CHAR>(lcg.next(256));
+  }
+}
+
+static FakeData& fakeData() {
+  static FakeData data;
+  return data;
+}
+
+void setFakeGame(const FakeGame& game) {
+  fakeData().build(game);
+}
+
+const FakeGame& fakeGame() {
+  return fakeData().game;
+}
+
+} // namespace
+
+using namespace RecAnalystWrapper;
+
+static int checkAnalyzed(recanalyst* ra) {
+  if (ra == NULL) {
+    return RECANALYST_INVALIDPTR;
+  }
+  return ra->analyzed ? RECANALYST_OK : RECANALYST_NOTANALYZED;
+}
+
+template <typename T, typename Proc>
+static int enumerate(recanalyst* ra, const std::vector<T>& items, Proc lpEnumFunc, LPARAM lParam) {
+  int code = checkAnalyzed(ra);
+  if (code != RECANALYST_OK) {
+    return code;
+  }
+  if (lpEnumFunc == NULL) {
+    return RECANALYST_NOCALLBACK;
+  }
+  // the library hands out a copy of each record, as the real one builds them on the fly
+  for (auto it = items.cbegin(); it != items.cend(); ++it) {
+    T item = *it;
+    if (!lpEnumFunc(&item, lParam)) {
+      break;
+    }
+  }
+  return RECANALYST_OK;
+}
+
+static int copyString(const char* s, LPTSTR buffer) {
+  int size = static_cast<int>(std::strlen(s)) + 1;
+  if (buffer != NULL) {
+    std::memcpy(buffer, s, size);
+  }
+  return size;
+}
+
+recanalyst* WINAPI recanalyst_create() {
+  recanalyst* ra = new recanalyst;
+  ra->analyzed = false;
+  return ra;
+}
+
+int WINAPI recanalyst_free(recanalyst* ra) {
+  if (ra == NULL) {
+    return RECANALYST_INVALIDPTR;
+  }
+  delete ra;
+  return RECANALYST_OK;
+}
+
+int WINAPI recanalyst_analyze(recanalyst* ra, LPCTSTR lpFileName) {
+  if (ra == NULL) {
+    return RECANALYST_INVALIDPTR;
+  }
+  if (lpFileName == NULL || *lpFileName == '\0') {
+    return RECANALYST_NOFILE;
+  }
+  ra->analyzed = true;
+  return RECANALYST_OK;
+}
+
+int WINAPI recanalyst_getgamesettings(recanalyst* ra, LPRECANALYST_GAMESETTINGS lpGameSettings) {
+  int code = checkAnalyzed(ra);
+  if (code != RECANALYST_OK) {
+    return code;
+  }
+  const FakeGame& game = fakeGame();
+  RECANALYST_GAMESETTINGS& gs = *lpGameSettings;
+  gs.dwGameType = 0;
+  gs.dwMapStyle = 0;
+  gs.dwDifficultyLevel = 1;
+  gs.dwGameSpeed = 150;
+  gs.dwRevealMap = 0;
+  gs.dwMapSize = 3;
+  gs.bIsScenario = FALSE;
+  gs.dwPlayers = game.players;
+  gs.dwPOV = 1;
+  gs.dwMapId = 9;
+  gs.dwPopLimit = 200;
+  gs.bLockDiplomacy = TRUE;
+  gs.dwPlayTime = game.inGameChatMessages * 10000 + 1800000;
+  gs.bInGameCoop = game.coopingPlayers > 0;
+  gs.bIsFFA = FALSE;
+  gs.dwVersion = 4;
+  gs.dwGameMode = 0;
+  std::strcpy(gs.szMap, "Arabia");
+  std::snprintf(gs.szPlayersType, sizeof(gs.szPlayersType), "%dv%d", (game.players + 1) / 2,
+    game.players / 2);
+  std::strcpy(gs.szPOV, "Player 1");
+  std::strcpy(gs.szGameType, "Random Map");
+  std::strcpy(gs.szMapStyle, "Standard");
+  std::strcpy(gs.szDifficultyLevel, "Hard");
+  std::strcpy(gs.szGameSpeed, "Normal");
+  std::strcpy(gs.szRevealMap, "Normal");
+  std::strcpy(gs.szMapSize, "Medium (4 player)");
+  std::strcpy(gs.szVersion, "AOC 1.0c");
+  gs.szScFileName[0] = '\0';
+  std::strcpy(gs.szSubVersion, "11.76");
+  if (gs.lpVictory != NULL) {
+    gs.lpVictory->dwTimeLimit = 0;
+    gs.lpVictory->dwScoreLimit = 0;
+    gs.lpVictory->dwVictoryCondition = 0;
+    std::strcpy(gs.lpVictory->szVictory, "Conquest");
+  }
+  if (gs.lpExtra != NULL) {
+    std::memset(gs.lpExtra, 0, sizeof(*gs.lpExtra));
+    gs.lpExtra->bHasData = TRUE;
+    gs.lpExtra->bTeamTogether = TRUE;
+  }
+  return RECANALYST_OK;
+}
+
+int WINAPI recanalyst_enumplayers(recanalyst* ra, EnumPlayersProc lpEnumFunc, LPARAM lParam) {
+  return enumerate(ra, fakeData().players, lpEnumFunc, lParam);
+}
+
+int WINAPI recanalyst_getobjectives(recanalyst* ra, LPTSTR lpObjectives) {
+  int code = checkAnalyzed(ra);
+  return code != RECANALYST_OK ? code : copyString("Conquest: destroy all enemy units and buildings.",
+    lpObjectives);
+}
+
+int WINAPI recanalyst_enumpregamechat(recanalyst* ra, EnumChatMessagesProc lpEnumFunc, LPARAM lParam) {
+  return enumerate(ra, fakeData().preGameChatMessages, lpEnumFunc, lParam);
+}
+
+int WINAPI recanalyst_enumingamechat(recanalyst* ra, EnumChatMessagesProc lpEnumFunc, LPARAM lParam) {
+  return enumerate(ra, fakeData().inGameChatMessages, lpEnumFunc, lParam);
+}
+
+int WINAPI recanalyst_enumtributes(recanalyst* ra, EnumTributesProc lpEnumFunc, LPARAM lParam) {
+  return enumerate(ra, fakeData().tributes, lpEnumFunc, lParam);
+}
+
+int WINAPI recanalyst_enumresearches(recanalyst* ra, EnumResearchesProc lpEnumFunc, LPARAM lParam) {
+  return enumerate(ra, fakeData().researches, lpEnumFunc, lParam);
+}
+
+int WINAPI recanalyst_generatemap(recanalyst* ra, DWORD dwWidth, DWORD dwHeight, CHAR* lpImageBuffer) {
+  int code = checkAnalyzed(ra);
+  if (code != RECANALYST_OK) {
+    return code;
+  }
+  if (dwWidth == 0 || dwHeight == 0) {
+    return RECANALYST_GENMAP;
+  }
+  const std::vector<CHAR>& map = fakeData().map;
+  if (lpImageBuffer != NULL && !map.empty()) {
+    std::memcpy(lpImageBuffer, map.data(), map.size());
+  }
+  return static_cast<int>(map.size());
+}
+
+int WINAPI recanalyst_analyzetime(recanalyst* ra) {
+  int code = checkAnalyzed(ra);
+  return code != RECANALYST_OK ? code : 1;
+}
+
+int WINAPI recanalyst_timetostring(DWORD dwTime, LPTSTR lpTime) {
+  char time[32];
+  DWORD seconds = dwTime / 1000;
+  std::snprintf(time, sizeof(time), "%02u:%02u:%02u", static_cast<unsigned int>(seconds / 3600),
+    static_cast<unsigned int>(seconds / 60 % 60), static_cast<unsigned int>(seconds % 60));
+  return copyString(time, lpTime);
+}
+
+LPCTSTR WINAPI recanalyst_errmsg(int iErrCode) {
+  switch (iErrCode) {
+    case RECANALYST_OK: return "Success.";
+    case RECANALYST_NOFILE: return "No file has been specified for analyzing.";
+    case RECANALYST_FILEEXT: return "Wrong file extension, file format is not supported.";
+    case RECANALYST_EMPTYHEADER: return "Header length is zero.";
+    case RECANALYST_DECOMP: return "Cannot decompress header section.";
+    case RECANALYST_FILEREAD: return "Cannot read sections.";
+    case RECANALYST_FILEOPEN: return "Cannot open file.";
+    case RECANALYST_HEADLENREAD: return "Unable to read the header length.";
+    case RECANALYST_INVALIDPTR: return "Invalid pointer.";
+    case RECANALYST_NOCALLBACK: return "Error setting parameters.";
+    case RECANALYST_NOTANALYZED: return "File has not been analyzed yet.";
+    case RECANALYST_GENMAP: return "Error generating map.";
+    default: return "Unknown error.";
+  }
+}
+
+LPCTSTR WINAPI recanalyst_libversion() {
+  return "fake";
+}
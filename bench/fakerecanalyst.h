@@ -0,0 +1,55 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FAKERECANALYST_H_
+#define _FAKERECANALYST_H_
+
+namespace RecAnalystWrapper {
+
+// Shape of the games produced by the deterministic stand-in of the recanalyst
+// library in fakerecanalyst.cpp, every analyzed file yields the same game
+struct FakeGame {
+  int players;  // 1..8
+  int coopingPlayers;  // extra players sharing a slot with the first ones
+  int preGameChatMessages;
+  int inGameChatMessages;
+  int tributes;
+  int researches;
+  int mapBytes;  // size of the "png" returned by recanalyst_generatemap()
+  unsigned int seed;
+  FakeGame() : players(8), coopingPlayers(0), preGameChatMessages(20), inGameChatMessages(200),
+    tributes(50), researches(400), mapBytes(64 * 1024), seed(1) {}
+};
+
+// The stand-in's random source, shared with the benches and tests that build
+// their own inputs so every run sees the same data
+class Lcg {
+public:
+  explicit Lcg(unsigned int seed) : mState(seed) {}
+  unsigned int next(unsigned int bound) {
+    mState = mState * 1664525u + 1013904223u;
+    return (mState >> 8) % bound;
+  }
+private:
+  unsigned int mState;
+};
+
+void setFakeGame(const FakeGame& game);
+const FakeGame& fakeGame();
+
+} // namespace
+
+#endif  //_FAKERECANALYST_H_
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the header inflate engines on a replay corpus.
+// usage: inflatebench [-n iterations] file...
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../inflate.h"
+#include "../recfile.h"
+#include "../recanalystwrap.h"
+
+using namespace RecAnalystWrapper;
+
+int main(int argc, char* argv[]) {
+  int iterations = 10;
+  std::vector<std::vector<unsigned char>> headers;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = std::atoi(argv[++i]);
+      continue;
+    }
+    try {
+      RecFile file(argv[i]);
+      headers.push_back(std::vector<unsigned char>());
+      file.readHeader(headers.back());
+    } catch (const ERecAnalystException& e) {
+      std::fprintf(stderr, "%s: %s\n", argv[i], e.what());
+    }
+  }
+  if (headers.empty()) {
+    std::fprintf(stderr, "usage: inflatebench [-n iterations] file...\n");
+    return 1;
+  }
+
+  std::vector<std::string> names = inflateEngineNames();
+  std::printf("%-14s %10s %12s %12s %10s\n", "engine", "headers", "in MB/s", "out MB/s", "us/header");
+  for (auto it = names.cbegin(); it != names.cend(); ++it) {
+    std::unique_ptr<InflateEngine> engine = createInflateEngine(*it);
+    std::vector<unsigned char> output;
+    unsigned long long in = 0, out = 0, count = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; ++n) {
+      for (auto h = headers.cbegin(); h != headers.cend(); ++h) {
+        if (!engine->inflate(h->data(), h->size(), output)) {
+          std::fprintf(stderr, "%s: unable to inflate header\n", engine->name());
+          return 1;
+        }
+        in += h->size();
+        out += output.size();
+        ++count;
+      }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-14s %10llu %12.1f %12.1f %10.1f\n", engine->name(), count,
+      in / seconds / 1e6, out / seconds / 1e6, seconds * 1e6 / count);
+  }
+  return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the memory held by Player copies with the same players kept in a
+// CompactPlayerStore, and checks that every player survives the round trip.
+// usage: playerfootprint [-repeat n] file...
+// -repeat adds the players of the corpus n times, to scale a small corpus up.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include "../compactplayer.h"
+#include "../recanalystwrap.h"
+
+using namespace RecAnalystWrapper;
+
+// live heap bytes, every block carries its size in front of it
+static long long gLiveBytes = 0;
+static const std::size_t BLOCK_HEADER = 16;
+
+void* operator new(std::size_t size) {
+  if (char* p = static_cast<char*>(std::malloc(size + BLOCK_HEADER))) {
+    *reinterpret_cast<std::size_t*>(p) = size;
+    gLiveBytes += size;
+    return p + BLOCK_HEADER;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  if (p != NULL) {
+    char* block = reinterpret_cast<char*>(reinterpret_cast<std::uintptr_t>(p) - BLOCK_HEADER);
+    gLiveBytes -= *reinterpret_cast<std::size_t*>(block);
+    std::free(block);
+  }
+}
+
+void operator delete[](void* p) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  operator delete(p);
+}
+
+static bool samePlayer(const Player& a, const Player& b) {
+  if (a.name != b.name || a.civ != b.civ || a.index != b.index || a.team != b.team ||
+      a.human != b.human || a.owner != b.owner || a.civId != b.civId || a.color != b.color ||
+      a.feudalTime != b.feudalTime || a.castleTime != b.castleTime ||
+      a.imperialTime != b.imperialTime || a.resignTime != b.resignTime ||
+      a.disconnectTime != b.disconnectTime ||
+      a.coopingPlayers.size() != b.coopingPlayers.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.coopingPlayers.size(); ++i) {
+    if (a.coopingPlayers[i].name != b.coopingPlayers[i].name ||
+        a.coopingPlayers[i].resignTime != b.coopingPlayers[i].resignTime) {
+      return false;
+    }
+  }
+  const InitialState& x = a.initialState;
+  const InitialState& y = b.initialState;
+  if (x.food != y.food || x.wood != y.wood || x.stone != y.stone || x.gold != y.gold ||
+      x.startingAge != y.startingAge || x.population != y.population ||
+      x.position.x != y.position.x || x.position.y != y.position.y ||
+      x.startingAgeString != y.startingAgeString) {
+    return false;
+  }
+  const Achievement& p = a.achievement;
+  const Achievement& q = b.achievement;
+  return p.victory == q.victory && p.medal == q.medal && p.result == q.result &&
+    p.totalScore == q.totalScore &&
+    p.militaryStats.unitsKilled == q.militaryStats.unitsKilled &&
+    p.economyStats.goldCollected == q.economyStats.goldCollected &&
+    p.technologyStats.imperialAge == q.technologyStats.imperialAge &&
+    p.societyStats.villagerHigh == q.societyStats.villagerHigh;
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<Player> players;
+  CompactPlayerStore store;
+  long long playerBytes = 0, compactBytes = 0;
+  int files = 0, repeat = 1;
+  RecAnalyst recAnalyst;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+      repeat = std::atoi(argv[++i]);
+      continue;
+    }
+    try {
+      recAnalyst.analyze(argv[i]);
+    } catch (const ERecAnalystException& e) {
+      std::fprintf(stderr, "%s: %s\n", argv[i], e.what());
+      continue;
+    }
+    ++files;
+    const Players& analyzed = recAnalyst.players();
+    for (int n = 0; n < repeat; ++n) {
+      long long live = gLiveBytes;
+      for (auto it = analyzed.cbegin(); it != analyzed.cend(); ++it) {
+        players.push_back(it->second);
+      }
+      playerBytes += gLiveBytes - live;
+      live = gLiveBytes;
+      for (auto it = analyzed.cbegin(); it != analyzed.cend(); ++it) {
+        store.add(it->second);
+      }
+      compactBytes += gLiveBytes - live;
+    }
+  }
+  if (players.empty()) {
+    std::fprintf(stderr, "usage: playerfootprint [-repeat n] file...\n");
+    return 1;
+  }
+  // drop the slack of the vectors' growth from both sides
+  long long live = gLiveBytes;
+  players.shrink_to_fit();
+  playerBytes += gLiveBytes - live;
+  live = gLiveBytes;
+  store.shrinkToFit();
+  compactBytes += gLiveBytes - live;
+
+  std::size_t mismatches = 0;
+  for (std::size_t i = 0; i < players.size(); ++i) {
+    if (!samePlayer(players[i], store.player(static_cast<std::uint32_t>(i)))) {
+      ++mismatches;
+    }
+  }
+
+  double count = static_cast<double>(players.size());
+  std::printf("files %d, players %zu, round trip mismatches %zu\n", files, players.size(), mismatches);
+  std::printf("%-14s %10s %14s %14s\n", "layout", "sizeof", "heap bytes", "bytes/player");
+  std::printf("%-14s %10zu %14lld %14.1f\n", "Player", sizeof(Player), playerBytes, playerBytes / count);
+  std::printf("%-14s %10zu %14zu %14.1f\n", "CompactPlayer", sizeof(CompactPlayer),
+    store.memoryUsage(), store.memoryUsage() / count);
+  std::printf("measured compact growth %lld bytes, reduction %.1fx\n", compactBytes,
+    static_cast<double>(playerBytes) / store.memoryUsage());
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the per-match core of RatingEngine on synthetic matches, ids are drawn
+// up front so the timing covers rating only.
+// usage: ratingbench [-n matches] [-players n] [-teamgames percent]
+// -teamgames is the share of 4v4 matches, the rest are 1v1.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../ratingengine.h"
+#include "fakerecanalyst.h"
+
+using namespace RecAnalystWrapper;
+
+struct Match {
+  MatchPlayer players[RatingEngine::MAX_PLAYERS];
+  std::size_t count;
+  unsigned int playTime;
+};
+
+int main(int argc, char* argv[]) {
+  unsigned int matchCount = 2000000;
+  unsigned int playerCount = 100000;
+  unsigned int teamGames = 30;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      matchCount = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-players") == 0 && i + 1 < argc) {
+      playerCount = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-teamgames") == 0 && i + 1 < argc) {
+      teamGames = std::atoi(argv[++i]);
+    } else {
+      matchCount = 0;
+    }
+  }
+  if (matchCount == 0 || playerCount < RatingEngine::MAX_PLAYERS || teamGames > 100) {
+    std::fprintf(stderr, "usage: ratingbench [-n matches] [-players n] [-teamgames percent]\n");
+    return 1;
+  }
+
+  RatingEngine engine;
+  std::vector<std::uint32_t> ids(playerCount);
+  for (unsigned int i = 0; i < playerCount; ++i) {
+    ids[i] = engine.playerId("player" + std::to_string(i));
+  }
+  Lcg lcg(playerCount);
+  std::vector<Match> matches(matchCount);
+  for (auto it = matches.begin(); it != matches.end(); ++it) {
+    it->count = (lcg.next(100) < teamGames) ? 8 : 2;
+    int winner = static_cast<int>(lcg.next(2));
+    for (std::size_t i = 0; i < it->count; ++i) {
+      // players may repeat within a match, the engine does not care
+      it->players[i].id = ids[lcg.next(playerCount)];
+      it->players[i].team = static_cast<int>(i % 2);
+      it->players[i].winner = it->players[i].team == winner;
+    }
+    it->playTime = (10 + lcg.next(50)) * 60 * 1000;
+  }
+
+  unsigned int rated = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (auto it = matches.cbegin(); it != matches.cend(); ++it) {
+    rated += engine.addMatch(it->players, it->count, it->playTime) == RatingOutcome::RATED ? 1 : 0;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::printf("%u matches, %u rated, %u players, %u%% 4v4\n", matchCount, rated, playerCount, teamGames);
+  std::printf("%.3f s, %.2fM matches/s, %.1f ns/match\n", seconds, matchCount / seconds / 1e6,
+    seconds * 1e9 / matchCount);
+  return 0;
+}
@@ -0,0 +1,385 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the wrapper's own overhead against the stand-in library in
+// fakerecanalyst.cpp, build it with recanalystwrap.cpp and fakerecanalyst.cpp
+// instead of the import library.
+// usage: wrapbench [-n iterations] [-players n] [-coop n] [-pregame n] [-ingame n]
+//   [-tributes n] [-researches n] [-map bytes] [-json] [-baseline file [-threshold percent]]
+//   [-trace file]
+// With -json one result per line is printed, a saved run passed as -baseline makes
+// the exit status nonzero if ns/event or allocations grow by more than threshold.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include "../recanalystwrap.h"
+#include "../trace.h"
+#include "fakerecanalyst.h"
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace RecAnalystWrapper;
+
+static unsigned long long gAllocations = 0;
+static unsigned long long gAllocatedBytes = 0;
+
+void* operator new(std::size_t size) {
+  ++gAllocations;
+  gAllocatedBytes += size;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+static unsigned long long peakRssKb() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+    return pmc.PeakWorkingSetSize / 1024;
+  }
+  return 0;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+struct Result {
+  std::string name;
+  unsigned long long iterations;
+  unsigned long long events;  // over all iterations
+  double nsPerEvent;
+  double allocationsPerIteration;
+  double bytesPerIteration;
+};
+
+// Accumulates time and allocations of the measured sections only
+class Meter {
+public:
+  Meter(void) : mNs(0), mAllocations(0), mBytes(0), mStartAllocations(0), mStartBytes(0) {}
+  void start() {
+    mStartAllocations = gAllocations;
+    mStartBytes = gAllocatedBytes;
+    mStart = std::chrono::steady_clock::now();
+  }
+  void stop() {
+    auto end = std::chrono::steady_clock::now();
+    mAllocations += gAllocations - mStartAllocations;
+    mBytes += gAllocatedBytes - mStartBytes;
+    mNs += std::chrono::duration_cast<std::chrono::nanoseconds>(end - mStart).count();
+  }
+  Result result(const char* name, unsigned long long iterations, unsigned long long events) const {
+    Result r;
+    r.name = name;
+    r.iterations = iterations;
+    r.events = events;
+    r.nsPerEvent = events ? (double)mNs / events : 0.0;
+    r.allocationsPerIteration = iterations ? (double)mAllocations / iterations : 0.0;
+    r.bytesPerIteration = iterations ? (double)mBytes / iterations : 0.0;
+    return r;
+  }
+private:
+  unsigned long long mNs;
+  unsigned long long mAllocations;
+  unsigned long long mBytes;
+  unsigned long long mStartAllocations;
+  unsigned long long mStartBytes;
+  std::chrono::steady_clock::time_point mStart;
+};
+
+static volatile size_t gSink;
+
+// Runs f() iterations times, f returns the number of events it processed
+template <typename F>
+static Result measure(const char* name, int iterations, F f) {
+  Meter meter;
+  unsigned long long events = 0;
+  meter.start();
+  for (int i = 0; i < iterations; ++i) {
+    events += f();
+  }
+  meter.stop();
+  return meter.result(name, iterations, events);
+}
+
+static void printJson(const FakeGame& game, const std::vector<Result>& results) {
+  std::printf("{\"game\": {\"players\": %d, \"coop\": %d, \"pregame\": %d, \"ingame\": %d, "
+    "\"tributes\": %d, \"researches\": %d, \"map\": %d},\n", game.players, game.coopingPlayers,
+    game.preGameChatMessages, game.inGameChatMessages, game.tributes, game.researches, game.mapBytes);
+  std::printf("\"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    std::printf("{\"name\": \"%s\", \"iterations\": %llu, \"events\": %llu, \"ns_per_event\": %.3f, "
+      "\"allocs_per_iter\": %.3f, \"bytes_per_iter\": %.1f}%s\n", r.name.c_str(), r.iterations,
+      r.events, r.nsPerEvent, r.allocationsPerIteration, r.bytesPerIteration,
+      (i + 1 < results.size()) ? "," : "");
+  }
+  std::printf("],\n\"peak_rss_kb\": %llu}\n", peakRssKb());
+}
+
+static void printTable(const std::vector<Result>& results) {
+  std::printf("%-22s %10s %12s %12s %14s %14s\n", "case", "iterations", "events", "ns/event",
+    "allocs/iter", "bytes/iter");
+  for (auto it = results.cbegin(); it != results.cend(); ++it) {
+    std::printf("%-22s %10llu %12llu %12.2f %14.2f %14.0f\n", it->name.c_str(), it->iterations,
+      it->events, it->nsPerEvent, it->allocationsPerIteration, it->bytesPerIteration);
+  }
+  std::printf("peak RSS: %llu kB\n", peakRssKb());
+}
+
+// Reads the result lines of a previous -json run
+static bool loadBaseline(const char* fileName, std::vector<Result>& baseline) {
+  std::FILE* file = std::fopen(fileName, "r");
+  if (file == NULL) {
+    return false;
+  }
+  char line[1024];
+  while (std::fgets(line, sizeof(line), file) != NULL) {
+    char name[128];
+    Result r;
+    if (std::sscanf(line, "{\"name\": \"%127[^\"]\", \"iterations\": %llu, \"events\": %llu, "
+      "\"ns_per_event\": %lf, \"allocs_per_iter\": %lf, \"bytes_per_iter\": %lf", name,
+      &r.iterations, &r.events, &r.nsPerEvent, &r.allocationsPerIteration, &r.bytesPerIteration) == 6) {
+      r.name = name;
+      baseline.push_back(r);
+    }
+  }
+  std::fclose(file);
+  return true;
+}
+
+static int compare(const std::vector<Result>& baseline, const std::vector<Result>& results,
+  double threshold) {
+  int regressions = 0;
+  for (auto it = results.cbegin(); it != results.cend(); ++it) {
+    for (auto b = baseline.cbegin(); b != baseline.cend(); ++b) {
+      if (b->name != it->name) {
+        continue;
+      }
+      double time = b->nsPerEvent > 0 ? (it->nsPerEvent / b->nsPerEvent - 1) * 100 : 0;
+      bool slower = time > threshold;
+      bool allocates = it->allocationsPerIteration > b->allocationsPerIteration * (1 + threshold / 100);
+      if (slower || allocates) {
+        ++regressions;
+        std::fprintf(stderr, "regression: %s ns/event %.2f -> %.2f, allocs/iter %.2f -> %.2f\n",
+          it->name.c_str(), b->nsPerEvent, it->nsPerEvent, b->allocationsPerIteration,
+          it->allocationsPerIteration);
+      }
+    }
+  }
+  return regressions;
+}
+
+int main(int argc, char* argv[]) {
+  FakeGame game;
+  int iterations = 1000;
+  bool json = false;
+  const char* baselineFile = NULL;
+  const char* traceFile = NULL;
+  double threshold = 10.0;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (std::strcmp(arg, "-json") == 0) {
+      json = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::fprintf(stderr, "usage: wrapbench [-n iterations] [-players n] [-coop n] [-pregame n] "
+        "[-ingame n] [-tributes n] [-researches n] [-map bytes] [-json] "
+        "[-baseline file [-threshold percent]] [-trace file]\n");
+      return 1;
+    }
+    const char* value = argv[++i];
+    if (std::strcmp(arg, "-n") == 0) {
+      iterations = std::atoi(value);
+    } else if (std::strcmp(arg, "-players") == 0) {
+      game.players = std::atoi(value);
+    } else if (std::strcmp(arg, "-coop") == 0) {
+      game.coopingPlayers = std::atoi(value);
+    } else if (std::strcmp(arg, "-pregame") == 0) {
+      game.preGameChatMessages = std::atoi(value);
+    } else if (std::strcmp(arg, "-ingame") == 0) {
+      game.inGameChatMessages = std::atoi(value);
+    } else if (std::strcmp(arg, "-tributes") == 0) {
+      game.tributes = std::atoi(value);
+    } else if (std::strcmp(arg, "-researches") == 0) {
+      game.researches = std::atoi(value);
+    } else if (std::strcmp(arg, "-map") == 0) {
+      game.mapBytes = std::atoi(value);
+    } else if (std::strcmp(arg, "-baseline") == 0) {
+      baselineFile = value;
+    } else if (std::strcmp(arg, "-trace") == 0) {
+      traceFile = value;
+    } else if (std::strcmp(arg, "-threshold") == 0) {
+      threshold = std::atof(value);
+    } else {
+      std::fprintf(stderr, "unknown option %s\n", arg);
+      return 1;
+    }
+  }
+  setFakeGame(game);
+  setTracingEnabled(traceFile != NULL);
+  game = fakeGame();
+  const std::string fileName = "synthetic.mgx";
+  std::vector<Result> results;
+
+  // analyze() on a fresh instance each time, construction is not measured
+  {
+    Meter meter;
+    unsigned long long events = 0;
+    for (int i = 0; i < iterations; ++i) {
+      RecAnalyst recAnalyst;
+      meter.start();
+      recAnalyst.analyze(fileName);
+      meter.stop();
+      events += 1 + game.players + game.coopingPlayers + game.preGameChatMessages
+        + game.inGameChatMessages + game.tributes + game.researches;
+    }
+    results.push_back(meter.result("analyze", iterations, events));
+  }
+
+  RecAnalyst recAnalyst;
+  recAnalyst.analyze(fileName);
+  results.push_back(measure("gameSettings", iterations, [&]() -> unsigned long long {
+    gSink = recAnalyst.gameSettings().map.size();
+    return 1;
+  }));
+  results.push_back(measure("players", iterations, [&]() -> unsigned long long {
+    const Players& players = recAnalyst.players();
+    for (auto it = players.cbegin(); it != players.cend(); ++it) {
+      gSink = it->second.name.size() + it->second.coopingPlayers.size();
+    }
+    return players.size();
+  }));
+  results.push_back(measure("teams", iterations, [&]() -> unsigned long long {
+    const Teams& teams = recAnalyst.teams();
+    unsigned long long n = 0;
+    for (auto it = teams.cbegin(); it != teams.cend(); ++it) {
+      for (auto p = it->second.cbegin(); p != it->second.cend(); ++p, ++n) {
+        gSink = p->second.get().index;
+      }
+    }
+    return n;
+  }));
+  results.push_back(measure("preGameChatMessages", iterations, [&]() -> unsigned long long {
+    const ChatMessages& messages = recAnalyst.preGameChatMessages();
+    for (auto it = messages.cbegin(); it != messages.cend(); ++it) {
+      gSink = it->msg.size();
+    }
+    return messages.size();
+  }));
+  results.push_back(measure("inGameChatMessages", iterations, [&]() -> unsigned long long {
+    const ChatMessages& messages = recAnalyst.inGameChatMessages();
+    for (auto it = messages.cbegin(); it != messages.cend(); ++it) {
+      gSink = it->msg.size();
+    }
+    return messages.size();
+  }));
+  results.push_back(measure("tributes", iterations, [&]() -> unsigned long long {
+    const Tributes& tributes = recAnalyst.tributes();
+    for (auto it = tributes.cbegin(); it != tributes.cend(); ++it) {
+      gSink = it->amount + it->playerFrom.index;
+    }
+    return tributes.size();
+  }));
+  results.push_back(measure("researches", iterations, [&]() -> unsigned long long {
+    const Researches& researches = recAnalyst.researches();
+    for (auto it = researches.cbegin(); it != researches.cend(); ++it) {
+      gSink = it->name.size() + it->player.index;
+    }
+    return researches.size();
+  }));
+  results.push_back(measure("owner", iterations, [&]() -> unsigned long long {
+    gSink = recAnalyst.owner()->first;
+    return 1;
+  }));
+
+  std::vector<std::string> names;
+  for (auto it = recAnalyst.players().cbegin(); it != recAnalyst.players().cend(); ++it) {
+    names.push_back(std::string(it->second.name));
+    for (auto cp = it->second.coopingPlayers.cbegin(); cp != it->second.coopingPlayers.cend(); ++cp) {
+      names.push_back(std::string(cp->name));
+    }
+  }
+  results.push_back(measure("getPlayer", iterations, [&]() -> unsigned long long {
+    for (auto it = names.cbegin(); it != names.cend(); ++it) {
+      gSink = recAnalyst.getPlayer(*it)->first;
+    }
+    return names.size();
+  }));
+  results.push_back(measure("getPlayer/miss", iterations, [&]() -> unsigned long long {
+    gSink = recAnalyst.hasPlayer("Nobody");
+    return 1;
+  }));
+  std::vector<char> png;
+  results.push_back(measure("generateMap", iterations, [&]() -> unsigned long long {
+    recAnalyst.generateMap(300, 150, png);
+    gSink = png.size();
+    return 1;
+  }));
+
+  if (traceFile != NULL) {
+    saveChromeTrace(traceFile);
+  }
+  if (json) {
+    printJson(game, results);
+  } else {
+    printTable(results);
+  }
+  if (baselineFile != NULL) {
+    std::vector<Result> baseline;
+    if (!loadBaseline(baselineFile, baseline)) {
+      std::fprintf(stderr, "%s: cannot read baseline\n", baselineFile);
+      return 1;
+    }
+    return compare(baseline, results, threshold) ? 2 : 0;
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Binary stream helpers shared by the index and snapshot formats, values are
+// written in native byte order. Internal, not part of the wrapper's API.
+
+#ifndef _BINARYIO_H_
+#define _BINARYIO_H_
+#include <algorithm>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace RecAnalystWrapper {
+
+template <typename T>
+inline void writeValue(std::ostream& stream, T value) {
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+inline bool readValue(std::istream& stream, T& value) {
+  return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+template <typename T>
+inline void writeArray(std::ostream& stream, const std::vector<T>& values) {
+  writeValue<unsigned long long>(stream, values.size());
+  stream.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+// Bytes between the read position and the end, -1 for streams that cannot seek
+inline long long bytesLeft(std::istream& stream) {
+  std::istream::pos_type position = stream.tellg();
+  if (position == std::istream::pos_type(-1)) {
+    return -1;
+  }
+  stream.seekg(0, std::ios::end);
+  std::istream::pos_type end = stream.tellg();
+  stream.seekg(position);
+  if (end == std::istream::pos_type(-1) || !stream) {
+    stream.clear();
+    stream.seekg(position);
+    return -1;
+  }
+  return static_cast<long long>(end - position);
+}
+
+// The count is checked against the bytes left before anything is allocated, on streams
+// that cannot seek the array is read in chunks so a truncated one fails early
+template <typename T>
+inline bool readArray(std::istream& stream, std::vector<T>& values, unsigned long long maxSize) {
+  static const std::size_t CHUNK = (1024 * 1024 + sizeof(T) - 1) / sizeof(T);
+  unsigned long long size;
+  if (!readValue(stream, size) || size > maxSize) {
+    return false;
+  }
+  long long left = bytesLeft(stream);
+  if (left >= 0 && size > static_cast<unsigned long long>(left) / sizeof(T)) {
+    return false;
+  }
+  values.clear();
+  while (values.size() < size) {
+    std::size_t offset = values.size();
+    std::size_t count = static_cast<std::size_t>(std::min<unsigned long long>(size - offset, CHUNK));
+    values.resize(offset + count);
+    if (!stream.read(reinterpret_cast<char*>(values.data() + offset), count * sizeof(T))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+#endif  //_BINARYIO_H_
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bodyparser.h"
+
+namespace RecAnalystWrapper {
+
+BodyParser::BodyParser(const std::string& fileName, size_t chunkSize) : mFile(fileName),
+  mBuffer(chunkSize), mBegin(0), mEnd(0), mTime(0) {
+  mPosition = mFile.layout().bodyOffset;
+}
+
+BodyParser::~BodyParser() {}
+
+bool BodyParser::fill(size_t size) {
+  if (size > MAX_OPERATION_SIZE + 12) {
+    throwMalformed();
+  }
+  if (mBegin > 0) {  // keep the unparsed tail at the front of the chunk
+    std::memmove(mBuffer.data(), mBuffer.data() + mBegin, mEnd - mBegin);
+    mEnd -= mBegin;
+    mBegin = 0;
+  }
+  if (size > mBuffer.size()) {
+    mBuffer.resize(size);
+  }
+  while (mEnd < size) {
+    size_t read = std::fread(mBuffer.data() + mEnd, 1, mBuffer.size() - mEnd, mFile.handle());
+    if (read == 0) {
+      std::clearerr(mFile.handle());  // the file may still be growing
+      return false;
+    }
+    mEnd += read;
+  }
+  return true;
+}
+
+void BodyParser::throwMalformed() {
+  throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEREAD));
+}
+
+} // namespace
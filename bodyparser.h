@@ -0,0 +1,306 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BODYPARSER_H_
+#define _BODYPARSER_H_
+#include <cstring>
+#include <string>
+#include <vector>
+#include "recfile.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+  enum class BodyOperation {
+    COMMAND = 1,
+    SYNC = 2,
+    VIEWLOCK = 3,
+    META = 4
+  };
+
+  enum class BodyCommand {
+    INTERACT = 0x00,
+    STOP = 0x01,
+    WORK = 0x02,
+    MOVE = 0x03,
+    AI_MOVE = 0x0A,
+    RESIGN = 0x0B,
+    WAYPOINT = 0x10,
+    STANCE = 0x12,
+    GUARD = 0x13,
+    FOLLOW = 0x14,
+    PATROL = 0x15,
+    FORMATION = 0x17,
+    SAVE = 0x1B,
+    AI_TRAIN = 0x64,
+    RESEARCH = 0x65,
+    BUILD = 0x66,
+    GAME = 0x67,
+    WALL = 0x69,
+    DELETE = 0x6A,
+    ATTACK_GROUND = 0x6B,
+    TRIBUTE = 0x6C,
+    REPAIR = 0x6E,
+    UNGARRISON = 0x6F,
+    TOGGLE_GATE = 0x72,
+    FLARE = 0x73,
+    ORDER = 0x75,
+    TRAIN = 0x77,
+    GATHER_POINT = 0x78,
+    SELL = 0x7A,
+    BUY = 0x7B,
+    DROP_RELIC = 0x7E,
+    TOWN_BELL = 0x7F,
+    BACK_TO_WORK = 0x80
+  };
+
+struct SyncEvent {
+  unsigned int time;   // game time after the sync (miliseconds)
+  unsigned int delta;
+};
+
+// data points into the parser's chunk buffer and is valid only during the callback
+struct CommandEvent {
+  unsigned int time;
+  int player;          // player index, -1 if the command does not carry one
+  BodyCommand type;
+  const unsigned char* data;  // command payload, data[0] is the command type
+  unsigned int length;
+};
+
+struct ChatEvent {
+  unsigned int time;
+  const char* text;    // raw "@#<n>..." chat text, not null-terminated
+  unsigned int length;
+};
+
+struct AgeUpEvent {
+  unsigned int time;   // time the advance was started
+  int player;
+  StartingAge age;
+};
+
+struct ResignEvent {
+  unsigned int time;
+  int player;
+  bool disconnected;
+};
+
+// Base for body visitors. Hide the callbacks you need; the empty ones inline away.
+// Return false from a callback to stop parsing.
+struct BodyVisitor {
+  bool onSync(const SyncEvent&) { return true; }
+  bool onCommand(const CommandEvent&) { return true; }
+  bool onChat(const ChatEvent&) { return true; }
+  bool onAgeUp(const AgeUpEvent&) { return true; }
+  bool onResign(const ResignEvent&) { return true; }
+};
+
+// Streams the body operations of a recorded game in fixed-size chunks.
+// parse() stops at the end of the available data and may be called again
+// once more data has been appended to the file.
+class BodyParser {
+public:
+  static const size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+  static const unsigned int MAX_OPERATION_SIZE = 1024 * 1024;
+  explicit BodyParser(const std::string& fileName, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+  ~BodyParser(void);
+  template <class Visitor> bool parse(Visitor& visitor);
+  unsigned long long position() const { return mPosition; }
+  unsigned int time() const { return mTime; }
+  const RecFileLayout& layout() const { return mFile.layout(); }
+  // Player index a command carries, -1 for the commands which only carry unit ids:
+  // STOP, WORK, WAYPOINT, STANCE, GUARD, FOLLOW, PATROL, FORMATION, SAVE, AI_TRAIN,
+  // ATTACK_GROUND, REPAIR, UNGARRISON, TOGGLE_GATE, FLARE, ORDER, TRAIN, GATHER_POINT,
+  // DROP_RELIC, TOWN_BELL, BACK_TO_WORK and the unknown types
+  static int commandPlayer(const unsigned char* data, unsigned int length);
+private:
+  BodyParser(const BodyParser&);
+  BodyParser& operator=(const BodyParser&);
+  const unsigned char* peek(size_t size);
+  void consume(size_t size);
+  bool fill(size_t size);
+  static int readInt32(const unsigned char* p);
+  static void throwMalformed();
+  RecFile mFile;
+  std::vector<unsigned char> mBuffer;
+  size_t mBegin;
+  size_t mEnd;
+  unsigned long long mPosition;  // file offset of the next unparsed operation
+  unsigned int mTime;
+};
+
+inline int BodyParser::readInt32(const unsigned char* p) {
+  int value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline const unsigned char* BodyParser::peek(size_t size) {
+  if (mEnd - mBegin >= size || fill(size)) {
+    return &mBuffer[mBegin];
+  }
+  return NULL;
+}
+
+inline void BodyParser::consume(size_t size) {
+  mBegin += size;
+  mPosition += size;
+}
+
+inline int BodyParser::commandPlayer(const unsigned char* data, unsigned int length) {
+  switch (static_cast<BodyCommand>(data[0])) {
+  case BodyCommand::INTERACT:
+  case BodyCommand::MOVE:
+  case BodyCommand::AI_MOVE:
+  case BodyCommand::RESIGN:
+  case BodyCommand::TRIBUTE:
+  case BodyCommand::SELL:
+  case BodyCommand::BUY:
+    return (length > 1) ? data[1] : -1;
+  case BodyCommand::BUILD:
+  case BodyCommand::WALL:
+  case BodyCommand::GAME:
+    return (length > 2) ? data[2] : -1;
+  case BodyCommand::DELETE:
+    return (length > 8) ? data[8] : -1;
+  case BodyCommand::RESEARCH:
+    return (length > 9) ? (data[8] | (data[9] << 8)) : -1;
+  default:
+    return -1;
+  }
+}
+
+template <class Visitor>
+bool BodyParser::parse(Visitor& visitor) {
+  const unsigned char* p;
+  while ((p = peek(4)) != NULL) {
+    switch (static_cast<BodyOperation>(readInt32(p))) {
+    case BodyOperation::COMMAND: {
+      if ((p = peek(8)) == NULL) {
+        return true;
+      }
+      int length = readInt32(p + 4);
+      if (length <= 0 || static_cast<unsigned int>(length) > MAX_OPERATION_SIZE) {
+        throwMalformed();
+      }
+      if ((p = peek(12 + length)) == NULL) {
+        return true;
+      }
+      consume(12 + length);  // length, payload and trailing dword
+      CommandEvent command;
+      command.time = mTime;
+      command.data = p + 8;
+      command.length = length;
+      command.type = static_cast<BodyCommand>(command.data[0]);
+      command.player = commandPlayer(command.data, command.length);
+      if (!visitor.onCommand(command)) {
+        return false;
+      }
+      if (command.type == BodyCommand::RESEARCH && length > 11) {
+        int researchId = command.data[10] | (command.data[11] << 8);
+        if (researchId >= 101 && researchId <= 103) {  // Feudal, Castle and Imperial Age
+          AgeUpEvent ageUp;
+          ageUp.time = mTime;
+          ageUp.player = command.player;
+          ageUp.age = static_cast<StartingAge>(researchId - 100);
+          if (!visitor.onAgeUp(ageUp)) {
+            return false;
+          }
+        }
+      } else if (command.type == BodyCommand::RESIGN && length > 3) {
+        ResignEvent resign;
+        resign.time = mTime;
+        resign.player = command.data[1];
+        resign.disconnected = command.data[3] != 0;
+        if (!visitor.onResign(resign)) {
+          return false;
+        }
+      }
+      break;
+    }
+    case BodyOperation::SYNC: {
+      if ((p = peek(12)) == NULL) {
+        return true;
+      }
+      size_t size = (readInt32(p + 8) == 0) ? 52 : 24;
+      if ((p = peek(size)) == NULL) {
+        return true;
+      }
+      consume(size);
+      SyncEvent sync;
+      sync.delta = static_cast<unsigned int>(readInt32(p + 4));
+      mTime += sync.delta;
+      sync.time = mTime;
+      if (!visitor.onSync(sync)) {
+        return false;
+      }
+      break;
+    }
+    case BodyOperation::VIEWLOCK:
+      if (peek(16) == NULL) {
+        return true;
+      }
+      consume(16);
+      break;
+    case BodyOperation::META: {
+      if ((p = peek(8)) == NULL) {
+        return true;
+      }
+      int command = readInt32(p + 4);
+      if (command == 0x01F4) {  // game start
+        size_t size = (layout().format == RecFormat::MGL) ? 36 : 28;
+        if (peek(size) == NULL) {
+          return true;
+        }
+        consume(size);
+      } else if (command == -1) {  // chat message
+        if ((p = peek(12)) == NULL) {
+          return true;
+        }
+        int length = readInt32(p + 8);
+        if (length < 0 || static_cast<unsigned int>(length) > MAX_OPERATION_SIZE) {
+          throwMalformed();
+        }
+        if ((p = peek(12 + length)) == NULL) {
+          return true;
+        }
+        consume(12 + length);
+        ChatEvent chat;
+        chat.time = mTime;
+        chat.text = reinterpret_cast<const char*>(p + 12);
+        chat.length = length;
+        while (chat.length > 0 && chat.text[chat.length - 1] == '\0') {
+          --chat.length;
+        }
+        if (!visitor.onChat(chat)) {
+          return false;
+        }
+      } else {
+        throwMalformed();
+      }
+      break;
+    }
+    default:
+      throwMalformed();
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+#endif  //_BODYPARSER_H_
@@ -0,0 +1,385 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECANALYST_SSE2
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <zlib.h>
+#include "chatindex.h"
+#include "binaryio.h"
+#include "fileutil.h"
+
+namespace RecAnalystWrapper {
+
+static const char CHAT_INDEX_MAGIC[8] = { 'R', 'A', 'C', 'H', 'A', 'T', '0', '2' };
+
+static inline char lowerAscii(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+static void lowerAscii(const char* src, char* dst, std::size_t size) {
+  std::size_t i = 0;
+#ifdef RECANALYST_SSE2
+  // 'A'..'Z' shifted to the bottom of the signed range, a single compare finds them
+  const __m128i shift = _mm_set1_epi8(static_cast<char>(0x80 - 'A'));
+  const __m128i limit = _mm_set1_epi8(static_cast<char>(-128 + 26));
+  const __m128i bit = _mm_set1_epi8(0x20);
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(v, _mm_and_si128(upper, bit)));
+  }
+#endif
+  for (; i < size; ++i) {
+    dst[i] = lowerAscii(src[i]);
+  }
+}
+
+// Position of the next occurrence of needle at or after from, or npos
+static std::size_t findNext(const std::string& text, std::size_t from, const std::string& needle) {
+  const std::size_t n = needle.size();
+  const char* p = text.data();
+  std::size_t size = text.size();
+  if (n == 0 || size < n) {
+    return std::string::npos;
+  }
+  std::size_t i = from;
+#ifdef RECANALYST_SSE2
+  // candidates have both the first and the last byte of the needle in place
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[n - 1]);
+  for (; i + n - 1 + 16 <= size; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + n - 1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask != 0) {
+      int bit = 0;
+      while (((mask >> bit) & 1) == 0) {
+        ++bit;
+      }
+      if (n <= 2 || std::memcmp(p + i + bit + 1, needle.data() + 1, n - 2) == 0) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i + n <= size; ++i) {
+    if (p[i] == needle[0] && std::memcmp(p + i, needle.data(), n) == 0) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
+static inline bool isWordChar(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    (static_cast<unsigned char>(c) >= 0x80);
+}
+
+static inline std::uint32_t trigram(const char* p) {
+  return static_cast<std::uint32_t>(static_cast<unsigned char>(p[0])) << 16 |
+    static_cast<std::uint32_t>(static_cast<unsigned char>(p[1])) << 8 |
+    static_cast<unsigned char>(p[2]);
+}
+
+ChatIndex::ChatIndex() : mTextBytes(0) {}
+
+void ChatIndex::add(ReplayHash replay, const RecAnalyst& recAnalyst) {
+  add(replay, recAnalyst.preGameChatMessages(), true);
+  add(replay, recAnalyst.inGameChatMessages(), false);
+}
+
+void ChatIndex::add(ReplayHash replay, const ChatMessages& chatMessages, bool preGame) {
+  for (auto it = chatMessages.cbegin(); it != chatMessages.cend(); ++it) {
+    add(replay, it->time, it->color, preGame, it->msg);
+  }
+}
+
+void ChatIndex::add(ReplayHash replay, unsigned int time, PlayerColor color, bool preGame,
+    std::string_view msg) {
+  if (msg.empty()) {
+    return;
+  }
+  if (msg.size() > 0xFFFF) {
+    msg = msg.substr(0, 0xFFFF);
+  }
+  if (!mOpenText.empty() && mOpenText.size() + msg.size() > BLOCK_SIZE) {
+    flush();
+  }
+  if (mOpenText.empty()) {
+    Block block;
+    block.textSize = 0;
+    block.firstMessage = static_cast<std::uint32_t>(mMessages.size());
+    mBlocks.push_back(block);
+  }
+  if (mReplays.empty() || mReplays.back() != replay) {
+    mReplays.push_back(replay);
+  }
+  Message message;
+  message.replay = static_cast<std::uint32_t>(mReplays.size() - 1);
+  message.time = time;
+  message.length = static_cast<std::uint16_t>(msg.size());
+  message.color = static_cast<std::uint8_t>(color);
+  message.preGame = preGame ? 1 : 0;
+  mMessages.push_back(message);
+  mOpenText.append(msg.data(), msg.size());
+  mBlocks.back().textSize = static_cast<std::uint32_t>(mOpenText.size());
+  mTextBytes += msg.size();
+
+  std::uint32_t block = static_cast<std::uint32_t>(mBlocks.size() - 1);
+  std::string lowered(msg.size(), '\0');
+  lowerAscii(msg.data(), &lowered[0], msg.size());
+  for (std::size_t i = 0; i + 3 <= lowered.size(); ++i) {
+    std::vector<std::uint32_t>& blocks = mPostings[trigram(lowered.data() + i)];
+    if (blocks.empty() || blocks.back() != block) {
+      blocks.push_back(block);
+    }
+  }
+}
+
+void ChatIndex::flush() {
+  if (mOpenText.empty()) {
+    return;
+  }
+  Block& block = mBlocks.back();
+  uLongf size = compressBound(static_cast<uLong>(mOpenText.size()));
+  block.data.resize(size);
+  if (compress2(block.data.data(), &size, reinterpret_cast<const Bytef*>(mOpenText.data()),
+      static_cast<uLong>(mOpenText.size()), Z_DEFAULT_COMPRESSION) != Z_OK) {
+    throw ERecAnalystException("Unable to compress chat block");
+  }
+  block.data.resize(size);
+  block.data.shrink_to_fit();
+  mOpenText.clear();
+}
+
+void ChatIndex::clear() {
+  mReplays.clear();
+  mMessages.clear();
+  mBlocks.clear();
+  mOpenText.clear();
+  mPostings.clear();
+  mTextBytes = 0;
+}
+
+std::size_t ChatIndex::compressedBytes() const {
+  std::size_t size = 0;
+  for (auto it = mBlocks.cbegin(); it != mBlocks.cend(); ++it) {
+    size += it->data.size();
+  }
+  return size;
+}
+
+std::vector<std::uint32_t> ChatIndex::candidateBlocks(const std::string& needle) const {
+  std::vector<std::uint32_t> result;
+  if (needle.size() < 3) {
+    for (std::uint32_t i = 0; i < mBlocks.size(); ++i) {
+      result.push_back(i);
+    }
+    return result;
+  }
+  std::vector<const std::vector<std::uint32_t>*> lists;
+  for (std::size_t i = 0; i + 3 <= needle.size(); ++i) {
+    auto it = mPostings.find(trigram(needle.data() + i));
+    if (it == mPostings.end()) {
+      return result;
+    }
+    lists.push_back(&it->second);
+  }
+  std::sort(lists.begin(), lists.end(), [](const std::vector<std::uint32_t>* a,
+      const std::vector<std::uint32_t>* b) { return a->size() < b->size(); });
+  result = *lists[0];
+  std::vector<std::uint32_t> next;
+  for (std::size_t i = 1; i < lists.size() && !result.empty(); ++i) {
+    next.clear();
+    std::set_intersection(result.cbegin(), result.cend(), lists[i]->cbegin(), lists[i]->cend(),
+      std::back_inserter(next));
+    result.swap(next);
+  }
+  return result;
+}
+
+void ChatIndex::searchBlock(std::uint32_t block, const std::string& text, const std::string& needle,
+    ChatQuery mode, std::size_t limit, std::vector<ChatHit>& hits) const {
+  std::string lowered(text.size(), '\0');
+  lowerAscii(text.data(), &lowered[0], text.size());
+  std::uint32_t message = mBlocks[block].firstMessage;
+  std::uint32_t lastMessage = (block + 1 < mBlocks.size()) ?
+    mBlocks[block + 1].firstMessage : static_cast<std::uint32_t>(mMessages.size());
+  std::size_t start = 0;  // of the current message
+  std::size_t pos = 0;
+  while (message < lastMessage && (pos = findNext(lowered, pos, needle)) != std::string::npos) {
+    while (message < lastMessage && start + mMessages[message].length <= pos) {
+      start += mMessages[message++].length;
+    }
+    if (message == lastMessage) {
+      break;
+    }
+    std::size_t end = start + mMessages[message].length;
+    bool match = pos + needle.size() <= end;
+    if (match && mode == ChatQuery::TOKEN) {
+      match = (pos == start || !isWordChar(lowered[pos - 1])) &&
+        (pos + needle.size() == end || !isWordChar(lowered[pos + needle.size()]));
+    }
+    if (!match) {
+      ++pos;  // a later occurrence may still be inside this message
+      continue;
+    }
+    const Message& m = mMessages[message];
+    ChatHit hit;
+    hit.replay = mReplays[m.replay];
+    hit.time = m.time;
+    hit.color = static_cast<PlayerColor>(m.color);
+    hit.preGame = m.preGame != 0;
+    hit.msg.assign(text, start, m.length);
+    hits.push_back(hit);
+    if (limit != 0 && hits.size() >= limit) {
+      return;
+    }
+    pos = end;
+    start = end;
+    ++message;
+  }
+}
+
+std::vector<ChatHit> ChatIndex::find(std::string_view query, ChatQuery mode, std::size_t limit) const {
+  std::vector<ChatHit> hits;
+  std::string needle(query.size(), '\0');
+  lowerAscii(query.data(), &needle[0], query.size());
+  if (needle.empty()) {
+    return hits;
+  }
+  std::vector<std::uint32_t> blocks = candidateBlocks(needle);
+  std::string text;
+  for (auto it = blocks.cbegin(); it != blocks.cend(); ++it) {
+    const Block& block = mBlocks[*it];
+    if (*it + 1 == mBlocks.size() && !mOpenText.empty()) {
+      searchBlock(*it, mOpenText, needle, mode, limit, hits);
+    } else {
+      text.resize(block.textSize);
+      uLongf size = block.textSize;
+      if (uncompress(reinterpret_cast<Bytef*>(&text[0]), &size, block.data.data(),
+          static_cast<uLong>(block.data.size())) != Z_OK || size != block.textSize) {
+        throw ERecAnalystException("Corrupted chat block");
+      }
+      searchBlock(*it, text, needle, mode, limit, hits);
+    }
+    if (limit != 0 && hits.size() >= limit) {
+      break;
+    }
+  }
+  return hits;
+}
+
+void ChatIndex::write(std::ostream& stream) const {
+  stream.write(CHAT_INDEX_MAGIC, sizeof(CHAT_INDEX_MAGIC));
+  writeArray(stream, mReplays);
+  writeArray(stream, mMessages);
+  writeValue<unsigned long long>(stream, mBlocks.size());
+  for (auto it = mBlocks.cbegin(); it != mBlocks.cend(); ++it) {
+    writeValue<std::uint32_t>(stream, it->textSize);
+    writeValue<std::uint32_t>(stream, it->firstMessage);
+    writeArray(stream, it->data);
+  }
+  writeValue<unsigned long long>(stream, mPostings.size());
+  for (auto it = mPostings.cbegin(); it != mPostings.cend(); ++it) {
+    writeValue<std::uint32_t>(stream, it->first);
+    writeArray(stream, it->second);
+  }
+}
+
+bool ChatIndex::read(std::istream& stream) {
+  clear();
+  char magic[sizeof(CHAT_INDEX_MAGIC)];
+  if (!stream.read(magic, sizeof(magic)) || std::memcmp(magic, CHAT_INDEX_MAGIC, sizeof(magic)) != 0 ||
+      !readArray(stream, mReplays, 1ULL << 32) || !readArray(stream, mMessages, 1ULL << 32)) {
+    return false;
+  }
+  unsigned long long blocks;
+  if (!readValue(stream, blocks) || blocks > mMessages.size()) {
+    return false;
+  }
+  mBlocks.resize(static_cast<std::size_t>(blocks));
+  std::uint32_t firstMessage = 0;
+  for (auto it = mBlocks.begin(); it != mBlocks.end(); ++it) {
+    if (!readValue(stream, it->textSize) || !readValue(stream, it->firstMessage) ||
+        it->textSize > BLOCK_SIZE + 0xFFFF || it->firstMessage < firstMessage ||
+        it->firstMessage >= mMessages.size() || !readArray(stream, it->data, 2 * BLOCK_SIZE + 0xFFFF * 2)) {
+      return false;
+    }
+    firstMessage = it->firstMessage;
+    mTextBytes += it->textSize;
+  }
+  for (auto it = mMessages.cbegin(); it != mMessages.cend(); ++it) {
+    if (it->replay >= mReplays.size()) {
+      return false;
+    }
+  }
+  unsigned long long postings;
+  if (!readValue(stream, postings)) {
+    return false;
+  }
+  for (unsigned long long n = 0; n < postings; ++n) {
+    std::uint32_t key;
+    std::vector<std::uint32_t> list;
+    if (!readValue(stream, key) || !readArray(stream, list, blocks) ||
+        (!list.empty() && list.back() >= blocks)) {
+      return false;
+    }
+    // strictly ascending, so every id is below the last one
+    for (std::size_t i = 1; i < list.size(); ++i) {
+      if (list[i - 1] >= list[i]) {
+        return false;
+      }
+    }
+    mPostings[key].swap(list);
+  }
+  return true;
+}
+
+void ChatIndex::save(const std::string& fileName) {
+  flush();
+  std::string tempName = fileName + ".tmp";
+  {
+    std::ofstream stream(tempName, std::ios::binary | std::ios::trunc);
+    write(stream);
+    if (!stream) {
+      throw ERecAnalystException("Unable to create chat index file: " + tempName);
+    }
+  }
+  if (!replaceFile(tempName, fileName)) {
+    throw ERecAnalystException("Unable to write chat index file: " + fileName);
+  }
+}
+
+void ChatIndex::load(const std::string& fileName) {
+  std::ifstream stream(fileName, std::ios::binary);
+  if (!stream) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+  }
+  if (!read(stream)) {
+    clear();
+    throw ERecAnalystException("Malformed chat index file: " + fileName);
+  }
+}
+
+} // namespace
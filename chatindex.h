@@ -0,0 +1,100 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CHATINDEX_H_
+#define _CHATINDEX_H_
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "recanalystwrap.h"
+#include "replayhash.h"
+
+namespace RecAnalystWrapper {
+
+  enum class ChatQuery {
+    SUBSTRING,  // anywhere in a message
+    TOKEN       // whole words, not preceded or followed by a letter or digit
+  };
+
+struct ChatHit {
+  ReplayHash replay;
+  unsigned int time;
+  PlayerColor color;
+  bool preGame;
+  std::string msg;
+};
+
+// Chat messages of a replay corpus in zlib compressed blocks with a trigram index of
+// the blocks. Queries are ASCII case insensitive, the trigrams narrow the search down
+// to candidate blocks which are inflated and scanned. add() and find() must not run
+// concurrently, concurrent find() calls are fine.
+class ChatIndex {
+public:
+  ChatIndex(void);
+  void add(ReplayHash replay, const RecAnalyst& recAnalyst);
+  void add(ReplayHash replay, const ChatMessages& chatMessages, bool preGame);
+  void add(ReplayHash replay, unsigned int time, PlayerColor color, bool preGame, std::string_view msg);
+  // hits in the order they were added, limit 0 returns every hit
+  std::vector<ChatHit> find(std::string_view query, ChatQuery mode = ChatQuery::SUBSTRING,
+    std::size_t limit = 0) const;
+  void flush();  // compresses the block being filled
+  void clear();
+  std::size_t messages() const { return mMessages.size(); }
+  std::size_t blocks() const { return mBlocks.size(); }
+  std::size_t compressedBytes() const;
+  std::size_t textBytes() const { return mTextBytes; }
+
+  void save(const std::string& fileName);  // flushes, throws ERecAnalystException
+  void load(const std::string& fileName);
+
+  static const std::size_t BLOCK_SIZE = 16 * 1024;  // uncompressed text per block
+private:
+  struct Message {
+    std::uint32_t replay;  // index into mReplays
+    std::uint32_t time;
+    std::uint16_t length;
+    std::uint8_t color;
+    std::uint8_t preGame;
+  };
+  struct Block {
+    std::vector<unsigned char> data;  // compressed text of the block's messages
+    std::uint32_t textSize;
+    std::uint32_t firstMessage;
+  };
+  typedef std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> Postings;  // trigram to blocks
+
+  std::vector<std::uint32_t> candidateBlocks(const std::string& needle) const;
+  void searchBlock(std::uint32_t block, const std::string& text, const std::string& needle,
+    ChatQuery mode, std::size_t limit, std::vector<ChatHit>& hits) const;
+  void write(std::ostream& stream) const;
+  bool read(std::istream& stream);
+
+  std::vector<ReplayHash> mReplays;
+  std::vector<Message> mMessages;
+  std::vector<Block> mBlocks;
+  std::string mOpenText;  // text of the block being filled, it is always the last block
+  Postings mPostings;
+  std::size_t mTextBytes;
+};
+
+} // namespace
+
+#endif  //_CHATINDEX_H_
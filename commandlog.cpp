@@ -0,0 +1,488 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include "commandlog.h"
+
+namespace RecAnalystWrapper {
+
+static const unsigned int COMMANDLOG_MAGIC = 0x4C434152;  // "RACL"
+static const unsigned int COMMANDLOG_VERSION = 2;
+static const size_t COPY_SLACK = 8;  // spare bytes behind the log and the decoded block
+static const size_t MIN_COMMAND_SIZE = 4;  // time delta, player, type and length bytes
+
+static void putVarint(std::vector<unsigned char>& out, unsigned int value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<unsigned char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+static inline bool getVarint(const unsigned char*& p, const unsigned char* end, unsigned int& value) {
+  if (p != end && *p < 0x80) {
+    value = *p++;
+    return true;
+  }
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p == end) {
+      return false;
+    }
+    unsigned char byte = *p++;
+    value |= static_cast<unsigned int>(byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Rest bytes run a few bytes between the fields, copied a fixed word at a time. The
+// bytes copied past size are overwritten by the next field or command.
+static inline void copyRest(unsigned char* to, const unsigned char* from, unsigned int size) {
+  if (size <= COPY_SLACK) {
+    std::memcpy(to, from, COPY_SLACK);
+  } else {
+    std::memcpy(to, from, size);
+  }
+}
+
+static void putUInt32(std::vector<unsigned char>& out, unsigned int value) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(&value);
+  out.insert(out.end(), p, p + 4);
+}
+
+static unsigned int getUInt32(const unsigned char* p) {
+  unsigned int value;
+  std::memcpy(&value, p, 4);
+  return value;
+}
+
+enum FieldColumn {
+  TARGET_COLUMN,
+  POSITION_COLUMN,
+  UNIT_COLUMN,
+  FIELD_COLUMNS
+};
+
+// 32-bit fields of a command payload by offset from the type byte, ascending
+struct PayloadLayout {
+  unsigned char fieldCount;
+  unsigned char offsets[3];
+  unsigned char columns[3];
+  unsigned char unitsOffset;  // of the trailing unit id list, 0 if there is none
+};
+
+static const PayloadLayout& payloadLayout(unsigned char type) {
+  static const PayloadLayout NONE = { 0, { 0 }, { 0 }, 0 };
+  static const PayloadLayout TARGET = { 1, { 4 }, { TARGET_COLUMN }, 0 };
+  static const PayloadLayout TARGET_POINT = { 3, { 4, 8, 12 },
+    { TARGET_COLUMN, POSITION_COLUMN, POSITION_COLUMN }, 0 };
+  static const PayloadLayout TARGET_POINT_UNITS = { 3, { 4, 12, 16 },
+    { TARGET_COLUMN, POSITION_COLUMN, POSITION_COLUMN }, 20 };
+  static const PayloadLayout TARGET_UNITS = { 1, { 4 }, { TARGET_COLUMN }, 8 };
+  static const PayloadLayout POINT_UNITS = { 2, { 4, 8 }, { POSITION_COLUMN, POSITION_COLUMN }, 12 };
+  static const PayloadLayout UNGARRISON = { 2, { 4, 8 }, { POSITION_COLUMN, POSITION_COLUMN }, 16 };
+  static const PayloadLayout BUILD = { 2, { 4, 8 }, { POSITION_COLUMN, POSITION_COLUMN }, 24 };
+  static const PayloadLayout UNITS = { 0, { 0 }, { 0 }, 4 };
+  static const PayloadLayout FORMATION = { 0, { 0 }, { 0 }, 8 };
+  static const PayloadLayout PATROL = { 0, { 0 }, { 0 }, 84 };  // after ten waypoints
+  switch (static_cast<BodyCommand>(type)) {
+  case BodyCommand::INTERACT:
+  case BodyCommand::MOVE:
+  case BodyCommand::AI_MOVE:
+  case BodyCommand::GATHER_POINT:
+    return TARGET_POINT_UNITS;
+  case BodyCommand::WORK:
+  case BodyCommand::ORDER:
+    return TARGET_POINT;
+  case BodyCommand::GUARD:
+  case BodyCommand::FOLLOW:
+  case BodyCommand::REPAIR:
+    return TARGET_UNITS;
+  case BodyCommand::ATTACK_GROUND:
+    return POINT_UNITS;
+  case BodyCommand::UNGARRISON:
+    return UNGARRISON;
+  case BodyCommand::BUILD:
+    return BUILD;
+  case BodyCommand::STOP:
+  case BodyCommand::STANCE:
+    return UNITS;
+  case BodyCommand::FORMATION:
+    return FORMATION;
+  case BodyCommand::PATROL:
+    return PATROL;
+  case BodyCommand::AI_TRAIN:
+  case BodyCommand::TRAIN:
+  case BodyCommand::RESEARCH:
+  case BodyCommand::DELETE:
+  case BodyCommand::TOGGLE_GATE:
+  case BodyCommand::SELL:
+  case BodyCommand::BUY:
+  case BodyCommand::DROP_RELIC:
+  case BodyCommand::TOWN_BELL:
+  case BodyCommand::BACK_TO_WORK:
+    return TARGET;
+  default:
+    return NONE;
+  }
+}
+
+// Payload bytes outside the field columns, type byte excluded
+static inline unsigned int restBytes(const PayloadLayout& layout, unsigned int length) {
+  unsigned int position = 1;
+  unsigned int rest = 0;
+  for (unsigned int i = 0; i < layout.fieldCount && layout.offsets[i] + 4U <= length; ++i) {
+    rest += layout.offsets[i] - position;
+    position = layout.offsets[i] + 4;
+  }
+  if (layout.unitsOffset != 0 && layout.unitsOffset >= position && layout.unitsOffset <= length) {
+    rest += layout.unitsOffset - position;
+    position = layout.unitsOffset + (length - layout.unitsOffset) / 4 * 4;
+  }
+  return rest + length - position;
+}
+
+static inline void putField(std::vector<unsigned char>& out, unsigned int& last, const unsigned char* p) {
+  unsigned int value = getUInt32(p);
+  unsigned int delta = value - last;
+  last = value;
+  putVarint(out, (delta << 1) ^ (0U - (delta >> 31)));
+}
+
+CommandLogWriter::CommandLogWriter(unsigned int blockSize) : mBlockSize(blockSize > 0 ? blockSize : 1) {
+  reset();
+}
+
+void CommandLogWriter::extract(const std::string& fileName) {
+  reset();
+  BodyParser parser(fileName);
+  parser.parse(*this);
+}
+
+void CommandLogWriter::reset() {
+  mCount = 0;
+  mLastTime = 0;
+  mBlockCount = 0;
+  mIndex.clear();
+  mData.clear();
+  mTimes.clear();
+  mPlayers.clear();
+  mTypes.clear();
+  mLengths.clear();
+  for (int column = 0; column < FIELD_COLUMNS; ++column) {
+    mFields[column].clear();
+    mLastFields[column] = 0;
+  }
+  mRest.clear();
+}
+
+bool CommandLogWriter::onCommand(const CommandEvent& command) {
+  if (mBlockCount == 0) {
+    CommandLogBlock block;
+    block.firstTime = command.time;
+    block.offset = static_cast<unsigned int>(mData.size());
+    block.count = 0;
+    mIndex.push_back(block);
+    mLastTime = command.time;
+  }
+  putVarint(mTimes, command.time - mLastTime);
+  mLastTime = command.time;
+  bool attributed = command.player >= 0 && command.player < 255;
+  mPlayers.push_back(static_cast<unsigned char>(attributed ? command.player + 1 : 0));
+  mTypes.push_back(static_cast<unsigned char>(command.type));
+  putVarint(mLengths, command.length - 1);
+  // fields to their columns, the bytes in between to the rest
+  const PayloadLayout& layout = payloadLayout(command.data[0]);
+  const unsigned char* data = command.data;
+  unsigned int position = 1;
+  for (unsigned int i = 0; i < layout.fieldCount && layout.offsets[i] + 4U <= command.length; ++i) {
+    mRest.insert(mRest.end(), data + position, data + layout.offsets[i]);
+    if (layout.columns[i] == POSITION_COLUMN) {
+      mFields[POSITION_COLUMN].insert(mFields[POSITION_COLUMN].end(), data + layout.offsets[i],
+        data + layout.offsets[i] + 4);
+    } else {
+      putField(mFields[layout.columns[i]], mLastFields[layout.columns[i]], data + layout.offsets[i]);
+    }
+    position = layout.offsets[i] + 4;
+  }
+  if (layout.unitsOffset != 0 && layout.unitsOffset >= position && layout.unitsOffset <= command.length) {
+    mRest.insert(mRest.end(), data + position, data + layout.unitsOffset);
+    for (position = layout.unitsOffset; position + 4 <= command.length; position += 4) {
+      putField(mFields[UNIT_COLUMN], mLastFields[UNIT_COLUMN], data + position);
+    }
+  }
+  mRest.insert(mRest.end(), data + position, data + command.length);
+  ++mCount;
+  if (++mBlockCount == mBlockSize) {
+    flushBlock();
+  }
+  return true;
+}
+
+void CommandLogWriter::flushBlock() {
+  if (mBlockCount == 0) {
+    return;
+  }
+  mIndex.back().count = mBlockCount;
+  mData.insert(mData.end(), mTimes.begin(), mTimes.end());
+  mData.insert(mData.end(), mPlayers.begin(), mPlayers.end());
+  mData.insert(mData.end(), mTypes.begin(), mTypes.end());
+  mData.insert(mData.end(), mLengths.begin(), mLengths.end());
+  for (int column = 0; column < FIELD_COLUMNS; ++column) {
+    putVarint(mData, static_cast<unsigned int>(mFields[column].size()));
+  }
+  for (int column = 0; column < FIELD_COLUMNS; ++column) {
+    mData.insert(mData.end(), mFields[column].begin(), mFields[column].end());
+    mFields[column].clear();
+    mLastFields[column] = 0;  // blocks decode on their own
+  }
+  mData.insert(mData.end(), mRest.begin(), mRest.end());
+  mTimes.clear();
+  mPlayers.clear();
+  mTypes.clear();
+  mLengths.clear();
+  mRest.clear();
+  mBlockCount = 0;
+}
+
+void CommandLogWriter::finish(std::vector<unsigned char>& log) {
+  flushBlock();
+  log.clear();
+  log.reserve(20 + mIndex.size() * 12 + mData.size());
+  putUInt32(log, COMMANDLOG_MAGIC);
+  putUInt32(log, COMMANDLOG_VERSION);
+  putUInt32(log, mCount);
+  putUInt32(log, static_cast<unsigned int>(mIndex.size()));
+  putUInt32(log, mBlockSize);
+  for (auto it = mIndex.cbegin(); it != mIndex.cend(); ++it) {
+    putUInt32(log, it->firstTime);
+    putUInt32(log, it->offset);
+    putUInt32(log, it->count);
+  }
+  log.insert(log.end(), mData.begin(), mData.end());
+}
+
+void CommandLogWriter::save(const std::string& fileName) {
+  std::vector<unsigned char> log;
+  finish(log);
+  std::FILE* file = std::fopen(fileName.c_str(), "wb");
+  if (file == NULL) {
+    throw ERecAnalystException("Unable to create command log file.");
+  }
+  size_t written = std::fwrite(log.data(), 1, log.size(), file);
+  std::fclose(file);
+  if (written != log.size()) {
+    throw ERecAnalystException("Unable to write command log file.");
+  }
+}
+
+CommandLog::CommandLog() : mCount(0), mBlockSize(0), mDataOffset(0) {}
+
+void CommandLog::load(const std::string& fileName) {
+  std::FILE* file = std::fopen(fileName.c_str(), "rb");
+  if (file == NULL) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+  }
+  std::vector<unsigned char> log;
+  unsigned char chunk[64 * 1024];
+  size_t read;
+  while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    log.insert(log.end(), chunk, chunk + read);
+  }
+  std::fclose(file);
+  assign(log);
+}
+
+void CommandLog::assign(const std::vector<unsigned char>& log) {
+  if (log.size() < 20 || getUInt32(&log[0]) != COMMANDLOG_MAGIC ||
+      getUInt32(&log[4]) != COMMANDLOG_VERSION) {
+    throwInvalid();
+  }
+  unsigned int count = getUInt32(&log[8]);
+  unsigned int blocks = getUInt32(&log[12]);
+  unsigned int blockSize = getUInt32(&log[16]);
+  if ((log.size() - 20) / 12 < blocks) {
+    throwInvalid();
+  }
+  // every command takes a few bytes of the data, and the block counts add up to count
+  size_t dataSize = log.size() - 20 - static_cast<size_t>(blocks) * 12;
+  if (count > dataSize / MIN_COMMAND_SIZE) {
+    throwInvalid();
+  }
+  std::vector<CommandLogBlock> index(blocks);
+  unsigned long long total = 0;
+  for (unsigned int i = 0; i < blocks; ++i) {
+    const unsigned char* p = &log[20 + static_cast<size_t>(i) * 12];
+    index[i].firstTime = getUInt32(p);
+    index[i].offset = getUInt32(p + 4);
+    index[i].count = getUInt32(p + 8);
+    if (index[i].count == 0 || index[i].count > blockSize || index[i].offset >= dataSize) {
+      throwInvalid();
+    }
+    total += index[i].count;
+  }
+  if (total != count) {
+    throwInvalid();
+  }
+  mLog.assign(log.begin(), log.end());
+  mLog.resize(log.size() + COPY_SLACK);
+  mCount = count;
+  mBlockSize = blockSize;
+  mIndex.swap(index);
+  mDataOffset = 20 + static_cast<size_t>(blocks) * 12;
+  mBlockCommands.clear();
+}
+
+size_t CommandLog::findBlock(unsigned int time) const {
+  // last block starting at or before time, commands with the same time may span blocks
+  auto it = std::lower_bound(mIndex.cbegin(), mIndex.cend(), time,
+    [] (const CommandLogBlock& block, unsigned int t) { return block.firstTime < t; });
+  return (it == mIndex.cbegin()) ? 0 : (it - mIndex.cbegin()) - 1;
+}
+
+const std::vector<CommandEvent>& CommandLog::decodeBlock(size_t block) {
+  const CommandLogBlock& b = mIndex.at(block);
+  if (b.offset > mLog.size() - COPY_SLACK - mDataOffset || b.count > mBlockSize) {
+    throwInvalid();
+  }
+  const unsigned char* p = &mLog[0] + mDataOffset + b.offset;
+  const unsigned char* end = &mLog[0] + mLog.size() - COPY_SLACK;
+  if (b.count > static_cast<size_t>(end - p) / MIN_COMMAND_SIZE) {
+    throwInvalid();  // before anything is sized by the count
+  }
+  mBlockCommands.resize(b.count);
+  unsigned int time = b.firstTime;
+  for (unsigned int i = 0; i < b.count; ++i) {
+    unsigned int delta;
+    if (!getVarint(p, end, delta)) {
+      throwInvalid();
+    }
+    time += delta;
+    mBlockCommands[i].time = time;
+  }
+  if (static_cast<size_t>(end - p) < 2 * static_cast<size_t>(b.count)) {
+    throwInvalid();
+  }
+  const unsigned char* players = p;
+  const unsigned char* types = p + b.count;
+  p += 2 * b.count;
+  size_t dataSize = 0;
+  size_t restSize = 0;
+  for (unsigned int i = 0; i < b.count; ++i) {
+    unsigned int length;
+    if (!getVarint(p, end, length) || length >= BodyParser::MAX_OPERATION_SIZE) {
+      throwInvalid();
+    }
+    mBlockCommands[i].length = length + 1;
+    dataSize += length + 1;
+    restSize += restBytes(payloadLayout(types[i]), length + 1);
+  }
+  // the field columns are decoded first, in tight loops
+  unsigned int columnSizes[FIELD_COLUMNS];
+  for (int column = 0; column < FIELD_COLUMNS; ++column) {
+    if (!getVarint(p, end, columnSizes[column])) {
+      throwInvalid();
+    }
+  }
+  for (int column = 0; column < FIELD_COLUMNS; ++column) {
+    if (static_cast<size_t>(end - p) < columnSizes[column]) {
+      throwInvalid();
+    }
+    const unsigned char* columnEnd = p + columnSizes[column];
+    std::vector<unsigned int>& values = mFieldValues[column];
+    if (column == POSITION_COLUMN) {  // raw floats, their deltas do not pack
+      if (columnSizes[column] % 4 != 0) {
+        throwInvalid();
+      }
+      values.resize(columnSizes[column] / 4);
+      if (!values.empty()) {
+        std::memcpy(values.data(), p, values.size() * 4);
+      }
+      p = columnEnd;
+      continue;
+    }
+    values.resize(columnSizes[column]);  // at least a byte per value
+    unsigned int* out = values.data();
+    unsigned int value = 0;
+    while (p != columnEnd) {
+      unsigned int zigzag;
+      if (!getVarint(p, columnEnd, zigzag)) {
+        throwInvalid();
+      }
+      value += (zigzag >> 1) ^ (0U - (zigzag & 1));
+      *out++ = value;
+    }
+    values.resize(out - values.data());
+  }
+  if (static_cast<size_t>(end - p) < restSize) {
+    throwInvalid();
+  }
+  const unsigned int* fields[FIELD_COLUMNS];
+  const unsigned int* fieldsEnd[FIELD_COLUMNS];
+  for (int column = 0; column < FIELD_COLUMNS; ++column) {
+    fields[column] = mFieldValues[column].data();
+    fieldsEnd[column] = fields[column] + mFieldValues[column].size();
+  }
+  mBlockData.resize(dataSize + COPY_SLACK);
+  unsigned char* data = mBlockData.data();
+  for (unsigned int i = 0; i < b.count; ++i) {
+    CommandEvent& command = mBlockCommands[i];
+    command.player = static_cast<int>(players[i]) - 1;
+    command.type = static_cast<BodyCommand>(types[i]);
+    command.data = data;
+    data[0] = types[i];
+    // the writer's split in reverse, rest bytes up to each field
+    const PayloadLayout& layout = payloadLayout(types[i]);
+    unsigned int position = 1;
+    for (unsigned int f = 0; f < layout.fieldCount && layout.offsets[f] + 4U <= command.length; ++f) {
+      int column = layout.columns[f];
+      if (fields[column] == fieldsEnd[column]) {
+        throwInvalid();
+      }
+      copyRest(data + position, p, layout.offsets[f] - position);
+      p += layout.offsets[f] - position;
+      std::memcpy(data + layout.offsets[f], fields[column]++, 4);
+      position = layout.offsets[f] + 4;
+    }
+    if (layout.unitsOffset != 0 && layout.unitsOffset >= position && layout.unitsOffset <= command.length) {
+      copyRest(data + position, p, layout.unitsOffset - position);
+      p += layout.unitsOffset - position;
+      unsigned int units = (command.length - layout.unitsOffset) / 4;
+      if (static_cast<size_t>(fieldsEnd[UNIT_COLUMN] - fields[UNIT_COLUMN]) < units) {
+        throwInvalid();
+      }
+      if (units > 0) {
+        std::memcpy(data + layout.unitsOffset, fields[UNIT_COLUMN], units * 4);
+        fields[UNIT_COLUMN] += units;
+      }
+      position = layout.unitsOffset + units * 4;
+    }
+    copyRest(data + position, p, command.length - position);
+    p += command.length - position;
+    data += command.length;
+  }
+  return mBlockCommands;
+}
+
+void CommandLog::throwInvalid() {
+  throw ERecAnalystException("Invalid command log.");
+}
+
+} // namespace
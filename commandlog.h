@@ -0,0 +1,114 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COMMANDLOG_H_
+#define _COMMANDLOG_H_
+#include <string>
+#include <vector>
+#include "bodyparser.h"
+
+namespace RecAnalystWrapper {
+
+/*
+ * Compact columnar log of the player commands of one recorded game.
+ *
+ * Layout: magic "RACL", version, command count, block count and block size,
+ * followed by the sparse index (first time, data offset, command count per
+ * block) and the blocks. Every block stores its commands as columns:
+ * varint time deltas, player indices (+1, 0 if unattributed), command types,
+ * varint payload lengths, the byte sizes of the three field columns, the field
+ * columns and the rest of the payloads without the type byte.
+ *
+ * The field columns hold the 32-bit fields a command type is known to carry at
+ * fixed offsets, split into target object ids, map coordinates and the selected
+ * unit ids that trail the fixed part. The id columns are stored as zigzag varint
+ * deltas against the previous value of the column in the block, so ids close to
+ * each other take a byte or two, the coordinates as raw floats. The remaining bytes
+ * (counts, padding and the fields of unknown types) go to the rest column
+ * unchanged, so any payload decodes to its original bytes.
+ */
+struct CommandLogBlock {
+  unsigned int firstTime;
+  unsigned int offset;
+  unsigned int count;
+};
+
+// Converts the body command stream into a command log
+class CommandLogWriter : public BodyVisitor {
+public:
+  static const unsigned int DEFAULT_BLOCK_SIZE = 1024;
+  explicit CommandLogWriter(unsigned int blockSize = DEFAULT_BLOCK_SIZE);
+  void extract(const std::string& fileName);
+  void reset();
+  bool onCommand(const CommandEvent& command);
+  void finish(std::vector<unsigned char>& log);
+  void save(const std::string& fileName);
+private:
+  void flushBlock();
+  unsigned int mBlockSize;
+  unsigned int mCount;
+  unsigned int mLastTime;
+  std::vector<CommandLogBlock> mIndex;
+  std::vector<unsigned char> mData;
+  std::vector<unsigned char> mTimes;
+  std::vector<unsigned char> mPlayers;
+  std::vector<unsigned char> mTypes;
+  std::vector<unsigned char> mLengths;
+  std::vector<unsigned char> mFields[3];  // target, position and unit columns
+  unsigned int mLastFields[3];
+  std::vector<unsigned char> mRest;
+  unsigned int mBlockCount;  // commands in the current block
+};
+
+// Reads a command log, decoding one block at a time
+class CommandLog {
+public:
+  CommandLog(void);
+  void load(const std::string& fileName);
+  void assign(const std::vector<unsigned char>& log);
+  unsigned int size() const { return mCount; }
+  size_t blockCount() const { return mIndex.size(); }
+  size_t findBlock(unsigned int time) const;
+  const std::vector<CommandEvent>& decodeBlock(size_t block);
+  template <class Visitor> bool replay(Visitor& visitor, unsigned int fromTime = 0);
+private:
+  static void throwInvalid();
+  unsigned int mCount;
+  unsigned int mBlockSize;
+  std::vector<CommandLogBlock> mIndex;
+  std::vector<unsigned char> mLog;
+  size_t mDataOffset;
+  std::vector<unsigned char> mBlockData;  // decoded [type][payload] of the current block
+  std::vector<unsigned int> mFieldValues[3];
+  std::vector<CommandEvent> mBlockCommands;
+};
+
+template <class Visitor>
+bool CommandLog::replay(Visitor& visitor, unsigned int fromTime) {
+  for (size_t block = findBlock(fromTime); block < mIndex.size(); ++block) {
+    const std::vector<CommandEvent>& commands = decodeBlock(block);
+    for (auto it = commands.cbegin(); it != commands.cend(); ++it) {
+      if (it->time >= fromTime && !visitor.onCommand(*it)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+#endif  //_COMMANDLOG_H_
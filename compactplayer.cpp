@@ -0,0 +1,264 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include "compactplayer.h"
+
+namespace RecAnalystWrapper {
+
+StringPool::StringPool() : mChunk(NULL), mChunkUsed(0), mChunkBytes(0) {
+  mStrings.push_back(std::string_view());
+  mIndex.emplace(std::string_view(), 0);
+}
+
+std::uint32_t StringPool::intern(std::string_view text) {
+  auto it = mIndex.find(text);
+  if (it != mIndex.end()) {
+    return it->second;
+  }
+  char* data;
+  if (text.size() > CHUNK_SIZE / 4) {
+    // long strings get a chunk of their own, the current chunk stays open
+    mChunks.emplace_back(new char[text.size()]);
+    mChunkBytes += text.size();
+    data = mChunks.back().get();
+  } else {
+    if (mChunk == NULL || mChunkUsed + text.size() > CHUNK_SIZE) {
+      mChunks.emplace_back(new char[CHUNK_SIZE]);
+      mChunk = mChunks.back().get();
+      mChunkUsed = 0;
+      mChunkBytes += CHUNK_SIZE;
+    }
+    data = mChunk + mChunkUsed;
+    mChunkUsed += text.size();
+  }
+  std::memcpy(data, text.data(), text.size());
+  std::uint32_t id = static_cast<std::uint32_t>(mStrings.size());
+  mStrings.push_back(std::string_view(data, text.size()));
+  mIndex.emplace(mStrings.back(), id);
+  return id;
+}
+
+bool StringPool::find(std::string_view text, std::uint32_t& id) const {
+  auto it = mIndex.find(text);
+  if (it == mIndex.end()) {
+    return false;
+  }
+  id = it->second;
+  return true;
+}
+
+std::size_t StringPool::memoryUsage() const {
+  // unordered_map nodes hold the value and a next pointer, plus a cached hash
+  const std::size_t nodeSize = sizeof(std::pair<const std::string_view, std::uint32_t>) + 2 * sizeof(void*);
+  return mChunkBytes + mChunks.capacity() * sizeof(mChunks[0]) +
+    mStrings.capacity() * sizeof(mStrings[0]) + mIndex.bucket_count() * sizeof(void*) +
+    mIndex.size() * nodeSize;
+}
+
+void StringPool::clear() {
+  mIndex.clear();
+  mStrings.clear();
+  mChunks.clear();
+  mChunk = NULL;
+  mChunkUsed = 0;
+  mChunkBytes = 0;
+  mStrings.push_back(std::string_view());
+  mIndex.emplace(std::string_view(), 0);
+}
+
+std::uint32_t CompactPlayerStore::add(const Player& player) {
+  CompactPlayer p;
+  p.name = mStrings.intern(player.name);
+  p.civ = mStrings.intern(player.civ);
+  p.startingAgeString = mStrings.intern(player.initialState.startingAgeString);
+  p.feudalTime = player.feudalTime;
+  p.castleTime = player.castleTime;
+  p.imperialTime = player.imperialTime;
+  p.resignTime = player.resignTime;
+  p.disconnectTime = player.disconnectTime;
+  p.coopingPlayersBegin = static_cast<std::uint32_t>(mCoopingPlayers.size());
+  p.coopingPlayersCount = static_cast<std::uint8_t>(player.coopingPlayers.size());
+  for (std::size_t i = 0; i < p.coopingPlayersCount; ++i) {
+    const CoopingPlayer& coopingPlayer = player.coopingPlayers[i];
+    CompactCoopingPlayer c;
+    c.name = mStrings.intern(coopingPlayer.name);
+    c.resignTime = coopingPlayer.resignTime;
+    c.disconnectTime = coopingPlayer.disconnectTime;
+    mCoopingPlayers.push_back(c);
+  }
+
+  const InitialState& is = player.initialState;
+  p.food = is.food;
+  p.wood = is.wood;
+  p.stone = is.stone;
+  p.gold = is.gold;
+  p.houseCapacity = is.houseCapacity;
+  p.population = is.population;
+  p.civilianPop = is.civilianPop;
+  p.militaryPop = is.militaryPop;
+  p.extraPop = is.extraPop;
+  p.positionX = static_cast<std::int32_t>(is.position.x);
+  p.positionY = static_cast<std::int32_t>(is.position.y);
+  p.startingAge = static_cast<std::uint8_t>(is.startingAge);
+
+  const Achievement& a = player.achievement;
+  p.totalScore = a.totalScore;
+  p.result = static_cast<std::uint8_t>(a.result);
+  p.militaryScore = static_cast<std::uint16_t>(a.militaryStats.militaryScore);
+  p.unitsKilled = static_cast<std::uint16_t>(a.militaryStats.unitsKilled);
+  p.unitsLost = static_cast<std::uint16_t>(a.militaryStats.unitsLost);
+  p.buildingsRazed = static_cast<std::uint16_t>(a.militaryStats.buildingsRazed);
+  p.buildingsLost = static_cast<std::uint16_t>(a.militaryStats.buildingsLost);
+  p.unitsConverted = static_cast<std::uint16_t>(a.militaryStats.unitsConverted);
+  p.economyScore = static_cast<std::uint16_t>(a.economyStats.economyScore);
+  p.foodCollected = a.economyStats.foodCollected;
+  p.woodCollected = a.economyStats.woodCollected;
+  p.stoneCollected = a.economyStats.stoneCollected;
+  p.goldCollected = a.economyStats.goldCollected;
+  p.tributeSent = static_cast<std::uint16_t>(a.economyStats.tributeSent);
+  p.tributeRcvd = static_cast<std::uint16_t>(a.economyStats.tributeRcvd);
+  p.tradeProfit = static_cast<std::uint16_t>(a.economyStats.tradeProfit);
+  p.relicGold = static_cast<std::uint16_t>(a.economyStats.relicGold);
+  p.technologyScore = static_cast<std::uint16_t>(a.technologyStats.technologyScore);
+  p.feudalAge = a.technologyStats.feudalAge;
+  p.castleAge = a.technologyStats.castleAge;
+  p.imperialAge = a.technologyStats.imperialAge;
+  p.mapExplored = static_cast<std::uint8_t>(a.technologyStats.mapExplored);
+  p.researchCount = static_cast<std::uint8_t>(a.technologyStats.researchCount);
+  p.researchPercent = static_cast<std::uint8_t>(a.technologyStats.researchPercent);
+  p.societyScore = static_cast<std::uint16_t>(a.societyStats.societyScore);
+  p.totalWonders = static_cast<std::uint8_t>(a.societyStats.totalWonders);
+  p.totalCastles = static_cast<std::uint8_t>(a.societyStats.totalCastles);
+  p.relicsCaptured = static_cast<std::uint8_t>(a.societyStats.relicsCaptured);
+  p.villagerHigh = static_cast<std::uint16_t>(a.societyStats.villagerHigh);
+
+  p.index = static_cast<std::uint8_t>(player.index);
+  p.team = static_cast<std::uint8_t>(player.team);
+  p.civId = static_cast<std::uint8_t>(player.civId);
+  p.color = static_cast<std::uint8_t>(player.color);
+  p.flags = (player.human ? COMPACT_HUMAN : 0) | (player.owner ? COMPACT_OWNER : 0) |
+    (a.victory ? COMPACT_VICTORY : 0) | (a.medal ? COMPACT_MEDAL : 0);
+
+  mPlayers.push_back(p);
+  return static_cast<std::uint32_t>(mPlayers.size() - 1);
+}
+
+void CompactPlayerStore::player(std::uint32_t id, Player& player) const {
+  const CompactPlayer& p = mPlayers[id];
+  player.name = mStrings.str(p.name);
+  player.resignTime = p.resignTime;
+  player.disconnectTime = p.disconnectTime;
+  player.index = p.index;
+  player.human = p.human();
+  player.team = p.team;
+  player.owner = p.owner();
+  player.civId = static_cast<Civilization>(p.civId);
+  player.civ = mStrings.str(p.civ);
+  player.color = static_cast<PlayerColor>(p.color);
+  player.feudalTime = p.feudalTime;
+  player.castleTime = p.castleTime;
+  player.imperialTime = p.imperialTime;
+  player.coopingPlayers.clear();
+  const CompactCoopingPlayer* c = coopingPlayers(p);
+  for (std::size_t i = 0; i < p.coopingPlayersCount; ++i) {
+    player.coopingPlayers.emplace_back();
+    CoopingPlayer& coopingPlayer = player.coopingPlayers.back();
+    coopingPlayer.name = mStrings.str(c[i].name);
+    coopingPlayer.resignTime = c[i].resignTime;
+    coopingPlayer.disconnectTime = c[i].disconnectTime;
+  }
+
+  InitialState& is = player.initialState;
+  is.food = p.food;
+  is.wood = p.wood;
+  is.stone = p.stone;
+  is.gold = p.gold;
+  is.startingAge = static_cast<StartingAge>(p.startingAge);
+  is.houseCapacity = p.houseCapacity;
+  is.population = p.population;
+  is.civilianPop = p.civilianPop;
+  is.militaryPop = p.militaryPop;
+  is.extraPop = p.extraPop;
+  is.position.x = p.positionX;
+  is.position.y = p.positionY;
+  is.startingAgeString = mStrings.str(p.startingAgeString);
+
+  Achievement& a = player.achievement;
+  a.victory = (p.flags & COMPACT_VICTORY) != 0;
+  a.medal = (p.flags & COMPACT_MEDAL) != 0;
+  a.result = static_cast<GameResult>(p.result);
+  a.totalScore = p.totalScore;
+  a.militaryStats.militaryScore = p.militaryScore;
+  a.militaryStats.unitsKilled = p.unitsKilled;
+  a.militaryStats.unitsLost = p.unitsLost;
+  a.militaryStats.buildingsRazed = p.buildingsRazed;
+  a.militaryStats.buildingsLost = p.buildingsLost;
+  a.militaryStats.unitsConverted = p.unitsConverted;
+  a.economyStats.economyScore = p.economyScore;
+  a.economyStats.foodCollected = p.foodCollected;
+  a.economyStats.woodCollected = p.woodCollected;
+  a.economyStats.stoneCollected = p.stoneCollected;
+  a.economyStats.goldCollected = p.goldCollected;
+  a.economyStats.tributeSent = p.tributeSent;
+  a.economyStats.tributeRcvd = p.tributeRcvd;
+  a.economyStats.tradeProfit = p.tradeProfit;
+  a.economyStats.relicGold = p.relicGold;
+  a.technologyStats.technologyScore = p.technologyScore;
+  a.technologyStats.feudalAge = p.feudalAge;
+  a.technologyStats.castleAge = p.castleAge;
+  a.technologyStats.imperialAge = p.imperialAge;
+  a.technologyStats.mapExplored = p.mapExplored;
+  a.technologyStats.researchCount = p.researchCount;
+  a.technologyStats.researchPercent = p.researchPercent;
+  a.societyStats.societyScore = p.societyScore;
+  a.societyStats.totalWonders = p.totalWonders;
+  a.societyStats.totalCastles = p.totalCastles;
+  a.societyStats.relicsCaptured = p.relicsCaptured;
+  a.societyStats.villagerHigh = p.villagerHigh;
+}
+
+Player CompactPlayerStore::player(std::uint32_t id) const {
+  Player result;
+  player(id, result);
+  return result;
+}
+
+const CompactCoopingPlayer* CompactPlayerStore::coopingPlayers(const CompactPlayer& player) const {
+  return mCoopingPlayers.data() + player.coopingPlayersBegin;
+}
+
+void CompactPlayerStore::reserve(std::size_t players) {
+  mPlayers.reserve(players);
+}
+
+void CompactPlayerStore::shrinkToFit() {
+  mPlayers.shrink_to_fit();
+  mCoopingPlayers.shrink_to_fit();
+}
+
+std::size_t CompactPlayerStore::memoryUsage() const {
+  return mStrings.memoryUsage() + mPlayers.capacity() * sizeof(CompactPlayer) +
+    mCoopingPlayers.capacity() * sizeof(CompactCoopingPlayer);
+}
+
+void CompactPlayerStore::clear() {
+  mStrings.clear();
+  mPlayers.clear();
+  mCoopingPlayers.clear();
+}
+
+} // namespace
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COMPACTPLAYER_H_
+#define _COMPACTPLAYER_H_
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+// Deduplicating string storage, interned strings never move so the views stay valid
+// for the lifetime of the pool. Id 0 is the empty string.
+class StringPool {
+public:
+  StringPool(void);
+  std::uint32_t intern(std::string_view text);
+  bool find(std::string_view text, std::uint32_t& id) const;  // id of an interned string
+  std::string_view str(std::uint32_t id) const { return mStrings[id]; }
+  std::size_t size() const { return mStrings.size(); }
+  std::size_t memoryUsage() const;  // approximate heap bytes owned by the pool
+  void clear();
+private:
+  static const std::size_t CHUNK_SIZE = 64 * 1024;
+  std::vector<std::unique_ptr<char[]>> mChunks;
+  char* mChunk;  // chunk short strings are appended to
+  std::size_t mChunkUsed;
+  std::size_t mChunkBytes;
+  std::vector<std::string_view> mStrings;
+  std::unordered_map<std::string_view, std::uint32_t> mIndex;
+};
+
+struct CompactCoopingPlayer {
+  std::uint32_t name;  // id in the string pool
+  std::uint32_t resignTime;
+  std::uint32_t disconnectTime;
+};
+
+  enum CompactPlayerFlags : std::uint8_t {
+    COMPACT_HUMAN = 0x01,
+    COMPACT_OWNER = 0x02,
+    COMPACT_VICTORY = 0x04,
+    COMPACT_MEDAL = 0x08
+  };
+
+// Player with the field widths of RECANALYST_PLAYER and its nested structs, enums
+// stored as single bytes, strings as string pool ids and the cooping players as a
+// range in a side table. Fields are ordered by width so there is no inner padding.
+struct CompactPlayer {
+  std::uint32_t name;
+  std::uint32_t civ;
+  std::uint32_t startingAgeString;
+  std::uint32_t feudalTime;
+  std::uint32_t castleTime;
+  std::uint32_t imperialTime;
+  std::uint32_t resignTime;
+  std::uint32_t disconnectTime;
+  std::uint32_t coopingPlayersBegin;  // first entry in the cooping players table
+  // InitialState
+  std::uint32_t food;
+  std::uint32_t wood;
+  std::uint32_t stone;
+  std::uint32_t gold;
+  std::uint32_t houseCapacity;
+  std::uint32_t population;
+  std::uint32_t civilianPop;
+  std::uint32_t militaryPop;
+  std::uint32_t extraPop;
+  std::int32_t positionX;
+  std::int32_t positionY;
+  // Achievement
+  std::uint32_t totalScore;
+  std::uint32_t foodCollected;
+  std::uint32_t woodCollected;
+  std::uint32_t stoneCollected;
+  std::uint32_t goldCollected;
+  std::uint32_t feudalAge;
+  std::uint32_t castleAge;
+  std::uint32_t imperialAge;
+  std::uint16_t militaryScore;
+  std::uint16_t unitsKilled;
+  std::uint16_t unitsLost;
+  std::uint16_t buildingsRazed;
+  std::uint16_t buildingsLost;
+  std::uint16_t unitsConverted;
+  std::uint16_t economyScore;
+  std::uint16_t tributeSent;
+  std::uint16_t tributeRcvd;
+  std::uint16_t tradeProfit;
+  std::uint16_t relicGold;
+  std::uint16_t technologyScore;
+  std::uint16_t societyScore;
+  std::uint16_t villagerHigh;
+  std::uint8_t index;
+  std::uint8_t team;
+  std::uint8_t civId;
+  std::uint8_t color;
+  std::uint8_t startingAge;
+  std::uint8_t result;
+  std::uint8_t flags;  // CompactPlayerFlags
+  std::uint8_t coopingPlayersCount;
+  std::uint8_t mapExplored;
+  std::uint8_t researchCount;
+  std::uint8_t researchPercent;
+  std::uint8_t totalWonders;
+  std::uint8_t totalCastles;
+  std::uint8_t relicsCaptured;
+  bool human() const { return (flags & COMPACT_HUMAN) != 0; }
+  bool owner() const { return (flags & COMPACT_OWNER) != 0; }
+};
+
+// Append-only store of compact players sharing one string pool and cooping players table.
+// Values wider than the field of the C struct they came from are truncated.
+class CompactPlayerStore {
+public:
+  std::uint32_t add(const Player& player);  // returns the id of the stored player
+  void player(std::uint32_t id, Player& player) const;  // expands a stored player
+  Player player(std::uint32_t id) const;
+  const CompactPlayer& operator[](std::uint32_t id) const { return mPlayers[id]; }
+  std::string_view str(std::uint32_t id) const { return mStrings.str(id); }
+  const CompactCoopingPlayer* coopingPlayers(const CompactPlayer& player) const;
+  std::size_t size() const { return mPlayers.size(); }
+  void reserve(std::size_t players);
+  void shrinkToFit();
+  std::size_t memoryUsage() const;  // approximate heap bytes owned by the store
+  void clear();
+private:
+  StringPool mStrings;
+  std::vector<CompactPlayer> mPlayers;
+  std::vector<CompactCoopingPlayer> mCoopingPlayers;
+};
+
+} // namespace
+
+#endif  //_COMPACTPLAYER_H_
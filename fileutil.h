@@ -0,0 +1,30 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _FILEUTIL_H_
+#define _FILEUTIL_H_
+#include <string>
+
+namespace RecAnalystWrapper {
+
+// Moves from over to, replacing an existing file in one step so readers of to never see
+// it missing. Both must be on the same volume. Returns false on failure.
+bool replaceFile(const std::string& from, const std::string& to);
+
+} // namespace
+
+#endif  //_FILEUTIL_H_
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "histogram.h"
+
+namespace RecAnalystWrapper {
+
+static inline int highestBit(unsigned long long value) {
+  int bit = 0;
+  while (value >>= 1) {
+    ++bit;
+  }
+  return bit;
+}
+
+Histogram::Histogram() : mBuckets(BUCKET_COUNT), mCount(0), mSum(0), mMin(~0ULL), mMax(0) {}
+
+int Histogram::bucketIndex(unsigned long long value) {
+  if (value < SUB_BUCKETS) {
+    return static_cast<int>(value);
+  }
+  if (value > MAX_VALUE) {
+    value = MAX_VALUE;
+  }
+  int shift = highestBit(value) - (SUB_BUCKET_BITS - 1);
+  return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS
+    + static_cast<int>(value >> shift) - HALF_SUB_BUCKETS;
+}
+
+unsigned long long Histogram::bucketLowerBound(int index) {
+  if (index < SUB_BUCKETS) {
+    return index;
+  }
+  int shift = (index - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+  unsigned long long sub = (index - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+  return sub << shift;
+}
+
+unsigned long long Histogram::bucketUpperBound(int index) {
+  if (index < SUB_BUCKETS) {
+    return index;
+  }
+  int shift = (index - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+  return bucketLowerBound(index) + (1ULL << shift) - 1;
+}
+
+void Histogram::record(unsigned long long value, unsigned long long count) {
+  mBuckets[bucketIndex(value)] += count;
+  mCount += count;
+  mSum += value * count;
+  if (value < mMin) {
+    mMin = value;
+  }
+  if (value > mMax) {
+    mMax = value;
+  }
+}
+
+void Histogram::addBuckets(const unsigned long long* buckets, unsigned long long sum,
+    unsigned long long min, unsigned long long max) {
+  unsigned long long count = 0;
+  for (int i = 0; i < BUCKET_COUNT; ++i) {
+    mBuckets[i] += buckets[i];
+    count += buckets[i];
+  }
+  if (count == 0) {
+    return;
+  }
+  mCount += count;
+  mSum += sum;
+  if (min < mMin) {
+    mMin = min;
+  }
+  if (max > mMax) {
+    mMax = max;
+  }
+}
+
+void Histogram::merge(const Histogram& other) {
+  addBuckets(other.mBuckets.data(), other.mSum, other.mMin, other.mMax);
+}
+
+void Histogram::clear() {
+  mBuckets.assign(BUCKET_COUNT, 0);
+  mCount = 0;
+  mSum = 0;
+  mMin = ~0ULL;
+  mMax = 0;
+}
+
+unsigned long long Histogram::valueAtQuantile(double q) const {
+  if (mCount == 0) {
+    return 0;
+  }
+  if (q < 0.0) {
+    q = 0.0;
+  } else if (q > 1.0) {
+    q = 1.0;
+  }
+  unsigned long long rank = static_cast<unsigned long long>(q * mCount + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  unsigned long long seen = 0;
+  for (int i = 0; i < BUCKET_COUNT; ++i) {
+    seen += mBuckets[i];
+    if (seen >= rank) {
+      unsigned long long value = bucketUpperBound(i);
+      return (value > mMax) ? mMax : (value < mMin ? mMin : value);
+    }
+  }
+  return mMax;
+}
+
+unsigned long long Histogram::countAtOrBelow(unsigned long long value) const {
+  if (value >= MAX_VALUE) {
+    return mCount;
+  }
+  int last = bucketIndex(value);
+  if (bucketUpperBound(last) > value) {
+    --last;  // the bucket straddles value, its values may be above it
+  }
+  unsigned long long count = 0;
+  for (int i = 0; i <= last; ++i) {
+    count += mBuckets[i];
+  }
+  return count;
+}
+
+SparseHistogram::SparseHistogram() : mCount(0), mSum(0), mMin(~0ULL), mMax(0) {}
+
+static inline bool bucketBefore(const std::pair<int, unsigned long long>& bucket, int index) {
+  return bucket.first < index;
+}
+
+void SparseHistogram::record(unsigned long long value, unsigned long long count) {
+  int index = Histogram::bucketIndex(value);
+  auto it = std::lower_bound(mBuckets.begin(), mBuckets.end(), index, bucketBefore);
+  if (it != mBuckets.end() && it->first == index) {
+    it->second += count;
+  } else {
+    mBuckets.insert(it, std::make_pair(index, count));
+  }
+  mCount += count;
+  mSum += value * count;
+  if (value < mMin) {
+    mMin = value;
+  }
+  if (value > mMax) {
+    mMax = value;
+  }
+}
+
+void SparseHistogram::addBuckets(const Buckets& buckets, unsigned long long sum,
+    unsigned long long min, unsigned long long max) {
+  Buckets merged;
+  merged.reserve(mBuckets.size() + buckets.size());
+  unsigned long long count = 0;
+  auto a = mBuckets.cbegin();
+  auto b = buckets.cbegin();
+  while (a != mBuckets.cend() || b != buckets.cend()) {
+    if (b == buckets.cend() || (a != mBuckets.cend() && a->first < b->first)) {
+      merged.push_back(*a++);
+    } else if (a == mBuckets.cend() || b->first < a->first) {
+      count += b->second;
+      merged.push_back(*b++);
+    } else {
+      count += b->second;
+      merged.push_back(std::make_pair(a->first, a->second + b->second));
+      ++a;
+      ++b;
+    }
+  }
+  mBuckets.swap(merged);
+  if (count == 0) {
+    return;
+  }
+  mCount += count;
+  mSum += sum;
+  if (min < mMin) {
+    mMin = min;
+  }
+  if (max > mMax) {
+    mMax = max;
+  }
+}
+
+void SparseHistogram::merge(const SparseHistogram& other) {
+  addBuckets(other.mBuckets, other.mSum, other.mMin, other.mMax);
+}
+
+void SparseHistogram::clear() {
+  mBuckets.clear();
+  mCount = 0;
+  mSum = 0;
+  mMin = ~0ULL;
+  mMax = 0;
+}
+
+unsigned long long SparseHistogram::valueAtQuantile(double q) const {
+  if (mCount == 0) {
+    return 0;
+  }
+  if (q < 0.0) {
+    q = 0.0;
+  } else if (q > 1.0) {
+    q = 1.0;
+  }
+  unsigned long long rank = static_cast<unsigned long long>(q * mCount + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  unsigned long long seen = 0;
+  for (auto it = mBuckets.cbegin(); it != mBuckets.cend(); ++it) {
+    seen += it->second;
+    if (seen >= rank) {
+      unsigned long long value = Histogram::bucketUpperBound(it->first);
+      return (value > mMax) ? mMax : (value < mMin ? mMin : value);
+    }
+  }
+  return mMax;
+}
+
+unsigned long long SparseHistogram::countAtOrBelow(unsigned long long value) const {
+  if (value >= Histogram::MAX_VALUE) {
+    return mCount;
+  }
+  int last = Histogram::bucketIndex(value);
+  if (Histogram::bucketUpperBound(last) > value) {
+    --last;
+  }
+  unsigned long long count = 0;
+  for (auto it = mBuckets.cbegin(); it != mBuckets.cend() && it->first <= last; ++it) {
+    count += it->second;
+  }
+  return count;
+}
+
+} // namespace
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+#include <utility>
+#include <vector>
+
+namespace RecAnalystWrapper {
+
+// Log-linear (HDR style) histogram of unsigned values, every power of two range
+// is split into 64 buckets which bounds the relative error of quantiles to 1/64.
+// Values above MAX_VALUE are counted in the last bucket.
+class Histogram {
+public:
+  static const int SUB_BUCKET_BITS = 7;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+  static const int MAX_BITS = 40;
+  static const unsigned long long MAX_VALUE = (1ULL << MAX_BITS) - 1;
+  static const int BUCKET_COUNT = SUB_BUCKETS + (MAX_BITS - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS;
+
+  Histogram(void);
+  void record(unsigned long long value, unsigned long long count = 1);
+  void merge(const Histogram& other);
+  void clear();
+  unsigned long long count() const { return mCount; }
+  unsigned long long sum() const { return mSum; }
+  unsigned long long min() const { return mCount ? mMin : 0; }
+  unsigned long long max() const { return mMax; }
+  double mean() const { return mCount ? (double)mSum / mCount : 0.0; }
+  // highest value equivalent to the one at quantile q (0..1)
+  unsigned long long valueAtQuantile(double q) const;
+  // number of recorded values not greater than value, exact at bucket boundaries
+  unsigned long long countAtOrBelow(unsigned long long value) const;
+
+  // Raw buckets, lets lock-free shards keep their own counters and merge them here
+  static int bucketIndex(unsigned long long value);
+  static unsigned long long bucketLowerBound(int index);
+  static unsigned long long bucketUpperBound(int index);
+  unsigned long long bucketCount(int index) const { return mBuckets[index]; }
+  void addBuckets(const unsigned long long* buckets, unsigned long long sum, unsigned long long min,
+    unsigned long long max);
+private:
+  std::vector<unsigned long long> mBuckets;
+  unsigned long long mCount;
+  unsigned long long mSum;
+  unsigned long long mMin;
+  unsigned long long mMax;
+};
+
+// Histogram with the same buckets that only stores the ones in use, for keeping
+// many small distributions (values clustered in a few octaves) around.
+class SparseHistogram {
+public:
+  typedef std::vector<std::pair<int, unsigned long long>> Buckets;  // bucket index to count, sorted
+
+  SparseHistogram(void);
+  void record(unsigned long long value, unsigned long long count = 1);
+  void merge(const SparseHistogram& other);
+  void clear();
+  unsigned long long count() const { return mCount; }
+  unsigned long long sum() const { return mSum; }
+  unsigned long long min() const { return mCount ? mMin : 0; }
+  unsigned long long max() const { return mMax; }
+  double mean() const { return mCount ? (double)mSum / mCount : 0.0; }
+  unsigned long long valueAtQuantile(double q) const;
+  unsigned long long countAtOrBelow(unsigned long long value) const;
+
+  const Buckets& buckets() const { return mBuckets; }
+  void addBuckets(const Buckets& buckets, unsigned long long sum, unsigned long long min,
+    unsigned long long max);
+private:
+  Buckets mBuckets;
+  unsigned long long mCount;
+  unsigned long long mSum;
+  unsigned long long mMin;
+  unsigned long long mMax;
+};
+
+} // namespace
+
+#endif  //_HISTOGRAM_H_
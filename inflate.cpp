@@ -0,0 +1,216 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <zlib.h>
+#ifdef RECANALYST_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include "inflate.h"
+#include "recfile.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+static const size_t INFLATE_CHUNK_SIZE = 16 * 1024;
+static const size_t INFLATE_MIN_OUTPUT = 256 * 1024;  // headers rarely inflate to less
+static const size_t INFLATE_MAX_OUTPUT = 64 * 1024 * 1024;  // real ones stay below a few MB
+
+// Reference engine: a fresh zlib stream per header, output grown chunk by chunk
+class ZlibInflateEngine : public InflateEngine {
+public:
+  const char* name() const { return "zlib"; }
+  bool inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& output);
+};
+
+bool ZlibInflateEngine::inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& output) {
+  z_stream stream = z_stream();
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  stream.next_in = const_cast<Bytef*>(data);
+  stream.avail_in = static_cast<uInt>(size);
+  output.clear();
+  int ret = Z_OK;
+  while (ret == Z_OK) {
+    size_t used = output.size();
+    size_t chunk = std::min(INFLATE_CHUNK_SIZE, INFLATE_MAX_OUTPUT - used);
+    if (chunk == 0) {
+      break;
+    }
+    output.resize(used + chunk);
+    stream.next_out = output.data() + used;
+    stream.avail_out = static_cast<uInt>(chunk);
+    ret = ::inflate(&stream, Z_NO_FLUSH);
+    output.resize(used + chunk - stream.avail_out);
+    if (ret == Z_BUF_ERROR && stream.avail_in > 0) {
+      ret = Z_OK;
+    }
+  }
+  inflateEnd(&stream);
+  return ret == Z_STREAM_END;
+}
+
+// Whole-buffer engine: one zlib stream reset between headers and a single
+// Z_FINISH call into an output pre-sized from the previous header
+class ZlibOneShotInflateEngine : public InflateEngine {
+public:
+  ZlibOneShotInflateEngine(void);
+  ~ZlibOneShotInflateEngine(void);
+  const char* name() const { return "zlib-oneshot"; }
+  bool inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& output);
+private:
+  z_stream mStream;
+  bool mInitialized;
+  size_t mSizeHint;
+};
+
+ZlibOneShotInflateEngine::ZlibOneShotInflateEngine() : mStream(z_stream()), mSizeHint(INFLATE_MIN_OUTPUT) {
+  mInitialized = inflateInit2(&mStream, -MAX_WBITS) == Z_OK;
+}
+
+ZlibOneShotInflateEngine::~ZlibOneShotInflateEngine() {
+  if (mInitialized) {
+    inflateEnd(&mStream);
+  }
+}
+
+bool ZlibOneShotInflateEngine::inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& output) {
+  if (!mInitialized || inflateReset(&mStream) != Z_OK) {
+    return false;
+  }
+  mStream.next_in = const_cast<Bytef*>(data);
+  mStream.avail_in = static_cast<uInt>(size);
+  output.resize(std::min(std::max(mSizeHint, output.capacity()), INFLATE_MAX_OUTPUT));
+  mStream.next_out = output.data();
+  mStream.avail_out = static_cast<uInt>(output.size());
+  int ret;
+  while (((ret = ::inflate(&mStream, Z_FINISH)) == Z_OK || ret == Z_BUF_ERROR) && mStream.avail_out == 0) {
+    size_t used = output.size();
+    if (used == INFLATE_MAX_OUTPUT) {
+      break;
+    }
+    output.resize(std::min(used * 2, INFLATE_MAX_OUTPUT));
+    mStream.next_out = output.data() + used;
+    mStream.avail_out = static_cast<uInt>(output.size() - used);
+  }
+  output.resize(mStream.total_out);
+  if (ret != Z_STREAM_END) {
+    return false;
+  }
+  mSizeHint = std::min(std::max(mSizeHint, output.size() + output.size() / 8), INFLATE_MAX_OUTPUT);
+  return true;
+}
+
+#ifdef RECANALYST_HAVE_LIBDEFLATE
+class LibdeflateInflateEngine : public InflateEngine {
+public:
+  LibdeflateInflateEngine(void);
+  ~LibdeflateInflateEngine(void);
+  const char* name() const { return "libdeflate"; }
+  bool inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& output);
+private:
+  libdeflate_decompressor* mDecompressor;
+  size_t mSizeHint;
+};
+
+LibdeflateInflateEngine::LibdeflateInflateEngine() : mSizeHint(INFLATE_MIN_OUTPUT) {
+  mDecompressor = libdeflate_alloc_decompressor();
+}
+
+LibdeflateInflateEngine::~LibdeflateInflateEngine() {
+  if (mDecompressor != NULL) {
+    libdeflate_free_decompressor(mDecompressor);
+  }
+}
+
+bool LibdeflateInflateEngine::inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& output) {
+  if (mDecompressor == NULL) {
+    return false;
+  }
+  output.resize(std::min(std::max(mSizeHint, output.capacity()), INFLATE_MAX_OUTPUT));
+  for (;;) {
+    size_t actual = 0;
+    libdeflate_result ret = libdeflate_deflate_decompress(mDecompressor, data, size,
+      output.data(), output.size(), &actual);
+    if (ret == LIBDEFLATE_SUCCESS) {
+      output.resize(actual);
+      mSizeHint = std::min(std::max(mSizeHint, actual + actual / 8), INFLATE_MAX_OUTPUT);
+      return true;
+    }
+    if (ret != LIBDEFLATE_INSUFFICIENT_SPACE || output.size() == INFLATE_MAX_OUTPUT) {
+      output.clear();
+      return false;
+    }
+    output.resize(std::min(output.size() * 2, INFLATE_MAX_OUTPUT));
+  }
+}
+#endif
+
+std::unique_ptr<InflateEngine> createInflateEngine(const std::string& name) {
+#ifdef RECANALYST_HAVE_LIBDEFLATE
+  if (name.empty() || name == "libdeflate") {
+    return std::unique_ptr<InflateEngine>(new LibdeflateInflateEngine());
+  }
+#else
+  if (name.empty()) {
+    return std::unique_ptr<InflateEngine>(new ZlibOneShotInflateEngine());
+  }
+#endif
+  if (name == "zlib-oneshot") {
+    return std::unique_ptr<InflateEngine>(new ZlibOneShotInflateEngine());
+  }
+  if (name == "zlib") {
+    return std::unique_ptr<InflateEngine>(new ZlibInflateEngine());
+  }
+  throw ERecAnalystException("Unknown inflate engine: " + name);
+}
+
+std::vector<std::string> inflateEngineNames() {
+  std::vector<std::string> names;
+  names.push_back("zlib");
+  names.push_back("zlib-oneshot");
+#ifdef RECANALYST_HAVE_LIBDEFLATE
+  names.push_back("libdeflate");
+#endif
+  return names;
+}
+
+bool probeInflate(const unsigned char* data, size_t size) {
+  unsigned char output[4096];
+  z_stream stream = z_stream();
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  stream.next_in = const_cast<Bytef*>(data);
+  stream.avail_in = static_cast<uInt>(size);
+  stream.next_out = output;
+  stream.avail_out = sizeof(output);
+  int ret = ::inflate(&stream, Z_SYNC_FLUSH);
+  bool produced = stream.avail_out < sizeof(output);
+  inflateEnd(&stream);
+  return produced && (ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR);
+}
+
+void readHeader(RecFile& file, InflateEngine& engine, std::vector<unsigned char>& header) {
+  std::vector<unsigned char> data;
+  file.readHeader(data);
+  if (!engine.inflate(data.data(), data.size(), header)) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_DECOMP));
+  }
+}
+
+} // namespace
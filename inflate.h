@@ -0,0 +1,49 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INFLATE_H_
+#define _INFLATE_H_
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace RecAnalystWrapper {
+
+class RecFile;
+
+// Decompresses the raw deflate stream of a recorded game header. An engine
+// keeps its state between calls and is not thread-safe, use one per thread.
+class InflateEngine {
+public:
+  virtual ~InflateEngine() {}
+  virtual const char* name() const = 0;
+  // output is resized to the inflated size, its capacity is reused between calls. False
+  // for a corrupt stream or one that inflates to more than 64 MB.
+  virtual bool inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& output) = 0;
+};
+
+// name is one of inflateEngineNames(), an empty name selects the fastest engine available
+std::unique_ptr<InflateEngine> createInflateEngine(const std::string& name = "");
+std::vector<std::string> inflateEngineNames();
+
+// True if a prefix of a deflated header decodes, i.e. it is worth a full parse
+bool probeInflate(const unsigned char* data, size_t size);
+
+void readHeader(RecFile& file, InflateEngine& engine, std::vector<unsigned char>& header);
+
+} // namespace
+
+#endif  //_INFLATE_H_
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "liveanalyst.h"
+
+namespace RecAnalystWrapper {
+
+class LiveAnalyst::Collector : public BodyVisitor {
+public:
+  explicit Collector(LiveDelta& delta) : mDelta(delta) {}
+  bool onCommand(const CommandEvent& command);
+  bool onChat(const ChatEvent& chat);
+  bool onAgeUp(const AgeUpEvent& ageUp);
+private:
+  LiveDelta& mDelta;
+};
+
+bool LiveAnalyst::Collector::onCommand(const CommandEvent& command) {
+  if (command.type == BodyCommand::TRIBUTE && command.length >= 12) {
+    LiveTribute tribute;
+    float amount;
+    tribute.time = command.time;
+    tribute.playerFrom = command.data[1];
+    tribute.playerTo = command.data[2];
+    tribute.resource = static_cast<Resource>(command.data[3]);
+    std::memcpy(&amount, command.data + 4, sizeof(amount));
+    std::memcpy(&tribute.fee, command.data + 8, sizeof(tribute.fee));
+    tribute.amount = static_cast<unsigned int>(amount);
+    mDelta.tributes.push_back(tribute);
+  } else if (command.type == BodyCommand::RESEARCH && command.length >= 12) {
+    LiveResearch research;
+    research.id = command.data[10] | (command.data[11] << 8);
+    research.time = command.time;
+    research.player = command.player;
+    mDelta.researches.push_back(research);
+  }
+  return true;
+}
+
+bool LiveAnalyst::Collector::onChat(const ChatEvent& chat) {
+  LiveChatMessage chatMessage;
+  chatMessage.time = chat.time;
+  if (chat.length >= 3 && chat.text[0] == '@' && chat.text[1] == '#' &&
+      chat.text[2] >= '0' && chat.text[2] <= '9') {
+    chatMessage.player = chat.text[2] - '0';
+    chatMessage.msg.assign(chat.text + 3, chat.length - 3);
+  } else {
+    chatMessage.msg.assign(chat.text, chat.length);
+  }
+  mDelta.chatMessages.push_back(chatMessage);
+  return true;
+}
+
+bool LiveAnalyst::Collector::onAgeUp(const AgeUpEvent& ageUp) {
+  LiveAgeUp liveAgeUp;
+  liveAgeUp.time = ageUp.time;
+  liveAgeUp.player = ageUp.player;
+  liveAgeUp.age = ageUp.age;
+  mDelta.ageUps.push_back(liveAgeUp);
+  return true;
+}
+
+LiveAnalyst::LiveAnalyst(const std::string& fileName) : mFileName(fileName) {}
+
+LiveAnalyst::~LiveAnalyst() {}
+
+unsigned long long LiveAnalyst::refresh() {
+  if (!mParser) {
+    mParser.reset(new BodyParser(mFileName));
+  }
+  unsigned long long position = mParser->position();
+  mDelta.chatMessages.clear();
+  mDelta.tributes.clear();
+  mDelta.researches.clear();
+  mDelta.ageUps.clear();
+  Collector collector(mDelta);
+  try {
+    mParser->parse(collector);
+  } catch (...) {
+    publish(position);  // the operations before the malformed one are consumed
+    throw;
+  }
+  return publish(position);
+}
+
+// Keeps the events collected since position and notifies the subscribers, returns
+// the bytes consumed
+unsigned long long LiveAnalyst::publish(unsigned long long position) {
+  mDelta.time = mParser->time();
+  if (!mDelta.empty()) {
+    mChatMessages.insert(mChatMessages.end(), mDelta.chatMessages.begin(), mDelta.chatMessages.end());
+    mTributes.insert(mTributes.end(), mDelta.tributes.begin(), mDelta.tributes.end());
+    mResearches.insert(mResearches.end(), mDelta.researches.begin(), mDelta.researches.end());
+    mAgeUps.insert(mAgeUps.end(), mDelta.ageUps.begin(), mDelta.ageUps.end());
+  }
+  unsigned long long consumed = mParser->position() - position;
+  if (consumed > 0) {
+    for (auto it = mSubscribers.cbegin(); it != mSubscribers.cend(); ++it) {
+      (*it)(mDelta);
+    }
+  }
+  return consumed;
+}
+
+void LiveAnalyst::subscribe(LiveSubscriber subscriber) {
+  mSubscribers.push_back(subscriber);
+}
+
+unsigned int LiveAnalyst::time() const {
+  return mParser ? mParser->time() : 0;
+}
+
+unsigned long long LiveAnalyst::position() const {
+  return mParser ? mParser->position() : 0;
+}
+
+} // namespace
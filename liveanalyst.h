@@ -0,0 +1,109 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIVEANALYST_H_
+#define _LIVEANALYST_H_
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bodyparser.h"
+
+namespace RecAnalystWrapper {
+
+struct LiveChatMessage {
+  unsigned int time;
+  int player;  // player number from the "@#<n>" prefix, 0 if missing
+  std::string msg;
+  LiveChatMessage() : time(0), player(0) {}
+};
+
+struct LiveTribute {
+  unsigned int time;
+  int playerFrom;
+  int playerTo;
+  Resource resource;
+  unsigned int amount;
+  float fee;
+  LiveTribute() : time(0), playerFrom(0), playerTo(0), resource(Resource::FOOD), amount(0), fee(0.0) {}
+};
+
+struct LiveResearch {
+  int id;
+  unsigned int time;
+  int player;
+  LiveResearch() : id(0), time(0), player(0) {}
+};
+
+struct LiveAgeUp {
+  unsigned int time;  // time the advance was started
+  int player;
+  StartingAge age;
+  LiveAgeUp() : time(0), player(0), age(StartingAge::DARK_AGE) {}
+};
+
+typedef std::vector<LiveChatMessage> LiveChatMessages;
+typedef std::vector<LiveTribute> LiveTributes;
+typedef std::vector<LiveResearch> LiveResearches;
+typedef std::vector<LiveAgeUp> LiveAgeUps;
+
+// Data found by one refresh()
+struct LiveDelta {
+  unsigned int time;  // game time reached
+  LiveChatMessages chatMessages;
+  LiveTributes tributes;
+  LiveResearches researches;
+  LiveAgeUps ageUps;
+  LiveDelta() : time(0) {}
+  bool empty() const {
+    return chatMessages.empty() && tributes.empty() && researches.empty() && ageUps.empty();
+  }
+};
+
+typedef std::function<void(const LiveDelta&)> LiveSubscriber;
+
+// Follows a recorded game which is still being written. Every refresh() parses
+// only the bytes appended since the previous one and notifies the subscribers
+// with what has been found. A refresh() that throws on a malformed operation
+// still keeps and hands out what was found before it.
+class LiveAnalyst {
+public:
+  explicit LiveAnalyst(const std::string& fileName);
+  ~LiveAnalyst(void);
+  unsigned long long refresh();
+  void subscribe(LiveSubscriber subscriber);
+  unsigned int time() const;
+  unsigned long long position() const;
+  const LiveChatMessages& inGameChatMessages() const { return mChatMessages; }
+  const LiveTributes& tributes() const { return mTributes; }
+  const LiveResearches& researches() const { return mResearches; }
+  const LiveAgeUps& ageUps() const { return mAgeUps; }
+private:
+  class Collector;
+  unsigned long long publish(unsigned long long position);
+  std::string mFileName;
+  std::unique_ptr<BodyParser> mParser;
+  std::vector<LiveSubscriber> mSubscribers;
+  LiveDelta mDelta;
+  LiveChatMessages mChatMessages;
+  LiveTributes mTributes;
+  LiveResearches mResearches;
+  LiveAgeUps mAgeUps;
+};
+
+} // namespace
+
+#endif  //_LIVEANALYST_H_
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include "mapcache.h"
+#include "fileutil.h"
+#include "recanalystwrap.h"
+
+namespace fs = std::filesystem;
+
+namespace RecAnalystWrapper {
+
+static const char PNG_EXTENSION[] = ".png";
+static const char TEMP_EXTENSION[] = ".tmp";
+
+// Parses "<hash>_<width>x<height>.png"
+static bool parseEntryName(const std::string& name, ReplayHash& hash, int& width, int& height) {
+  const std::size_t digits = ReplayHash::SIZE * 2;
+  if (name.size() < digits + 1 + 3 + 4 || name[digits] != '_'
+    || name.compare(name.size() - 4, 4, PNG_EXTENSION) != 0) {
+    return false;
+  }
+  if (!replayHashFromString(name.substr(0, digits), hash)) {
+    return false;
+  }
+  char tail;
+  return std::sscanf(name.c_str() + digits + 1, "%dx%d.pn%c", &width, &height, &tail) == 3
+    && width > 0 && height > 0;
+}
+
+MapCache::MapCache(const std::string& directory, unsigned long long diskCapacity,
+  std::size_t memoryCapacity) :
+  mDirectory(directory), mDiskCapacity(diskCapacity), mMemoryCapacity(memoryCapacity) {
+  std::error_code ec;
+  fs::create_directories(mDirectory, ec);
+  if (ec) {
+    throw ERecAnalystException("Unable to create map cache directory: " + mDirectory);
+  }
+  loadDirectory();
+}
+
+std::string MapCache::entryPath(const MapCacheKey& key) const {
+  return (fs::path(mDirectory) / (replayHashToString(key.hash) + "_" + std::to_string(key.width)
+    + "x" + std::to_string(key.height) + PNG_EXTENSION)).string();
+}
+
+// Parses "<hash>_<width>x<height>.png.<n>.tmp", an image storeDisk() did not finish
+static bool isTempEntryName(const std::string& name) {
+  std::size_t png = name.rfind(PNG_EXTENSION);
+  ReplayHash hash;
+  int width, height;
+  return png != std::string::npos && name.size() > 4 &&
+    name.compare(name.size() - 4, 4, TEMP_EXTENSION) == 0 &&
+    parseEntryName(name.substr(0, png + 4), hash, width, height);
+}
+
+// Indexes images of previous runs, the oldest written are evicted first. Temporary
+// files of writes a previous run did not finish are removed.
+void MapCache::loadDirectory() {
+  struct Found {
+    MapCacheKey key;
+    unsigned long long size;
+    fs::file_time_type time;
+  };
+  std::vector<Found> found;
+  std::error_code ec;
+  for (fs::directory_iterator it(mDirectory, ec), end; !ec && it != end; it.increment(ec)) {
+    ReplayHash hash;
+    int width, height;
+    std::string name = it->path().filename().string();
+    if (!it->is_regular_file(ec)) {
+      continue;
+    }
+    if (isTempEntryName(name)) {
+      std::error_code removeError;
+      fs::remove(it->path(), removeError);
+      continue;
+    }
+    if (!parseEntryName(name, hash, width, height)) {
+      continue;
+    }
+    unsigned long long size = it->file_size(ec);
+    if (ec) {
+      continue;
+    }
+    found.push_back({MapCacheKey(hash, width, height), size, it->last_write_time(ec)});
+  }
+  std::sort(found.begin(), found.end(),
+    [](const Found& a, const Found& b) { return a.time > b.time; });
+  for (auto it = found.cbegin(); it != found.cend(); ++it) {
+    mDiskLru.push_back(it->key);
+    mDisk[it->key] = {std::prev(mDiskLru.end()), it->size};
+    mStats.diskBytes += it->size;
+  }
+  while (mStats.diskBytes > mDiskCapacity && !mDiskLru.empty()) {
+    eraseDisk(mDisk.find(mDiskLru.back()));
+  }
+}
+
+bool MapCache::lookup(ReplayHash hash, int width, int height, std::vector<char>& pngBuffer) {
+  MapCacheKey key(hash, width, height);
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mMemory.find(key);
+    if (it != mMemory.end()) {
+      mMemoryLru.splice(mMemoryLru.begin(), mMemoryLru, it->second.lru);
+      pngBuffer = it->second.png;
+      mStats.memoryHits++;
+      mStats.bytesServed += pngBuffer.size();
+      return true;
+    }
+    auto dit = mDisk.find(key);
+    if (dit == mDisk.end()) {
+      mStats.misses++;
+      return false;
+    }
+    mDiskLru.splice(mDiskLru.begin(), mDiskLru, dit->second.lru);
+  }
+  // the file is read without holding the lock, a concurrent eviction makes it a miss
+  bool found = readDisk(key, pngBuffer);
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!found) {
+    // gone or unreadable, drop the entry so it is not read again and its size not counted
+    auto dit = mDisk.find(key);
+    if (dit != mDisk.end()) {
+      eraseDisk(dit);
+    }
+    mStats.misses++;
+    return false;
+  }
+  mStats.diskHits++;
+  mStats.bytesServed += pngBuffer.size();
+  storeMemory(key, pngBuffer);
+  return true;
+}
+
+void MapCache::store(ReplayHash hash, int width, int height, const std::vector<char>& pngBuffer) {
+  MapCacheKey key(hash, width, height);
+  storeDisk(key, pngBuffer);
+  std::lock_guard<std::mutex> lock(mMutex);
+  storeMemory(key, pngBuffer);
+}
+
+ReplayHash MapCache::generateMap(RecAnalyst& recAnalyst, const std::string& fileName, int width,
+  int height, std::vector<char>& pngBuffer) {
+  ReplayHash hash = hashReplayFile(fileName);
+  if (!lookup(hash, width, height, pngBuffer)) {
+    recAnalyst.analyze(fileName);
+    recAnalyst.generateMap(width, height, pngBuffer);
+    store(hash, width, height, pngBuffer);
+  }
+  return hash;
+}
+
+void MapCache::clear() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMemory.clear();
+  mMemoryLru.clear();
+  mStats.memoryBytes = 0;
+  while (!mDiskLru.empty()) {
+    eraseDisk(mDisk.find(mDiskLru.back()));
+  }
+}
+
+MapCacheStats MapCache::stats() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats;
+}
+
+// Caller holds the lock
+void MapCache::storeMemory(const MapCacheKey& key, const std::vector<char>& pngBuffer) {
+  if (pngBuffer.size() > mMemoryCapacity) {
+    return;
+  }
+  auto it = mMemory.find(key);
+  if (it != mMemory.end()) {
+    mStats.memoryBytes -= it->second.png.size();
+    mMemoryLru.splice(mMemoryLru.begin(), mMemoryLru, it->second.lru);
+    it->second.png = pngBuffer;
+  } else {
+    mMemoryLru.push_front(key);
+    mMemory[key] = {mMemoryLru.begin(), pngBuffer};
+  }
+  mStats.memoryBytes += pngBuffer.size();
+  while (mStats.memoryBytes > mMemoryCapacity) {
+    auto victim = mMemory.find(mMemoryLru.back());
+    mStats.memoryBytes -= victim->second.png.size();
+    mMemory.erase(victim);
+    mMemoryLru.pop_back();
+  }
+}
+
+void MapCache::storeDisk(const MapCacheKey& key, const std::vector<char>& pngBuffer) {
+  if (pngBuffer.size() > mDiskCapacity) {
+    return;
+  }
+  // written under a unique name and renamed so readers never see a partial image
+  static std::atomic<unsigned int> sequence(0);
+  std::string path = entryPath(key);
+  std::string tempPath = path + "." + std::to_string(sequence++) + TEMP_EXTENSION;
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(pngBuffer.data(), pngBuffer.size());
+    if (!file) {
+      file.close();
+      std::error_code ec;
+      fs::remove(tempPath, ec);
+      return;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!replaceFile(tempPath, path)) {
+    std::error_code ec;
+    fs::remove(tempPath, ec);
+    return;
+  }
+  auto it = mDisk.find(key);
+  if (it != mDisk.end()) {
+    mStats.diskBytes -= it->second.size;
+    mDiskLru.splice(mDiskLru.begin(), mDiskLru, it->second.lru);
+    it->second.size = pngBuffer.size();
+  } else {
+    mDiskLru.push_front(key);
+    mDisk[key] = {mDiskLru.begin(), pngBuffer.size()};
+  }
+  mStats.diskBytes += pngBuffer.size();
+  while (mStats.diskBytes > mDiskCapacity) {
+    eraseDisk(mDisk.find(mDiskLru.back()));
+  }
+}
+
+bool MapCache::readDisk(const MapCacheKey& key, std::vector<char>& pngBuffer) {
+  std::ifstream file(entryPath(key), std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  std::streamoff size = file.tellg();
+  if (size <= 0) {
+    return false;
+  }
+  pngBuffer.resize(static_cast<std::size_t>(size));
+  file.seekg(0);
+  return static_cast<bool>(file.read(pngBuffer.data(), size));
+}
+
+// Caller holds the lock
+void MapCache::eraseDisk(std::unordered_map<MapCacheKey, DiskEntry, MapCacheKeyHash>::iterator it) {
+  std::error_code ec;
+  fs::remove(entryPath(it->first), ec);
+  mStats.diskBytes -= it->second.size;
+  mStats.evictions++;
+  mDiskLru.erase(it->second.lru);
+  mDisk.erase(it);
+}
+
+} // namespace
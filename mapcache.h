@@ -0,0 +1,107 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MAPCACHE_H_
+#define _MAPCACHE_H_
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "replayhash.h"
+
+namespace RecAnalystWrapper {
+
+class RecAnalyst;
+
+struct MapCacheKey {
+  ReplayHash hash;
+  int width;
+  int height;
+  MapCacheKey(ReplayHash hash, int width, int height) : hash(hash), width(width), height(height) {}
+  bool operator==(const MapCacheKey& other) const {
+    return hash == other.hash && width == other.width && height == other.height;
+  }
+};
+
+struct MapCacheKeyHash {
+  std::size_t operator()(const MapCacheKey& key) const {
+    return static_cast<std::size_t>(key.hash.prefix() ^ (static_cast<unsigned long long>(key.width) << 16)
+      ^ (static_cast<unsigned long long>(key.height) << 40));
+  }
+};
+
+struct MapCacheStats {
+  unsigned long long memoryHits;
+  unsigned long long diskHits;
+  unsigned long long misses;
+  unsigned long long bytesServed;  // png bytes returned from either tier
+  unsigned long long memoryBytes;
+  unsigned long long diskBytes;
+  unsigned long long evictions;  // entries removed from the disk store
+  MapCacheStats() : memoryHits(0), diskHits(0), misses(0), bytesServed(0), memoryBytes(0),
+    diskBytes(0), evictions(0) {}
+  unsigned long long lookups() const { return memoryHits + diskHits + misses; }
+  double hitRate() const { return lookups() ? (double)(memoryHits + diskHits) / lookups() : 0.0; }
+};
+
+// Generated map images keyed by replay content hash and image size, an in-memory
+// LRU in front of a size-bounded directory of png files, safe to share between threads
+class MapCache {
+public:
+  // diskCapacity and memoryCapacity in bytes, the directory is created if missing
+  // and images left there by previous runs are reused, unfinished ones removed
+  MapCache(const std::string& directory, unsigned long long diskCapacity,
+    std::size_t memoryCapacity = 64 * 1024 * 1024);
+  bool lookup(ReplayHash hash, int width, int height, std::vector<char>& pngBuffer);
+  void store(ReplayHash hash, int width, int height, const std::vector<char>& pngBuffer);
+  // Hashes the file and serves the image from the cache, the replay is analyzed
+  // with recAnalyst and the map generated only on a miss
+  ReplayHash generateMap(RecAnalyst& recAnalyst, const std::string& fileName, int width, int height,
+    std::vector<char>& pngBuffer);
+  void clear();
+  MapCacheStats stats() const;
+private:
+  typedef std::list<MapCacheKey> LruList;
+  struct MemoryEntry {
+    LruList::iterator lru;
+    std::vector<char> png;
+  };
+  struct DiskEntry {
+    LruList::iterator lru;
+    unsigned long long size;
+  };
+  std::string entryPath(const MapCacheKey& key) const;
+  void loadDirectory();
+  void storeMemory(const MapCacheKey& key, const std::vector<char>& pngBuffer);
+  void storeDisk(const MapCacheKey& key, const std::vector<char>& pngBuffer);
+  bool readDisk(const MapCacheKey& key, std::vector<char>& pngBuffer);
+  void eraseDisk(std::unordered_map<MapCacheKey, DiskEntry, MapCacheKeyHash>::iterator it);
+  std::string mDirectory;
+  unsigned long long mDiskCapacity;
+  std::size_t mMemoryCapacity;
+  mutable std::mutex mMutex;
+  LruList mMemoryLru;  // most recently used first
+  LruList mDiskLru;
+  std::unordered_map<MapCacheKey, MemoryEntry, MapCacheKeyHash> mMemory;
+  std::unordered_map<MapCacheKey, DiskEntry, MapCacheKeyHash> mDisk;
+  MapCacheStats mStats;
+};
+
+} // namespace
+
+#endif  //_MAPCACHE_H_
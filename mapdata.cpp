@@ -0,0 +1,110 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include "mapdata.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+static const int MAX_MAP_SIZE = 512;
+static const float HD_SUBVERSION = 11.97f;
+
+// Bounds-checked reader over the inflated header
+class HeaderCursor {
+public:
+  explicit HeaderCursor(const std::vector<unsigned char>& header) : mHeader(header), mPos(0) {}
+  void skip(size_t size) { require(size); mPos += size; }
+  int readInt32() { int v; read(&v, 4); return v; }
+  unsigned int readUInt16() { unsigned short v; read(&v, 2); return v; }
+  unsigned int peekByte() { require(1); return mHeader[mPos]; }
+  float readFloat() { float v; read(&v, 4); return v; }
+  const unsigned char* data(size_t size) { require(size); const unsigned char* p = &mHeader[mPos]; mPos += size; return p; }
+  size_t position() const { return mPos; }
+private:
+  void read(void* value, size_t size) { require(size); std::memcpy(value, &mHeader[mPos], size); mPos += size; }
+  void require(size_t size) {
+    if (size > mHeader.size() - mPos) {
+      throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+    }
+  }
+  const std::vector<unsigned char>& mHeader;
+  size_t mPos;
+};
+
+static void skipAiInfo(HeaderCursor& cursor, float subVersion) {
+  cursor.skip(2);
+  unsigned int numStrings = cursor.readUInt16();
+  cursor.skip(4);
+  for (unsigned int i = 0; i < numStrings; ++i) {
+    int length = cursor.readInt32();
+    if (length < 0) {
+      throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+    }
+    cursor.skip(length);
+  }
+  cursor.skip(6);
+  for (int i = 0; i < 8; ++i) {
+    cursor.skip(10);
+    unsigned int numRules = cursor.readUInt16();
+    cursor.skip(4 + 400 * static_cast<size_t>(numRules));
+  }
+  cursor.skip(5544);
+  if (subVersion >= HD_SUBVERSION) {
+    cursor.skip(1280);
+  }
+}
+
+void readMapData(const std::vector<unsigned char>& header, MapData& mapData) {
+  HeaderCursor cursor(header);
+  cursor.skip(8);  // version string
+  float subVersion = cursor.readFloat();
+  if (cursor.readInt32() != 0) {
+    skipAiInfo(cursor, subVersion);
+  }
+  cursor.skip(110);  // replay info
+  int width = cursor.readInt32();
+  int height = cursor.readInt32();
+  int numZones = cursor.readInt32();
+  if (width <= 0 || width > MAX_MAP_SIZE || height <= 0 || height > MAX_MAP_SIZE ||
+      numZones < 0 || numZones > 255) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+  }
+  size_t tiles = static_cast<size_t>(width) * height;
+  for (int i = 0; i < numZones; ++i) {
+    cursor.skip(((subVersion >= HD_SUBVERSION) ? 2048 : 1275) + tiles);
+    int numFloats = cursor.readInt32();
+    if (numFloats < 0) {
+      throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+    }
+    cursor.skip(4 * static_cast<size_t>(numFloats) + 4);
+  }
+  cursor.skip(2);  // all visible, fog of war
+
+  // UserPatch extended terrains use 4 bytes per tile, marked by 0xFF
+  size_t tileSize = (cursor.peekByte() == 0xFF) ? 4 : 2;
+  const unsigned char* p = cursor.data(tiles * tileSize);
+  mapData.width = width;
+  mapData.height = height;
+  mapData.terrain.resize(tiles);
+  mapData.elevation.resize(tiles);
+  for (size_t i = 0; i < tiles; ++i, p += tileSize) {
+    mapData.terrain[i] = (tileSize == 4) ? p[1] : p[0];
+    mapData.elevation[i] = (tileSize == 4) ? p[2] : p[1];
+  }
+}
+
+} // namespace
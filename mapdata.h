@@ -0,0 +1,42 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MAPDATA_H_
+#define _MAPDATA_H_
+#include <vector>
+
+namespace RecAnalystWrapper {
+
+// Tile grid of the map, tiles are stored row by row (index = y * width + x).
+// Only terrain and elevation are decoded. Placed objects (gold, stone, relics,
+// trees) are not: they sit in the per player object lists after the map, whose
+// records vary in size by object type and game version and are not parsed here.
+// There is no object grid or radius query either.
+struct MapData {
+  int width;
+  int height;
+  std::vector<unsigned char> terrain;
+  std::vector<unsigned char> elevation;
+  MapData() : width(0), height(0) {}
+  int tileIndex(int x, int y) const { return y * width + x; }
+};
+
+// Decodes the map section of an inflated header
+void readMapData(const std::vector<unsigned char>& header, MapData& mapData);
+
+} // namespace
+
+#endif  //_MAPDATA_H_
@@ -0,0 +1,339 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include <zlib.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECANALYST_SSE2
+#include <emmintrin.h>
+#endif
+#include "maprenderer.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+// terrain id to 0xRRGGBB
+static const unsigned int TERRAIN_COLORS[] = {
+  0x339727, 0x305DB6, 0xE8B478, 0xE4A252, 0x5492B0, 0x339727, 0xE4A252, 0x82884D,
+  0x82884D, 0x339727, 0x157615, 0xE4A252, 0x339727, 0x157615, 0xE8B478, 0x305DB6,
+  0x339727, 0x157615, 0x157615, 0x157615, 0x157615, 0x157615, 0x004AA1, 0x004ABB,
+  0xE4A252, 0xE4A252, 0xFFEC49, 0xE4A252, 0x305DB6, 0x82884D, 0x82884D, 0x82884D,
+  0xC8D8FF, 0xC8D8FF, 0xC8D8FF, 0x98C0F0, 0xC8D8FF, 0x98C0F0, 0xC8D8FF, 0xC8D8FF,
+  0xFFEC49, 0x157615
+};
+static const unsigned int UNKNOWN_TERRAIN_COLOR = 0x808080;
+
+static unsigned int shade(unsigned int color, int elevationDiff) {
+  int factor = 256 + 20 * std::max(-2, std::min(2, elevationDiff));
+  unsigned int result = 0;
+  for (int shift = 0; shift < 24; shift += 8) {
+    int channel = ((color >> shift) & 0xFF) * factor >> 8;
+    result |= static_cast<unsigned int>(std::min(channel, 255)) << shift;
+  }
+  return result;
+}
+
+void renderMap(const MapData& mapData, const MapMarkers& markers, int width, int height,
+    unsigned char* rgbaBuffer) {
+  if (width <= 0 || height <= 0 || mapData.width <= 0 || mapData.height <= 0) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+  }
+  // color every tile once, then sample the tile image for each pixel
+  std::vector<unsigned int> tiles(mapData.terrain.size());
+  for (int y = 0; y < mapData.height; ++y) {
+    for (int x = 0; x < mapData.width; ++x) {
+      int i = mapData.tileIndex(x, y);
+      unsigned int terrain = mapData.terrain[i];
+      unsigned int color = (terrain < sizeof(TERRAIN_COLORS) / sizeof(TERRAIN_COLORS[0])) ?
+        TERRAIN_COLORS[terrain] : UNKNOWN_TERRAIN_COLOR;
+      int lower = (x > 0) ? mapData.elevation[i - 1] : mapData.elevation[i];
+      tiles[i] = shade(color, mapData.elevation[i] - lower);
+    }
+  }
+  int radius = std::max(1, std::max(mapData.width, mapData.height) / 60);
+  for (auto it = markers.cbegin(); it != markers.cend(); ++it) {
+    for (int y = std::max(0, it->y - radius); y <= std::min(mapData.height - 1, it->y + radius); ++y) {
+      for (int x = std::max(0, it->x - radius); x <= std::min(mapData.width - 1, it->x + radius); ++x) {
+        tiles[mapData.tileIndex(x, y)] = it->color;
+      }
+    }
+  }
+
+  // tile x grows to the bottom right and tile y to the top right, (0, 0) is the left corner
+  double step = 1.0 / width;
+  for (int v = 0; v < height; ++v) {
+    double t = (v + 0.5) / height;
+    double fx = 0.5 * step + t - 0.5;
+    double fy = 0.5 * step - t + 0.5;
+    unsigned char* row = rgbaBuffer + static_cast<size_t>(v) * width * 4;
+    for (int u = 0; u < width; ++u, fx += step, fy += step) {
+      unsigned char* pixel = row + u * 4;
+      if (fx < 0.0 || fx >= 1.0 || fy < 0.0 || fy >= 1.0) {
+        std::memset(pixel, 0, 4);
+        continue;
+      }
+      unsigned int color = tiles[mapData.tileIndex(static_cast<int>(fx * mapData.width),
+        static_cast<int>(fy * mapData.height))];
+      pixel[0] = static_cast<unsigned char>(color >> 16);
+      pixel[1] = static_cast<unsigned char>(color >> 8);
+      pixel[2] = static_cast<unsigned char>(color);
+      pixel[3] = 0xFF;
+    }
+  }
+}
+
+// Four channels of one pixel, premultiplied by alpha
+#ifdef RECANALYST_SSE2
+typedef __m128 Pixel4;
+
+static inline Pixel4 zeroPixel() {
+  return _mm_setzero_ps();
+}
+
+static inline Pixel4 loadPremultiplied(const unsigned char* p) {
+  int packed;
+  std::memcpy(&packed, p, 4);
+  __m128i zero = _mm_setzero_si128();
+  __m128 f = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero));
+  __m128 alphaLane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+  __m128 scale = _mm_mul_ps(_mm_shuffle_ps(f, f, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_ps(1.0f / 255.0f));
+  scale = _mm_or_ps(_mm_and_ps(alphaLane, _mm_set1_ps(1.0f)), _mm_andnot_ps(alphaLane, scale));
+  return _mm_mul_ps(f, scale);
+}
+
+static inline Pixel4 loadPixel(const float* p) {
+  return _mm_loadu_ps(p);
+}
+
+static inline Pixel4 addWeighted(Pixel4 acc, Pixel4 p, float weight) {
+  return _mm_add_ps(acc, _mm_mul_ps(p, _mm_set1_ps(weight)));
+}
+
+static inline void storePixel(float* p, Pixel4 v) {
+  _mm_storeu_ps(p, v);
+}
+#else
+struct Pixel4 {
+  float v[4];
+};
+
+static inline Pixel4 zeroPixel() {
+  Pixel4 p = {{0.0f, 0.0f, 0.0f, 0.0f}};
+  return p;
+}
+
+static inline Pixel4 loadPremultiplied(const unsigned char* p) {
+  float scale = p[3] / 255.0f;
+  Pixel4 result = {{p[0] * scale, p[1] * scale, p[2] * scale, static_cast<float>(p[3])}};
+  return result;
+}
+
+static inline Pixel4 loadPixel(const float* p) {
+  Pixel4 result = {{p[0], p[1], p[2], p[3]}};
+  return result;
+}
+
+static inline Pixel4 addWeighted(Pixel4 acc, Pixel4 p, float weight) {
+  for (int i = 0; i < 4; ++i) {
+    acc.v[i] += p.v[i] * weight;
+  }
+  return acc;
+}
+
+static inline void storePixel(float* p, Pixel4 v) {
+  std::memcpy(p, v.v, sizeof(v.v));
+}
+#endif
+
+// Source span and coverage weights of every target coordinate
+struct AreaWeights {
+  std::vector<int> first;
+  std::vector<int> offset;  // into weights, offset[t + 1] - offset[t] is the span length
+  std::vector<float> weights;
+};
+
+static void computeAreaWeights(int sourceSize, int targetSize, AreaWeights& w) {
+  double scale = static_cast<double>(sourceSize) / targetSize;
+  w.first.resize(targetSize);
+  w.offset.assign(1, 0);
+  w.weights.clear();
+  for (int t = 0; t < targetSize; ++t) {
+    double begin = t * scale;
+    double end = (t + 1) * scale;
+    int first = static_cast<int>(begin);
+    int last = std::min(static_cast<int>(std::ceil(end)), sourceSize);
+    w.first[t] = first;
+    for (int s = first; s < last; ++s) {
+      double cover = std::min(end, s + 1.0) - std::max(begin, static_cast<double>(s));
+      w.weights.push_back(static_cast<float>(cover / scale));
+    }
+    w.offset.push_back(static_cast<int>(w.weights.size()));
+  }
+}
+
+void downscaleImage(const MapImage& source, MapImage& target) {
+  if (target.width <= 0 || target.height <= 0 || target.width > source.width || target.height > source.height) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+  }
+  AreaWeights horizontal, vertical;
+  computeAreaWeights(source.width, target.width, horizontal);
+  computeAreaWeights(source.height, target.height, vertical);
+
+  // horizontal pass into a premultiplied float image of target.width x source.height
+  std::vector<float> columns(static_cast<size_t>(target.width) * source.height * 4);
+  for (int y = 0; y < source.height; ++y) {
+    const unsigned char* row = &source.rgba[static_cast<size_t>(y) * source.width * 4];
+    float* out = &columns[static_cast<size_t>(y) * target.width * 4];
+    for (int x = 0; x < target.width; ++x) {
+      Pixel4 acc = zeroPixel();
+      const unsigned char* p = row + horizontal.first[x] * 4;
+      for (int k = horizontal.offset[x]; k < horizontal.offset[x + 1]; ++k, p += 4) {
+        acc = addWeighted(acc, loadPremultiplied(p), horizontal.weights[k]);
+      }
+      storePixel(out + x * 4, acc);
+    }
+  }
+
+  // vertical pass, row by row to keep the reads sequential
+  target.rgba.resize(static_cast<size_t>(target.width) * target.height * 4);
+  std::vector<float> acc(static_cast<size_t>(target.width) * 4);
+  for (int y = 0; y < target.height; ++y) {
+    std::fill(acc.begin(), acc.end(), 0.0f);
+    int row = vertical.first[y];
+    for (int k = vertical.offset[y]; k < vertical.offset[y + 1]; ++k, ++row) {
+      const float* in = &columns[static_cast<size_t>(row) * target.width * 4];
+      for (int x = 0; x < target.width; ++x) {
+        storePixel(&acc[x * 4], addWeighted(loadPixel(&acc[x * 4]), loadPixel(in + x * 4), vertical.weights[k]));
+      }
+    }
+    unsigned char* out = &target.rgba[static_cast<size_t>(y) * target.width * 4];
+    for (int x = 0; x < target.width; ++x) {
+      const float* p = &acc[x * 4];
+      float alpha = std::min(p[3], 255.0f);
+      float scale = (alpha > 0.0f) ? 255.0f / alpha : 0.0f;
+      for (int c = 0; c < 3; ++c) {
+        out[x * 4 + c] = static_cast<unsigned char>(std::min(p[c] * scale, 255.0f) + 0.5f);
+      }
+      out[x * 4 + 3] = static_cast<unsigned char>(alpha + 0.5f);
+    }
+  }
+}
+
+void renderMapPyramid(const MapData& mapData, const MapMarkers& markers, const MapImageSizes& sizes,
+    MapImages& images, bool png, bool parallel) {
+  images.clear();
+  images.resize(sizes.size());
+  MapImage base;
+  for (auto it = sizes.cbegin(); it != sizes.cend(); ++it) {
+    if (it->width <= 0 || it->height <= 0) {
+      throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+    }
+    base.width = std::max(base.width, it->width);
+    base.height = std::max(base.height, it->height);
+  }
+  if (sizes.empty()) {
+    return;
+  }
+  base.rgba.resize(static_cast<size_t>(base.width) * base.height * 4);
+  renderMap(mapData, markers, base.width, base.height, base.rgba.data());
+
+  std::vector<std::exception_ptr> errors(sizes.size());
+  auto level = [&] (size_t i) {
+    try {
+      MapImage& image = images[i];
+      image.width = sizes[i].width;
+      image.height = sizes[i].height;
+      if (image.width == base.width && image.height == base.height) {
+        image.rgba = base.rgba;
+      } else {
+        downscaleImage(base, image);
+      }
+      if (png) {
+        encodePng(image.rgba.data(), image.width, image.height, image.png);
+      }
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  if (parallel && sizes.size() > 1) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < sizes.size(); ++i) {
+      threads.push_back(std::thread(level, i));
+    }
+    level(0);
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+      it->join();
+    }
+  } else {
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      level(i);
+    }
+  }
+  for (auto it = errors.cbegin(); it != errors.cend(); ++it) {
+    if (*it) {
+      std::rethrow_exception(*it);
+    }
+  }
+}
+
+static void putUInt32BE(std::vector<char>& out, unsigned int value) {
+  out.push_back(static_cast<char>(value >> 24));
+  out.push_back(static_cast<char>(value >> 16));
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+static void putChunk(std::vector<char>& png, const char* type, const unsigned char* data, size_t size) {
+  putUInt32BE(png, static_cast<unsigned int>(size));
+  size_t start = png.size();
+  png.insert(png.end(), type, type + 4);
+  png.insert(png.end(), data, data + size);
+  uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(&png[start]), static_cast<uInt>(size + 4));
+  putUInt32BE(png, static_cast<unsigned int>(crc));
+}
+
+void encodePng(const unsigned char* rgbaBuffer, int width, int height, std::vector<char>& pngBuffer) {
+  size_t stride = static_cast<size_t>(width) * 4;
+  std::vector<unsigned char> raw((stride + 1) * height);
+  for (int y = 0; y < height; ++y) {
+    raw[y * (stride + 1)] = 0;  // filter type none
+    std::memcpy(&raw[y * (stride + 1) + 1], rgbaBuffer + y * stride, stride);
+  }
+  uLongf compressedSize = compressBound(static_cast<uLong>(raw.size()));
+  std::vector<unsigned char> compressed(compressedSize);
+  if (compress2(compressed.data(), &compressedSize, raw.data(), static_cast<uLong>(raw.size()),
+      Z_BEST_SPEED) != Z_OK) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_GENMAP));
+  }
+  unsigned char ihdr[13] = {
+    static_cast<unsigned char>(width >> 24), static_cast<unsigned char>(width >> 16),
+    static_cast<unsigned char>(width >> 8), static_cast<unsigned char>(width),
+    static_cast<unsigned char>(height >> 24), static_cast<unsigned char>(height >> 16),
+    static_cast<unsigned char>(height >> 8), static_cast<unsigned char>(height),
+    8, 6, 0, 0, 0  // 8-bit RGBA
+  };
+  static const char signature[] = "\x89PNG\r\n\x1A\n";
+  pngBuffer.assign(signature, signature + 8);
+  putChunk(pngBuffer, "IHDR", ihdr, sizeof(ihdr));
+  putChunk(pngBuffer, "IDAT", compressed.data(), compressedSize);
+  putChunk(pngBuffer, "IEND", NULL, 0);
+}
+
+} // namespace
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MAPRENDERER_H_
+#define _MAPRENDERER_H_
+#include <vector>
+#include "mapdata.h"
+
+namespace RecAnalystWrapper {
+
+// Square drawn over the terrain, e.g. a player's starting position
+struct MapMarker {
+  int x;  // tile coordinates
+  int y;
+  unsigned int color;  // 0xRRGGBB
+  MapMarker(int x, int y, unsigned int color) : x(x), y(y), color(color) {}
+};
+
+typedef std::vector<MapMarker> MapMarkers;
+
+struct MapImageSize {
+  int width;
+  int height;
+  MapImageSize(int width, int height) : width(width), height(height) {}
+};
+
+struct MapImage {
+  int width;
+  int height;
+  std::vector<unsigned char> rgba;
+  std::vector<char> png;  // filled only if requested
+  MapImage() : width(0), height(0) {}
+};
+
+typedef std::vector<MapImageSize> MapImageSizes;
+typedef std::vector<MapImage> MapImages;
+
+// Renders the map rotated by 45 degrees into width * height RGBA pixels,
+// pixels outside of the map are transparent
+void renderMap(const MapData& mapData, const MapMarkers& markers, int width, int height,
+  unsigned char* rgbaBuffer);
+
+// Renders the map once at the largest requested size and area-downscales it
+// to the other sizes, images are returned in the order of sizes
+void renderMapPyramid(const MapData& mapData, const MapMarkers& markers, const MapImageSizes& sizes,
+  MapImages& images, bool png = false, bool parallel = false);
+
+// Box/area filter with premultiplied alpha, target must not be larger than source
+void downscaleImage(const MapImage& source, MapImage& target);
+
+void encodePng(const unsigned char* rgbaBuffer, int width, int height, std::vector<char>& pngBuffer);
+
+} // namespace
+
+#endif  //_MAPRENDERER_H_
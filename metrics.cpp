@@ -0,0 +1,265 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "metrics.h"
+#include "fileutil.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+static const int ERROR_CODES = 32;  // slot -code, RECANALYST_* codes are all above -32
+static const int LATENCY_METRICS = static_cast<int>(LatencyMetric::COUNT);
+
+typedef std::atomic<unsigned long long> Counter;
+
+// Shards have a single writer, so a relaxed load and store is enough
+inline void add(Counter& counter, unsigned long long value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct LatencyShard {
+  Counter buckets[Histogram::BUCKET_COUNT];
+  Counter sum;
+  Counter min;
+  Counter max;
+  LatencyShard() : sum(0), min(~0ULL), max(0) {
+    for (int i = 0; i < Histogram::BUCKET_COUNT; ++i) {
+      buckets[i].store(0, std::memory_order_relaxed);
+    }
+  }
+  void record(unsigned long long value) {
+    add(buckets[Histogram::bucketIndex(value)], 1);
+    add(sum, value);
+    if (value < min.load(std::memory_order_relaxed)) {
+      min.store(value, std::memory_order_relaxed);
+    }
+    if (value > max.load(std::memory_order_relaxed)) {
+      max.store(value, std::memory_order_relaxed);
+    }
+  }
+  void mergeInto(Histogram& histogram) const {
+    std::vector<unsigned long long> counts(Histogram::BUCKET_COUNT);
+    for (int i = 0; i < Histogram::BUCKET_COUNT; ++i) {
+      counts[i] = buckets[i].load(std::memory_order_relaxed);
+    }
+    histogram.addBuckets(counts.data(), sum.load(std::memory_order_relaxed),
+      min.load(std::memory_order_relaxed), max.load(std::memory_order_relaxed));
+  }
+};
+
+struct MetricsShard {
+  Counter filesAnalyzed;
+  Counter bytesProcessed;
+  Counter mapsGenerated;
+  Counter mapBytes;
+  Counter errors[ERROR_CODES];
+  LatencyShard latencies[LATENCY_METRICS];
+  MetricsShard() : filesAnalyzed(0), bytesProcessed(0), mapsGenerated(0), mapBytes(0) {
+    for (int i = 0; i < ERROR_CODES; ++i) {
+      errors[i].store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+// Shards are kept after their threads exit, totals never go backwards
+class MetricsRegistry {
+public:
+  MetricsShard* create() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mShards.push_back(std::unique_ptr<MetricsShard>(new MetricsShard()));
+    return mShards.back().get();
+  }
+  void snapshot(MetricsSnapshot& snapshot) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mShards.cbegin(); it != mShards.cend(); ++it) {
+      const MetricsShard& shard = **it;
+      snapshot.filesAnalyzed += shard.filesAnalyzed.load(std::memory_order_relaxed);
+      snapshot.bytesProcessed += shard.bytesProcessed.load(std::memory_order_relaxed);
+      snapshot.mapsGenerated += shard.mapsGenerated.load(std::memory_order_relaxed);
+      snapshot.mapBytes += shard.mapBytes.load(std::memory_order_relaxed);
+      for (int i = 0; i < ERROR_CODES; ++i) {
+        unsigned long long count = shard.errors[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+          snapshot.errors[-i] += count;
+        }
+      }
+      for (int i = 0; i < LATENCY_METRICS; ++i) {
+        shard.latencies[i].mergeInto(snapshot.latencies[i]);
+      }
+    }
+  }
+private:
+  std::mutex mMutex;
+  std::vector<std::unique_ptr<MetricsShard>> mShards;
+};
+
+static MetricsRegistry& metricsRegistry() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+static MetricsShard& threadMetricsShard() {
+  static thread_local MetricsShard* shard = metricsRegistry().create();
+  return *shard;
+}
+
+void recordAnalyzed(unsigned long long fileBytes, unsigned long long ns) {
+  MetricsShard& shard = threadMetricsShard();
+  add(shard.filesAnalyzed, 1);
+  add(shard.bytesProcessed, fileBytes);
+  shard.latencies[static_cast<int>(LatencyMetric::ANALYZE)].record(ns);
+}
+
+void recordMapGenerated(unsigned long long imageBytes, unsigned long long ns, LatencyMetric metric) {
+  MetricsShard& shard = threadMetricsShard();
+  add(shard.mapsGenerated, 1);
+  add(shard.mapBytes, imageBytes);
+  shard.latencies[static_cast<int>(metric)].record(ns);
+}
+
+void recordError(int code) {
+  int slot = -code;
+  if (slot <= 0 || slot >= ERROR_CODES) {
+    slot = -RECANALYST_UNKNOWN;
+  }
+  add(threadMetricsShard().errors[slot], 1);
+}
+
+MetricsSnapshot metricsSnapshot() {
+  MetricsSnapshot snapshot;
+  metricsRegistry().snapshot(snapshot);
+  return snapshot;
+}
+
+static const char* errorName(int code) {
+  switch (code) {
+    case RECANALYST_NOFILE: return "NOFILE";
+    case RECANALYST_FILEEXT: return "FILEEXT";
+    case RECANALYST_EMPTYHEADER: return "EMPTYHEADER";
+    case RECANALYST_DECOMP: return "DECOMP";
+    case RECANALYST_FILEREAD: return "FILEREAD";
+    case RECANALYST_FILEOPEN: return "FILEOPEN";
+    case RECANALYST_UNKNOWN: return "UNKNOWN";
+    case RECANALYST_HEADLENREAD: return "HEADLENREAD";
+    case RECANALYST_NOTRIGG: return "NOTRIGG";
+    case RECANALYST_NOGAMESETS: return "NOGAMESETS";
+    case RECANALYST_READPLAYER: return "READPLAYER";
+    case RECANALYST_INVALIDPTR: return "INVALIDPTR";
+    case RECANALYST_FREEOBJ: return "FREEOBJ";
+    case RECANALYST_NOCALLBACK: return "NOCALLBACK";
+    case RECANALYST_ENUMP: return "ENUMP";
+    case RECANALYST_ANALYZEF: return "ANALYZEF";
+    case RECANALYST_NOTANALYZED: return "NOTANALYZED";
+    case RECANALYST_TIMECONV: return "TIMECONV";
+    case RECANALYST_OBJECTIVES: return "OBJECTIVES";
+    case RECANALYST_ENUMPRECHAT: return "ENUMPRECHAT";
+    case RECANALYST_ENUMINCHAT: return "ENUMINCHAT";
+    case RECANALYST_ENUMT: return "ENUMT";
+    case RECANALYST_ENUMR: return "ENUMR";
+    case RECANALYST_GAMESETTS: return "GAMESETTS";
+    case RECANALYST_GENMAP: return "GENMAP";
+    case RECANALYST_ANLTIME: return "ANLTIME";
+    default: return "OTHER";
+  }
+}
+
+// Histogram bucket bounds in seconds
+static const double LATENCY_BOUNDS[] = {
+  0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+static const double LATENCY_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+static void writeLatency(std::ostream& stream, const char* name, const char* help,
+    const Histogram& histogram) {
+  char line[256];
+  stream << "# HELP recanalyst_" << name << "_seconds " << help << "\n";
+  stream << "# TYPE recanalyst_" << name << "_seconds histogram\n";
+  for (auto it = std::begin(LATENCY_BOUNDS); it != std::end(LATENCY_BOUNDS); ++it) {
+    std::snprintf(line, sizeof(line), "recanalyst_%s_seconds_bucket{le=\"%g\"} %llu\n", name, *it,
+      histogram.countAtOrBelow(static_cast<unsigned long long>(*it * 1e9)));
+    stream << line;
+  }
+  std::snprintf(line, sizeof(line), "recanalyst_%s_seconds_bucket{le=\"+Inf\"} %llu\n"
+    "recanalyst_%s_seconds_sum %.9f\nrecanalyst_%s_seconds_count %llu\n", name, histogram.count(),
+    name, histogram.sum() / 1e9, name, histogram.count());
+  stream << line;
+  // quantiles from the full resolution histogram, the buckets above are too coarse for tails
+  stream << "# HELP recanalyst_" << name << "_quantile_seconds " << help << ", quantiles\n";
+  stream << "# TYPE recanalyst_" << name << "_quantile_seconds gauge\n";
+  for (auto it = std::begin(LATENCY_QUANTILES); it != std::end(LATENCY_QUANTILES); ++it) {
+    std::snprintf(line, sizeof(line), "recanalyst_%s_quantile_seconds{quantile=\"%g\"} %.9f\n", name,
+      *it, histogram.valueAtQuantile(*it) / 1e9);
+    stream << line;
+  }
+}
+
+void writePrometheusMetrics(std::ostream& stream) {
+  MetricsSnapshot snapshot = metricsSnapshot();
+  stream << "# HELP recanalyst_files_analyzed_total Recorded games analyzed successfully.\n"
+    "# TYPE recanalyst_files_analyzed_total counter\n"
+    "recanalyst_files_analyzed_total " << snapshot.filesAnalyzed << "\n"
+    "# HELP recanalyst_bytes_processed_total Size of the analyzed files.\n"
+    "# TYPE recanalyst_bytes_processed_total counter\n"
+    "recanalyst_bytes_processed_total " << snapshot.bytesProcessed << "\n"
+    "# HELP recanalyst_maps_generated_total Map images generated.\n"
+    "# TYPE recanalyst_maps_generated_total counter\n"
+    "recanalyst_maps_generated_total " << snapshot.mapsGenerated << "\n"
+    "# HELP recanalyst_map_bytes_total Size of the generated map images.\n"
+    "# TYPE recanalyst_map_bytes_total counter\n"
+    "recanalyst_map_bytes_total " << snapshot.mapBytes << "\n"
+    "# HELP recanalyst_errors_total Errors by RECANALYST_* code.\n"
+    "# TYPE recanalyst_errors_total counter\n";
+  for (auto it = snapshot.errors.cbegin(); it != snapshot.errors.cend(); ++it) {
+    stream << "recanalyst_errors_total{code=\"" << it->first << "\",name=\"" << errorName(it->first)
+      << "\"} " << it->second << "\n";
+  }
+  writeLatency(stream, "analyze_duration", "Time spent in RecAnalyst::analyze()",
+    snapshot.latency(LatencyMetric::ANALYZE));
+  writeLatency(stream, "generate_map_duration", "Time spent in RecAnalyst::generateMap()",
+    snapshot.latency(LatencyMetric::GENERATE_MAP));
+  writeLatency(stream, "render_map_duration", "Time spent rendering maps natively",
+    snapshot.latency(LatencyMetric::RENDER_MAP));
+}
+
+void savePrometheusMetrics(const std::string& fileName) {
+  std::string tempName = fileName + ".tmp";
+  {
+    std::ofstream stream(tempName);
+    if (!stream) {
+      throw ERecAnalystException("Unable to create metrics file: " + tempName);
+    }
+    writePrometheusMetrics(stream);
+  }
+  if (!replaceFile(tempName, fileName)) {
+    throw ERecAnalystException("Unable to write metrics file: " + fileName);
+  }
+}
+
+void exportPrometheusMetrics(const std::function<void(const std::string&)>& callback) {
+  std::ostringstream stream;
+  writePrometheusMetrics(stream);
+  callback(stream.str());
+}
+
+} // namespace
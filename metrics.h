@@ -0,0 +1,60 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include "histogram.h"
+
+namespace RecAnalystWrapper {
+
+  enum class LatencyMetric {
+    ANALYZE,
+    GENERATE_MAP,
+    RENDER_MAP,
+    COUNT
+  };
+
+// Process wide totals, aggregated over the per-thread shards on demand
+struct MetricsSnapshot {
+  unsigned long long filesAnalyzed;
+  unsigned long long bytesProcessed;  // size of the analyzed files
+  unsigned long long mapsGenerated;
+  unsigned long long mapBytes;  // size of the generated images
+  std::map<int, unsigned long long> errors;  // RECANALYST_* code to count
+  Histogram latencies[static_cast<int>(LatencyMetric::COUNT)];  // ns
+  MetricsSnapshot() : filesAnalyzed(0), bytesProcessed(0), mapsGenerated(0), mapBytes(0) {}
+  const Histogram& latency(LatencyMetric metric) const { return latencies[static_cast<int>(metric)]; }
+};
+
+// Recording touches only the calling thread's shard and never blocks
+void recordAnalyzed(unsigned long long fileBytes, unsigned long long ns);
+void recordMapGenerated(unsigned long long imageBytes, unsigned long long ns, LatencyMetric metric);
+void recordError(int code);
+
+MetricsSnapshot metricsSnapshot();
+// Prometheus text exposition format
+void writePrometheusMetrics(std::ostream& stream);
+// Written to a temporary file and renamed, suits the node exporter textfile collector
+void savePrometheusMetrics(const std::string& fileName);
+void exportPrometheusMetrics(const std::function<void(const std::string&)>& callback);
+
+} // namespace
+
+#endif  //_METRICS_H_
@@ -0,0 +1,381 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include <time.h>
+#ifdef RECANALYST_HAVE_LIBURING
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "prefetch.h"
+#include "trace.h"
+
+namespace RecAnalystWrapper {
+
+// Read-ahead buffer, the vector keeps its capacity across files
+struct PrefetchBuffer {
+  std::size_t index;
+  bool loaded;  // otherwise the parser leaves reading to the library
+  std::vector<unsigned char> data;
+  PrefetchBuffer() : index(0), loaded(false) {}
+};
+
+static double threadCpuSeconds() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return 0.0;
+  }
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime;
+  k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;
+  u.HighPart = user.dwHighDateTime;
+  return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0.0;
+  }
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Blocking queue of buffers, pop() returns NULL once closed and drained
+class BufferQueue {
+public:
+  BufferQueue(void) : mClosed(false) {}
+  void push(PrefetchBuffer* buffer) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mBuffers.push_back(buffer);
+    }
+    mCondition.notify_one();
+  }
+  PrefetchBuffer* pop(double& blockedSeconds) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mBuffers.empty() && !mClosed) {
+      auto start = std::chrono::steady_clock::now();
+      mCondition.wait(lock, [this] { return !mBuffers.empty() || mClosed; });
+      blockedSeconds += secondsSince(start);
+    }
+    return takeFront();
+  }
+  PrefetchBuffer* tryPop() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return takeFront();
+  }
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mClosed = true;
+    }
+    mCondition.notify_all();
+  }
+private:
+  PrefetchBuffer* takeFront() {
+    if (mBuffers.empty()) {
+      return NULL;
+    }
+    PrefetchBuffer* buffer = mBuffers.front();
+    mBuffers.pop_front();
+    return buffer;
+  }
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::deque<PrefetchBuffer*> mBuffers;
+  bool mClosed;
+};
+
+// Per thread times merged into a stage report
+class StageTimer {
+public:
+  StageTimer(void) : mStart(std::chrono::steady_clock::now()), mCpuStart(threadCpuSeconds()),
+    blockedSeconds(0.0), items(0), bytes(0) {}
+  void finish(std::mutex& mutex, StageReport& report) {
+    double wall = secondsSince(mStart);
+    double cpu = threadCpuSeconds() - mCpuStart;
+    std::lock_guard<std::mutex> lock(mutex);
+    report.busySeconds += wall - blockedSeconds;
+    report.cpuSeconds += cpu;
+    report.blockedSeconds += blockedSeconds;
+    report.items += items;
+    report.bytes += bytes;
+  }
+private:
+  std::chrono::steady_clock::time_point mStart;
+  double mCpuStart;
+public:
+  double blockedSeconds;
+  unsigned long long items;
+  unsigned long long bytes;
+};
+
+static void readFile(const std::string& fileName, std::size_t maxSize, PrefetchBuffer& buffer) {
+  buffer.loaded = false;
+  std::FILE* file = std::fopen(fileName.c_str(), "rb");
+  if (file == NULL) {
+    return;
+  }
+  long size = -1;
+  if (std::fseek(file, 0, SEEK_END) == 0) {
+    size = std::ftell(file);
+  }
+  if (size > 0 && static_cast<unsigned long>(size) <= maxSize && std::fseek(file, 0, SEEK_SET) == 0) {
+    buffer.data.resize(size);
+    buffer.loaded = std::fread(buffer.data.data(), 1, size, file) == static_cast<std::size_t>(size);
+  }
+  std::fclose(file);
+}
+
+struct Pipeline {
+  const std::vector<std::string>& fileNames;
+  const PrefetchOptions& options;
+  BufferQueue freeBuffers;
+  BufferQueue filledBuffers;
+  std::mutex reportMutex;
+  PrefetchReport report;
+  Pipeline(const std::vector<std::string>& fileNames, const PrefetchOptions& options) :
+    fileNames(fileNames), options(options) {}
+};
+
+static void readThread(Pipeline& pipeline, std::atomic<std::size_t>& next) {
+  if (tracingEnabled()) {
+    setTraceThreadName("prefetch-io");
+  }
+  StageTimer timer;
+  std::size_t index;
+  while ((index = next++) < pipeline.fileNames.size()) {
+    PrefetchBuffer* buffer = pipeline.freeBuffers.pop(timer.blockedSeconds);
+    {
+      RECANALYST_TRACE_SCOPE("prefetch_read");
+      buffer->index = index;
+      readFile(pipeline.fileNames[index], pipeline.options.maxFileSize, *buffer);
+    }
+    ++timer.items;
+    timer.bytes += buffer->loaded ? buffer->data.size() : 0;
+    pipeline.filledBuffers.push(buffer);
+  }
+  timer.finish(pipeline.reportMutex, pipeline.report.io);
+}
+
+#ifdef RECANALYST_HAVE_LIBURING
+// Single I/O thread keeping up to queueDepth whole-file reads in flight, returns
+// false without reading anything if the ring cannot be set up
+static bool readWithIoUring(Pipeline& pipeline) {
+  struct Read {
+    PrefetchBuffer* buffer;
+    int fd;
+    std::size_t done;
+  };
+  io_uring ring;
+  unsigned int depth = pipeline.options.queueDepth ? pipeline.options.queueDepth : 1;
+  if (io_uring_queue_init(depth, &ring, 0) < 0) {
+    return false;
+  }
+  if (tracingEnabled()) {
+    setTraceThreadName("prefetch-io");
+  }
+  StageTimer timer;
+  std::vector<Read> reads(depth);
+  std::vector<Read*> idle;
+  for (auto it = reads.begin(); it != reads.end(); ++it) {
+    idle.push_back(&*it);
+  }
+  std::size_t next = 0;
+  unsigned int inFlight = 0;
+  while (next < pipeline.fileNames.size() || inFlight > 0) {
+    bool queued = false;
+    while (next < pipeline.fileNames.size() && !idle.empty()) {
+      // wait for a free buffer only when there is no completion to wait for instead
+      PrefetchBuffer* buffer = inFlight ? pipeline.freeBuffers.tryPop() :
+        pipeline.freeBuffers.pop(timer.blockedSeconds);
+      if (buffer == NULL) {
+        break;
+      }
+      buffer->index = next;
+      buffer->loaded = false;
+      const std::string& fileName = pipeline.fileNames[next++];
+      int fd = ::open(fileName.c_str(), O_RDONLY);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0 ||
+          static_cast<unsigned long long>(st.st_size) > pipeline.options.maxFileSize) {
+        if (fd >= 0) {
+          ::close(fd);
+        }
+        ++timer.items;
+        pipeline.filledBuffers.push(buffer);
+        continue;
+      }
+      buffer->data.resize(st.st_size);
+      Read* read = idle.back();
+      idle.pop_back();
+      read->buffer = buffer;
+      read->fd = fd;
+      read->done = 0;
+      io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_read(sqe, fd, buffer->data.data(), static_cast<unsigned int>(buffer->data.size()), 0);
+      io_uring_sqe_set_data(sqe, read);
+      ++inFlight;
+      queued = true;
+    }
+    if (queued) {
+      io_uring_submit(&ring);
+    }
+    if (inFlight == 0) {
+      continue;
+    }
+    io_uring_cqe* cqe;
+    if (io_uring_wait_cqe(&ring, &cqe) < 0) {
+      continue;  // interrupted
+    }
+    Read* read = static_cast<Read*>(io_uring_cqe_get_data(cqe));
+    int result = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+    PrefetchBuffer* buffer = read->buffer;
+    if (result > 0 && read->done + result < buffer->data.size()) {
+      // short read, queue the rest
+      read->done += result;
+      io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_read(sqe, read->fd, buffer->data.data() + read->done,
+        static_cast<unsigned int>(buffer->data.size() - read->done), read->done);
+      io_uring_sqe_set_data(sqe, read);
+      io_uring_submit(&ring);
+      continue;
+    }
+    ::close(read->fd);
+    buffer->loaded = result > 0 && read->done + result == buffer->data.size();
+    ++timer.items;
+    timer.bytes += buffer->loaded ? buffer->data.size() : 0;
+    idle.push_back(read);
+    --inFlight;
+    pipeline.filledBuffers.push(buffer);
+  }
+  io_uring_queue_exit(&ring);
+  timer.finish(pipeline.reportMutex, pipeline.report.io);
+  return true;
+}
+#endif
+
+static void parseThread(Pipeline& pipeline, const AnalyzedProc& proc) {
+  if (tracingEnabled()) {
+    setTraceThreadName("prefetch-parse");
+  }
+  StageTimer timer;
+  RecAnalyst recAnalyst;
+  unsigned long long failed = 0;
+  PrefetchBuffer* buffer;
+  while ((buffer = pipeline.filledBuffers.pop(timer.blockedSeconds)) != NULL) {
+    const std::string& fileName = pipeline.fileNames[buffer->index];
+    AnalyzeStatus status = buffer->loaded ?
+      recAnalyst.analyzeProbed(fileName, buffer->data.data(), buffer->data.size()) :
+      recAnalyst.analyze(fileName, std::nothrow);
+    std::size_t index = buffer->index;
+    ++timer.items;
+    timer.bytes += buffer->loaded ? buffer->data.size() : 0;
+    pipeline.freeBuffers.push(buffer);  // before proc, so the I/O stage can go on
+    failed += status.ok() ? 0 : 1;
+    proc(index, status, recAnalyst);
+  }
+  timer.finish(pipeline.reportMutex, pipeline.report.parse);
+  std::lock_guard<std::mutex> lock(pipeline.reportMutex);
+  pipeline.report.failed += failed;
+}
+
+PrefetchReport analyzeFiles(const std::vector<std::string>& fileNames, const AnalyzedProc& proc,
+    const PrefetchOptions& options) {
+  RECANALYST_TRACE_SCOPE("analyzeFiles");
+  auto start = std::chrono::steady_clock::now();
+  Pipeline pipeline(fileNames, options);
+  unsigned int workers = options.workers ? options.workers : std::thread::hardware_concurrency();
+  if (workers == 0) {
+    workers = 1;
+  }
+  std::vector<PrefetchBuffer> buffers(options.buffers ? options.buffers : 1);
+  for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+    pipeline.freeBuffers.push(&*it);
+  }
+
+  std::vector<std::thread> parsers;
+  for (unsigned int i = 0; i < workers; ++i) {
+    parsers.push_back(std::thread(parseThread, std::ref(pipeline), std::cref(proc)));
+  }
+  pipeline.report.parse.threads = workers;
+
+  bool done = false;
+#ifdef RECANALYST_HAVE_LIBURING
+  if (options.useIoUring && readWithIoUring(pipeline)) {
+    pipeline.report.ioEngine = "io_uring";
+    pipeline.report.io.threads = 1;
+    done = true;
+  }
+#endif
+  if (!done) {
+    unsigned int readers = options.ioThreads ? options.ioThreads : 1;
+    std::atomic<std::size_t> next(0);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < readers; ++i) {
+      threads.push_back(std::thread(readThread, std::ref(pipeline), std::ref(next)));
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+      it->join();
+    }
+    pipeline.report.ioEngine = "threads";
+    pipeline.report.io.threads = readers;
+  }
+  pipeline.filledBuffers.close();
+  for (auto it = parsers.begin(); it != parsers.end(); ++it) {
+    it->join();
+  }
+  pipeline.report.wallSeconds = secondsSince(start);
+  return pipeline.report;
+}
+
+static void writeStage(std::ostream& stream, const char* name, const StageReport& stage, double wall) {
+  double capacity = wall * stage.threads;
+  stream << std::left << std::setw(8) << name << std::right << std::setw(8) << stage.threads
+    << std::setw(10) << stage.items << std::setw(12) << std::setprecision(1) << stage.bytes / 1e6
+    << std::setw(9) << std::setprecision(1) << (capacity > 0 ? 100.0 * stage.cpuSeconds / capacity : 0.0)
+    << std::setw(11) << std::setprecision(3) << stage.cpuSeconds
+    << std::setw(11) << stage.ioWaitSeconds() << std::setw(11) << stage.blockedSeconds << '\n';
+}
+
+void writePrefetchReport(std::ostream& stream, const PrefetchReport& report) {
+  std::ios::fmtflags flags = stream.flags();
+  stream << std::fixed << std::setprecision(3) << "io engine " << report.ioEngine << ", wall "
+    << report.wallSeconds << " s, failed " << report.failed << '\n';
+  stream << std::left << std::setw(8) << "stage" << std::right << std::setw(8) << "threads"
+    << std::setw(10) << "files" << std::setw(12) << "MB" << std::setw(9) << "cpu %"
+    << std::setw(11) << "cpu s" << std::setw(11) << "io wait s" << std::setw(11) << "blocked s" << '\n';
+  writeStage(stream, "io", report.io, report.wallSeconds);
+  writeStage(stream, "parse", report.parse, report.wallSeconds);
+  stream.flags(flags);
+}
+
+} // namespace
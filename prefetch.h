@@ -0,0 +1,74 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+struct PrefetchOptions {
+  unsigned int workers;     // parser threads, 0 for one per core
+  unsigned int buffers;     // read-ahead buffers, memory stays below buffers * maxFileSize
+  unsigned int ioThreads;   // readers of the thread pool I/O engine
+  unsigned int queueDepth;  // reads in flight with io_uring
+  std::size_t maxFileSize;  // larger files are left to the library to read
+  bool useIoUring;          // only where built with RECANALYST_HAVE_LIBURING
+  PrefetchOptions() : workers(0), buffers(16), ioThreads(4), queueDepth(8),
+    maxFileSize(64 * 1024 * 1024), useIoUring(true) {}
+};
+
+// Time of one pipeline stage summed over its threads
+struct StageReport {
+  unsigned int threads;
+  double busySeconds;     // not waiting on the other stage
+  double cpuSeconds;
+  double blockedSeconds;  // I/O waiting for a free buffer, parsers waiting for a filled one
+  unsigned long long items;
+  unsigned long long bytes;
+  StageReport() : threads(0), busySeconds(0.0), cpuSeconds(0.0), blockedSeconds(0.0), items(0), bytes(0) {}
+  double ioWaitSeconds() const { return busySeconds > cpuSeconds ? busySeconds - cpuSeconds : 0.0; }
+};
+
+struct PrefetchReport {
+  const char* ioEngine;  // "io_uring" or "threads"
+  double wallSeconds;
+  unsigned long long failed;
+  StageReport io;
+  StageReport parse;
+  PrefetchReport() : ioEngine(""), wallSeconds(0.0), failed(0) {}
+};
+
+// Called on a parser thread for every file, results of recAnalyst are valid during the call
+typedef std::function<void(std::size_t index, const AnalyzeStatus& status, RecAnalyst& recAnalyst)> AnalyzedProc;
+
+// Analyzes the files with an I/O stage reading them ahead into a bounded pool of
+// reused buffers and parser threads validating and analyzing the filled buffers.
+// The I/O stage blocks while every buffer is in use. Files are handed to proc
+// roughly in order but from several threads.
+PrefetchReport analyzeFiles(const std::vector<std::string>& fileNames, const AnalyzedProc& proc,
+  const PrefetchOptions& options = PrefetchOptions());
+
+void writePrefetchReport(std::ostream& stream, const PrefetchReport& report);
+
+} // namespace
+
+#endif  //_PREFETCH_H_
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include "ratingengine.h"
+#include "binaryio.h"
+
+namespace RecAnalystWrapper {
+
+static const char RATING_MAGIC[8] = { 'R', 'A', 'R', 'A', 'T', 'E', '0', '1' };
+
+// Smallest player record in a snapshot: name size, a one byte name, rating, games, wins
+static const unsigned long long MIN_PLAYER_RECORD = sizeof(unsigned int) + 1 + sizeof(double) +
+  2 * sizeof(unsigned int);
+
+static const RatingOptions& checkOptions(const RatingOptions& options) {
+  if (!std::isfinite(options.initialRating)) {
+    throw ERecAnalystException("RatingOptions: initialRating must be finite");
+  }
+  if (!std::isfinite(options.kFactor) || options.kFactor < 0.0 ||
+      !std::isfinite(options.provisionalKFactor) || options.provisionalKFactor < 0.0) {
+    throw ERecAnalystException("RatingOptions: K factors must be finite and not negative");
+  }
+  if (options.fullWeightTime < options.minPlayTime) {
+    throw ERecAnalystException("RatingOptions: fullWeightTime must not be less than minPlayTime");
+  }
+  return options;
+}
+
+RatingEngine::RatingEngine(const RatingOptions& options) : mOptions(checkOptions(options)), mMatches(0) {
+  clear();
+}
+
+void RatingEngine::clear() {
+  mNames.clear();
+  mRatings.clear();
+  PlayerRating empty = { mOptions.initialRating, 0, 0 };
+  mRatings.push_back(empty);
+  mMatches = 0;
+}
+
+std::uint32_t RatingEngine::playerId(std::string_view name) {
+  if (name.size() > MAX_NAME_SIZE) {
+    return 0;
+  }
+  std::uint32_t id = mNames.intern(name);
+  if (id == mRatings.size()) {
+    PlayerRating rating = { mOptions.initialRating, 0, 0 };
+    mRatings.push_back(rating);
+  }
+  return id;
+}
+
+const PlayerRating* RatingEngine::rating(std::string_view name) const {
+  std::uint32_t id;
+  return mNames.find(name, id) ? &mRatings[id] : NULL;
+}
+
+RatingOutcome RatingEngine::addMatch(const GameSettings& gameSettings, const Teams& teams) {
+  if (!gameSettings.extra.hasData) {
+    return RatingOutcome::SKIPPED_NO_RESULT;
+  }
+  MatchPlayer players[MAX_PLAYERS];
+  std::size_t count = 0;
+  for (auto t = teams.cbegin(); t != teams.cend(); ++t) {
+    for (auto p = t->second.cbegin(); p != t->second.cend() && count < MAX_PLAYERS; ++p) {
+      const Player& player = p->second;
+      players[count].id = playerId(player.name);
+      players[count].team = t->first;
+      players[count].winner = player.achievement.victory || player.achievement.result == GameResult::WIN;
+      ++count;
+    }
+  }
+  return addMatch(players, count, gameSettings.playTime);
+}
+
+RatingOutcome RatingEngine::addMatch(const RecAnalyst& recAnalyst) {
+  return addMatch(recAnalyst.gameSettings(), recAnalyst.teams());
+}
+
+RatingOutcome RatingEngine::addMatch(const MatchPlayer* players, std::size_t count, unsigned int playTime) {
+  if (playTime < mOptions.minPlayTime) {
+    return RatingOutcome::SKIPPED_SHORT;
+  }
+  if (count > MAX_PLAYERS) {
+    count = MAX_PLAYERS;
+  }
+  // collect the teams, a team wins if any of its members won
+  int teamIds[MAX_PLAYERS];
+  double teamRating[MAX_PLAYERS];
+  int teamSize[MAX_PLAYERS];
+  bool teamWon[MAX_PLAYERS];
+  int playerTeam[MAX_PLAYERS];
+  std::size_t teams = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    std::size_t t = 0;
+    while (t < teams && teamIds[t] != players[i].team) {
+      ++t;
+    }
+    if (t == teams) {
+      teamIds[t] = players[i].team;
+      teamRating[t] = 0.0;
+      teamSize[t] = 0;
+      teamWon[t] = false;
+      ++teams;
+    }
+    teamRating[t] += mRatings[players[i].id].rating;
+    ++teamSize[t];
+    teamWon[t] = teamWon[t] || players[i].winner;
+    playerTeam[i] = static_cast<int>(t);
+  }
+  if (teams < 2) {
+    return RatingOutcome::SKIPPED_ONE_TEAM;
+  }
+  std::size_t winners = 0;
+  for (std::size_t t = 0; t < teams; ++t) {
+    teamRating[t] /= teamSize[t];
+    winners += teamWon[t] ? 1 : 0;
+  }
+  if (winners == 0 || winners == teams) {
+    return RatingOutcome::SKIPPED_NO_RESULT;
+  }
+
+  // mean of actual minus expected score against every other team
+  double teamDelta[MAX_PLAYERS];
+  for (std::size_t a = 0; a < teams; ++a) {
+    double delta = 0.0;
+    for (std::size_t b = 0; b < teams; ++b) {
+      if (a == b) {
+        continue;
+      }
+      double expected = 1.0 / (1.0 + std::pow(10.0, (teamRating[b] - teamRating[a]) / 400.0));
+      double actual = (teamWon[a] == teamWon[b]) ? 0.5 : (teamWon[a] ? 1.0 : 0.0);
+      delta += actual - expected;
+    }
+    teamDelta[a] = delta / (teams - 1);
+  }
+
+  double weight = 1.0;
+  if (playTime < mOptions.fullWeightTime) {
+    weight = static_cast<double>(playTime - mOptions.minPlayTime) /
+      (mOptions.fullWeightTime - mOptions.minPlayTime);
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    if (players[i].id == 0) {
+      continue;  // unnamed player
+    }
+    PlayerRating& rating = mRatings[players[i].id];
+    double k = (rating.games < mOptions.provisionalGames) ? mOptions.provisionalKFactor : mOptions.kFactor;
+    rating.rating += k * weight * teamDelta[playerTeam[i]];
+    ++rating.games;
+    rating.wins += teamWon[playerTeam[i]] ? 1 : 0;
+  }
+  ++mMatches;
+  return RatingOutcome::RATED;
+}
+
+void RatingEngine::snapshot(std::ostream& stream) const {
+  stream.write(RATING_MAGIC, sizeof(RATING_MAGIC));
+  writeValue<unsigned long long>(stream, mMatches);
+  writeValue<unsigned int>(stream, static_cast<unsigned int>(mRatings.size() - 1));
+  for (std::uint32_t id = 1; id < mRatings.size(); ++id) {
+    std::string_view name = mNames.str(id);  // at most MAX_NAME_SIZE, playerId() drops longer ones
+    writeValue<unsigned int>(stream, static_cast<unsigned int>(name.size()));
+    stream.write(name.data(), name.size());
+    writeValue<double>(stream, mRatings[id].rating);
+    writeValue<unsigned int>(stream, mRatings[id].games);
+    writeValue<unsigned int>(stream, mRatings[id].wins);
+  }
+}
+
+bool RatingEngine::restore(std::istream& stream) {
+  clear();
+  char magic[sizeof(RATING_MAGIC)];
+  unsigned long long matches;
+  unsigned int players;
+  if (!stream.read(magic, sizeof(magic)) || std::memcmp(magic, RATING_MAGIC, sizeof(magic)) != 0 ||
+      !readValue(stream, matches) || !readValue(stream, players)) {
+    return false;
+  }
+  long long left = bytesLeft(stream);
+  if (left >= 0) {
+    if (players > static_cast<unsigned long long>(left) / MIN_PLAYER_RECORD) {
+      return false;
+    }
+    mRatings.reserve(players + 1ull);
+  }
+  std::string name;
+  for (unsigned int n = 0; n < players; ++n) {
+    unsigned int size;
+    PlayerRating rating;
+    if (!readValue(stream, size) || size == 0 || size > MAX_NAME_SIZE) {
+      clear();
+      return false;
+    }
+    name.resize(size);
+    if (!stream.read(&name[0], size) || !readValue(stream, rating.rating) ||
+        !readValue(stream, rating.games) || !readValue(stream, rating.wins) ||
+        playerId(name) != n + 1) {
+      clear();  // truncated, or the same name twice
+      return false;
+    }
+    mRatings.back() = rating;
+  }
+  mMatches = matches;
+  return true;
+}
+
+} // namespace
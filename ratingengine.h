@@ -0,0 +1,101 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RATINGENGINE_H_
+#define _RATINGENGINE_H_
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string_view>
+#include <vector>
+#include "compactplayer.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+  enum class RatingOutcome {
+    RATED,
+    SKIPPED_SHORT,      // played for less than minPlayTime
+    SKIPPED_NO_RESULT,  // no achievement data, or every team won or lost
+    SKIPPED_ONE_TEAM
+  };
+
+struct RatingOptions {
+  double initialRating;
+  double kFactor;
+  double provisionalKFactor;     // used for the first provisionalGames games of a player
+  unsigned int provisionalGames;
+  unsigned int minPlayTime;      // ms, shorter games are not rated
+  unsigned int fullWeightTime;   // ms, shorter games count proportionally less
+  RatingOptions() : initialRating(1500.0), kFactor(24.0), provisionalKFactor(48.0),
+    provisionalGames(10), minPlayTime(5 * 60 * 1000), fullWeightTime(20 * 60 * 1000) {}
+};
+
+struct PlayerRating {
+  double rating;
+  unsigned int games;
+  unsigned int wins;
+};
+
+// Participant of a match, id comes from RatingEngine::playerId()
+struct MatchPlayer {
+  std::uint32_t id;
+  int team;
+  bool winner;
+};
+
+// Team Elo updated one match at a time, matches must be fed in the order they were
+// played. A team is rated by the mean of its members, every team plays every other
+// team and each member receives the team's change scaled by their own K factor.
+class RatingEngine {
+public:
+  // Throws ERecAnalystException for non-finite ratings, negative K factors or a
+  // fullWeightTime below minPlayTime
+  explicit RatingEngine(const RatingOptions& options = RatingOptions());
+  RatingOutcome addMatch(const GameSettings& gameSettings, const Teams& teams);
+  RatingOutcome addMatch(const RecAnalyst& recAnalyst);
+  // at most MAX_PLAYERS players, no allocation besides new player ids
+  RatingOutcome addMatch(const MatchPlayer* players, std::size_t count, unsigned int playTime);
+
+  // Adds unknown players. Names longer than MAX_NAME_SIZE map to 0, the unnamed
+  // player, and are never rated.
+  std::uint32_t playerId(std::string_view name);
+  const PlayerRating* rating(std::string_view name) const;
+  const PlayerRating& rating(std::uint32_t id) const { return mRatings[id]; }
+  std::string_view playerName(std::uint32_t id) const { return mNames.str(id); }
+  std::size_t players() const { return mRatings.size() - 1; }
+  unsigned long long matches() const { return mMatches; }
+  const RatingOptions& options() const { return mOptions; }
+  void clear();
+
+  // Snapshot in native byte order, restore() replaces the ratings and
+  // returns false on malformed input
+  void snapshot(std::ostream& stream) const;
+  bool restore(std::istream& stream);
+
+  static const std::size_t MAX_PLAYERS = 8;
+  static const std::size_t MAX_NAME_SIZE = 256;
+private:
+  RatingOptions mOptions;
+  StringPool mNames;                  // player name to id
+  std::vector<PlayerRating> mRatings;  // indexed by id, id 0 is the empty name
+  unsigned long long mMatches;
+};
+
+} // namespace
+
+#endif  //_RATINGENGINE_H_
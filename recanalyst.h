@@ -337,9 +337,12 @@ typedef BOOL (CALLBACK* EnumResearchesProc)(LPRECANALYST_RESEARCH lpResearch,
 //  {$ENDIF}
 
 /*
- * exported api routines
+ * exported api routines, define DLLIMPORT before including this file to
+ * provide or link against another implementation of the api
  */
+#ifndef DLLIMPORT
 #define DLLIMPORT __declspec(dllimport)
+#endif
 
 /*
  * This routine creates a recanalyst object. If the object is created
@@ -15,30 +15,52 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <functional>
+#include <optional>
 #include "recanalystwrap.h"
+#include "inflate.h"
+#include "mapdata.h"
+#include "metrics.h"
+#include "maprenderer.h"
+#include "recfile.h"
+#include "trace.h"
+#include "transcode.h"
 
 namespace RecAnalystWrapper {
 
+// Text fields are transcoded to UTF-8, views into the source are kept when it needs no
+// transcoding, otherwise they point into memory from resource
 class RecAnalystTranslator {
 public:
-  static void translateInitialState(const RECANALYST_INITIALSTATE& is, InitialState& initialState);
+  RecAnalystTranslator(const Utf8Transcoder& utf8, std::pmr::memory_resource* resource) :
+    mUtf8(utf8), mResource(resource) {}
+  void translateInitialState(const RECANALYST_INITIALSTATE& is, InitialState& initialState) const;
   static void translateMilitaryStats(const RECANALYST_MILITARYSTATS& ms, MilitaryStats& militaryStats);
   static void translateEconomyStats(const RECANALYST_ECONOMYSTATS& es, EconomyStats& economyStats);
   static void translateTechnologyStats(const RECANALYST_TECHNOLOGYSTATS& ts, TechnologyStats& technologyStats);
   static void translateSocietyStats(const RECANALYST_SOCIETYSTATS& ss, SocietyStats& societyStats);
   static void translateAchievement(const RECANALYST_ACHIEVEMENT& a, Achievement& achievement);
-  static void translateCoopingPlayer(const RECANALYST_PLAYER& p, CoopingPlayer& player);
-  static void translatePlayer(const RECANALYST_PLAYER& p, Player& player);
-  static void translateVictory(const RECANALYST_VICTORY& v, Victory& victory);
+  void translateCoopingPlayer(const RECANALYST_PLAYER& p, CoopingPlayer& player) const;
+  void translatePlayer(const RECANALYST_PLAYER& p, Player& player) const;
+  template <typename VictoryT>
+  void translateVictory(const RECANALYST_VICTORY& v, VictoryT& victory) const;
   static void translateExtraGameData(const RECANALYST_EXTRAGAMEDATA& e, ExtraGameData& extra);
-  static void translateGameSettings(const RECANALYST_GAMESETTINGS& gs, GameSettings& gameSettings);
-  static void translateChatMessage(const RECANALYST_CHATMESSAGE& cm, ChatMessage& chatMessage);
+  // also fills GameSettingsView, whose string views then point into gs
+  template <typename GameSettingsT>
+  void translateGameSettings(const RECANALYST_GAMESETTINGS& gs, GameSettingsT& gameSettings) const;
+  void translateChatMessage(const RECANALYST_CHATMESSAGE& cm, ChatMessage& chatMessage) const;
   static Tribute translateTribute(const RECANALYST_TRIBUTE& t, const Players& players);
-  static Research translateResearch(const RECANALYST_RESEARCH& r, const Players& players);
+  void translateResearch(const RECANALYST_RESEARCH& r, Research& research) const;
+  void translateText(std::string_view text, std::pmr::string& out) const { mUtf8.assign(out, text); }
+  void translateText(std::string_view text, std::string_view& out) const { out = mUtf8.borrow(text, mResource); }
+private:
+  const Utf8Transcoder& mUtf8;
+  std::pmr::memory_resource* mResource;
 };
 
-void RecAnalystTranslator::translateInitialState(const RECANALYST_INITIALSTATE& is, InitialState& initialState) {
+void RecAnalystTranslator::translateInitialState(const RECANALYST_INITIALSTATE& is, InitialState& initialState) const {
   initialState.food = is.dwFood;
   initialState.wood = is.dwWood;
   initialState.stone = is.dwStone;
@@ -51,7 +73,7 @@ void RecAnalystTranslator::translateInitialState(const RECANALYST_INITIALSTATE&
   initialState.extraPop = is.dwExtraPop;
   initialState.position.x = is.ptPosition.x;
   initialState.position.y = is.ptPosition.y;
-  initialState.startingAgeString = is.szStartingAge;
+  translateText(is.szStartingAge, initialState.startingAgeString);
 }
 
 void RecAnalystTranslator::translateMilitaryStats(const RECANALYST_MILITARYSTATS& ms, MilitaryStats& militaryStats) {
@@ -112,37 +134,38 @@ void RecAnalystTranslator::translateAchievement(const RECANALYST_ACHIEVEMENT& a,
   }
 }
 
-void RecAnalystTranslator::translateCoopingPlayer(const RECANALYST_PLAYER& p, CoopingPlayer& player) {
-  player.name = p.szName;
+void RecAnalystTranslator::translateCoopingPlayer(const RECANALYST_PLAYER& p, CoopingPlayer& player) const {
+  translateText(p.szName, player.name);
   player.resignTime = p.dwResignTime;
   player.disconnectTime = p.dwDisconnectTime;
 }
 
-void RecAnalystTranslator::translatePlayer(const RECANALYST_PLAYER& p, Player& player) {
-  RecAnalystTranslator::translateCoopingPlayer(p, player);
+void RecAnalystTranslator::translatePlayer(const RECANALYST_PLAYER& p, Player& player) const {
+  translateCoopingPlayer(p, player);
   player.index = p.dwIndex;
   player.human = p.bHuman != 0;
   player.team = p.dwTeam;
   player.owner = p.bOwner != 0;
   player.civId = static_cast<Civilization>(p.dwCivId);
-  player.civ = p.szCivilization;
+  translateText(p.szCivilization, player.civ);
   player.color = static_cast<PlayerColor>(p.dwColor);
   player.feudalTime = p.dwFeudalTime;
   player.castleTime = p.dwCastleTime;
   player.imperialTime = p.dwImperialTime;
   if (p.lpInitialState != NULL) {
-    RecAnalystTranslator::translateInitialState(*p.lpInitialState, player.initialState);
+    translateInitialState(*p.lpInitialState, player.initialState);
   }
   if (p.lpAchievement != NULL) {
     RecAnalystTranslator::translateAchievement(*p.lpAchievement, player.achievement);
   }
 }
 
-void RecAnalystTranslator::translateVictory(const RECANALYST_VICTORY& v, Victory& victory) {
+template <typename VictoryT>
+void RecAnalystTranslator::translateVictory(const RECANALYST_VICTORY& v, VictoryT& victory) const {
   victory.timeLimit = v.dwTimeLimit;
   victory.scoreLimit = v.dwScoreLimit;
   victory.victoryCondition = static_cast<VictoryCondition>(v.dwVictoryCondition);
-  victory.victoryString = v.szVictory;
+  translateText(v.szVictory, victory.victoryString);
 }
 
 void RecAnalystTranslator::translateExtraGameData(const RECANALYST_EXTRAGAMEDATA& e, ExtraGameData& extra) {
@@ -154,7 +177,8 @@ void RecAnalystTranslator::translateExtraGameData(const RECANALYST_EXTRAGAMEDATA
   extra.complete = e.bComplete != 0;
 }
 
-void RecAnalystTranslator::translateGameSettings(const RECANALYST_GAMESETTINGS& gs, GameSettings& gameSettings) {
+template <typename GameSettingsT>
+void RecAnalystTranslator::translateGameSettings(const RECANALYST_GAMESETTINGS& gs, GameSettingsT& gameSettings) const {
   gameSettings.gameType = static_cast<GameType>(gs.dwGameType);
   gameSettings.mapStyle = static_cast<MapStyle>(gs.dwMapStyle);
   gameSettings.difficultyLevel = static_cast<DifficultyLevel>(gs.dwDifficultyLevel);
@@ -170,29 +194,29 @@ void RecAnalystTranslator::translateGameSettings(const RECANALYST_GAMESETTINGS&
   gameSettings.isFFA = gs.bIsFFA != 0;
   gameSettings.gameVersion = static_cast<GameVersion>(gs.dwVersion);
   gameSettings.gameMode = static_cast<GameMode>(gs.dwGameMode);
-  gameSettings.map = gs.szMap;
-  gameSettings.playersType = gs.szPlayersType;
-  gameSettings.pov = gs.szPOV;
-  gameSettings.gameTypeString = gs.szGameType;
-  gameSettings.mapStyleString = gs.szMapStyle;
-  gameSettings.difficultyLevelString = gs.szDifficultyLevel;
-  gameSettings.gameSpeedString = gs.szGameSpeed;
-  gameSettings.revealMapString = gs.szRevealMap;
-  gameSettings.mapSizeString = gs.szMapSize;
-  gameSettings.gameVersionString = gs.szVersion;
-  gameSettings.scenarioFileName = gs.szScFileName;
-  gameSettings.gameSubVersionString = gs.szSubVersion;
+  translateText(gs.szMap, gameSettings.map);
+  translateText(gs.szPlayersType, gameSettings.playersType);
+  translateText(gs.szPOV, gameSettings.pov);
+  translateText(gs.szGameType, gameSettings.gameTypeString);
+  translateText(gs.szMapStyle, gameSettings.mapStyleString);
+  translateText(gs.szDifficultyLevel, gameSettings.difficultyLevelString);
+  translateText(gs.szGameSpeed, gameSettings.gameSpeedString);
+  translateText(gs.szRevealMap, gameSettings.revealMapString);
+  translateText(gs.szMapSize, gameSettings.mapSizeString);
+  translateText(gs.szVersion, gameSettings.gameVersionString);
+  translateText(gs.szScFileName, gameSettings.scenarioFileName);
+  translateText(gs.szSubVersion, gameSettings.gameSubVersionString);
   if (gs.lpVictory != NULL) {
-    RecAnalystTranslator::translateVictory(*gs.lpVictory, gameSettings.victory);
+    translateVictory(*gs.lpVictory, gameSettings.victory);
   }
   if (gs.lpExtra != NULL) {
     RecAnalystTranslator::translateExtraGameData(*gs.lpExtra, gameSettings.extra);
   }
 }
 
-void RecAnalystTranslator::translateChatMessage(const RECANALYST_CHATMESSAGE& cm, ChatMessage& chatMessage) {
+void RecAnalystTranslator::translateChatMessage(const RECANALYST_CHATMESSAGE& cm, ChatMessage& chatMessage) const {
   chatMessage.time = cm.dwTime;
-  chatMessage.msg = cm.szMessage;
+  translateText(cm.szMessage, chatMessage.msg);
   chatMessage.color = static_cast<PlayerColor>(cm.dwColor);
 }
 
@@ -207,28 +231,84 @@ Tribute RecAnalystTranslator::translateTribute(const RECANALYST_TRIBUTE& t, cons
   return tribute;
 }
 
-Research RecAnalystTranslator::translateResearch(const RECANALYST_RESEARCH& r, const Players& players) {
-  const Player& p = players.find(r.dwPlayerId)->second;
-  Research research(p);
+void RecAnalystTranslator::translateResearch(const RECANALYST_RESEARCH& r, Research& research) const {
   research.id = r.dwId;
   research.time = r.dwTime;
-  research.name = r.szName;
-  return research;
+  translateText(r.szName, research.name);
+}
+
+// Time spent translating the records of one enumeration
+class TranslateTimer {
+public:
+  struct Totals {
+    long long events;
+    unsigned long long ns;
+  };
+  explicit TranslateTimer(Totals& totals) : mTotals(totals), mStart(tracingEnabled() ? traceNow() : 0) {}
+  ~TranslateTimer() {
+    if (mStart != 0) {
+      mTotals.events++;
+      mTotals.ns += traceNow() - mStart;
+    }
+  }
+private:
+  Totals& mTotals;
+  unsigned long long mStart;
+};
+
+static unsigned long long elapsedNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
 }
 
 class RecAnalyst::Impl
 {
 public:
   recanalyst* mRecAnalyst;
-  Players mPlayers;
-  Teams mTeams;
-  GameSettings mGameSettings;
-  ChatMessages mPreGameChatMessages;
-  ChatMessages mInGameChatMessages;
-  Tributes mTributes;
-  Researches mResearches;
+  // Everything allocated from the arena, destroyed before it is released
+  struct Results {
+    Players players;  // first, the others refer to players
+    Teams teams;
+    GameSettings gameSettings;
+    ChatMessages preGameChatMessages;
+    ChatMessages inGameChatMessages;
+    Tributes tributes;
+    Researches researches;
+    explicit Results(std::pmr::memory_resource* resource) : players(resource), teams(resource),
+      gameSettings(resource), preGameChatMessages(resource), inGameChatMessages(resource),
+      tributes(resource), researches(resource) {}
+  };
+  std::vector<unsigned char> mArenaBuffer;
+  std::pmr::monotonic_buffer_resource mArena;
+  Utf8Transcoder mUtf8;
+  RecAnalystTranslator mTranslator;
+  std::optional<Results> mResults;
+  std::optional<BorrowedResults> mBorrowed;
+  // kept across analyses, too large for the stack and what borrowed game settings point into
+  struct RawGameSettings {
+    RECANALYST_GAMESETTINGS gs;
+    RECANALYST_VICTORY v;
+    RECANALYST_EXTRAGAMEDATA e;
+  };
+  std::unique_ptr<RawGameSettings> mRawGameSettings;
   int mAnalyzeTime;
+  std::string mFileName;
+  std::unique_ptr<InflateEngine> mInflateEngine;
+  std::unique_ptr<MapData> mMapData;
+  TranslateTimer::Totals mTranslateTotals;
   void throwExceptionIfError(int code);
+  template <typename Proc>
+  int enumerate(const char* name, int (WINAPI* enumFunc)(recanalyst*, Proc, LPARAM), Proc proc);
+  int analyzeGame(const std::string& fileName);
+  int getGameSettings(GameSettings* gameSettings, GameSettingsView* gameSettingsView);
+  bool enumBorrowedPlayersCallback(LPRECANALYST_PLAYER lpPlayer);
+  static BOOL CALLBACK enumBorrowedPlayersCallback(LPRECANALYST_PLAYER lpPlayer, LPARAM lParam);
+  static BOOL CALLBACK enumBorrowedPreGameChatMessagesCallback(LPRECANALYST_CHATMESSAGE lpChatMessage, LPARAM lParam);
+  static BOOL CALLBACK enumBorrowedInGameChatMessagesCallback(LPRECANALYST_CHATMESSAGE lpChatMessage, LPARAM lParam);
+  static BOOL CALLBACK enumBorrowedTributesCallback(LPRECANALYST_TRIBUTE lpTribute, LPARAM lParam);
+  static BOOL CALLBACK enumBorrowedResearchesCallback(LPRECANALYST_RESEARCH lpResearch, LPARAM lParam);
+  const MapData& mapData();
+  void mapMarkers(MapMarkers& markers) const;
   void assignPlayerWithTeam(const Player& player);
   bool enumPlayersCallback(LPRECANALYST_PLAYER lpPlayer);
   bool enumPreGameChatMessagesCallback(LPRECANALYST_CHATMESSAGE lpChatMessage);
@@ -242,13 +322,24 @@ public:
   static BOOL CALLBACK enumResearchesCallback(LPRECANALYST_RESEARCH lpResearch, LPARAM lParam);
   static bool isOwner(const PlayersPair& pp);
 public:
-  Impl(void);
+  Impl(std::pmr::memory_resource* upstream, std::size_t arenaSize);
   ~Impl(void);
-  void analyze(const std::string& fileName);
+  void reset();
+  int analyze(const std::string& fileName, bool validate);
+  int analyzeProbed(const std::string& fileName, const unsigned char* data, std::size_t size);
+  int analyzeBorrowed(const std::string& fileName, bool validate);
+  int visit(const std::string& fileName, const VisitCallbacks& callbacks, LPARAM lParam, bool validate);
   void generateMap(int width, int height, std::vector<char>& pngBuffer);
+  void renderMap(int width, int height, unsigned char* rgbaBuffer);
+  void generateMapPyramid(const MapImageSizes& sizes, MapImages& images, bool png, bool parallel);
 };
 
-RecAnalyst::Impl::Impl() {
+RecAnalyst::Impl::Impl(std::pmr::memory_resource* upstream, std::size_t arenaSize) :
+  mArenaBuffer(arenaSize), mArena(mArenaBuffer.data(), mArenaBuffer.size(), upstream),
+  mTranslator(mUtf8, &mArena) {
+  mResults.emplace(&mArena);
+  mBorrowed.emplace(&mArena);
+  mRawGameSettings.reset(new RawGameSettings());
   mAnalyzeTime = 0;
   if ((mRecAnalyst = recanalyst_create()) == NULL) {
     throw ERecAnalystException("Unable to create RecAnalyst object.");
@@ -261,59 +352,70 @@ RecAnalyst::Impl::~Impl() {
   }
 }
 
+// Drops the previous results and reuses the whole arena, the initial buffer included
+void RecAnalyst::Impl::reset() {
+  mResults.reset();
+  mBorrowed.reset();
+  mArena.release();
+  mResults.emplace(&mArena);
+  mBorrowed.emplace(&mArena);
+  mMapData.reset();
+  mFileName.clear();
+  mAnalyzeTime = 0;
+}
+
 void RecAnalyst::Impl::assignPlayerWithTeam(const Player& player) {
-  auto& it = mTeams.find(player.team);
-  if (it != mTeams.end()) {
-    it->second.insert(TeamPair(player.index, std::cref(player)));
-  } else {
-    Team team;
-    team.insert(TeamPair(player.index, std::cref(player)));
-    mTeams.insert(TeamsPair(player.team, team));
-  }
+  mResults->teams[player.team].emplace(player.index, std::cref(player));
 }
 
 bool RecAnalyst::Impl::enumPlayersCallback(LPRECANALYST_PLAYER lpPlayer) {
+  TranslateTimer timer(mTranslateTotals);
   if (lpPlayer->bIsCooping) {
-    CoopingPlayer cplayer;
-    RecAnalystTranslator::translateCoopingPlayer(*lpPlayer, cplayer);
-    auto& pit = mPlayers.find(lpPlayer->dwIndex);
-    pit->second.coopingPlayers.push_back(cplayer); // player already exists, can't point to mPlayers.end()
+    auto pit = mResults->players.find(lpPlayer->dwIndex);
+    pit->second.coopingPlayers.emplace_back(); // player already exists, can't point to mResults->players.end()
+    mTranslator.translateCoopingPlayer(*lpPlayer, pit->second.coopingPlayers.back());
   } else {
-      Player player;
-      RecAnalystTranslator::translatePlayer(*lpPlayer, player);
+      // built in place so that its strings come from the arena
+      auto pit = mResults->players.emplace(std::piecewise_construct,
+        std::forward_as_tuple(lpPlayer->dwIndex), std::forward_as_tuple());
+      if (!pit.second) {
+        return true;
+      }
+      Player& player = pit.first->second;
+      mTranslator.translatePlayer(*lpPlayer, player);
       if (player.team == 0) {
-        const auto& iter = mTeams.crbegin();
-        player.team = (iter != mTeams.crend()) ? iter->first + 1 : 5;  // max(dwTeam) = 4
+        const auto& iter = mResults->teams.crbegin();
+        player.team = (iter != mResults->teams.crend()) ? iter->first + 1 : 5;  // max(dwTeam) = 4
       }
-      auto& pit = mPlayers.insert(PlayersPair(player.index, player));
-      assignPlayerWithTeam(pit.first->second);
+      assignPlayerWithTeam(player);
   }
   return true;
 }
 
 bool RecAnalyst::Impl::enumPreGameChatMessagesCallback(LPRECANALYST_CHATMESSAGE lpChatMessage) {
-  ChatMessage chatMessage;
-  RecAnalystTranslator::translateChatMessage(*lpChatMessage, chatMessage);
-  mPreGameChatMessages.push_back(chatMessage);
+  TranslateTimer timer(mTranslateTotals);
+  mResults->preGameChatMessages.emplace_back();
+  mTranslator.translateChatMessage(*lpChatMessage, mResults->preGameChatMessages.back());
   return true;
 }
 
 bool RecAnalyst::Impl::enumInGameChatMessagesCallback(LPRECANALYST_CHATMESSAGE lpChatMessage) {
-  ChatMessage chatMessage;
-  RecAnalystTranslator::translateChatMessage(*lpChatMessage, chatMessage);
-  mInGameChatMessages.push_back(chatMessage);
+  TranslateTimer timer(mTranslateTotals);
+  mResults->inGameChatMessages.emplace_back();
+  mTranslator.translateChatMessage(*lpChatMessage, mResults->inGameChatMessages.back());
   return true;
 }
 
 bool RecAnalyst::Impl::enumTributesCallback(LPRECANALYST_TRIBUTE lpTribute) {
-  Tribute& t = RecAnalystTranslator::translateTribute(*lpTribute, mPlayers);
-  mTributes.push_back(t);
+  TranslateTimer timer(mTranslateTotals);
+  mResults->tributes.push_back(RecAnalystTranslator::translateTribute(*lpTribute, mResults->players));
   return true;
 }
 
 bool RecAnalyst::Impl::enumResearchesCallback(LPRECANALYST_RESEARCH lpResearch) {
-  Research& r = RecAnalystTranslator::translateResearch(*lpResearch, mPlayers);
-  mResearches.push_back(r);
+  TranslateTimer timer(mTranslateTotals);
+  mResults->researches.emplace_back(mResults->players.find(lpResearch->dwPlayerId)->second);
+  mTranslator.translateResearch(*lpResearch, mResults->researches.back());
   return true;
 }
 
@@ -342,86 +444,497 @@ BOOL CALLBACK RecAnalyst::Impl::enumResearchesCallback(LPRECANALYST_RESEARCH lpR
   return recAnalyst->enumResearchesCallback(lpResearch);
 }
 
-void RecAnalyst::Impl::analyze(const std::string& fileName) {
-  throwExceptionIfError(recanalyst_analyze(mRecAnalyst, fileName.c_str()));
-  RECANALYST_GAMESETTINGS gs;
-  RECANALYST_VICTORY v;
-  RECANALYST_EXTRAGAMEDATA e;
-  gs.lpVictory = &v;
-  gs.lpExtra = &e;
-  throwExceptionIfError(recanalyst_getgamesettings(mRecAnalyst, &gs));
-  RecAnalystTranslator::translateGameSettings(gs, mGameSettings);
-
+// Runs one recanalyst_enum* call, its span reports the time spent in our callbacks
+template <typename Proc>
+int RecAnalyst::Impl::enumerate(const char* name, int (WINAPI* enumFunc)(recanalyst*, Proc, LPARAM),
+    Proc proc) {
+  TraceScope scope(name);
+  mTranslateTotals.events = 0;
+  mTranslateTotals.ns = 0;
+  int code = enumFunc(mRecAnalyst, proc, reinterpret_cast<LPARAM>(this));
+  if (scope.active()) {
+    scope.setArg("events", mTranslateTotals.events);
+    scope.setArg("translate_us", static_cast<long long>(mTranslateTotals.ns / 1000));
+  }
+  return code;
+}
+
+// Fetches the game settings and objectives into one of the result kinds
+int RecAnalyst::Impl::getGameSettings(GameSettings* gameSettings, GameSettingsView* gameSettingsView) {
+  int code;
+  RECANALYST_GAMESETTINGS& gs = mRawGameSettings->gs;
+  gs.lpVictory = &mRawGameSettings->v;
+  gs.lpExtra = &mRawGameSettings->e;
+  {
+    RECANALYST_TRACE_SCOPE("recanalyst_getgamesettings");
+    if ((code = recanalyst_getgamesettings(mRecAnalyst, &gs)) < RECANALYST_OK) {
+      return code;
+    }
+  }
+  {
+    RECANALYST_TRACE_SCOPE("translateGameSettings");
+    if (gameSettings != NULL) {
+      mTranslator.translateGameSettings(gs, *gameSettings);
+    } else {
+      mTranslator.translateGameSettings(gs, *gameSettingsView);
+    }
+  }
+  RECANALYST_TRACE_SCOPE("recanalyst_getobjectives");
   int size = recanalyst_getobjectives(mRecAnalyst, NULL);
-  throwExceptionIfError(size);
+  if (size < RECANALYST_OK) {
+    return size;
+  }
   if (size > 0) {
-    mGameSettings.objectives.resize(size);
-    throwExceptionIfError(recanalyst_getobjectives(mRecAnalyst, &mGameSettings.objectives[0]));
-    mGameSettings.objectives.resize(size - 1);
+    char* objectives = static_cast<char*>(mArena.allocate(size, 1));
+    if ((code = recanalyst_getobjectives(mRecAnalyst, objectives)) < RECANALYST_OK) {
+      return code;
+    }
+    std::string_view text(objectives, size - 1);
+    if (gameSettings != NULL) {
+      mTranslator.translateText(text, gameSettings->objectives);
+    } else {
+      mTranslator.translateText(text, gameSettingsView->objectives);
+    }
+  }
+  return RECANALYST_OK;
+}
+
+// The player record is copied with the structs it points to, the views point into the copy
+bool RecAnalyst::Impl::enumBorrowedPlayersCallback(LPRECANALYST_PLAYER lpPlayer) {
+  TranslateTimer timer(mTranslateTotals);
+  RECANALYST_PLAYER* p = static_cast<RECANALYST_PLAYER*>(mArena.allocate(sizeof(RECANALYST_PLAYER),
+    alignof(RECANALYST_PLAYER)));
+  *p = *lpPlayer;
+  if (lpPlayer->lpInitialState != NULL) {
+    p->lpInitialState = static_cast<LPRECANALYST_INITIALSTATE>(mArena.allocate(
+      sizeof(RECANALYST_INITIALSTATE), alignof(RECANALYST_INITIALSTATE)));
+    *p->lpInitialState = *lpPlayer->lpInitialState;
   }
-  throwExceptionIfError(recanalyst_enumplayers(mRecAnalyst, enumPlayersCallback, reinterpret_cast<LPARAM>(this)));
+  if (lpPlayer->lpAchievement != NULL) {
+    // the achievement and its stats in one block
+    struct AchievementCopy {
+      RECANALYST_ACHIEVEMENT a;
+      RECANALYST_MILITARYSTATS ms;
+      RECANALYST_ECONOMYSTATS es;
+      RECANALYST_TECHNOLOGYSTATS ts;
+      RECANALYST_SOCIETYSTATS ss;
+    };
+    const RECANALYST_ACHIEVEMENT& a = *lpPlayer->lpAchievement;
+    AchievementCopy* copy = static_cast<AchievementCopy*>(mArena.allocate(sizeof(AchievementCopy),
+      alignof(AchievementCopy)));
+    copy->a = a;
+    if (a.lpMilitaryStats != NULL) {
+      copy->ms = *a.lpMilitaryStats;
+      copy->a.lpMilitaryStats = &copy->ms;
+    }
+    if (a.lpEconomyStats != NULL) {
+      copy->es = *a.lpEconomyStats;
+      copy->a.lpEconomyStats = &copy->es;
+    }
+    if (a.lpTechnologyStats != NULL) {
+      copy->ts = *a.lpTechnologyStats;
+      copy->a.lpTechnologyStats = &copy->ts;
+    }
+    if (a.lpSocietyStats != NULL) {
+      copy->ss = *a.lpSocietyStats;
+      copy->a.lpSocietyStats = &copy->ss;
+    }
+    p->lpAchievement = &copy->a;
+  }
+  PlayerView view = Visiting::playerView(*p);
+  mTranslator.translateText(p->szName, view.name);
+  mTranslator.translateText(p->szCivilization, view.civ);
+  mBorrowed->players.push_back(view);
+  return true;
+}
+
+BOOL CALLBACK RecAnalyst::Impl::enumBorrowedPlayersCallback(LPRECANALYST_PLAYER lpPlayer, LPARAM lParam) {
+  return reinterpret_cast<RecAnalyst::Impl*>(lParam)->enumBorrowedPlayersCallback(lpPlayer);
+}
+
+BOOL CALLBACK RecAnalyst::Impl::enumBorrowedPreGameChatMessagesCallback(LPRECANALYST_CHATMESSAGE lpChatMessage,
+    LPARAM lParam) {
+  RecAnalyst::Impl* recAnalyst = reinterpret_cast<RecAnalyst::Impl*>(lParam);
+  TranslateTimer timer(recAnalyst->mTranslateTotals);
+  ChatMessageView view = Visiting::chatMessageView(*lpChatMessage);
+  view.msg = recAnalyst->mUtf8.copy(lpChatMessage->szMessage, &recAnalyst->mArena);
+  recAnalyst->mBorrowed->preGameChatMessages.push_back(view);
+  return TRUE;
+}
+
+BOOL CALLBACK RecAnalyst::Impl::enumBorrowedInGameChatMessagesCallback(LPRECANALYST_CHATMESSAGE lpChatMessage,
+    LPARAM lParam) {
+  RecAnalyst::Impl* recAnalyst = reinterpret_cast<RecAnalyst::Impl*>(lParam);
+  TranslateTimer timer(recAnalyst->mTranslateTotals);
+  ChatMessageView view = Visiting::chatMessageView(*lpChatMessage);
+  view.msg = recAnalyst->mUtf8.copy(lpChatMessage->szMessage, &recAnalyst->mArena);
+  recAnalyst->mBorrowed->inGameChatMessages.push_back(view);
+  return TRUE;
+}
 
-  throwExceptionIfError(recanalyst_enumpregamechat(mRecAnalyst, enumPreGameChatMessagesCallback, reinterpret_cast<LPARAM>(this)));
-  throwExceptionIfError(recanalyst_enumingamechat(mRecAnalyst, enumInGameChatMessagesCallback, reinterpret_cast<LPARAM>(this)));
-  throwExceptionIfError(recanalyst_enumtributes(mRecAnalyst, enumTributesCallback, reinterpret_cast<LPARAM>(this)));
-  throwExceptionIfError(recanalyst_enumresearches(mRecAnalyst, enumResearchesCallback, reinterpret_cast<LPARAM>(this)));
+BOOL CALLBACK RecAnalyst::Impl::enumBorrowedTributesCallback(LPRECANALYST_TRIBUTE lpTribute, LPARAM lParam) {
+  RecAnalyst::Impl* recAnalyst = reinterpret_cast<RecAnalyst::Impl*>(lParam);
+  TranslateTimer timer(recAnalyst->mTranslateTotals);
+  recAnalyst->mBorrowed->tributes.push_back(Visiting::tributeView(*lpTribute));
+  return TRUE;
+}
+
+BOOL CALLBACK RecAnalyst::Impl::enumBorrowedResearchesCallback(LPRECANALYST_RESEARCH lpResearch, LPARAM lParam) {
+  RecAnalyst::Impl* recAnalyst = reinterpret_cast<RecAnalyst::Impl*>(lParam);
+  TranslateTimer timer(recAnalyst->mTranslateTotals);
+  ResearchView view = Visiting::researchView(*lpResearch);
+  view.name = recAnalyst->mUtf8.copy(lpResearch->szName, &recAnalyst->mArena);
+  recAnalyst->mBorrowed->researches.push_back(view);
+  return TRUE;
+}
+
+// Returns the first error code instead of throwing, so error-heavy batches don't unwind
+int RecAnalyst::Impl::analyzeGame(const std::string& fileName) {
+  int code;
+  {
+    RECANALYST_TRACE_SCOPE("recanalyst_analyze");
+    if ((code = recanalyst_analyze(mRecAnalyst, fileName.c_str())) < RECANALYST_OK) {
+      return code;
+    }
+  }
+  mFileName = fileName;
+  if ((code = getGameSettings(&mResults->gameSettings, NULL)) < RECANALYST_OK) {
+    return code;
+  }
+  if ((code = enumerate("recanalyst_enumplayers", recanalyst_enumplayers, enumPlayersCallback)) < RECANALYST_OK) {
+    return code;
+  }
+  if ((code = enumerate("recanalyst_enumpregamechat", recanalyst_enumpregamechat,
+      enumPreGameChatMessagesCallback)) < RECANALYST_OK) {
+    return code;
+  }
+  if ((code = enumerate("recanalyst_enumingamechat", recanalyst_enumingamechat,
+      enumInGameChatMessagesCallback)) < RECANALYST_OK) {
+    return code;
+  }
+  if ((code = enumerate("recanalyst_enumtributes", recanalyst_enumtributes, enumTributesCallback)) < RECANALYST_OK) {
+    return code;
+  }
+  if ((code = enumerate("recanalyst_enumresearches", recanalyst_enumresearches,
+      enumResearchesCallback)) < RECANALYST_OK) {
+    return code;
+  }
 
   int time = recanalyst_analyzetime(mRecAnalyst);
-  throwExceptionIfError(time);
+  if (time < RECANALYST_OK) {
+    return time;
+  }
   mAnalyzeTime = time;
+  return RECANALYST_OK;
+}
+
+int RecAnalyst::Impl::analyze(const std::string& fileName, bool validate) {
+  RECANALYST_TRACE_SCOPE("analyze");
+  auto start = std::chrono::steady_clock::now();
+  reset();
+  int code = RECANALYST_OK;
+  if (validate) {
+    RECANALYST_TRACE_SCOPE("validateRecFile");
+    code = validateRecFile(fileName);
+  }
+  if (code == RECANALYST_OK) {
+    code = analyzeGame(fileName);
+  }
+  if (code < RECANALYST_OK) {
+    recordError(code);
+    return code;
+  }
+  std::error_code ec;
+  std::uintmax_t fileSize = std::filesystem::file_size(fileName, ec);
+  recordAnalyzed(ec ? 0 : fileSize, elapsedNs(start));
+  return RECANALYST_OK;
+}
+
+int RecAnalyst::Impl::analyzeProbed(const std::string& fileName, const unsigned char* data, std::size_t size) {
+  RECANALYST_TRACE_SCOPE("analyzeProbed");
+  auto start = std::chrono::steady_clock::now();
+  reset();
+  int code;
+  {
+    RECANALYST_TRACE_SCOPE("validateRecData");
+    code = validateRecData(fileName, data, size);
+  }
+  if (code == RECANALYST_OK) {
+    code = analyzeGame(fileName);
+  }
+  if (code < RECANALYST_OK) {
+    recordError(code);
+    return code;
+  }
+  recordAnalyzed(size, elapsedNs(start));
+  return RECANALYST_OK;
+}
+
+int RecAnalyst::Impl::analyzeBorrowed(const std::string& fileName, bool validate) {
+  RECANALYST_TRACE_SCOPE("analyzeBorrowed");
+  auto start = std::chrono::steady_clock::now();
+  reset();
+  int code = RECANALYST_OK;
+  if (validate) {
+    RECANALYST_TRACE_SCOPE("validateRecFile");
+    code = validateRecFile(fileName);
+  }
+  if (code == RECANALYST_OK) {
+    RECANALYST_TRACE_SCOPE("recanalyst_analyze");
+    code = recanalyst_analyze(mRecAnalyst, fileName.c_str());
+  }
+  if (code >= RECANALYST_OK) {
+    mFileName = fileName;
+    code = getGameSettings(NULL, &mBorrowed->gameSettings);
+  }
+  if (code >= RECANALYST_OK) {
+    code = enumerate("recanalyst_enumplayers", recanalyst_enumplayers, enumBorrowedPlayersCallback);
+  }
+  if (code >= RECANALYST_OK) {
+    code = enumerate("recanalyst_enumpregamechat", recanalyst_enumpregamechat,
+      enumBorrowedPreGameChatMessagesCallback);
+  }
+  if (code >= RECANALYST_OK) {
+    code = enumerate("recanalyst_enumingamechat", recanalyst_enumingamechat,
+      enumBorrowedInGameChatMessagesCallback);
+  }
+  if (code >= RECANALYST_OK) {
+    code = enumerate("recanalyst_enumtributes", recanalyst_enumtributes, enumBorrowedTributesCallback);
+  }
+  if (code >= RECANALYST_OK) {
+    code = enumerate("recanalyst_enumresearches", recanalyst_enumresearches, enumBorrowedResearchesCallback);
+  }
+  if (code >= RECANALYST_OK) {
+    code = recanalyst_analyzetime(mRecAnalyst);
+  }
+  if (code < RECANALYST_OK) {
+    recordError(code);
+    return code;
+  }
+  mAnalyzeTime = code;
+  std::error_code ec;
+  std::uintmax_t fileSize = std::filesystem::file_size(fileName, ec);
+  recordAnalyzed(ec ? 0 : fileSize, elapsedNs(start));
+  return RECANALYST_OK;
+}
+
+// Runs the enumerations the visitor asked for straight into its callbacks
+int RecAnalyst::Impl::visit(const std::string& fileName, const VisitCallbacks& callbacks, LPARAM lParam,
+    bool validate) {
+  RECANALYST_TRACE_SCOPE("visit");
+  auto start = std::chrono::steady_clock::now();
+  reset();
+  int code = RECANALYST_OK;
+  if (validate) {
+    RECANALYST_TRACE_SCOPE("validateRecFile");
+    code = validateRecFile(fileName);
+  }
+  if (code == RECANALYST_OK) {
+    RECANALYST_TRACE_SCOPE("recanalyst_analyze");
+    code = recanalyst_analyze(mRecAnalyst, fileName.c_str());
+  }
+  if (code >= RECANALYST_OK && callbacks.players != NULL) {
+    RECANALYST_TRACE_SCOPE("recanalyst_enumplayers");
+    code = recanalyst_enumplayers(mRecAnalyst, callbacks.players, lParam);
+  }
+  if (code >= RECANALYST_OK && callbacks.preGameChatMessages != NULL) {
+    RECANALYST_TRACE_SCOPE("recanalyst_enumpregamechat");
+    code = recanalyst_enumpregamechat(mRecAnalyst, callbacks.preGameChatMessages, lParam);
+  }
+  if (code >= RECANALYST_OK && callbacks.inGameChatMessages != NULL) {
+    RECANALYST_TRACE_SCOPE("recanalyst_enumingamechat");
+    code = recanalyst_enumingamechat(mRecAnalyst, callbacks.inGameChatMessages, lParam);
+  }
+  if (code >= RECANALYST_OK && callbacks.tributes != NULL) {
+    RECANALYST_TRACE_SCOPE("recanalyst_enumtributes");
+    code = recanalyst_enumtributes(mRecAnalyst, callbacks.tributes, lParam);
+  }
+  if (code >= RECANALYST_OK && callbacks.researches != NULL) {
+    RECANALYST_TRACE_SCOPE("recanalyst_enumresearches");
+    code = recanalyst_enumresearches(mRecAnalyst, callbacks.researches, lParam);
+  }
+  if (code < RECANALYST_OK) {
+    recordError(code);
+    return code;
+  }
+  std::error_code ec;
+  std::uintmax_t fileSize = std::filesystem::file_size(fileName, ec);
+  recordAnalyzed(ec ? 0 : fileSize, elapsedNs(start));
+  return RECANALYST_OK;
 }
 
 void RecAnalyst::Impl::generateMap(int width, int height, std::vector<char>& pngBuffer) {
-  int size = recanalyst_generatemap(mRecAnalyst, width, height, NULL);
-  throwExceptionIfError(size);
+  RECANALYST_TRACE_SCOPE("generateMap");
+  auto start = std::chrono::steady_clock::now();
+  int size;
+  {
+    RECANALYST_TRACE_SCOPE("recanalyst_generatemap/size");
+    size = recanalyst_generatemap(mRecAnalyst, width, height, NULL);
+    throwExceptionIfError(size);
+  }
   pngBuffer.clear();
   pngBuffer.resize(size);
-  throwExceptionIfError(recanalyst_generatemap(mRecAnalyst, width, height, pngBuffer.data()));
+  {
+    RECANALYST_TRACE_SCOPE("recanalyst_generatemap");
+    throwExceptionIfError(recanalyst_generatemap(mRecAnalyst, width, height, pngBuffer.data()));
+  }
+  recordMapGenerated(pngBuffer.size(), elapsedNs(start), LatencyMetric::GENERATE_MAP);
+}
+
+const MapData& RecAnalyst::Impl::mapData() {
+  if (!mMapData) {
+    if (mFileName.empty()) {
+      throwExceptionIfError(RECANALYST_NOTANALYZED);
+    }
+    if (!mInflateEngine) {
+      mInflateEngine = createInflateEngine();
+    }
+    std::vector<unsigned char> header;
+    {
+      RECANALYST_TRACE_SCOPE("readHeader");
+      RecFile file(mFileName);
+      readHeader(file, *mInflateEngine, header);
+    }
+    std::unique_ptr<MapData> mapData(new MapData());
+    {
+      RECANALYST_TRACE_SCOPE("readMapData");
+      readMapData(header, *mapData);
+    }
+    mMapData = std::move(mapData);
+  }
+  return *mMapData;
+}
+
+void RecAnalyst::Impl::mapMarkers(MapMarkers& markers) const {
+  static const unsigned int playerColors[] = {
+    0xFFFFFF, 0x0000FF, 0xFF0000, 0x00FF00, 0xFFFF00, 0x00FFFF, 0xFF00FF, 0x434343, 0xFF8201
+  };
+  for (auto it = mResults->players.cbegin(); it != mResults->players.cend(); ++it) {
+    const Player& player = it->second;
+    unsigned int color = static_cast<unsigned int>(player.color);
+    markers.push_back(MapMarker(player.initialState.position.x, player.initialState.position.y,
+      playerColors[(color < sizeof(playerColors) / sizeof(playerColors[0])) ? color : 0]));
+  }
+}
+
+void RecAnalyst::Impl::renderMap(int width, int height, unsigned char* rgbaBuffer) {
+  RECANALYST_TRACE_SCOPE("renderMap");
+  auto start = std::chrono::steady_clock::now();
+  MapMarkers markers;
+  mapMarkers(markers);
+  RecAnalystWrapper::renderMap(mapData(), markers, width, height, rgbaBuffer);
+  recordMapGenerated(static_cast<unsigned long long>(width) * height * 4, elapsedNs(start),
+    LatencyMetric::RENDER_MAP);
+}
+
+void RecAnalyst::Impl::generateMapPyramid(const MapImageSizes& sizes, MapImages& images, bool png,
+    bool parallel) {
+  RECANALYST_TRACE_SCOPE("generateMapPyramid");
+  auto start = std::chrono::steady_clock::now();
+  MapMarkers markers;
+  mapMarkers(markers);
+  renderMapPyramid(mapData(), markers, sizes, images, png, parallel);
+  unsigned long long bytes = 0;
+  for (auto it = images.cbegin(); it != images.cend(); ++it) {
+    bytes += png ? it->png.size() : it->rgba.size();
+  }
+  recordMapGenerated(bytes, elapsedNs(start), LatencyMetric::RENDER_MAP);
 }
 
 void RecAnalyst::Impl::throwExceptionIfError(int code) {
   if (code < RECANALYST_OK) {
+    recordError(code);
     throw ERecAnalystException(recanalyst_errmsg(code));
   }
 }
 
-RecAnalyst::RecAnalyst() : pimpl(new Impl()) {}
+RecAnalyst::RecAnalyst() : pimpl(new Impl(std::pmr::get_default_resource(), DEFAULT_ARENA_SIZE)) {}
+
+RecAnalyst::RecAnalyst(std::pmr::memory_resource* upstream, std::size_t arenaSize) :
+  pimpl(new Impl(upstream, arenaSize)) {}
 
 RecAnalyst::~RecAnalyst() {}
 
 void RecAnalyst::analyze(const std::string& fileName) {
-  return pimpl->analyze(fileName);
+  int code = pimpl->analyze(fileName, false);
+  if (code < RECANALYST_OK) {
+    throw ERecAnalystException(recanalyst_errmsg(code));
+  }
+}
+
+AnalyzeStatus RecAnalyst::analyze(const std::string& fileName, const std::nothrow_t&) {
+  return AnalyzeStatus(pimpl->analyze(fileName, true));
+}
+
+AnalyzeStatus RecAnalyst::analyzeProbed(const std::string& fileName, const unsigned char* data,
+    std::size_t size) {
+  return AnalyzeStatus(pimpl->analyzeProbed(fileName, data, size));
+}
+
+AnalyzeStatus RecAnalyst::analyzeBorrowed(const std::string& fileName, bool validate) {
+  return AnalyzeStatus(pimpl->analyzeBorrowed(fileName, validate));
+}
+
+const BorrowedResults& RecAnalyst::borrowed() const {
+  return *pimpl->mBorrowed;
+}
+
+AnalyzeStatus RecAnalyst::visit(const std::string& fileName, const VisitCallbacks& callbacks,
+    LPARAM lParam, bool validate) {
+  return AnalyzeStatus(pimpl->visit(fileName, callbacks, lParam, validate));
+}
+
+AnalyzeStatus RecAnalyst::validate(const std::string& fileName) {
+  return AnalyzeStatus(validateRecFile(fileName));
 }
 void RecAnalyst::generateMap(int width, int height, std::vector<CHAR>& pngBuffer) {
   return pimpl->generateMap(width, height, pngBuffer);
 }
 
+void RecAnalyst::renderMap(int width, int height, unsigned char* rgbaBuffer) {
+  pimpl->renderMap(width, height, rgbaBuffer);
+}
+
+void RecAnalyst::renderMapPng(int width, int height, std::vector<char>& pngBuffer) {
+  std::vector<unsigned char> rgba(static_cast<size_t>(width) * height * 4);
+  pimpl->renderMap(width, height, rgba.data());
+  encodePng(rgba.data(), width, height, pngBuffer);
+}
+
+void RecAnalyst::generateMapPyramid(const MapImageSizes& sizes, MapImages& images, bool png, bool parallel) {
+  pimpl->generateMapPyramid(sizes, images, png, parallel);
+}
+
 const GameSettings& RecAnalyst::gameSettings() const {
-  return pimpl->mGameSettings;
+  return pimpl->mResults->gameSettings;
 }
 
 const Players& RecAnalyst::players() const {
-  return pimpl->mPlayers;
+  return pimpl->mResults->players;
 }
 
 const Teams& RecAnalyst::teams() const {
-  return pimpl->mTeams;
+  return pimpl->mResults->teams;
 }
 
 const ChatMessages& RecAnalyst::preGameChatMessages() const {
-  return pimpl->mPreGameChatMessages;
+  return pimpl->mResults->preGameChatMessages;
 }
 
 const ChatMessages& RecAnalyst::inGameChatMessages() const {
-  return pimpl->mInGameChatMessages;
+  return pimpl->mResults->inGameChatMessages;
 }
 
 const Tributes& RecAnalyst::tributes() const {
-  return pimpl->mTributes;
+  return pimpl->mResults->tributes;
 }
 
 const Researches& RecAnalyst::researches() const {
-  return pimpl->mResearches;
+  return pimpl->mResults->researches;
+}
+
+const MapData& RecAnalyst::mapData() const {
+  return pimpl->mapData();
 }
 
 bool RecAnalyst::Impl::isOwner(const PlayersPair& pp) {
@@ -429,31 +942,33 @@ bool RecAnalyst::Impl::isOwner(const PlayersPair& pp) {
 }
 
 const Players::const_iterator RecAnalyst::owner() const {
-  return std::find_if(pimpl->mPlayers.cbegin(), pimpl->mPlayers.cend(), Impl::isOwner);
+  return std::find_if(pimpl->mResults->players.cbegin(), pimpl->mResults->players.cend(), Impl::isOwner);
 }
 
-const Players::const_iterator RecAnalyst::getPlayer(std::string name, bool canCoop) const {
-  struct {
-    const std::string& name;
-    bool canCoop;
-    auto operator()(const PlayersPair& pp) -> bool {
+const Players::const_iterator RecAnalyst::getPlayer(std::string_view name, bool canCoop) const {
+  return std::find_if(pimpl->mResults->players.cbegin(), pimpl->mResults->players.cend(),
+    [name, canCoop] (const PlayersPair& pp) {
       const Player& p = pp.second;
-      const std::string& playerName = name;
       return p.name == name ||
         (canCoop && (p.coopingPlayers.cend() != std::find_if(p.coopingPlayers.cbegin(),
-        p.coopingPlayers.cend(), [&playerName] (const CoopingPlayer& cp) { return cp.name == playerName; })));
-      }
-  } lambda = {name, canCoop};
-
-  return std::find_if(pimpl->mPlayers.cbegin(), pimpl->mPlayers.cend(), lambda);
+        p.coopingPlayers.cend(), [name] (const CoopingPlayer& cp) { return cp.name == name; })));
+    });
 }
 
-bool RecAnalyst::hasPlayer(std::string name, bool canCoop) const {
-  return getPlayer(name, canCoop) != pimpl->mPlayers.cend();
+bool RecAnalyst::hasPlayer(std::string_view name, bool canCoop) const {
+  return getPlayer(name, canCoop) != pimpl->mResults->players.cend();
 }
 
 bool RecAnalyst::hasAchievements() const {
-  return pimpl->mGameSettings.extra.hasData;
+  return pimpl->mResults->gameSettings.extra.hasData;
+}
+
+void RecAnalyst::setCodePage(CodePage codePage) {
+  pimpl->mUtf8 = Utf8Transcoder(codePage);
+}
+
+CodePage RecAnalyst::codePage() const {
+  return pimpl->mUtf8.codePage();
 }
 
 int RecAnalyst::analyzeTime() const {
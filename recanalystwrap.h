@@ -17,11 +17,19 @@
 #ifndef _RECANALYSTWRAP_H_
 #define _RECANALYSTWRAP_H_
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <exception>
+#include <stdexcept>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include "recanalyst.h"
+#include "maprenderer.h"
+#include "transcode.h"
 
 namespace RecAnalystWrapper {
 
@@ -69,7 +77,7 @@ namespace RecAnalystWrapper {
     PURPLE,
     GREY,
     ORANGE
-  }
+  };
 
   enum class VictoryCondition {
     STANDARD,
@@ -164,7 +172,19 @@ namespace RecAnalystWrapper {
     GOLD
   };
 
+// Result types allocate from the memory resource of their allocator, by default the
+// per-analysis arena of the RecAnalyst they were returned by. Copies made without an
+// allocator use the default resource, moves keep the allocator of the source.
+//
+// API break: the strings in the results are std::pmr::string and the containers are
+// std::pmr::map and std::pmr::vector, they used to be std::string, std::map and
+// std::vector. Code that spells out the old types must use the typedefs below or
+// convert, e.g. std::string(player.name), and results are released by the next
+// analyze() of the same RecAnalyst. See README.md.
+typedef std::pmr::polymorphic_allocator<char> ResultAllocator;
+
 struct InitialState {
+  typedef ResultAllocator allocator_type;
   struct Position { long x; long y; Position() : x(0), y(0) {} };
   unsigned int food;
   unsigned int wood;
@@ -177,9 +197,18 @@ struct InitialState {
   unsigned int militaryPop;
   unsigned int extraPop;
   Position position;
-  std::string startingAgeString;
+  std::pmr::string startingAgeString;
   InitialState() : food(0), wood(0), stone(0), gold(0), startingAge(StartingAge::DARK_AGE),
     houseCapacity(0), population(0), civilianPop(0), militaryPop(0), extraPop(0) {}
+  explicit InitialState(const allocator_type& alloc) : food(0), wood(0), stone(0), gold(0),
+    startingAge(StartingAge::DARK_AGE), houseCapacity(0), population(0), civilianPop(0),
+    militaryPop(0), extraPop(0), startingAgeString(alloc) {}
+  InitialState(const InitialState& other) = default;
+  InitialState(const InitialState& other, const allocator_type& alloc) : InitialState(alloc) { *this = other; }
+  InitialState(InitialState&& other) = default;
+  InitialState(InitialState&& other, const allocator_type& alloc) : InitialState(alloc) { *this = std::move(other); }
+  InitialState& operator=(const InitialState& other) = default;
+  InitialState& operator=(InitialState&& other) = default;
 };
 
 struct MilitaryStats {
@@ -242,36 +271,63 @@ struct Achievement {
 };
 
 struct CoopingPlayer {
-  std::string name;
+  typedef ResultAllocator allocator_type;
+  std::pmr::string name;
   unsigned int resignTime;
   unsigned int disconnectTime;
   CoopingPlayer() : resignTime(0), disconnectTime(0) {}
+  explicit CoopingPlayer(const allocator_type& alloc) : name(alloc), resignTime(0), disconnectTime(0) {}
+  CoopingPlayer(const CoopingPlayer& other) = default;
+  CoopingPlayer(const CoopingPlayer& other, const allocator_type& alloc) : CoopingPlayer(alloc) { *this = other; }
+  CoopingPlayer(CoopingPlayer&& other) = default;
+  CoopingPlayer(CoopingPlayer&& other, const allocator_type& alloc) : CoopingPlayer(alloc) { *this = std::move(other); }
+  CoopingPlayer& operator=(const CoopingPlayer& other) = default;
+  CoopingPlayer& operator=(CoopingPlayer&& other) = default;
 };
 
 struct Player : CoopingPlayer {
+  typedef ResultAllocator allocator_type;
   int index;
   bool human;
   int team;
   bool owner;
   Civilization civId;
-  std::string civ;
+  std::pmr::string civ;
   PlayerColor color;
   unsigned int feudalTime;
   unsigned int castleTime;
   unsigned int imperialTime;
-  std::vector<CoopingPlayer> coopingPlayers;
+  std::pmr::vector<CoopingPlayer> coopingPlayers;
   InitialState initialState;
   Achievement achievement;
   Player() : index(0), human(false), team(0), owner(false), civId(Civilization::BRITONS),
     color(PlayerColor::UNDEFINED), feudalTime(0), castleTime(0), imperialTime(0) {}
+  explicit Player(const allocator_type& alloc) : CoopingPlayer(alloc), index(0), human(false),
+    team(0), owner(false), civId(Civilization::BRITONS), civ(alloc), color(PlayerColor::UNDEFINED),
+    feudalTime(0), castleTime(0), imperialTime(0), coopingPlayers(alloc), initialState(alloc) {}
+  Player(const Player& other) = default;
+  Player(const Player& other, const allocator_type& alloc) : Player(alloc) { *this = other; }
+  Player(Player&& other) = default;
+  Player(Player&& other, const allocator_type& alloc) : Player(alloc) { *this = std::move(other); }
+  Player& operator=(const Player& other) = default;
+  Player& operator=(Player&& other) = default;
 };
 
 struct Victory {
+  typedef ResultAllocator allocator_type;
   int timeLimit;
   int scoreLimit;
   VictoryCondition victoryCondition;
-  std::string victoryString;
+  std::pmr::string victoryString;
   Victory() : timeLimit(0), scoreLimit(0), victoryCondition(VictoryCondition::STANDARD) {}
+  explicit Victory(const allocator_type& alloc) : timeLimit(0), scoreLimit(0),
+    victoryCondition(VictoryCondition::STANDARD), victoryString(alloc) {}
+  Victory(const Victory& other) = default;
+  Victory(const Victory& other, const allocator_type& alloc) : Victory(alloc) { *this = other; }
+  Victory(Victory&& other) = default;
+  Victory(Victory&& other, const allocator_type& alloc) : Victory(alloc) { *this = std::move(other); }
+  Victory& operator=(const Victory& other) = default;
+  Victory& operator=(Victory&& other) = default;
 };
 
 struct ExtraGameData {
@@ -286,16 +342,17 @@ struct ExtraGameData {
 };
 
 struct GameSettings {
+  typedef ResultAllocator allocator_type;
   GameType gameType;
   MapStyle mapStyle;
   DifficultyLevel difficultyLevel;
   GameSpeed gameSpeed;
   RevealMap revealMap;
   MapSize mapSize;
-  std::string map;
-  std::string playersType;
-  std::string pov;
-  std::string objectives;
+  std::pmr::string map;
+  std::pmr::string playersType;
+  std::pmr::string pov;
+  std::pmr::string objectives;
   int mapId;
   int popLimit;
   bool lockDiplomacy;
@@ -303,31 +360,54 @@ struct GameSettings {
   bool inGameCoop;
   bool isScenario;
   bool isFFA;
-  std::string scenarioFileName;
+  std::pmr::string scenarioFileName;
   GameVersion gameVersion;
   GameMode gameMode;
   Victory victory;
   ExtraGameData extra;
-  std::string gameTypeString;
-  std::string mapStyleString;
-  std::string difficultyLevelString;
-  std::string gameSpeedString;
-  std::string revealMapString;
-  std::string mapSizeString;
-  std::string gameVersionString;
-  std::string gameSubVersionString;
+  std::pmr::string gameTypeString;
+  std::pmr::string mapStyleString;
+  std::pmr::string difficultyLevelString;
+  std::pmr::string gameSpeedString;
+  std::pmr::string revealMapString;
+  std::pmr::string mapSizeString;
+  std::pmr::string gameVersionString;
+  std::pmr::string gameSubVersionString;
   GameSettings() : gameType(GameType::RANDOM_MAP), mapStyle(MapStyle::STANDARD),
     difficultyLevel(DifficultyLevel::STANDARD), gameSpeed(GameSpeed::NORMAL),
     revealMap(RevealMap::NORMAL), mapSize(MapSize::NORMAL), mapId(0), popLimit(0),
     lockDiplomacy(false), playTime(0), inGameCoop(false), isScenario(false), isFFA(false),
     gameVersion(GameVersion::UNKNOWN), gameMode(GameMode::SINGLEPLAYER) {}
+  explicit GameSettings(const allocator_type& alloc) : gameType(GameType::RANDOM_MAP),
+    mapStyle(MapStyle::STANDARD), difficultyLevel(DifficultyLevel::STANDARD),
+    gameSpeed(GameSpeed::NORMAL), revealMap(RevealMap::NORMAL), mapSize(MapSize::NORMAL), map(alloc),
+    playersType(alloc), pov(alloc), objectives(alloc), mapId(0), popLimit(0), lockDiplomacy(false),
+    playTime(0), inGameCoop(false), isScenario(false), isFFA(false), scenarioFileName(alloc),
+    gameVersion(GameVersion::UNKNOWN), gameMode(GameMode::SINGLEPLAYER), victory(alloc),
+    gameTypeString(alloc), mapStyleString(alloc), difficultyLevelString(alloc),
+    gameSpeedString(alloc), revealMapString(alloc), mapSizeString(alloc), gameVersionString(alloc),
+    gameSubVersionString(alloc) {}
+  GameSettings(const GameSettings& other) = default;
+  GameSettings(const GameSettings& other, const allocator_type& alloc) : GameSettings(alloc) { *this = other; }
+  GameSettings(GameSettings&& other) = default;
+  GameSettings(GameSettings&& other, const allocator_type& alloc) : GameSettings(alloc) { *this = std::move(other); }
+  GameSettings& operator=(const GameSettings& other) = default;
+  GameSettings& operator=(GameSettings&& other) = default;
 };
 
 struct ChatMessage {
+  typedef ResultAllocator allocator_type;
   unsigned int time;
-  std::string msg;
+  std::pmr::string msg;
   PlayerColor color;
   ChatMessage() : time(0), color(PlayerColor::UNDEFINED) {}
+  explicit ChatMessage(const allocator_type& alloc) : time(0), msg(alloc), color(PlayerColor::UNDEFINED) {}
+  ChatMessage(const ChatMessage& other) = default;
+  ChatMessage(const ChatMessage& other, const allocator_type& alloc) : ChatMessage(alloc) { *this = other; }
+  ChatMessage(ChatMessage&& other) = default;
+  ChatMessage(ChatMessage&& other, const allocator_type& alloc) : ChatMessage(alloc) { *this = std::move(other); }
+  ChatMessage& operator=(const ChatMessage& other) = default;
+  ChatMessage& operator=(ChatMessage&& other) = default;
 };
 
 struct Tribute {
@@ -342,24 +422,33 @@ struct Tribute {
 };
 
 struct Research {
+  typedef ResultAllocator allocator_type;
   int id;
   unsigned int time;
   const Player& player;
-  std::string name;
+  std::pmr::string name;
   Research(const Player& player) : id(0), time(0), player(player) {}
+  Research(const Player& player, const allocator_type& alloc) : id(0), time(0), player(player),
+    name(alloc) {}
+  Research(const Research& other) = default;
+  Research(const Research& other, const allocator_type& alloc) : id(other.id), time(other.time),
+    player(other.player), name(other.name, alloc) {}
+  Research(Research&& other) = default;
+  Research(Research&& other, const allocator_type& alloc) : id(other.id), time(other.time),
+    player(other.player), name(std::move(other.name), alloc) {}
 };
 
-typedef std::map<int, Player> Players;  // player's index to player map
-typedef std::map<int, std::reference_wrapper<const Player>> Team; // player's index to player's reference map
-typedef std::map<int, Team> Teams;  // team's index to team map
+typedef std::pmr::map<int, Player> Players;  // player's index to player map
+typedef std::pmr::map<int, std::reference_wrapper<const Player>> Team; // player's index to player's reference map
+typedef std::pmr::map<int, Team> Teams;  // team's index to team map
 
-typedef std::pair<int, Player> PlayersPair;
-typedef std::pair<int, std::reference_wrapper<const Player>> TeamPair;
-typedef std::pair<int, Team> TeamsPair;
+typedef Players::value_type PlayersPair;
+typedef Team::value_type TeamPair;
+typedef Teams::value_type TeamsPair;
 
-typedef std::vector<ChatMessage> ChatMessages;
-typedef std::vector<Tribute> Tributes;
-typedef std::vector<Research> Researches;
+typedef std::pmr::vector<ChatMessage> ChatMessages;
+typedef std::pmr::vector<Tribute> Tributes;
+typedef std::pmr::vector<Research> Researches;
 
 class ERecAnalystException : public std::runtime_error
 {
@@ -367,12 +456,162 @@ public:
   ERecAnalystException(const std::string& msg) : runtime_error(msg) {}
 };
 
+// Outcome of the non-throwing analyze, the message is looked up only when asked for
+class AnalyzeStatus {
+public:
+  AnalyzeStatus(int code = RECANALYST_OK) : mCode(code) {}
+  bool ok() const { return mCode >= RECANALYST_OK; }
+  explicit operator bool() const { return ok(); }
+  int code() const { return mCode; }  // RECANALYST_*
+  std::string message() const { return recanalyst_errmsg(mCode); }
+private:
+  int mCode;
+};
+
+// Views handed to RecAnalyst::visit() visitors, valid only during the callback,
+// and kept in BorrowedResults. Visitors get the library's code page text, borrowed
+// results are UTF-8 like the owned ones.
+struct PlayerView {
+  int index;
+  std::string_view name;
+  bool human;
+  int team;
+  bool owner;
+  bool cooping;
+  Civilization civId;
+  std::string_view civ;
+  PlayerColor color;
+  unsigned int feudalTime;
+  unsigned int castleTime;
+  unsigned int imperialTime;
+  unsigned int resignTime;
+  unsigned int disconnectTime;
+  const RECANALYST_PLAYER* raw;  // initial state and achievements
+};
+
+struct ChatMessageView {
+  unsigned int time;
+  PlayerColor color;
+  std::string_view msg;
+};
+
+struct TributeView {
+  unsigned int time;
+  int playerFrom;  // player index
+  int playerTo;
+  Resource resource;
+  unsigned int amount;
+  float fee;
+};
+
+struct ResearchView {
+  int id;
+  unsigned int time;
+  int player;  // player index
+  std::string_view name;
+};
+
+// Borrowed counterparts of Victory and GameSettings, see RecAnalyst::analyzeBorrowed()
+struct VictoryView {
+  int timeLimit;
+  int scoreLimit;
+  VictoryCondition victoryCondition;
+  std::string_view victoryString;
+  VictoryView() : timeLimit(0), scoreLimit(0), victoryCondition(VictoryCondition::STANDARD) {}
+};
+
+struct GameSettingsView {
+  GameType gameType;
+  MapStyle mapStyle;
+  DifficultyLevel difficultyLevel;
+  GameSpeed gameSpeed;
+  RevealMap revealMap;
+  MapSize mapSize;
+  std::string_view map;
+  std::string_view playersType;
+  std::string_view pov;
+  std::string_view objectives;
+  int mapId;
+  int popLimit;
+  bool lockDiplomacy;
+  unsigned int playTime;
+  bool inGameCoop;
+  bool isScenario;
+  bool isFFA;
+  std::string_view scenarioFileName;
+  GameVersion gameVersion;
+  GameMode gameMode;
+  VictoryView victory;
+  ExtraGameData extra;
+  std::string_view gameTypeString;
+  std::string_view mapStyleString;
+  std::string_view difficultyLevelString;
+  std::string_view gameSpeedString;
+  std::string_view revealMapString;
+  std::string_view mapSizeString;
+  std::string_view gameVersionString;
+  std::string_view gameSubVersionString;
+  GameSettingsView() : gameType(GameType::RANDOM_MAP), mapStyle(MapStyle::STANDARD),
+    difficultyLevel(DifficultyLevel::STANDARD), gameSpeed(GameSpeed::NORMAL),
+    revealMap(RevealMap::NORMAL), mapSize(MapSize::NORMAL), mapId(0), popLimit(0),
+    lockDiplomacy(false), playTime(0), inGameCoop(false), isScenario(false), isFFA(false),
+    gameVersion(GameVersion::UNKNOWN), gameMode(GameMode::SINGLEPLAYER) {}
+};
+
+// Results of RecAnalyst::analyzeBorrowed(), players hold cooping players as separate
+// entries in enumeration order. Everything points into buffers of the RecAnalyst and
+// stays valid until it analyzes the next game.
+struct BorrowedResults {
+  typedef ResultAllocator allocator_type;
+  GameSettingsView gameSettings;
+  std::pmr::vector<PlayerView> players;
+  std::pmr::vector<ChatMessageView> preGameChatMessages;
+  std::pmr::vector<ChatMessageView> inGameChatMessages;
+  std::pmr::vector<TributeView> tributes;
+  std::pmr::vector<ResearchView> researches;
+  explicit BorrowedResults(const allocator_type& alloc) : players(alloc), preGameChatMessages(alloc),
+    inGameChatMessages(alloc), tributes(alloc), researches(alloc) {}
+};
+
+// Enumeration callbacks used by visit(), NULL for the sections the visitor skips
+struct VisitCallbacks {
+  EnumPlayersProc players;
+  EnumChatMessagesProc preGameChatMessages;
+  EnumChatMessagesProc inGameChatMessages;
+  EnumTributesProc tributes;
+  EnumResearchesProc researches;
+};
+
 class RecAnalyst {
 public:
+  static const std::size_t DEFAULT_ARENA_SIZE = 256 * 1024;
   RecAnalyst(void);
+  // Results are allocated from an arena released on the next analyze(), the arena
+  // starts with arenaSize bytes and grows from upstream
+  explicit RecAnalyst(std::pmr::memory_resource* upstream, std::size_t arenaSize = DEFAULT_ARENA_SIZE);
   ~RecAnalyst(void);
+  // Code page of the library's text, strings are returned in UTF-8
+  void setCodePage(CodePage codePage);
+  CodePage codePage() const;
   void analyze(const std::string& fileName);
+  // Rejects files failing validate() before the full parse, errors are returned
+  // instead of thrown (std::bad_alloc aside)
+  AnalyzeStatus analyze(const std::string& fileName, const std::nothrow_t&);
+  // Non-throwing analyze of a file the caller has already read into memory. Only the
+  // probe runs on data, so a bad file is rejected without the library opening it; the
+  // library then parses the file by name, which the caller's read has brought into
+  // the page cache.
+  AnalyzeStatus analyzeProbed(const std::string& fileName, const unsigned char* data, std::size_t size);
+  static AnalyzeStatus validate(const std::string& fileName);  // extension, header length, inflate probe
+  // Non-throwing analyze without copying strings, see BorrowedResults. The owned
+  // results (players(), gameSettings() ...) stay empty. validate as in visit().
+  AnalyzeStatus analyzeBorrowed(const std::string& fileName, bool validate = true);
+  const BorrowedResults& borrowed() const;
   void generateMap(int width, int height, std::vector<char>& pngBuffer);
+  void renderMap(int width, int height, unsigned char* rgbaBuffer);  // width * height * 4 bytes
+  void renderMapPng(int width, int height, std::vector<char>& pngBuffer);
+  void generateMapPyramid(const MapImageSizes& sizes, MapImages& images, bool png = false,
+    bool parallel = false);
   const GameSettings& gameSettings() const;
   const Players& players() const;
   const Teams& teams() const;
@@ -380,17 +619,115 @@ public:
   const ChatMessages& inGameChatMessages() const;
   const Tributes& tributes() const;
   const Researches& researches() const;
+  const MapData& mapData() const;
   const Players::const_iterator owner() const;
-  const Players::const_iterator getPlayer(std::string name, bool canCoop = true) const;
-  bool hasPlayer(std::string name, bool canCoop = true) const;
+  const Players::const_iterator getPlayer(std::string_view name, bool canCoop = true) const;
+  bool hasPlayer(std::string_view name, bool canCoop = true) const;
   bool hasAchievements() const;
   int analyzeTime() const;
   static std::string gameTimeToString(unsigned int time);
+  // Streams the records of the sections the visitor has a callback for, without
+  // translating or storing them. Callbacks return false to stop the section:
+  //   bool onPlayer(const PlayerView&);
+  //   bool onPreGameChatMessage(const ChatMessageView&);
+  //   bool onInGameChatMessage(const ChatMessageView&);
+  //   bool onTribute(const TributeView&);
+  //   bool onResearch(const ResearchView&);
+  // Stored results are cleared. Errors are returned like in the non-throwing analyze,
+  // validate runs validate() first, pass false for files already checked.
+  template <typename Visitor>
+  AnalyzeStatus visit(const std::string& fileName, Visitor& visitor, bool validate = true);
 private:
   class Impl;
   std::unique_ptr<Impl> pimpl;
+  AnalyzeStatus visit(const std::string& fileName, const VisitCallbacks& callbacks, LPARAM lParam,
+    bool validate);
+};
+
+namespace Visiting {
+
+#define RECANALYST_VISITOR_TRAIT(Trait, method, View) \
+  template <typename V, typename = void> struct Trait : std::false_type {}; \
+  template <typename V> struct Trait<V, std::void_t<decltype( \
+    std::declval<V&>().method(std::declval<const View&>()))>> : std::true_type {};
+
+RECANALYST_VISITOR_TRAIT(HasOnPlayer, onPlayer, PlayerView)
+RECANALYST_VISITOR_TRAIT(HasOnPreGameChatMessage, onPreGameChatMessage, ChatMessageView)
+RECANALYST_VISITOR_TRAIT(HasOnInGameChatMessage, onInGameChatMessage, ChatMessageView)
+RECANALYST_VISITOR_TRAIT(HasOnTribute, onTribute, TributeView)
+RECANALYST_VISITOR_TRAIT(HasOnResearch, onResearch, ResearchView)
+
+#undef RECANALYST_VISITOR_TRAIT
+
+inline PlayerView playerView(const RECANALYST_PLAYER& p) {
+  PlayerView view = {static_cast<int>(p.dwIndex), p.szName, p.bHuman != 0,
+    static_cast<int>(p.dwTeam), p.bOwner != 0, p.bIsCooping != 0,
+    static_cast<Civilization>(p.dwCivId), p.szCivilization, static_cast<PlayerColor>(p.dwColor),
+    p.dwFeudalTime, p.dwCastleTime, p.dwImperialTime, p.dwResignTime, p.dwDisconnectTime, &p};
+  return view;
+}
+
+inline ChatMessageView chatMessageView(const RECANALYST_CHATMESSAGE& cm) {
+  ChatMessageView view = {cm.dwTime, static_cast<PlayerColor>(cm.dwColor), cm.szMessage};
+  return view;
+}
+
+inline TributeView tributeView(const RECANALYST_TRIBUTE& t) {
+  TributeView view = {t.dwTime, static_cast<int>(t.dwPlayerFrom), static_cast<int>(t.dwPlayerTo),
+    static_cast<Resource>(t.byResource), t.dwAmount, t.fFee};
+  return view;
+}
+
+inline ResearchView researchView(const RECANALYST_RESEARCH& r) {
+  ResearchView view = {static_cast<int>(r.dwId), r.dwTime, static_cast<int>(r.dwPlayerId), r.szName};
+  return view;
+}
+
+template <typename Visitor>
+struct Thunks {
+  static BOOL CALLBACK player(LPRECANALYST_PLAYER p, LPARAM lParam) {
+    return reinterpret_cast<Visitor*>(lParam)->onPlayer(playerView(*p)) ? TRUE : FALSE;
+  }
+  static BOOL CALLBACK preGameChatMessage(LPRECANALYST_CHATMESSAGE cm, LPARAM lParam) {
+    return reinterpret_cast<Visitor*>(lParam)->onPreGameChatMessage(chatMessageView(*cm)) ? TRUE : FALSE;
+  }
+  static BOOL CALLBACK inGameChatMessage(LPRECANALYST_CHATMESSAGE cm, LPARAM lParam) {
+    return reinterpret_cast<Visitor*>(lParam)->onInGameChatMessage(chatMessageView(*cm)) ? TRUE : FALSE;
+  }
+  static BOOL CALLBACK tribute(LPRECANALYST_TRIBUTE t, LPARAM lParam) {
+    return reinterpret_cast<Visitor*>(lParam)->onTribute(tributeView(*t)) ? TRUE : FALSE;
+  }
+  static BOOL CALLBACK research(LPRECANALYST_RESEARCH r, LPARAM lParam) {
+    return reinterpret_cast<Visitor*>(lParam)->onResearch(researchView(*r)) ? TRUE : FALSE;
+  }
 };
 
 } // namespace
 
+template <typename Visitor>
+AnalyzeStatus RecAnalyst::visit(const std::string& fileName, Visitor& visitor, bool validate) {
+  using namespace Visiting;
+  typedef Thunks<Visitor> T;
+  VisitCallbacks callbacks = {NULL, NULL, NULL, NULL, NULL};
+  // thunks of the sections the visitor does not handle are never instantiated
+  if constexpr (HasOnPlayer<Visitor>::value) {
+    callbacks.players = &T::player;
+  }
+  if constexpr (HasOnPreGameChatMessage<Visitor>::value) {
+    callbacks.preGameChatMessages = &T::preGameChatMessage;
+  }
+  if constexpr (HasOnInGameChatMessage<Visitor>::value) {
+    callbacks.inGameChatMessages = &T::inGameChatMessage;
+  }
+  if constexpr (HasOnTribute<Visitor>::value) {
+    callbacks.tributes = &T::tribute;
+  }
+  if constexpr (HasOnResearch<Visitor>::value) {
+    callbacks.researches = &T::research;
+  }
+  return visit(fileName, callbacks, reinterpret_cast<LPARAM>(&visitor), validate);
+}
+
+} // namespace
+
 #endif  //_RECANALYSTWRAP_H_
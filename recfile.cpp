@@ -0,0 +1,145 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include "recfile.h"
+#include "inflate.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+RecFile::RecFile() : mFile(NULL) {}
+
+RecFile::RecFile(const std::string& fileName) : mFile(NULL) {
+  int code = open(fileName);
+  if (code != RECANALYST_OK) {
+    throw ERecAnalystException(recanalyst_errmsg(code));
+  }
+}
+
+RecFile::~RecFile() {
+  close();
+}
+
+int RecFile::open(const std::string& fileName) {
+  close();
+  mLayout = RecFileLayout();
+  if (!formatFromFileName(fileName, mLayout.format)) {
+    return RECANALYST_FILEEXT;
+  }
+  if ((mFile = std::fopen(fileName.c_str(), "rb")) == NULL) {
+    return RECANALYST_FILEOPEN;
+  }
+  unsigned char lengths[8];
+  size_t fieldsSize = (mLayout.format == RecFormat::MGL) ? 4 : 8;
+  if (std::fread(lengths, 1, fieldsSize, mFile) != fieldsSize) {
+    close();
+    return RECANALYST_HEADLENREAD;
+  }
+  std::memcpy(&mLayout.headerLength, lengths, 4);
+  std::fseek(mFile, 0, SEEK_END);
+  mLayout.fileSize = static_cast<unsigned long long>(std::ftell(mFile));
+  if (mLayout.headerLength <= fieldsSize) {
+    close();
+    return RECANALYST_EMPTYHEADER;
+  }
+  if (mLayout.headerLength > mLayout.fileSize) {
+    close();
+    return RECANALYST_FILEREAD;  // truncated inside the header
+  }
+  mLayout.headerOffset = static_cast<unsigned int>(fieldsSize);
+  mLayout.bodyOffset = mLayout.headerLength;
+  std::fseek(mFile, mLayout.bodyOffset, SEEK_SET);
+  return RECANALYST_OK;
+}
+
+void RecFile::close() {
+  if (mFile != NULL) {
+    std::fclose(mFile);
+    mFile = NULL;
+  }
+}
+
+// reads the deflated header, leaving the file positioned at the body
+void RecFile::readHeader(std::vector<unsigned char>& data) {
+  data.resize(mLayout.headerLength - mLayout.headerOffset);
+  if (std::fseek(mFile, mLayout.headerOffset, SEEK_SET) != 0 ||
+      std::fread(data.data(), 1, data.size(), mFile) != data.size()) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEREAD));
+  }
+}
+
+bool RecFile::formatFromFileName(const std::string& fileName, RecFormat& format) {
+  size_t dot = fileName.find_last_of('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  std::string ext = fileName.substr(dot + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), [] (char c) { return static_cast<char>(std::tolower(c)); });
+  if (ext == "mgl") {
+    format = RecFormat::MGL;
+  } else if (ext == "mgx") {
+    format = RecFormat::MGX;
+  } else if (ext == "mgz") {
+    format = RecFormat::MGZ;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int validateRecFile(const std::string& fileName) {
+  static const size_t PROBE_SIZE = 4096;
+  RecFile file;
+  int code = file.open(fileName);
+  if (code != RECANALYST_OK) {
+    return code;
+  }
+  const RecFileLayout& layout = file.layout();
+  unsigned char probe[PROBE_SIZE];
+  size_t size = std::min<size_t>(PROBE_SIZE, layout.headerLength - layout.headerOffset);
+  if (std::fseek(file.handle(), layout.headerOffset, SEEK_SET) != 0 ||
+      std::fread(probe, 1, size, file.handle()) != size) {
+    return RECANALYST_FILEREAD;
+  }
+  return probeInflate(probe, size) ? RECANALYST_OK : RECANALYST_DECOMP;
+}
+
+int validateRecData(const std::string& fileName, const unsigned char* data, std::size_t size) {
+  static const size_t PROBE_SIZE = 4096;
+  RecFormat format;
+  if (!RecFile::formatFromFileName(fileName, format)) {
+    return RECANALYST_FILEEXT;
+  }
+  size_t fieldsSize = (format == RecFormat::MGL) ? 4 : 8;
+  if (size < fieldsSize) {
+    return RECANALYST_HEADLENREAD;
+  }
+  unsigned int headerLength;
+  std::memcpy(&headerLength, data, 4);
+  if (headerLength <= fieldsSize) {
+    return RECANALYST_EMPTYHEADER;
+  }
+  if (headerLength > size) {
+    return RECANALYST_FILEREAD;
+  }
+  size_t probeSize = std::min<size_t>(PROBE_SIZE, headerLength - fieldsSize);
+  return probeInflate(data + fieldsSize, probeSize) ? RECANALYST_OK : RECANALYST_DECOMP;
+}
+
+} // namespace
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RECFILE_H_
+#define _RECFILE_H_
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace RecAnalystWrapper {
+
+  enum class RecFormat {
+    MGL,  // AOK
+    MGX,  // AOC
+    MGZ   // UserPatch
+  };
+
+// Layout of a recorded game file: [header length][next pos (mgx/mgz only)][deflated header][body]
+struct RecFileLayout {
+  RecFormat format;
+  unsigned int headerLength;    // header length incl. the length fields, equals the body offset
+  unsigned int headerOffset;    // offset of the deflated header data
+  unsigned int bodyOffset;
+  unsigned long long fileSize;  // size at the time the file was opened
+  RecFileLayout() : format(RecFormat::MGX), headerLength(0), headerOffset(0), bodyOffset(0),
+    fileSize(0) {}
+};
+
+// Read-only handle to a recorded game file, used by the native parsers
+class RecFile {
+public:
+  RecFile(void);
+  explicit RecFile(const std::string& fileName);
+  ~RecFile(void);
+  // Non-throwing counterpart of the constructor, returns RECANALYST_OK or an error code
+  int open(const std::string& fileName);
+  void close();
+  const RecFileLayout& layout() const { return mLayout; }
+  std::FILE* handle() const { return mFile; }
+  void readHeader(std::vector<unsigned char>& data);
+  static bool formatFromFileName(const std::string& fileName, RecFormat& format);
+private:
+  RecFile(const RecFile&);
+  RecFile& operator=(const RecFile&);
+  std::FILE* mFile;
+  RecFileLayout mLayout;
+};
+
+// Cheap check of extension, header length and the start of the deflated header,
+// returns RECANALYST_OK or the error the file is rejected with. Never throws.
+int validateRecFile(const std::string& fileName);
+// Same checks on the contents of the file already read into memory
+int validateRecData(const std::string& fileName, const unsigned char* data, std::size_t size);
+
+} // namespace
+
+#endif  //_RECFILE_H_
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "replayhash.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+static const std::uint64_t BLAKE2B_IV[8] = {
+  0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+  0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL, 0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL
+};
+
+static const unsigned char BLAKE2B_SIGMA[12][16] = {
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+  { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+  { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+  { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+  { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+  { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+  { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+  { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+  { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 }
+};
+
+static inline std::uint64_t rotr64(std::uint64_t x, unsigned int n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+static inline std::uint64_t load64(const unsigned char* p) {
+  std::uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+static inline void mix(std::uint64_t* v, int a, int b, int c, int d, std::uint64_t x, std::uint64_t y) {
+  v[a] = v[a] + v[b] + x;
+  v[d] = rotr64(v[d] ^ v[a], 32);
+  v[c] = v[c] + v[d];
+  v[b] = rotr64(v[b] ^ v[c], 24);
+  v[a] = v[a] + v[b] + y;
+  v[d] = rotr64(v[d] ^ v[a], 16);
+  v[c] = v[c] + v[d];
+  v[b] = rotr64(v[b] ^ v[c], 63);
+}
+
+ReplayHasher::ReplayHasher() : mBlockSize(0) {
+  std::memcpy(mState, BLAKE2B_IV, sizeof(mState));
+  // unkeyed, 32 byte digest, fanout 1, depth 1
+  mState[0] ^= 0x01010000ULL ^ ReplayHash::SIZE;
+  mLength[0] = 0;
+  mLength[1] = 0;
+}
+
+void ReplayHasher::compress(std::uint64_t* state, const std::uint64_t* length, const unsigned char* block, bool last) {
+  std::uint64_t m[16];
+  std::uint64_t v[16];
+  for (int i = 0; i < 16; ++i) {
+    m[i] = load64(block + i * 8);
+  }
+  for (int i = 0; i < 8; ++i) {
+    v[i] = state[i];
+    v[i + 8] = BLAKE2B_IV[i];
+  }
+  v[12] ^= length[0];
+  v[13] ^= length[1];
+  if (last) {
+    v[14] = ~v[14];
+  }
+  for (int round = 0; round < 12; ++round) {
+    const unsigned char* s = BLAKE2B_SIGMA[round];
+    mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+  for (int i = 0; i < 8; ++i) {
+    state[i] ^= v[i] ^ v[i + 8];
+  }
+}
+
+void ReplayHasher::update(const void* data, std::size_t size) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  while (size > 0) {
+    // the final block is compressed by digest() with the last flag set, so a full
+    // buffer is only flushed once more data follows
+    if (mBlockSize == sizeof(mBlock)) {
+      mLength[0] += sizeof(mBlock);
+      if (mLength[0] < sizeof(mBlock)) {
+        ++mLength[1];
+      }
+      compress(mState, mLength, mBlock, false);
+      mBlockSize = 0;
+    }
+    if (mBlockSize == 0) {
+      while (size > sizeof(mBlock)) {
+        mLength[0] += sizeof(mBlock);
+        if (mLength[0] < sizeof(mBlock)) {
+          ++mLength[1];
+        }
+        compress(mState, mLength, p, false);
+        p += sizeof(mBlock);
+        size -= sizeof(mBlock);
+      }
+    }
+    std::size_t n = (size < sizeof(mBlock) - mBlockSize) ? size : sizeof(mBlock) - mBlockSize;
+    std::memcpy(mBlock + mBlockSize, p, n);
+    mBlockSize += n;
+    p += n;
+    size -= n;
+  }
+}
+
+ReplayHash ReplayHasher::digest() const {
+  std::uint64_t state[8];
+  std::uint64_t length[2] = { mLength[0] + mBlockSize, mLength[1] };
+  if (length[0] < mBlockSize) {
+    ++length[1];
+  }
+  unsigned char block[sizeof(mBlock)];
+  std::memcpy(state, mState, sizeof(state));
+  std::memcpy(block, mBlock, mBlockSize);
+  std::memset(block + mBlockSize, 0, sizeof(block) - mBlockSize);
+  compress(state, length, block, true);
+  ReplayHash hash;
+  for (std::size_t i = 0; i < ReplayHash::SIZE; ++i) {
+    hash.bytes[i] = static_cast<unsigned char>(state[i / 8] >> (8 * (i % 8)));
+  }
+  return hash;
+}
+
+ReplayHash hashReplayData(const void* data, std::size_t size) {
+  ReplayHasher hasher;
+  hasher.update(data, size);
+  return hasher.digest();
+}
+
+ReplayHash hashReplayFile(const std::string& fileName) {
+  std::FILE* file = std::fopen(fileName.c_str(), "rb");
+  if (file == NULL) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+  }
+  ReplayHasher hasher;
+  unsigned char chunk[64 * 1024];
+  std::size_t read;
+  while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    hasher.update(chunk, read);
+  }
+  bool failed = std::ferror(file) != 0;
+  std::fclose(file);
+  if (failed) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEREAD));
+  }
+  return hasher.digest();
+}
+
+std::string replayHashToString(const ReplayHash& hash) {
+  static const char DIGITS[] = "0123456789abcdef";
+  std::string text(ReplayHash::SIZE * 2, '0');
+  for (std::size_t i = 0; i < ReplayHash::SIZE; ++i) {
+    text[i * 2] = DIGITS[hash.bytes[i] >> 4];
+    text[i * 2 + 1] = DIGITS[hash.bytes[i] & 0x0F];
+  }
+  return text;
+}
+
+bool replayHashFromString(const std::string& text, ReplayHash& hash) {
+  if (text.size() != ReplayHash::SIZE * 2) {
+    return false;
+  }
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    int digit;
+    if (text[i] >= '0' && text[i] <= '9') {
+      digit = text[i] - '0';
+    } else if (text[i] >= 'a' && text[i] <= 'f') {
+      digit = text[i] - 'a' + 10;
+    } else if (text[i] >= 'A' && text[i] <= 'F') {
+      digit = text[i] - 'A' + 10;
+    } else {
+      return false;
+    }
+    if (i % 2 == 0) {
+      hash.bytes[i / 2] = static_cast<unsigned char>(digit << 4);
+    } else {
+      hash.bytes[i / 2] |= static_cast<unsigned char>(digit);
+    }
+  }
+  return true;
+}
+
+} // namespace
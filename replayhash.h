@@ -0,0 +1,77 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _REPLAYHASH_H_
+#define _REPLAYHASH_H_
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+
+namespace RecAnalystWrapper {
+
+// BLAKE2b-256 content hash of a recorded game file. Collision resistant, so a crafted
+// upload cannot take over the cache entry or the dedup slot of another replay.
+struct ReplayHash {
+  static const std::size_t SIZE = 32;
+  unsigned char bytes[SIZE];
+  // the first eight bytes big-endian, for sharding and hash tables
+  unsigned long long prefix() const {
+    unsigned long long value = 0;
+    for (std::size_t i = 0; i < 8; ++i) {
+      value = (value << 8) | bytes[i];
+    }
+    return value;
+  }
+  bool operator==(const ReplayHash& other) const { return std::memcmp(bytes, other.bytes, SIZE) == 0; }
+  bool operator!=(const ReplayHash& other) const { return !(*this == other); }
+  bool operator<(const ReplayHash& other) const { return std::memcmp(bytes, other.bytes, SIZE) < 0; }
+};
+
+// Incremental BLAKE2b with a 32 byte digest, processes the data 128 bytes at a time
+class ReplayHasher {
+public:
+  ReplayHasher(void);
+  void update(const void* data, std::size_t size);
+  ReplayHash digest() const;
+private:
+  std::uint64_t mState[8];
+  std::uint64_t mLength[2];  // bytes compressed so far, a 128-bit counter
+  unsigned char mBlock[128];
+  std::size_t mBlockSize;
+  static void compress(std::uint64_t* state, const std::uint64_t* length, const unsigned char* block, bool last);
+};
+
+ReplayHash hashReplayData(const void* data, std::size_t size);
+ReplayHash hashReplayFile(const std::string& fileName);
+std::string replayHashToString(const ReplayHash& hash);  // 64 hex digits
+bool replayHashFromString(const std::string& text, ReplayHash& hash);
+
+} // namespace
+
+namespace std {
+
+template <>
+struct hash<RecAnalystWrapper::ReplayHash> {
+  std::size_t operator()(const RecAnalystWrapper::ReplayHash& hash) const {
+    return static_cast<std::size_t>(hash.prefix());
+  }
+};
+
+} // namespace std
+
+#endif  //_REPLAYHASH_H_
@@ -0,0 +1,543 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#ifdef RECANALYST_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#include "replaypack.h"
+#include "fileutil.h"
+
+namespace RecAnalystWrapper {
+
+static const char REPLAY_PACK_MAGIC[8] = { 'R', 'A', 'P', 'A', 'C', 'K', '0', '2' };
+static const std::size_t PACK_HEADER_SIZE = 48;
+static const std::size_t PACK_ENTRY_SIZE = 64;
+static const std::uint32_t PACK_STORED = 0;
+static const std::uint32_t PACK_ZSTD = 1;
+static const std::uint32_t MAX_REPLAY_SIZE = 256 * 1024 * 1024;  // allocated up front when reading
+static const std::size_t MAX_SAMPLE_SIZE = 128 * 1024;  // of a replay used for training
+
+// Header: magic, compression, reserved, entries, index offset, dictionary offset and size
+struct PackHeader {
+  std::uint32_t compression;
+  unsigned long long entries;
+  unsigned long long indexOffset;
+  unsigned long long dictionaryOffset;
+  unsigned long long dictionarySize;
+};
+
+template <typename T>
+static inline void putValue(unsigned char*& p, T value) {
+  std::memcpy(p, &value, sizeof(value));
+  p += sizeof(value);
+}
+
+template <typename T>
+static inline T getValue(const unsigned char*& p) {
+  T value;
+  std::memcpy(&value, p, sizeof(value));
+  p += sizeof(value);
+  return value;
+}
+
+static void encodeHeader(const PackHeader& header, unsigned char* data) {
+  unsigned char* p = data;
+  std::memcpy(p, REPLAY_PACK_MAGIC, sizeof(REPLAY_PACK_MAGIC));
+  p += sizeof(REPLAY_PACK_MAGIC);
+  putValue<std::uint32_t>(p, header.compression);
+  putValue<std::uint32_t>(p, 0);
+  putValue(p, header.entries);
+  putValue(p, header.indexOffset);
+  putValue(p, header.dictionaryOffset);
+  putValue(p, header.dictionarySize);
+}
+
+static bool decodeHeader(const unsigned char* data, PackHeader& header) {
+  if (std::memcmp(data, REPLAY_PACK_MAGIC, sizeof(REPLAY_PACK_MAGIC)) != 0) {
+    return false;
+  }
+  const unsigned char* p = data + sizeof(REPLAY_PACK_MAGIC);
+  header.compression = getValue<std::uint32_t>(p);
+  getValue<std::uint32_t>(p);
+  header.entries = getValue<unsigned long long>(p);
+  header.indexOffset = getValue<unsigned long long>(p);
+  header.dictionaryOffset = getValue<unsigned long long>(p);
+  header.dictionarySize = getValue<unsigned long long>(p);
+  return true;
+}
+
+static void encodeEntry(const ReplayPackEntry& entry, unsigned char* data) {
+  unsigned char* p = data;
+  putValue(p, entry.hash);
+  putValue(p, entry.offset);
+  putValue(p, entry.storedSize);
+  putValue(p, entry.size);
+  putValue(p, entry.headerLength);
+  putValue(p, entry.probe);
+  putValue<std::uint8_t>(p, static_cast<std::uint8_t>(entry.format));
+  putValue<std::uint8_t>(p, entry.compressed ? 1 : 0);
+  std::memset(p, 0, data + PACK_ENTRY_SIZE - p);
+}
+
+static void decodeEntry(const unsigned char* data, ReplayPackEntry& entry) {
+  const unsigned char* p = data;
+  entry.hash = getValue<ReplayHash>(p);
+  entry.offset = getValue<unsigned long long>(p);
+  entry.storedSize = getValue<std::uint32_t>(p);
+  entry.size = getValue<std::uint32_t>(p);
+  entry.headerLength = getValue<std::uint32_t>(p);
+  entry.probe = getValue<std::int32_t>(p);
+  entry.format = static_cast<RecFormat>(getValue<std::uint8_t>(p));
+  entry.compressed = getValue<std::uint8_t>(p) != 0;
+}
+
+static inline bool entryBefore(const ReplayPackEntry& entry, ReplayHash hash) {
+  return entry.hash < hash;
+}
+
+static int seekTo(std::FILE* file, unsigned long long offset) {
+#ifdef _WIN32
+  return _fseeki64(file, static_cast<long long>(offset), SEEK_SET);
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+
+static const char* formatExtension(RecFormat format) {
+  switch (format) {
+    case RecFormat::MGL:
+      return ".mgl";
+    case RecFormat::MGZ:
+      return ".mgz";
+    default:
+      return ".mgx";
+  }
+}
+
+#ifdef RECANALYST_HAVE_ZSTD
+struct ReplayPackWriter::Compressor {
+  ZSTD_CCtx* context;
+  ZSTD_CDict* dictionary;
+  Compressor() : context(ZSTD_createCCtx()), dictionary(NULL) {}
+  ~Compressor() {
+    ZSTD_freeCDict(dictionary);
+    ZSTD_freeCCtx(context);
+  }
+};
+
+struct ReplayPack::Decompressor {
+  ZSTD_DDict* dictionary;
+  std::mutex mutex;
+  std::vector<ZSTD_DCtx*> contexts;  // idle ones, a reader takes one per replay
+  Decompressor() : dictionary(NULL) {}
+  ~Decompressor() {
+    for (auto it = contexts.begin(); it != contexts.end(); ++it) {
+      ZSTD_freeDCtx(*it);
+    }
+    ZSTD_freeDDict(dictionary);
+  }
+};
+#else
+struct ReplayPackWriter::Compressor {};
+struct ReplayPack::Decompressor {};
+#endif
+
+ReplayPackWriter::ReplayPackWriter(const std::string& fileName, const ReplayPackOptions& options) :
+  mFileName(fileName), mTempName(fileName + ".tmp"), mOptions(options), mOffset(PACK_HEADER_SIZE) {
+#ifndef RECANALYST_HAVE_ZSTD
+  mOptions.compress = false;
+#endif
+  if (!mOptions.compress) {
+    mOptions.dictionarySize = 0;
+  }
+  if ((mFile = std::fopen(mTempName.c_str(), "wb")) == NULL) {
+    throw ERecAnalystException("Unable to create replay pack file: " + mTempName);
+  }
+  unsigned char header[PACK_HEADER_SIZE] = {};
+  write(header, sizeof(header));  // written again by finish()
+#ifdef RECANALYST_HAVE_ZSTD
+  if (mOptions.compress) {
+    mCompressor.reset(new Compressor());
+  }
+#endif
+}
+
+ReplayPackWriter::~ReplayPackWriter() {
+  if (mFile != NULL) {
+    std::fclose(mFile);
+    std::remove(mTempName.c_str());
+  }
+}
+
+void ReplayPackWriter::write(const void* data, std::size_t size) {
+  if (size > 0 && std::fwrite(data, 1, size, mFile) != size) {
+    throw ERecAnalystException("Unable to write replay pack file: " + mTempName);
+  }
+}
+
+bool ReplayPackWriter::add(const std::string& fileName) {
+  std::ifstream stream(fileName, std::ios::binary);
+  if (!stream) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+  }
+  std::vector<unsigned char> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  if (stream.bad()) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEREAD));
+  }
+  return add(fileName, data.data(), data.size());
+}
+
+bool ReplayPackWriter::add(const std::string& fileName, const unsigned char* data, std::size_t size) {
+  if (size > MAX_REPLAY_SIZE) {
+    throw ERecAnalystException("Replay too large for a pack: " + fileName);
+  }
+  ReplayPackEntry entry;
+  entry.hash = hashReplayData(data, size);
+  if (!mHashes.insert(entry.hash).second) {
+    return false;
+  }
+  entry.offset = 0;
+  entry.storedSize = 0;
+  entry.size = static_cast<std::uint32_t>(size);
+  entry.headerLength = 0;
+  if (size >= sizeof(entry.headerLength)) {
+    std::memcpy(&entry.headerLength, data, sizeof(entry.headerLength));
+  }
+  entry.probe = validateRecData(fileName, data, size);
+  entry.format = RecFormat::MGX;
+  RecFile::formatFromFileName(fileName, entry.format);
+  entry.compressed = false;
+  if (mOptions.dictionarySize > 0 && mDictionary.empty() && mSamples.size() < mOptions.trainingSamples) {
+    mSamples.push_back(Sample());
+    mSamples.back().entry = entry;
+    mSamples.back().data.assign(data, data + size);
+    if (mSamples.size() == mOptions.trainingSamples) {
+      trainDictionary();
+    }
+    return true;
+  }
+  store(entry, data);
+  return true;
+}
+
+// Trains on the start of the held back replays, then stores them. A failed training
+// leaves the pack compressed without a dictionary.
+void ReplayPackWriter::trainDictionary() {
+#ifdef RECANALYST_HAVE_ZSTD
+  std::vector<unsigned char> samples;
+  std::vector<std::size_t> sampleSizes;
+  for (auto it = mSamples.cbegin(); it != mSamples.cend(); ++it) {
+    std::size_t size = std::min(it->data.size(), MAX_SAMPLE_SIZE);
+    samples.insert(samples.end(), it->data.begin(), it->data.begin() + size);
+    sampleSizes.push_back(size);
+  }
+  mDictionary.resize(mOptions.dictionarySize);
+  std::size_t size = ZDICT_trainFromBuffer(mDictionary.data(), mDictionary.size(), samples.data(),
+    sampleSizes.data(), static_cast<unsigned int>(sampleSizes.size()));
+  if (ZDICT_isError(size)) {
+    mDictionary.clear();
+  } else {
+    mDictionary.resize(size);
+    mCompressor->dictionary = ZSTD_createCDict(mDictionary.data(), mDictionary.size(), mOptions.level);
+  }
+#endif
+  mOptions.dictionarySize = 0;
+  std::vector<Sample> samplesHeld;
+  samplesHeld.swap(mSamples);
+  for (auto it = samplesHeld.begin(); it != samplesHeld.end(); ++it) {
+    store(it->entry, it->data.data());
+  }
+}
+
+// Stored compressed only when that is smaller
+void ReplayPackWriter::store(ReplayPackEntry& entry, const unsigned char* data) {
+  entry.offset = mOffset;
+  const unsigned char* stored = data;
+  std::size_t storedSize = entry.size;
+#ifdef RECANALYST_HAVE_ZSTD
+  if (mCompressor) {
+    mBuffer.resize(ZSTD_compressBound(entry.size));
+    std::size_t size;
+    if (mCompressor->dictionary != NULL) {
+      size = ZSTD_compress_usingCDict(mCompressor->context, mBuffer.data(), mBuffer.size(), data, entry.size,
+        mCompressor->dictionary);
+    } else {
+      size = ZSTD_compressCCtx(mCompressor->context, mBuffer.data(), mBuffer.size(), data, entry.size,
+        mOptions.level);
+    }
+    if (!ZSTD_isError(size) && size < entry.size) {
+      stored = mBuffer.data();
+      storedSize = size;
+      entry.compressed = true;
+    }
+  }
+#endif
+  write(stored, storedSize);
+  entry.storedSize = static_cast<std::uint32_t>(storedSize);
+  mOffset += storedSize;
+  mEntries.push_back(entry);
+}
+
+void ReplayPackWriter::finish() {
+  if (mFile == NULL) {
+    return;
+  }
+  if (!mSamples.empty()) {
+    trainDictionary();
+  }
+  PackHeader header;
+  header.compression = mCompressor ? PACK_ZSTD : PACK_STORED;
+  header.entries = mEntries.size();
+  header.dictionaryOffset = mOffset;
+  header.dictionarySize = mDictionary.size();
+  header.indexOffset = mOffset + mDictionary.size();
+  write(mDictionary.data(), mDictionary.size());
+  std::sort(mEntries.begin(), mEntries.end(),
+    [](const ReplayPackEntry& a, const ReplayPackEntry& b) { return a.hash < b.hash; });
+  std::vector<unsigned char> index(mEntries.size() * PACK_ENTRY_SIZE);
+  for (std::size_t i = 0; i < mEntries.size(); ++i) {
+    encodeEntry(mEntries[i], &index[i * PACK_ENTRY_SIZE]);
+  }
+  write(index.data(), index.size());
+  unsigned char data[PACK_HEADER_SIZE] = {};
+  encodeHeader(header, data);
+  if (std::fseek(mFile, 0, SEEK_SET) != 0) {
+    throw ERecAnalystException("Unable to write replay pack file: " + mTempName);
+  }
+  write(data, sizeof(data));
+  bool failed = std::fclose(mFile) != 0;
+  mFile = NULL;
+  if (failed) {
+    std::remove(mTempName.c_str());
+    throw ERecAnalystException("Unable to write replay pack file: " + mTempName);
+  }
+  if (!replaceFile(mTempName, mFileName)) {
+    throw ERecAnalystException("Unable to write replay pack file: " + mFileName);
+  }
+}
+
+ReplayPack::ReplayPack() : mFile(NULL) {}
+
+ReplayPack::ReplayPack(const std::string& fileName) : mFile(NULL) {
+  open(fileName);
+}
+
+ReplayPack::~ReplayPack() {
+  close();
+}
+
+void ReplayPack::close() {
+  if (mFile != NULL) {
+    std::fclose(mFile);
+    mFile = NULL;
+  }
+  mEntries.clear();
+  mDecompressor.reset();
+  mFileName.clear();
+}
+
+void ReplayPack::open(const std::string& fileName) {
+  close();
+  if ((mFile = std::fopen(fileName.c_str(), "rb")) == NULL) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+  }
+  mFileName = fileName;
+  unsigned char data[PACK_HEADER_SIZE];
+  PackHeader header;
+  std::error_code ec;
+  unsigned long long fileSize = std::filesystem::file_size(fileName, ec);
+  if (ec || std::fread(data, 1, sizeof(data), mFile) != sizeof(data) || !decodeHeader(data, header) ||
+      header.compression > PACK_ZSTD || header.dictionaryOffset < PACK_HEADER_SIZE ||
+      header.dictionaryOffset + header.dictionarySize != header.indexOffset || header.indexOffset > fileSize ||
+      header.entries > (fileSize - header.indexOffset) / PACK_ENTRY_SIZE ||
+      header.indexOffset + header.entries * PACK_ENTRY_SIZE != fileSize) {
+    close();
+    throw ERecAnalystException("Malformed replay pack file: " + fileName);
+  }
+#ifndef RECANALYST_HAVE_ZSTD
+  if (header.compression == PACK_ZSTD) {
+    close();
+    throw ERecAnalystException("Replay pack is compressed, zstd support is not built in: " + fileName);
+  }
+#endif
+  std::vector<unsigned char> index(static_cast<std::size_t>(header.entries) * PACK_ENTRY_SIZE);
+  std::vector<unsigned char> dictionary(static_cast<std::size_t>(header.dictionarySize));
+  readAt(header.dictionaryOffset, dictionary.data(), dictionary.size());
+  readAt(header.indexOffset, index.data(), index.size());
+  mEntries.resize(static_cast<std::size_t>(header.entries));
+  for (std::size_t i = 0; i < mEntries.size(); ++i) {
+    ReplayPackEntry& entry = mEntries[i];
+    decodeEntry(&index[i * PACK_ENTRY_SIZE], entry);
+    // only a zstd pack has a decompressor, and the size is trusted for the read buffer
+    if (entry.offset < PACK_HEADER_SIZE || entry.offset + entry.storedSize > header.dictionaryOffset ||
+        entry.size > MAX_REPLAY_SIZE || (entry.compressed && header.compression != PACK_ZSTD) ||
+        (!entry.compressed && entry.storedSize != entry.size) || (i > 0 && !(mEntries[i - 1].hash < entry.hash))) {
+      close();
+      throw ERecAnalystException("Malformed replay pack file: " + fileName);
+    }
+  }
+#ifdef RECANALYST_HAVE_ZSTD
+  if (header.compression == PACK_ZSTD) {
+    mDecompressor.reset(new Decompressor());
+    if (!dictionary.empty()) {
+      mDecompressor->dictionary = ZSTD_createDDict(dictionary.data(), dictionary.size());
+    }
+  }
+#endif
+}
+
+const ReplayPackEntry* ReplayPack::find(ReplayHash hash) const {
+  auto it = std::lower_bound(mEntries.cbegin(), mEntries.cend(), hash, entryBefore);
+  return (it != mEntries.cend() && it->hash == hash) ? &*it : NULL;
+}
+
+void ReplayPack::readAt(unsigned long long offset, void* data, std::size_t size) {
+  std::lock_guard<std::mutex> lock(mFileMutex);
+  if (mFile == NULL || seekTo(mFile, offset) != 0 || std::fread(data, 1, size, mFile) != size) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEREAD));
+  }
+}
+
+void ReplayPack::unpack(const ReplayPackEntry& entry, const unsigned char* stored,
+    std::vector<unsigned char>& data) {
+  data.resize(entry.size);
+#ifdef RECANALYST_HAVE_ZSTD
+  ZSTD_DCtx* context = NULL;
+  {
+    std::lock_guard<std::mutex> lock(mDecompressor->mutex);
+    if (!mDecompressor->contexts.empty()) {
+      context = mDecompressor->contexts.back();
+      mDecompressor->contexts.pop_back();
+    }
+  }
+  if (context == NULL) {
+    context = ZSTD_createDCtx();
+  }
+  std::size_t size;
+  if (mDecompressor->dictionary != NULL) {
+    size = ZSTD_decompress_usingDDict(context, data.data(), data.size(), stored, entry.storedSize,
+      mDecompressor->dictionary);
+  } else {
+    size = ZSTD_decompressDCtx(context, data.data(), data.size(), stored, entry.storedSize);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mDecompressor->mutex);
+    mDecompressor->contexts.push_back(context);
+  }
+  if (!ZSTD_isError(size) && size == entry.size) {
+    return;
+  }
+#else
+  (void)stored;
+#endif
+  throw ERecAnalystException(recanalyst_errmsg(RECANALYST_DECOMP));
+}
+
+void ReplayPack::read(const ReplayPackEntry& entry, std::vector<unsigned char>& data) {
+  if (!entry.compressed) {
+    data.resize(entry.size);
+    readAt(entry.offset, data.data(), data.size());
+    return;
+  }
+  std::vector<unsigned char> stored(entry.storedSize);
+  readAt(entry.offset, stored.data(), stored.size());
+  unpack(entry, stored.data(), data);
+}
+
+// Unique among the threads and the processes analyzing out of packs
+static std::filesystem::path scratchFileName(const ReplayPackEntry& entry) {
+  static const unsigned int process = std::random_device()();
+  static std::atomic<unsigned long long> counter(0);
+  std::string name = "recanalyst-" + std::to_string(process) + "-" + std::to_string(counter++) + "-" +
+    replayHashToString(entry.hash) + formatExtension(entry.format);
+  return std::filesystem::temp_directory_path() / name;
+}
+
+AnalyzeStatus ReplayPack::analyze(ReplayHash hash, RecAnalyst& recAnalyst) {
+  const ReplayPackEntry* entry = find(hash);
+  if (entry == NULL) {
+    return AnalyzeStatus(RECANALYST_FILEOPEN);
+  }
+  if (entry->probe != RECANALYST_OK) {
+    return AnalyzeStatus(entry->probe);
+  }
+  std::vector<unsigned char> data;
+  std::string fileName;
+  try {
+    read(*entry, data);
+    fileName = scratchFileName(*entry).string();
+  } catch (const ERecAnalystException&) {
+    return AnalyzeStatus(RECANALYST_FILEREAD);
+  } catch (const std::filesystem::filesystem_error&) {
+    return AnalyzeStatus(RECANALYST_FILEOPEN);
+  }
+  {
+    std::ofstream stream(fileName, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!stream) {
+      std::remove(fileName.c_str());
+      return AnalyzeStatus(RECANALYST_FILEOPEN);
+    }
+  }
+  AnalyzeStatus status = recAnalyst.analyzeProbed(fileName, data.data(), data.size());
+  std::remove(fileName.c_str());
+  return status;
+}
+
+void ReplayPack::scan(const PackedReplayProc& proc, std::size_t blockSize) {
+  std::vector<const ReplayPackEntry*> order;
+  order.reserve(mEntries.size());
+  for (auto it = mEntries.cbegin(); it != mEntries.cend(); ++it) {
+    order.push_back(&*it);
+  }
+  // an empty replay shares its offset with the one added after it
+  std::sort(order.begin(), order.end(), [](const ReplayPackEntry* a, const ReplayPackEntry* b) {
+    return a->offset < b->offset || (a->offset == b->offset && a->storedSize < b->storedSize);
+  });
+  unsigned long long dataEnd = order.empty() ? 0 : order.back()->offset + order.back()->storedSize;
+  std::vector<unsigned char> block;
+  unsigned long long blockStart = 0;
+  unsigned long long blockEnd = 0;
+  std::vector<unsigned char> data;
+  for (auto it = order.cbegin(); it != order.cend(); ++it) {
+    const ReplayPackEntry& entry = **it;
+    if (entry.offset < blockStart || entry.offset + entry.storedSize > blockEnd) {
+      // next block from this replay on, replays larger than a block get one of their own
+      blockStart = entry.offset;
+      blockEnd = std::max<unsigned long long>(entry.offset + entry.storedSize,
+        std::min<unsigned long long>(entry.offset + blockSize, dataEnd));
+      block.resize(static_cast<std::size_t>(blockEnd - blockStart));
+      readAt(blockStart, block.data(), block.size());
+    }
+    const unsigned char* stored = &block[static_cast<std::size_t>(entry.offset - blockStart)];
+    if (entry.compressed) {
+      unpack(entry, stored, data);
+      proc(entry, data.data(), data.size());
+    } else {
+      proc(entry, stored, entry.size);
+    }
+  }
+}
+
+} // namespace
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _REPLAYPACK_H_
+#define _REPLAYPACK_H_
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "recanalystwrap.h"
+#include "recfile.h"
+#include "replayhash.h"
+
+namespace RecAnalystWrapper {
+
+// Pack layout: [header][replay data in the order added][dictionary][index sorted by hash]
+struct ReplayPackEntry {
+  ReplayHash hash;
+  unsigned long long offset;  // of the stored data
+  std::uint32_t storedSize;
+  std::uint32_t size;          // of the replay
+  std::uint32_t headerLength;  // probe metadata, the first field of the file
+  std::int32_t probe;          // validateRecData() result, RECANALYST_OK for replays worth analyzing
+  RecFormat format;
+  bool compressed;
+};
+
+struct ReplayPackOptions {
+  bool compress;               // zstd, only where built with RECANALYST_HAVE_ZSTD
+  int level;
+  std::size_t dictionarySize;  // 0 for no dictionary
+  std::size_t trainingSamples;  // replays held in memory until the dictionary is trained on them
+  ReplayPackOptions() : compress(true), level(3), dictionarySize(112 * 1024), trainingSamples(256) {}
+};
+
+// Writes a pack to fileName + ".tmp" and renames it on finish(), a pack left unfinished
+// is removed. Replays with the same content are stored once.
+class ReplayPackWriter {
+public:
+  explicit ReplayPackWriter(const std::string& fileName, const ReplayPackOptions& options = ReplayPackOptions());
+  ~ReplayPackWriter(void);
+  // false when the pack already has the replay, the name gives the format
+  bool add(const std::string& fileName);
+  bool add(const std::string& fileName, const unsigned char* data, std::size_t size);
+  void finish();
+  std::size_t size() const { return mHashes.size(); }
+private:
+  ReplayPackWriter(const ReplayPackWriter&);
+  ReplayPackWriter& operator=(const ReplayPackWriter&);
+  struct Sample {
+    ReplayPackEntry entry;
+    std::vector<unsigned char> data;
+  };
+  struct Compressor;
+  std::string mFileName;
+  std::string mTempName;
+  ReplayPackOptions mOptions;
+  std::FILE* mFile;
+  unsigned long long mOffset;
+  std::unordered_set<ReplayHash> mHashes;
+  std::vector<ReplayPackEntry> mEntries;
+  std::vector<Sample> mSamples;  // until the dictionary is trained
+  std::vector<unsigned char> mDictionary;
+  std::unique_ptr<Compressor> mCompressor;
+  std::vector<unsigned char> mBuffer;
+  void trainDictionary();
+  void store(ReplayPackEntry& entry, const unsigned char* data);
+  void write(const void* data, std::size_t size);
+};
+
+typedef std::function<void(const ReplayPackEntry& entry, const unsigned char* data, std::size_t size)> PackedReplayProc;
+
+// Read access to a pack. read() and analyze() may be called from several threads.
+class ReplayPack {
+public:
+  ReplayPack(void);
+  explicit ReplayPack(const std::string& fileName);
+  ~ReplayPack(void);
+  void open(const std::string& fileName);
+  void close();
+  const std::vector<ReplayPackEntry>& entries() const { return mEntries; }  // hash order
+  const ReplayPackEntry* find(ReplayHash hash) const;
+  void read(const ReplayPackEntry& entry, std::vector<unsigned char>& data);
+  // The library reads replays by name only, the replay is written to a scratch file in
+  // the temp directory for the parse and removed after. Replays that failed the probe
+  // when packed are rejected with its error without being read.
+  AnalyzeStatus analyze(ReplayHash hash, RecAnalyst& recAnalyst);
+  // Replays in the order they were added, read in large sequential blocks
+  void scan(const PackedReplayProc& proc, std::size_t blockSize = 8 * 1024 * 1024);
+private:
+  ReplayPack(const ReplayPack&);
+  ReplayPack& operator=(const ReplayPack&);
+  struct Decompressor;
+  std::string mFileName;
+  std::FILE* mFile;
+  std::mutex mFileMutex;
+  std::vector<ReplayPackEntry> mEntries;
+  std::unique_ptr<Decompressor> mDecompressor;
+  void readAt(unsigned long long offset, void* data, std::size_t size);
+  void unpack(const ReplayPackEntry& entry, const unsigned char* stored, std::vector<unsigned char>& data);
+};
+
+} // namespace
+
+#endif  //_REPLAYPACK_H_
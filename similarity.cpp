@@ -0,0 +1,430 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECANALYST_SSE2
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <utility>
+#include "similarity.h"
+#include "binaryio.h"
+#include "fileutil.h"
+
+namespace RecAnalystWrapper {
+
+static const char SIMILARITY_INDEX_MAGIC[8] = { 'R', 'A', 'S', 'I', 'M', 'I', 'L', '2' };
+static const std::size_t D = SimilarityIndex::DIMENSIONS;
+static const float MAX_AGE_MINUTES = 120.0f;  // also for ages never reached
+static const std::size_t PARALLEL_MIN = 4096;  // vectors worth a thread
+
+static inline float squaredDistance(const float* a, const float* b) {
+#ifdef RECANALYST_SSE2
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  for (std::size_t i = 0; i < D; i += 8) {
+    __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+  }
+  sum0 = _mm_add_ps(sum0, sum1);
+  __m128 shuffled = _mm_shuffle_ps(sum0, sum0, _MM_SHUFFLE(2, 3, 0, 1));
+  sum0 = _mm_add_ps(sum0, shuffled);
+  shuffled = _mm_movehl_ps(shuffled, sum0);
+  return _mm_cvtss_f32(_mm_add_ss(sum0, shuffled));
+#else
+  float sum = 0.0f;
+  for (std::size_t i = 0; i < D; ++i) {
+    float d = a[i] - b[i];
+    sum += d * d;
+  }
+  return sum;
+#endif
+}
+
+static std::uint32_t nearestCentroid(const float* vector, const float* centroids, std::size_t count) {
+  std::uint32_t best = 0;
+  float bestDistance = std::numeric_limits<float>::max();
+  for (std::size_t i = 0; i < count; ++i) {
+    float distance = squaredDistance(vector, centroids + i * D);
+    if (distance < bestDistance) {
+      bestDistance = distance;
+      best = static_cast<std::uint32_t>(i);
+    }
+  }
+  return best;
+}
+
+// Calls proc(begin, end) on ranges of [0, count) from up to threads threads
+static void parallelFor(std::size_t count, unsigned int threads,
+    const std::function<void(std::size_t, std::size_t)>& proc) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = static_cast<unsigned int>(std::min<std::size_t>(threads, count / PARALLEL_MIN));
+  if (threads <= 1) {
+    proc(0, count);
+    return;
+  }
+  std::vector<std::thread> workers;
+  std::size_t step = (count + threads - 1) / threads;
+  for (std::size_t begin = 0; begin < count; begin += step) {
+    workers.push_back(std::thread(std::cref(proc), begin, std::min(begin + step, count)));
+  }
+  for (auto it = workers.begin(); it != workers.end(); ++it) {
+    it->join();
+  }
+}
+
+// The k smallest distances seen, a max-heap
+class NearestSet {
+public:
+  explicit NearestSet(std::size_t k) : mK(k) { mHeap.reserve(k); }
+  float bound() const { return mHeap.size() < mK ? std::numeric_limits<float>::max() : mHeap.front().first; }
+  void add(float distance, std::uint32_t index) {
+    if (mHeap.size() < mK) {
+      mHeap.push_back(std::make_pair(distance, index));
+      std::push_heap(mHeap.begin(), mHeap.end());
+    } else if (distance < mHeap.front().first) {
+      std::pop_heap(mHeap.begin(), mHeap.end());
+      mHeap.back() = std::make_pair(distance, index);
+      std::push_heap(mHeap.begin(), mHeap.end());
+    }
+  }
+  void scan(const float* query, const float* vectors, std::size_t begin, std::size_t end) {
+    float limit = bound();
+    for (std::size_t i = begin; i < end; ++i) {
+      float distance = squaredDistance(query, vectors + i * D);
+      if (distance < limit) {
+        add(distance, static_cast<std::uint32_t>(i));
+        limit = bound();
+      }
+    }
+  }
+  std::vector<std::pair<float, std::uint32_t>>& sorted() {
+    std::sort_heap(mHeap.begin(), mHeap.end());
+    return mHeap;
+  }
+private:
+  std::size_t mK;
+  std::vector<std::pair<float, std::uint32_t>> mHeap;
+};
+
+SimilarityIndex::SimilarityIndex() {}
+
+void SimilarityIndex::playerFeatures(const Player& player, float* features) {
+  auto minutes = [](unsigned int time) {
+    return (time == 0) ? MAX_AGE_MINUTES : std::min(time / 60000.0f, MAX_AGE_MINUTES);
+  };
+  auto count = [](unsigned int value) { return std::log1p(static_cast<float>(value)); };
+  const Achievement& a = player.achievement;
+  const MilitaryStats& ms = a.militaryStats;
+  const EconomyStats& es = a.economyStats;
+  const TechnologyStats& ts = a.technologyStats;
+  const SocietyStats& ss = a.societyStats;
+  float* f = features;
+  *f++ = minutes(player.feudalTime);
+  *f++ = minutes(player.castleTime);
+  *f++ = minutes(player.imperialTime);
+  *f++ = count(a.totalScore);
+  *f++ = count(ms.militaryScore);
+  *f++ = count(ms.unitsKilled);
+  *f++ = count(ms.unitsLost);
+  *f++ = count(ms.buildingsRazed);
+  *f++ = count(ms.buildingsLost);
+  *f++ = count(ms.unitsConverted);
+  *f++ = count(es.economyScore);
+  *f++ = count(es.foodCollected);
+  *f++ = count(es.woodCollected);
+  *f++ = count(es.stoneCollected);
+  *f++ = count(es.goldCollected);
+  *f++ = count(es.tributeSent);
+  *f++ = count(es.tributeRcvd);
+  *f++ = count(es.tradeProfit);
+  *f++ = count(es.relicGold);
+  *f++ = count(ts.technologyScore);
+  *f++ = static_cast<float>(ts.mapExplored);  // percent
+  *f++ = count(ts.researchCount);
+  *f++ = static_cast<float>(ts.researchPercent);
+  *f++ = count(ss.societyScore);
+  *f++ = count(ss.totalWonders);
+  *f++ = count(ss.totalCastles);
+  *f++ = count(ss.relicsCaptured);
+  *f++ = count(ss.villagerHigh);
+  std::fill(f, features + D, 0.0f);
+}
+
+std::size_t SimilarityIndex::add(ReplayHash replay, const RecAnalyst& recAnalyst) {
+  if (!recAnalyst.hasAchievements()) {
+    return 0;
+  }
+  const Players& players = recAnalyst.players();
+  for (auto it = players.cbegin(); it != players.cend(); ++it) {
+    add(replay, it->second);
+  }
+  return players.size();
+}
+
+void SimilarityIndex::add(ReplayHash replay, const Player& player) {
+  float features[D];
+  playerFeatures(player, features);
+  add(replay, player.index, features);
+}
+
+void SimilarityIndex::add(ReplayHash replay, int player, const float* features) {
+  std::size_t offset = mVectors.size();
+  mVectors.insert(mVectors.end(), features, features + D);
+  if (built()) {
+    normalize(&mVectors[offset]);
+  }
+  mReplays.push_back(replay);
+  mPlayers.push_back(static_cast<std::uint8_t>(player));
+}
+
+void SimilarityIndex::normalize(float* vector) const {
+  for (std::size_t i = 0; i < D; ++i) {
+    vector[i] = (vector[i] - mMean[i]) * mScale[i];
+  }
+}
+
+void SimilarityIndex::build(const SimilarityOptions& options) {
+  std::size_t count = size();
+  if (!built()) {
+    std::vector<double> sum(D, 0.0);
+    std::vector<double> squares(D, 0.0);
+    for (std::size_t i = 0; i < count; ++i) {
+      const float* vector = &mVectors[i * D];
+      for (std::size_t j = 0; j < D; ++j) {
+        sum[j] += vector[j];
+        squares[j] += static_cast<double>(vector[j]) * vector[j];
+      }
+    }
+    mMean.assign(D, 0.0f);
+    mScale.assign(D, 1.0f);
+    for (std::size_t j = 0; count > 0 && j < D; ++j) {
+      double mean = sum[j] / count;
+      double variance = squares[j] / count - mean * mean;
+      mMean[j] = static_cast<float>(mean);
+      mScale[j] = (variance > 1e-12) ? static_cast<float>(1.0 / std::sqrt(variance)) : 0.0f;
+    }
+    parallelFor(count, options.threads, [this](std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; ++i) {
+        normalize(&mVectors[i * D]);
+      }
+    });
+  }
+  mCentroids.clear();
+  mListOffsets.clear();
+  if (options.lists > 0 && count > 0) {
+    cluster(options);
+  }
+}
+
+// Lloyd's k-means on an evenly spaced sample, then every vector goes to its nearest
+// centroid and the vectors are regrouped by list
+void SimilarityIndex::cluster(const SimilarityOptions& options) {
+  std::size_t count = size();
+  std::size_t lists = std::min<std::size_t>(options.lists, count);
+  std::size_t sampleCount = std::min<std::size_t>(count,
+    lists * std::max(1u, options.samplesPerList));
+  std::vector<float> samples(sampleCount * D);
+  for (std::size_t i = 0; i < sampleCount; ++i) {
+    std::size_t index = i * count / sampleCount;
+    std::memcpy(&samples[i * D], &mVectors[index * D], D * sizeof(float));
+  }
+  mCentroids.resize(lists * D);
+  for (std::size_t i = 0; i < lists; ++i) {
+    std::memcpy(&mCentroids[i * D], &samples[(i * sampleCount / lists) * D], D * sizeof(float));
+  }
+  std::vector<std::uint32_t> assignment(sampleCount);
+  for (unsigned int iteration = 0; iteration < options.iterations; ++iteration) {
+    parallelFor(sampleCount, options.threads, [&](std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; ++i) {
+        assignment[i] = nearestCentroid(&samples[i * D], mCentroids.data(), lists);
+      }
+    });
+    std::vector<double> sums(lists * D, 0.0);
+    std::vector<std::size_t> sizes(lists, 0);
+    for (std::size_t i = 0; i < sampleCount; ++i) {
+      double* sum = &sums[assignment[i] * D];
+      const float* sample = &samples[i * D];
+      for (std::size_t j = 0; j < D; ++j) {
+        sum[j] += sample[j];
+      }
+      ++sizes[assignment[i]];
+    }
+    for (std::size_t i = 0; i < lists; ++i) {
+      float* centroid = &mCentroids[i * D];
+      if (sizes[i] == 0) {
+        // an empty cluster restarts from a sample
+        std::size_t sample = (iteration * lists + i * 7919) % sampleCount;
+        std::memcpy(centroid, &samples[sample * D], D * sizeof(float));
+        continue;
+      }
+      for (std::size_t j = 0; j < D; ++j) {
+        centroid[j] = static_cast<float>(sums[i * D + j] / sizes[i]);
+      }
+    }
+  }
+  assignment.resize(count);
+  parallelFor(count, options.threads, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      assignment[i] = nearestCentroid(&mVectors[i * D], mCentroids.data(), lists);
+    }
+  });
+  mListOffsets.assign(lists + 1, 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    ++mListOffsets[assignment[i] + 1];
+  }
+  for (std::size_t i = 0; i < lists; ++i) {
+    mListOffsets[i + 1] += mListOffsets[i];
+  }
+  std::vector<std::uint32_t> next(mListOffsets.begin(), mListOffsets.end() - 1);
+  std::vector<float> vectors(mVectors.size());
+  std::vector<ReplayHash> replays(count);
+  std::vector<std::uint8_t> players(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    std::uint32_t position = next[assignment[i]]++;
+    std::memcpy(&vectors[position * D], &mVectors[i * D], D * sizeof(float));
+    replays[position] = mReplays[i];
+    players[position] = mPlayers[i];
+  }
+  mVectors.swap(vectors);
+  mReplays.swap(replays);
+  mPlayers.swap(players);
+}
+
+std::vector<SimilarityHit> SimilarityIndex::nearest(const Player& player, std::size_t k,
+    unsigned int probes) const {
+  float features[D];
+  playerFeatures(player, features);
+  return nearest(features, k, probes);
+}
+
+std::vector<SimilarityHit> SimilarityIndex::nearest(const float* features, std::size_t k,
+    unsigned int probes) const {
+  if (!built()) {
+    throw ERecAnalystException("Similarity index is not built.");
+  }
+  float query[D];
+  std::memcpy(query, features, sizeof(query));
+  normalize(query);
+  NearestSet nearestSet(k);
+  std::size_t listed = mListOffsets.empty() ? 0 : mListOffsets.back();
+  if (k > 0 && lists() > 0) {
+    std::vector<std::pair<float, std::uint32_t>> order(lists());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      order[i] = std::make_pair(squaredDistance(query, &mCentroids[i * D]), static_cast<std::uint32_t>(i));
+    }
+    std::size_t scanned = (probes == 0) ? order.size() : std::min<std::size_t>(probes, order.size());
+    std::partial_sort(order.begin(), order.begin() + scanned, order.end());
+    for (std::size_t i = 0; i < scanned; ++i) {
+      std::uint32_t list = order[i].second;
+      nearestSet.scan(query, mVectors.data(), mListOffsets[list], mListOffsets[list + 1]);
+    }
+  }
+  if (k > 0) {
+    nearestSet.scan(query, mVectors.data(), listed, size());  // not clustered yet
+  }
+  std::vector<std::pair<float, std::uint32_t>>& found = nearestSet.sorted();
+  std::vector<SimilarityHit> hits(found.size());
+  for (std::size_t i = 0; i < found.size(); ++i) {
+    hits[i].replay = mReplays[found[i].second];
+    hits[i].player = mPlayers[found[i].second];
+    hits[i].distance = found[i].first;
+  }
+  return hits;
+}
+
+void SimilarityIndex::clear() {
+  mVectors.clear();
+  mReplays.clear();
+  mPlayers.clear();
+  mMean.clear();
+  mScale.clear();
+  mCentroids.clear();
+  mListOffsets.clear();
+}
+
+void SimilarityIndex::write(std::ostream& stream) const {
+  stream.write(SIMILARITY_INDEX_MAGIC, sizeof(SIMILARITY_INDEX_MAGIC));
+  writeArray(stream, mReplays);
+  writeArray(stream, mPlayers);
+  writeArray(stream, mVectors);
+  writeArray(stream, mMean);
+  writeArray(stream, mScale);
+  writeArray(stream, mCentroids);
+  writeArray(stream, mListOffsets);
+}
+
+bool SimilarityIndex::read(std::istream& stream) {
+  clear();
+  char magic[sizeof(SIMILARITY_INDEX_MAGIC)];
+  if (!stream.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, SIMILARITY_INDEX_MAGIC, sizeof(magic)) != 0 ||
+      !readArray(stream, mReplays, 1ULL << 32) || !readArray(stream, mPlayers, mReplays.size()) ||
+      !readArray(stream, mVectors, mReplays.size() * D) || !readArray(stream, mMean, D) ||
+      !readArray(stream, mScale, D) || !readArray(stream, mCentroids, mReplays.size() * D) ||
+      !readArray(stream, mListOffsets, mReplays.size() + 1)) {
+    clear();
+    return false;
+  }
+  bool valid = mPlayers.size() == mReplays.size() && mVectors.size() == mReplays.size() * D &&
+    mMean.size() == mScale.size() && (mMean.empty() || mMean.size() == D) &&
+    mCentroids.size() == lists() * D && (mListOffsets.empty() || mListOffsets.front() == 0);
+  for (std::size_t i = 1; valid && i < mListOffsets.size(); ++i) {
+    valid = mListOffsets[i - 1] <= mListOffsets[i] && mListOffsets[i] <= mReplays.size();
+  }
+  if (!valid) {
+    clear();
+  }
+  return valid;
+}
+
+void SimilarityIndex::save(const std::string& fileName) const {
+  std::string tempName = fileName + ".tmp";
+  {
+    std::ofstream stream(tempName, std::ios::binary | std::ios::trunc);
+    write(stream);
+    if (!stream) {
+      throw ERecAnalystException("Unable to create similarity index file: " + tempName);
+    }
+  }
+  if (!replaceFile(tempName, fileName)) {
+    throw ERecAnalystException("Unable to write similarity index file: " + fileName);
+  }
+}
+
+void SimilarityIndex::load(const std::string& fileName) {
+  std::ifstream stream(fileName, std::ios::binary);
+  if (!stream) {
+    throw ERecAnalystException(recanalyst_errmsg(RECANALYST_FILEOPEN));
+  }
+  if (!read(stream)) {
+    throw ERecAnalystException("Malformed similarity index file: " + fileName);
+  }
+}
+
+} // namespace
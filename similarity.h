@@ -0,0 +1,87 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _SIMILARITY_H_
+#define _SIMILARITY_H_
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "recanalystwrap.h"
+#include "replayhash.h"
+
+namespace RecAnalystWrapper {
+
+struct SimilarityHit {
+  ReplayHash replay;
+  int player;      // player index
+  float distance;  // squared euclidean, in standard deviations
+};
+
+struct SimilarityOptions {
+  unsigned int lists;           // k-means clusters searched by probe, 0 for brute force search
+  unsigned int iterations;      // k-means rounds
+  unsigned int samplesPerList;  // vectors the clusters are trained on
+  unsigned int threads;         // 0 for one per core
+  SimilarityOptions() : lists(0), iterations(10), samplesPerList(64), threads(0) {}
+};
+
+// k nearest neighbor search over player achievements. A player is a fixed width vector
+// of age-up times, scores and their sub-fields: counts are log scaled and every feature
+// is standardized by the mean and deviation of the vectors the index was first built
+// from. With lists set the vectors are grouped by their nearest k-means centroid and a
+// query scans the closest lists only.
+class SimilarityIndex {
+public:
+  static const std::size_t DIMENSIONS = 32;  // features padded for SIMD
+  SimilarityIndex(void);
+  // players of games with achievements, returns the number added
+  std::size_t add(ReplayHash replay, const RecAnalyst& recAnalyst);
+  void add(ReplayHash replay, const Player& player);
+  void add(ReplayHash replay, int player, const float* features);  // as from playerFeatures()
+  static void playerFeatures(const Player& player, float* features);
+  // Clusters the vectors, players added after a build are scanned by every query
+  // until the next one
+  void build(const SimilarityOptions& options = SimilarityOptions());
+  bool built() const { return !mMean.empty(); }
+  // closest first, probes is the number of lists scanned
+  std::vector<SimilarityHit> nearest(const Player& player, std::size_t k, unsigned int probes = 8) const;
+  std::vector<SimilarityHit> nearest(const float* features, std::size_t k, unsigned int probes = 8) const;
+  std::size_t size() const { return mReplays.size(); }
+  std::size_t lists() const { return mListOffsets.empty() ? 0 : mListOffsets.size() - 1; }
+  void clear();
+  void write(std::ostream& stream) const;
+  bool read(std::istream& stream);
+  void save(const std::string& fileName) const;
+  void load(const std::string& fileName);
+private:
+  std::vector<float> mVectors;  // DIMENSIONS per player, in list order up to the last list offset
+  std::vector<ReplayHash> mReplays;
+  std::vector<std::uint8_t> mPlayers;
+  std::vector<float> mMean;   // fitted by the first build
+  std::vector<float> mScale;  // inverse deviation
+  std::vector<float> mCentroids;
+  std::vector<std::uint32_t> mListOffsets;
+  void normalize(float* vector) const;
+  void cluster(const SimilarityOptions& options);
+};
+
+} // namespace
+
+#endif  //_SIMILARITY_H_
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <functional>
+#include "statsaggregator.h"
+#include "binaryio.h"
+
+namespace RecAnalystWrapper {
+
+static const char STATS_MAGIC[8] = { 'R', 'A', 'S', 'T', 'A', 'T', 'S', '1' };
+
+std::size_t StatsKeyHash::operator()(const StatsKey& key) const {
+  std::size_t h = std::hash<std::string>()(key.map);
+  h ^= (static_cast<std::size_t>(key.civ) << 8 | static_cast<std::size_t>(key.version)) * 0x9E3779B9U;
+  return h;
+}
+
+void CivStats::merge(const CivStats& other) {
+  players += other.players;
+  wins += other.wins;
+  losses += other.losses;
+  feudalTime.merge(other.feudalTime);
+  castleTime.merge(other.castleTime);
+  imperialTime.merge(other.imperialTime);
+  for (int i = 0; i < static_cast<int>(StatsScore::COUNT); ++i) {
+    scores[i].merge(other.scores[i]);
+  }
+}
+
+StatsAggregator::StatsAggregator(bool humansOnly) : mHumansOnly(humansOnly), mGames(0) {}
+
+void StatsAggregator::add(const GameSettings& gameSettings, const Players& players) {
+  ++mGames;
+  bool hasAchievements = gameSettings.extra.hasData;
+  StatsKey key;
+  key.map = gameSettings.map;
+  key.version = gameSettings.gameVersion;
+  for (auto it = players.cbegin(); it != players.cend(); ++it) {
+    const Player& player = it->second;
+    if (mHumansOnly && !player.human) {
+      continue;
+    }
+    key.civ = player.civId;
+    CivStats& stats = mCells[key];
+    ++stats.players;
+    if (player.feudalTime > 0) {
+      stats.feudalTime.record(player.feudalTime);
+    }
+    if (player.castleTime > 0) {
+      stats.castleTime.record(player.castleTime);
+    }
+    if (player.imperialTime > 0) {
+      stats.imperialTime.record(player.imperialTime);
+    }
+    if (!hasAchievements) {
+      continue;
+    }
+    const Achievement& a = player.achievement;
+    if (a.victory || a.result == GameResult::WIN) {
+      ++stats.wins;
+    } else {
+      ++stats.losses;
+    }
+    stats.scores[static_cast<int>(StatsScore::TOTAL)].record(a.totalScore);
+    stats.scores[static_cast<int>(StatsScore::MILITARY)].record(a.militaryStats.militaryScore);
+    stats.scores[static_cast<int>(StatsScore::ECONOMY)].record(a.economyStats.economyScore);
+    stats.scores[static_cast<int>(StatsScore::TECHNOLOGY)].record(a.technologyStats.technologyScore);
+    stats.scores[static_cast<int>(StatsScore::SOCIETY)].record(a.societyStats.societyScore);
+  }
+}
+
+void StatsAggregator::add(const RecAnalyst& recAnalyst) {
+  add(recAnalyst.gameSettings(), recAnalyst.players());
+}
+
+void StatsAggregator::merge(const StatsAggregator& other) {
+  mGames += other.mGames;
+  for (auto it = other.mCells.cbegin(); it != other.mCells.cend(); ++it) {
+    mCells[it->first].merge(it->second);
+  }
+}
+
+void StatsAggregator::clear() {
+  mGames = 0;
+  mCells.clear();
+}
+
+const CivStats* StatsAggregator::find(const StatsKey& key) const {
+  auto it = mCells.find(key);
+  return (it != mCells.end()) ? &it->second : NULL;
+}
+
+static void writeHistogram(std::ostream& stream, const SparseHistogram& histogram) {
+  writeValue<unsigned long long>(stream, histogram.sum());
+  writeValue<unsigned long long>(stream, histogram.min());
+  writeValue<unsigned long long>(stream, histogram.max());
+  const SparseHistogram::Buckets& buckets = histogram.buckets();
+  writeValue<unsigned int>(stream, static_cast<unsigned int>(buckets.size()));
+  for (auto it = buckets.cbegin(); it != buckets.cend(); ++it) {
+    writeValue<int>(stream, it->first);
+    writeValue<unsigned long long>(stream, it->second);
+  }
+}
+
+static bool readHistogram(std::istream& stream, SparseHistogram& histogram) {
+  unsigned long long sum, min, max;
+  unsigned int size;
+  if (!readValue(stream, sum) || !readValue(stream, min) || !readValue(stream, max) ||
+      !readValue(stream, size)) {
+    return false;
+  }
+  SparseHistogram::Buckets buckets;
+  int last = -1;
+  for (unsigned int i = 0; i < size; ++i) {
+    std::pair<int, unsigned long long> bucket;
+    if (!readValue(stream, bucket.first) || !readValue(stream, bucket.second) ||
+        bucket.first <= last || bucket.first >= Histogram::BUCKET_COUNT) {
+      return false;
+    }
+    last = bucket.first;
+    buckets.push_back(bucket);
+  }
+  histogram.clear();
+  histogram.addBuckets(buckets, sum, min, max);
+  return true;
+}
+
+void StatsAggregator::write(std::ostream& stream) const {
+  stream.write(STATS_MAGIC, sizeof(STATS_MAGIC));
+  writeValue<unsigned long long>(stream, mGames);
+  writeValue<unsigned long long>(stream, mCells.size());
+  for (auto it = mCells.cbegin(); it != mCells.cend(); ++it) {
+    const StatsKey& key = it->first;
+    const CivStats& stats = it->second;
+    writeValue<int>(stream, static_cast<int>(key.civ));
+    writeValue<int>(stream, static_cast<int>(key.version));
+    writeValue<unsigned int>(stream, static_cast<unsigned int>(key.map.size()));
+    stream.write(key.map.data(), key.map.size());
+    writeValue<unsigned long long>(stream, stats.players);
+    writeValue<unsigned long long>(stream, stats.wins);
+    writeValue<unsigned long long>(stream, stats.losses);
+    writeHistogram(stream, stats.feudalTime);
+    writeHistogram(stream, stats.castleTime);
+    writeHistogram(stream, stats.imperialTime);
+    for (int i = 0; i < static_cast<int>(StatsScore::COUNT); ++i) {
+      writeHistogram(stream, stats.scores[i]);
+    }
+  }
+}
+
+bool StatsAggregator::read(std::istream& stream) {
+  clear();
+  char magic[sizeof(STATS_MAGIC)];
+  unsigned long long games, cells;
+  if (!stream.read(magic, sizeof(magic)) || std::memcmp(magic, STATS_MAGIC, sizeof(magic)) != 0 ||
+      !readValue(stream, games) || !readValue(stream, cells)) {
+    return false;
+  }
+  for (unsigned long long n = 0; n < cells; ++n) {
+    int civ, version;
+    unsigned int mapSize;
+    if (!readValue(stream, civ) || !readValue(stream, version) || !readValue(stream, mapSize) ||
+        mapSize > 65536) {
+      clear();
+      return false;
+    }
+    StatsKey key;
+    key.civ = static_cast<Civilization>(civ);
+    key.version = static_cast<GameVersion>(version);
+    key.map.resize(mapSize);
+    CivStats stats;
+    bool ok = static_cast<bool>(stream.read(&key.map[0], mapSize)) &&
+      readValue(stream, stats.players) && readValue(stream, stats.wins) &&
+      readValue(stream, stats.losses) && readHistogram(stream, stats.feudalTime) &&
+      readHistogram(stream, stats.castleTime) && readHistogram(stream, stats.imperialTime);
+    for (int i = 0; ok && i < static_cast<int>(StatsScore::COUNT); ++i) {
+      ok = readHistogram(stream, stats.scores[i]);
+    }
+    if (!ok) {
+      clear();
+      return false;
+    }
+    mCells[key].merge(stats);
+  }
+  mGames = games;
+  return true;
+}
+
+} // namespace
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _STATSAGGREGATOR_H_
+#define _STATSAGGREGATOR_H_
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include "histogram.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+// Statistics are kept per civilization, map name and game version
+struct StatsKey {
+  Civilization civ;
+  std::string map;
+  GameVersion version;
+  bool operator==(const StatsKey& other) const {
+    return civ == other.civ && version == other.version && map == other.map;
+  }
+};
+
+struct StatsKeyHash {
+  std::size_t operator()(const StatsKey& key) const;
+};
+
+  enum class StatsScore {
+    TOTAL,
+    MILITARY,
+    ECONOMY,
+    TECHNOLOGY,
+    SOCIETY,
+    COUNT
+  };
+
+struct CivStats {
+  unsigned long long players;  // player appearances
+  unsigned long long wins;     // wins and losses only count games with achievement data
+  unsigned long long losses;
+  SparseHistogram feudalTime;  // ms, players who reached the age
+  SparseHistogram castleTime;
+  SparseHistogram imperialTime;
+  SparseHistogram scores[static_cast<int>(StatsScore::COUNT)];
+  CivStats() : players(0), wins(0), losses(0) {}
+  const SparseHistogram& score(StatsScore score) const { return scores[static_cast<int>(score)]; }
+  double winRate() const { return (wins + losses) ? (double)wins / (wins + losses) : 0.0; }
+  void merge(const CivStats& other);
+};
+
+// Incrementally aggregates the players of analyzed games. Not synchronized, keep one
+// aggregator per thread or node and merge them, merging is commutative.
+class StatsAggregator {
+public:
+  typedef std::unordered_map<StatsKey, CivStats, StatsKeyHash> Cells;
+
+  explicit StatsAggregator(bool humansOnly = true);
+  void add(const GameSettings& gameSettings, const Players& players);
+  void add(const RecAnalyst& recAnalyst);
+  void merge(const StatsAggregator& other);
+  void clear();
+  unsigned long long games() const { return mGames; }
+  const Cells& cells() const { return mCells; }
+  const CivStats* find(const StatsKey& key) const;
+  // combined stats of all cells the filter accepts, e.g. one civ over every map
+  template <typename Filter> CivStats combine(Filter filter) const {
+    CivStats result;
+    for (auto it = mCells.cbegin(); it != mCells.cend(); ++it) {
+      if (filter(it->first)) {
+        result.merge(it->second);
+      }
+    }
+    return result;
+  }
+
+  // Binary form for shipping partials between nodes, native byte order.
+  // read() replaces the contents and returns false on malformed input.
+  void write(std::ostream& stream) const;
+  bool read(std::istream& stream);
+private:
+  bool mHumansOnly;
+  unsigned long long mGames;
+  Cells mCells;
+};
+
+} // namespace
+
+#endif  //_STATSAGGREGATOR_H_
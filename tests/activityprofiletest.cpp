@@ -0,0 +1,151 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// ActivityProfiler: attribution, repeated commands and bucketing of a small body.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../activityprofile.h"
+#include "bodywriter.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+static std::vector<unsigned char> move(int player, int x) {
+  std::vector<unsigned char> payload(28, 0);
+  payload[0] = static_cast<unsigned char>(BodyCommand::MOVE);
+  payload[1] = static_cast<unsigned char>(player);
+  payload[4] = static_cast<unsigned char>(x);
+  payload[8] = 1;  // one unit
+  return payload;
+}
+
+static std::vector<unsigned char> stop() {
+  std::vector<unsigned char> payload(8, 0);
+  payload[0] = static_cast<unsigned char>(BodyCommand::STOP);
+  return payload;
+}
+
+// Player 1 moves three times at 1000 and once at 1600, player 2 at 1600 and 61600
+static std::string sampleBody() {
+  BodyWriter body;
+  body.sync(1000);
+  body.command(move(1, 10));
+  body.command(move(1, 10));  // the same move again
+  body.command(move(1, 20));
+  body.sync(600);
+  body.command(move(1, 20));  // the same move 600 ms later
+  body.command(move(2, 10));
+  body.command(stop());
+  body.sync(60000);
+  body.command(move(2, 10));
+  return body.data();
+}
+
+static void testProfile(const std::string& fileName) {
+  writeFile(fileName, sampleBody());
+  ActivityProfiler profiler;
+  profiler.profile(fileName);
+  CHECK(profiler.duration() == 61600);
+  CHECK(profiler.players().size() == 2);
+  CHECK(profiler.unattributedActions() == 1);
+  CHECK(profiler.unattributedCounts()[static_cast<unsigned int>(BodyCommand::STOP)] == 1);
+
+  const PlayerActivity& first = profiler.players().at(1);
+  CHECK(first.times == std::vector<unsigned int>({ 1000, 1000, 1000, 1600 }));
+  CHECK(first.effectiveTimes == std::vector<unsigned int>({ 1000, 1000, 1600 }));
+  CHECK(first.commandCounts[static_cast<unsigned int>(BodyCommand::MOVE)] == 4);
+  const PlayerActivity& second = profiler.players().at(2);
+  CHECK(second.times == std::vector<unsigned int>({ 1600, 61600 }));
+  CHECK(second.effectiveTimes == second.times);  // a minute apart
+  CHECK(profiler.averageApm(1) == 4 * 60000.0 / 61600);
+  CHECK(profiler.averageApm(1, true) == 3 * 60000.0 / 61600);
+  CHECK(profiler.averageApm(3) == 0.0);
+
+  // a wider window makes the move at 1600 a repeat too
+  ActivityProfiler patient(1000);
+  patient.profile(fileName);
+  CHECK(patient.players().at(1).effectiveTimes == std::vector<unsigned int>({ 1000, 1000 }));
+
+  // profile() starts over
+  profiler.profile(fileName);
+  CHECK(profiler.players().at(1).times.size() == 4 && profiler.unattributedActions() == 1);
+  profiler.reset();
+  CHECK(profiler.players().empty() && profiler.duration() == 0 && profiler.unattributedActions() == 0);
+}
+
+static void testSeries(const std::string& fileName) {
+  writeFile(fileName, sampleBody());
+  ActivityProfiler profiler;
+  profiler.profile(fileName);
+  ActivitySeries series;
+  CHECK(profiler.series(1, 60000, series));
+  CHECK(series.bucketWidth == 60000);
+  CHECK(series.actions == std::vector<unsigned int>({ 4, 0 }));
+  CHECK(series.effectiveActions == std::vector<unsigned int>({ 3, 0 }));
+  CHECK(series.apm(0) == 4.0 && series.eapm(0) == 3.0);
+
+  // one bucket per second up to the last sync, the move at 61600 in the last one
+  CHECK(profiler.series(2, 1000, series));
+  CHECK(series.actions.size() == 62);
+  CHECK(series.actions[1] == 1 && series.actions[61] == 1);
+  unsigned int total = 0;
+  for (unsigned int count : series.actions) {
+    total += count;
+  }
+  CHECK(total == 2);
+
+  CHECK(!profiler.series(3, 1000, series));
+  CHECK(!profiler.series(1, 0, series));
+}
+
+static void testBucketize() {
+  std::vector<unsigned int> times = { 0, 999, 1000, 2999, 5000, 9999 };
+  std::vector<unsigned int> counts(3, 0);
+  ActivityProfiler::bucketize(times, 1000, counts);
+  CHECK(counts == std::vector<unsigned int>({ 2, 1, 3 }));  // the last takes the rest
+  ActivityProfiler::bucketize(times, 1000, counts);
+  CHECK(counts == std::vector<unsigned int>({ 4, 2, 6 }));  // added to what is there
+
+  counts.assign(2, 0);
+  ActivityProfiler::bucketize(std::vector<unsigned int>(), 1000, counts);
+  CHECK(counts == std::vector<unsigned int>({ 0, 0 }));
+  counts.clear();
+  ActivityProfiler::bucketize(times, 1000, counts);
+  CHECK(counts.empty());
+
+  // boundaries past 2^32 ms do not wrap
+  std::vector<unsigned int> late = { 0xFFFFFFF0u };
+  counts.assign(2, 0);
+  ActivityProfiler::bucketize(late, 0x80000000u, counts);
+  CHECK(counts == std::vector<unsigned int>({ 0, 1 }));
+}
+
+int main() {
+  std::string fileName = tempPath("activityprofile.mgx");
+  try {
+    testProfile(fileName);
+    testSeries(fileName);
+    testBucketize();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(fileName.c_str());
+  return testResult("activityprofiletest");
+}
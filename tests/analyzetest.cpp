@@ -0,0 +1,215 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// RecAnalyst against the stand-in library: validation, the non-throwing analyze,
+// visit() and the borrowed results.
+
+#include <cstdio>
+#include <new>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+static std::string deflateRaw(const std::string& data) {
+  std::vector<unsigned char> out(compressBound(static_cast<uLong>(data.size())) + 16);
+  z_stream stream = z_stream();
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = out.data();
+  stream.avail_out = static_cast<uInt>(out.size());
+  deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  return std::string(reinterpret_cast<const char*>(out.data()), stream.total_out);
+}
+
+// An MGX file: header length, next position, the deflated header, then the body
+static std::string recordedGame(const std::string& deflated) {
+  std::string data;
+  unsigned int lengths[2] = { static_cast<unsigned int>(8 + deflated.size()), 0 };
+  data.append(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+  data += deflated;
+  data.append(16, '\0');
+  return data;
+}
+
+static std::string validGame() {
+  return recordedGame(deflateRaw(std::string(5000, 'h')));
+}
+
+static std::string invalidGame() {
+  return recordedGame(std::string(64, '\xFF'));  // not a deflate stream
+}
+
+static void testValidate(const std::string& fileName) {
+  writeFile(fileName, validGame());
+  CHECK(RecAnalyst::validate(fileName).code() == RECANALYST_OK);
+  writeFile(fileName, invalidGame());
+  CHECK(RecAnalyst::validate(fileName).code() == RECANALYST_DECOMP);
+  writeFile(fileName, std::string("\x08\0\0\0\0\0\0\0", 8));
+  CHECK(RecAnalyst::validate(fileName).code() == RECANALYST_EMPTYHEADER);
+  writeFile(fileName, std::string("\0\1\0\0\0\0\0\0", 8));  // 256 bytes of header in an 8 byte file
+  CHECK(RecAnalyst::validate(fileName).code() == RECANALYST_FILEREAD);
+  writeFile(fileName, "mgx");
+  CHECK(RecAnalyst::validate(fileName).code() == RECANALYST_HEADLENREAD);
+  CHECK(RecAnalyst::validate(fileName + ".missing.mgx").code() == RECANALYST_FILEOPEN);
+  CHECK(RecAnalyst::validate(fileName + ".txt").code() == RECANALYST_FILEEXT);
+}
+
+static void testNoThrow(const std::string& fileName) {
+  RecAnalyst recAnalyst;
+  writeFile(fileName, validGame());
+  AnalyzeStatus status = recAnalyst.analyze(fileName, std::nothrow);
+  CHECK(status.ok() && static_cast<bool>(status));
+  CHECK(recAnalyst.players().size() == static_cast<std::size_t>(fakeGame().players));
+  CHECK(recAnalyst.inGameChatMessages().size() == static_cast<std::size_t>(fakeGame().inGameChatMessages));
+
+  // a rejected file leaves no results of the previous one behind
+  writeFile(fileName, invalidGame());
+  status = recAnalyst.analyze(fileName, std::nothrow);
+  CHECK(!status && status.code() == RECANALYST_DECOMP && !status.message().empty());
+  CHECK(recAnalyst.players().empty() && recAnalyst.inGameChatMessages().empty());
+  CHECK(recAnalyst.analyze(fileName + ".txt", std::nothrow).code() == RECANALYST_FILEEXT);
+
+  // the probe runs on the caller's bytes, not on the file
+  std::string valid = validGame();
+  std::string invalid = invalidGame();
+  const unsigned char* validData = reinterpret_cast<const unsigned char*>(valid.data());
+  const unsigned char* invalidData = reinterpret_cast<const unsigned char*>(invalid.data());
+  CHECK(recAnalyst.analyzeProbed(fileName, validData, valid.size()).ok());
+  CHECK(recAnalyst.players().size() == static_cast<std::size_t>(fakeGame().players));
+  writeFile(fileName, valid);
+  CHECK(recAnalyst.analyzeProbed(fileName, invalidData, invalid.size()).code() == RECANALYST_DECOMP);
+  CHECK(recAnalyst.analyzeProbed(fileName, validData, 6).code() == RECANALYST_HEADLENREAD);
+  CHECK(recAnalyst.analyzeProbed(fileName, validData, 20).code() == RECANALYST_FILEREAD);
+}
+
+// Handles players and in-game chat only, stops the chat after stopChatAt messages
+struct CountingVisitor {
+  int players;
+  int chatMessages;
+  int stopChatAt;
+  std::string lastName;
+  CountingVisitor() : players(0), chatMessages(0), stopChatAt(-1) {}
+  bool onPlayer(const PlayerView& player) {
+    ++players;
+    lastName = std::string(player.name);
+    return true;
+  }
+  bool onInGameChatMessage(const ChatMessageView& chatMessage) {
+    CHECK(!chatMessage.msg.empty());
+    return ++chatMessages != stopChatAt;
+  }
+};
+
+static void testVisit(const std::string& fileName) {
+  RecAnalyst recAnalyst;
+  writeFile(fileName, validGame());
+  recAnalyst.analyze(fileName);
+  CHECK(!recAnalyst.players().empty());
+
+  CountingVisitor visitor;
+  CHECK(recAnalyst.visit(fileName, visitor).ok());
+  CHECK(visitor.players == fakeGame().players);
+  CHECK(visitor.chatMessages == fakeGame().inGameChatMessages);
+  CHECK(visitor.lastName == "Player " + std::to_string(fakeGame().players));
+  // the stored results of the earlier analyze are gone
+  CHECK(recAnalyst.players().empty() && recAnalyst.inGameChatMessages().empty());
+
+  // false stops that section only
+  CountingVisitor stopping;
+  stopping.stopChatAt = 5;
+  CHECK(recAnalyst.visit(fileName, stopping).ok());
+  CHECK(stopping.chatMessages == 5 && stopping.players == fakeGame().players);
+
+  // an invalid file is rejected before any callback, unless the caller skips the check
+  writeFile(fileName, invalidGame());
+  CountingVisitor rejected;
+  CHECK(recAnalyst.visit(fileName, rejected).code() == RECANALYST_DECOMP);
+  CHECK(rejected.players == 0 && rejected.chatMessages == 0);
+  CHECK(recAnalyst.visit(fileName, rejected, false).ok());
+  CHECK(rejected.players == fakeGame().players);
+}
+
+static void testBorrowed(const std::string& fileName) {
+  FakeGame game;
+  game.players = 4;
+  game.coopingPlayers = 2;
+  setFakeGame(game);
+  writeFile(fileName, validGame());
+
+  RecAnalyst owned;
+  owned.analyze(fileName);
+  RecAnalyst recAnalyst;
+  CHECK(recAnalyst.analyzeBorrowed(fileName).ok());
+  const BorrowedResults& borrowed = recAnalyst.borrowed();
+  CHECK(recAnalyst.players().empty() && recAnalyst.inGameChatMessages().empty());
+
+  // cooping players are entries of their own, the owned ones nest them
+  CHECK(borrowed.players.size() == 6 && owned.players().size() == 4);
+  int cooping = 0;
+  for (const PlayerView& player : borrowed.players) {
+    const Player& slot = owned.players().at(player.index);
+    if (player.cooping) {
+      ++cooping;
+      CHECK(slot.coopingPlayers.size() == 1 && player.name == slot.coopingPlayers[0].name);
+    } else {
+      CHECK(player.name == slot.name && player.civ == slot.civ);
+    }
+  }
+  CHECK(cooping == 2);
+  CHECK(borrowed.gameSettings.map == "Arabia" && borrowed.gameSettings.map == owned.gameSettings().map);
+  CHECK(borrowed.preGameChatMessages.size() == owned.preGameChatMessages().size());
+  CHECK(borrowed.inGameChatMessages.size() == owned.inGameChatMessages().size());
+  for (std::size_t i = 0; i < borrowed.inGameChatMessages.size(); ++i) {
+    CHECK(borrowed.inGameChatMessages[i].msg == owned.inGameChatMessages()[i].msg);
+    CHECK(borrowed.inGameChatMessages[i].time == owned.inGameChatMessages()[i].time);
+  }
+  CHECK(borrowed.tributes.size() == owned.tributes().size());
+  CHECK(borrowed.researches.size() == owned.researches().size());
+  for (std::size_t i = 0; i < borrowed.researches.size(); ++i) {
+    CHECK(borrowed.researches[i].name == owned.researches()[i].name);
+  }
+
+  // an owned analyze drops the borrowed results, a rejected file leaves none
+  recAnalyst.analyze(fileName);
+  CHECK(recAnalyst.borrowed().players.empty() && recAnalyst.players().size() == 4);
+  CHECK(recAnalyst.analyzeBorrowed(fileName).ok() && !recAnalyst.borrowed().players.empty());
+  writeFile(fileName, invalidGame());
+  CHECK(recAnalyst.analyzeBorrowed(fileName).code() == RECANALYST_DECOMP);
+  CHECK(recAnalyst.borrowed().players.empty() && recAnalyst.borrowed().researches.empty());
+  CHECK(recAnalyst.borrowed().gameSettings.map.empty());
+  setFakeGame(FakeGame());
+}
+
+int main() {
+  std::string fileName = tempPath("analyze.mgx");
+  try {
+    testValidate(fileName);
+    testNoThrow(fileName);
+    testVisit(fileName);
+    testBorrowed(fileName);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(fileName.c_str());
+  return testResult("analyzetest");
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// BodyParser on a synthetic body: every operation kind, the events derived from
+// commands, parsing a file that is still being written and malformed operations.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../bodyparser.h"
+#include "bodywriter.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+struct Recorder : public BodyVisitor {
+  std::vector<SyncEvent> syncs;
+  std::vector<BodyCommand> commands;
+  std::vector<int> players;
+  std::vector<std::string> chats;
+  std::vector<AgeUpEvent> ageUps;
+  std::vector<ResignEvent> resigns;
+  unsigned int stopAfter;
+  Recorder() : stopAfter(0) {}
+  bool onSync(const SyncEvent& sync) { syncs.push_back(sync); return true; }
+  bool onCommand(const CommandEvent& command) {
+    commands.push_back(command.type);
+    players.push_back(command.player);
+    return stopAfter == 0 || commands.size() < stopAfter;
+  }
+  bool onChat(const ChatEvent& chat) { chats.push_back(std::string(chat.text, chat.length)); return true; }
+  bool onAgeUp(const AgeUpEvent& ageUp) { ageUps.push_back(ageUp); return true; }
+  bool onResign(const ResignEvent& resign) { resigns.push_back(resign); return true; }
+};
+
+static std::vector<unsigned char> move(int player) {
+  std::vector<unsigned char> payload(28, 0);
+  payload[0] = static_cast<unsigned char>(BodyCommand::MOVE);
+  payload[1] = static_cast<unsigned char>(player);
+  payload[8] = 1;  // one unit
+  return payload;
+}
+
+static std::vector<unsigned char> research(int player, int id) {
+  std::vector<unsigned char> payload(16, 0);
+  payload[0] = static_cast<unsigned char>(BodyCommand::RESEARCH);
+  payload[8] = static_cast<unsigned char>(player);
+  payload[10] = static_cast<unsigned char>(id & 0xFF);
+  payload[11] = static_cast<unsigned char>(id >> 8);
+  return payload;
+}
+
+static std::vector<unsigned char> resign(int player, bool disconnected) {
+  std::vector<unsigned char> payload(12, 0);
+  payload[0] = static_cast<unsigned char>(BodyCommand::RESIGN);
+  payload[1] = static_cast<unsigned char>(player);
+  payload[2] = static_cast<unsigned char>(player);
+  payload[3] = disconnected ? 1 : 0;
+  return payload;
+}
+
+static BodyWriter sampleBody() {
+  BodyWriter body;
+  body.gameStart();
+  body.sync(100, true);
+  body.command(move(2));
+  body.viewLock();
+  body.sync(250);
+  body.chat("@#2gl hf");
+  body.command(research(3, 102));  // Castle Age
+  body.command(research(3, 4));    // not an age
+  body.sync(50);
+  body.command(resign(1, true));
+  return body;
+}
+
+static void checkSample(const Recorder& recorder) {
+  CHECK(recorder.syncs.size() == 3);
+  CHECK(recorder.syncs.size() == 3 && recorder.syncs[0].time == 100 && recorder.syncs[1].time == 350 &&
+    recorder.syncs[2].time == 400 && recorder.syncs[2].delta == 50);
+  CHECK(recorder.commands.size() == 4);
+  CHECK(recorder.players.size() == 4 && recorder.players[0] == 2 && recorder.players[1] == 3 &&
+    recorder.players[3] == 1);
+  CHECK(recorder.chats.size() == 1 && recorder.chats[0] == "@#2gl hf");
+  CHECK(recorder.ageUps.size() == 1);
+  CHECK(recorder.ageUps.size() == 1 && recorder.ageUps[0].player == 3 &&
+    recorder.ageUps[0].age == StartingAge::CASTLE_AGE && recorder.ageUps[0].time == 350);
+  CHECK(recorder.resigns.size() == 1 && recorder.resigns[0].player == 1 && recorder.resigns[0].disconnected);
+}
+
+static void testParse(const std::string& fileName) {
+  std::string data = sampleBody().data();
+  writeFile(fileName, data);
+  // chunks smaller than an operation take the growing path of the buffer
+  const size_t chunkSizes[] = { 8, 16, 100, BodyParser::DEFAULT_CHUNK_SIZE };
+  for (size_t chunkSize : chunkSizes) {
+    BodyParser parser(fileName, chunkSize);
+    Recorder recorder;
+    CHECK(parser.parse(recorder));
+    checkSample(recorder);
+    CHECK(parser.position() == data.size());
+    CHECK(parser.time() == 400);
+  }
+}
+
+static void testStop(const std::string& fileName) {
+  writeFile(fileName, sampleBody().data());
+  BodyParser parser(fileName);
+  Recorder recorder;
+  recorder.stopAfter = 1;
+  CHECK(!parser.parse(recorder));
+  CHECK(recorder.commands.size() == 1 && recorder.syncs.size() == 1);
+}
+
+// The file grows between the calls, every split point lands the same events
+static void testGrowing(const std::string& fileName) {
+  std::string data = sampleBody().data();
+  for (size_t split = 12; split <= data.size(); ++split) {
+    writeFile(fileName, data.substr(0, split));
+    BodyParser parser(fileName, 16);
+    Recorder recorder;
+    CHECK(parser.parse(recorder));
+    CHECK(parser.position() <= split);
+    {
+      std::FILE* file = std::fopen(fileName.c_str(), "ab");
+      std::fwrite(data.data() + split, 1, data.size() - split, file);
+      std::fclose(file);
+    }
+    CHECK(parser.parse(recorder));
+    checkSample(recorder);
+    CHECK(parser.position() == data.size());
+  }
+}
+
+static void testMalformed(const std::string& fileName) {
+  Recorder recorder;
+  BodyWriter unknown;
+  unknown.sync(100);
+  unknown.putInt32(9);  // no such operation
+  unknown.putInt32(0);
+  writeFile(fileName, unknown.data());
+  {
+    BodyParser parser(fileName);
+    CHECK_THROWS(parser.parse(recorder));
+    CHECK(recorder.syncs.size() == 1);
+  }
+
+  BodyWriter empty;
+  empty.command(std::vector<unsigned char>());
+  writeFile(fileName, empty.data());
+  {
+    BodyParser parser(fileName);
+    CHECK_THROWS(parser.parse(recorder));
+  }
+
+  BodyWriter huge;
+  huge.putInt32(static_cast<int>(BodyOperation::COMMAND));
+  huge.putInt32(static_cast<int>(BodyParser::MAX_OPERATION_SIZE + 1));
+  writeFile(fileName, huge.data());
+  {
+    BodyParser parser(fileName);
+    CHECK_THROWS(parser.parse(recorder));
+  }
+
+  BodyWriter chat;
+  chat.putInt32(static_cast<int>(BodyOperation::META));
+  chat.putInt32(-1);
+  chat.putInt32(-5);
+  writeFile(fileName, chat.data());
+  {
+    BodyParser parser(fileName);
+    CHECK_THROWS(parser.parse(recorder));
+  }
+
+  BodyWriter meta;
+  meta.putInt32(static_cast<int>(BodyOperation::META));
+  meta.putInt32(0x1234);
+  writeFile(fileName, meta.data());
+  {
+    BodyParser parser(fileName);
+    CHECK_THROWS(parser.parse(recorder));
+  }
+}
+
+int main() {
+  std::string fileName = tempPath("bodyparser.mgx");
+  try {
+    testParse(fileName);
+    testStop(fileName);
+    testGrowing(fileName);
+    testMalformed(fileName);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(fileName.c_str());
+  return testResult("bodyparsertest");
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Builds recorded game bodies operation by operation, behind a 12 byte placeholder
+// header like the synthetic body of bench/commandlogbench.cpp.
+
+#ifndef _BODYWRITER_H_
+#define _BODYWRITER_H_
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../bodyparser.h"
+
+class BodyWriter {
+public:
+  BodyWriter(void) {
+    putInt32(12);  // header length
+    putInt32(0);
+    putInt32(0);
+  }
+  const std::string& data() const { return mData; }
+  void putInt32(int value) {
+    mData.append(reinterpret_cast<const char*>(&value), 4);
+  }
+  void putFloat(float value) {
+    mData.append(reinterpret_cast<const char*>(&value), 4);
+  }
+  // the short form, the long one has a zero third field and 28 more bytes
+  void sync(unsigned int delta, bool longForm = false) {
+    putInt32(static_cast<int>(RecAnalystWrapper::BodyOperation::SYNC));
+    putInt32(static_cast<int>(delta));
+    putInt32(longForm ? 0 : 1);
+    mData.append(longForm ? 40 : 12, '\0');
+  }
+  void command(const std::vector<unsigned char>& payload) {
+    putInt32(static_cast<int>(RecAnalystWrapper::BodyOperation::COMMAND));
+    putInt32(static_cast<int>(payload.size()));
+    mData.append(reinterpret_cast<const char*>(payload.data()), payload.size());
+    putInt32(0);
+  }
+  void viewLock() {
+    putInt32(static_cast<int>(RecAnalystWrapper::BodyOperation::VIEWLOCK));
+    mData.append(12, '\0');
+  }
+  void gameStart() {  // MGX form
+    putInt32(static_cast<int>(RecAnalystWrapper::BodyOperation::META));
+    putInt32(0x01F4);
+    mData.append(20, '\0');
+  }
+  void chat(const std::string& text) {
+    putInt32(static_cast<int>(RecAnalystWrapper::BodyOperation::META));
+    putInt32(-1);
+    putInt32(static_cast<int>(text.size() + 1));
+    mData.append(text);
+    mData.push_back('\0');
+  }
+private:
+  std::string mData;
+};
+
+#endif  //_BODYWRITER_H_
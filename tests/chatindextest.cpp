@@ -0,0 +1,282 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// ChatIndex against a brute force search of the same messages, save/load round trips
+// and malformed index files.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../chatindex.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+struct AddedMessage {
+  ReplayHash replay;
+  unsigned int time;
+  PlayerColor color;
+  bool preGame;
+  std::string msg;
+};
+
+static const char* const WORDS[] = { "gg", "wp", "GL", "hf", "rush", "Rushing", "castle", "boom",
+  "wololo", "11", "lag", "mangonel", "mango", "go", "ff", "xbow", "push", "deer", "boar", "ARABIA" };
+
+static std::vector<AddedMessage> randomMessages(unsigned int count) {
+  Lcg lcg(count);
+  std::vector<AddedMessage> messages;
+  ReplayHash replay = hashReplayData("0", 1);
+  for (unsigned int n = 0; n < count; ++n) {
+    if (lcg.next(20) == 0) {
+      std::string seed = std::to_string(n);
+      replay = hashReplayData(seed.data(), seed.size());
+    }
+    AddedMessage message;
+    message.replay = replay;
+    message.time = n * 1000;
+    message.color = static_cast<PlayerColor>(lcg.next(9));
+    message.preGame = lcg.next(4) == 0;
+    for (unsigned int i = 0, words = 1 + lcg.next(8); i < words; ++i) {
+      message.msg += (i == 0) ? "" : (lcg.next(3) ? " " : ",");
+      message.msg += WORDS[lcg.next(sizeof(WORDS) / sizeof(WORDS[0]))];
+    }
+    if (lcg.next(50) == 0) {
+      message.msg += "\xC3\xA9t\xC3\xA9";  // bytes above 0x7F are word characters
+    }
+    messages.push_back(message);
+  }
+  return messages;
+}
+
+static char lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+static bool isWordChar(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    static_cast<unsigned char>(c) >= 0x80;
+}
+
+static bool matches(const std::string& msg, const std::string& query, ChatQuery mode) {
+  std::string text;
+  std::string needle;
+  for (char c : msg) text += lower(c);
+  for (char c : query) needle += lower(c);
+  for (std::size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1)) {
+    if (mode == ChatQuery::SUBSTRING) {
+      return true;
+    }
+    if ((pos == 0 || !isWordChar(text[pos - 1])) &&
+        (pos + needle.size() == text.size() || !isWordChar(text[pos + needle.size()]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool sameHits(const std::vector<ChatHit>& hits, const std::vector<const AddedMessage*>& expected) {
+  if (hits.size() != expected.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < hits.size(); ++i) {
+    const AddedMessage& m = *expected[i];
+    if (hits[i].replay != m.replay || hits[i].time != m.time || hits[i].color != m.color ||
+        hits[i].preGame != m.preGame || hits[i].msg != m.msg) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static const char* const QUERIES[] = { "gg", "GG", "rush", "mango", "mangonel", "go", "castle boom",
+  "xbow push", "wp,", "\xC3\xA9t", "arabia", "nothing like it", "o" };
+
+static void checkQueries(const ChatIndex& index, const std::vector<AddedMessage>& messages) {
+  for (const char* query : QUERIES) {
+    for (ChatQuery mode : { ChatQuery::SUBSTRING, ChatQuery::TOKEN }) {
+      std::vector<const AddedMessage*> expected;
+      for (auto it = messages.cbegin(); it != messages.cend(); ++it) {
+        if (matches(it->msg, query, mode)) {
+          expected.push_back(&*it);
+        }
+      }
+      if (!sameHits(index.find(query, mode), expected)) {
+        std::fprintf(stderr, "query \"%s\" mode %d\n", query, static_cast<int>(mode));
+        CHECK(false);
+      }
+      std::vector<ChatHit> limited = index.find(query, mode, 3);
+      expected.resize(std::min<std::size_t>(expected.size(), 3));
+      CHECK(sameHits(limited, expected));
+    }
+  }
+}
+
+static void fill(ChatIndex& index, const std::vector<AddedMessage>& messages) {
+  for (auto it = messages.cbegin(); it != messages.cend(); ++it) {
+    index.add(it->replay, it->time, it->color, it->preGame, it->msg);
+  }
+}
+
+static void testFind() {
+  std::vector<AddedMessage> messages = randomMessages(6000);
+  ChatIndex index;
+  fill(index, messages);
+  CHECK(index.messages() == messages.size());
+  CHECK(index.blocks() > 3);
+  checkQueries(index, messages);  // the last block still open
+  index.flush();
+  checkQueries(index, messages);
+
+  ChatIndex empty;
+  CHECK(empty.find("gg").empty());
+  empty.add(messages[0].replay, 0, PlayerColor::BLUE, false, "");
+  CHECK(empty.messages() == 0);
+  CHECK(index.find("").empty());
+}
+
+static void testRoundTrip(const std::string& fileName) {
+  std::vector<AddedMessage> messages = randomMessages(3000);
+  ChatIndex index;
+  fill(index, messages);
+  index.save(fileName);
+  ChatIndex loaded;
+  loaded.load(fileName);
+  CHECK(loaded.messages() == index.messages() && loaded.blocks() == index.blocks());
+  CHECK(loaded.textBytes() == index.textBytes() && loaded.compressedBytes() == index.compressedBytes());
+  checkQueries(loaded, messages);
+
+  // a loaded index takes more messages
+  std::vector<AddedMessage> more = randomMessages(500);
+  fill(loaded, more);
+  messages.insert(messages.end(), more.begin(), more.end());
+  checkQueries(loaded, messages);
+
+  ChatIndex empty;
+  empty.save(fileName);
+  loaded.load(fileName);
+  CHECK(loaded.messages() == 0 && loaded.blocks() == 0);
+  CHECK_THROWS(loaded.load(fileName + ".missing"));
+}
+
+// One replay, three messages, one block each
+static std::string threeBlocks(const std::string& fileName) {
+  ChatIndex index;
+  ReplayHash replay = hashReplayData("p", 1);
+  for (int n = 0; n < 3; ++n) {
+    index.add(replay, n, PlayerColor::BLUE, false, "qqq " + std::string(10000, 'a' + n));
+  }
+  CHECK(index.blocks() == 3);
+  index.save(fileName);
+  return readFile(fileName);
+}
+
+template <typename T>
+static void patch(std::string& image, std::size_t offset, T value) {
+  image.replace(offset, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool loads(const std::string& fileName, const std::string& image) {
+  writeFile(fileName, image);
+  ChatIndex loaded;
+  try {
+    loaded.load(fileName);
+  } catch (const ERecAnalystException&) {
+    CHECK(loaded.messages() == 0 && loaded.blocks() == 0);
+    return false;
+  }
+  return true;
+}
+
+// Layout: magic, replay hashes and messages as counted arrays, the block count, then
+// per block text size, first message and compressed data, then the posting lists
+static void testMalformed(const std::string& fileName) {
+  const std::size_t MESSAGES = 48;
+  const std::size_t FIRST_REPLAY = MESSAGES + 8;
+  const std::size_t BLOCKS = MESSAGES + 8 + 3 * 12;
+  const std::size_t TEXT_SIZE = BLOCKS + 8;
+  const std::size_t FIRST_MESSAGE = TEXT_SIZE + 4;
+  const std::size_t DATA = FIRST_MESSAGE + 4;
+  std::string image = threeBlocks(fileName);
+  CHECK(loads(fileName, image));
+  checkTruncations(image, [&fileName](const std::string& truncated) { return loads(fileName, truncated); });
+
+  std::string bad = image;
+  patch<unsigned long long>(bad, MESSAGES, 1ULL << 40);
+  CHECK(!loads(fileName, bad));
+  bad = image;
+  patch<unsigned long long>(bad, BLOCKS, 4);  // more blocks than messages
+  CHECK(!loads(fileName, bad));
+  bad = image;
+  patch<std::uint32_t>(bad, TEXT_SIZE, 0xFFFFFFFFu);
+  CHECK(!loads(fileName, bad));
+  bad = image;
+  patch<std::uint32_t>(bad, FIRST_MESSAGE, 2);  // the next block starts at message 1
+  CHECK(!loads(fileName, bad));
+  bad = image;
+  patch<std::uint32_t>(bad, FIRST_REPLAY, 1);
+  CHECK(!loads(fileName, bad));
+  bad = image;
+  patch<unsigned long long>(bad, DATA, 1ULL << 40);
+  CHECK(!loads(fileName, bad));
+
+  // the compressed text is only checked when a search opens it
+  bad = image;
+  bad[DATA + 8 + 4] ^= 0x55;
+  CHECK(loads(fileName, bad));
+  ChatIndex loaded;
+  loaded.load(fileName);
+  CHECK_THROWS(loaded.find("qqq"));
+}
+
+// A posting list must be sorted, a block id out of range anywhere in it is rejected
+static void testUnsortedPostings(const std::string& fileName) {
+  std::string image = threeBlocks(fileName);
+  std::string posting;
+  std::uint32_t key = 'q' << 16 | 'q' << 8 | 'q';
+  unsigned long long count = 3;
+  std::uint32_t blocks[3] = { 0, 1, 2 };
+  posting.append(reinterpret_cast<const char*>(&key), sizeof(key));
+  posting.append(reinterpret_cast<const char*>(&count), sizeof(count));
+  posting.append(reinterpret_cast<const char*>(blocks), sizeof(blocks));
+  std::size_t offset = image.find(posting);
+  CHECK(offset != std::string::npos);
+  if (offset == std::string::npos) {
+    return;
+  }
+  std::string bad = image;
+  patch<std::uint32_t>(bad, offset + 12, 1000);
+  CHECK(!loads(fileName, bad));
+  bad = image;
+  patch<std::uint32_t>(bad, offset + 12, 1);  // 1, 1, 2
+  CHECK(!loads(fileName, bad));
+}
+
+int main() {
+  std::string fileName = tempPath("chatindex.rachat");
+  try {
+    testFind();
+    testRoundTrip(fileName);
+    testMalformed(fileName);
+    testUnsortedPostings(fileName);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(fileName.c_str());
+  return testResult("chatindextest");
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// CommandLog round trips against the body it was extracted from, seeking by time and
+// malformed logs.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../bodyparser.h"
+#include "../commandlog.h"
+#include "bodywriter.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+struct StoredCommand {
+  unsigned int time;
+  int player;
+  BodyCommand type;
+  std::vector<unsigned char> data;
+  bool operator==(const StoredCommand& other) const {
+    return time == other.time && player == other.player && type == other.type && data == other.data;
+  }
+};
+
+struct Collector : public BodyVisitor {
+  std::vector<StoredCommand> commands;
+  bool onCommand(const CommandEvent& command) {
+    StoredCommand stored = { command.time, command.player, command.type,
+      std::vector<unsigned char>(command.data, command.data + command.length) };
+    commands.push_back(stored);
+    return true;
+  }
+};
+
+static void putInt32(std::vector<unsigned char>& payload, int value) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(&value);
+  payload.insert(payload.end(), p, p + 4);
+}
+
+// Known layouts with consistent and inconsistent unit counts, unknown types and
+// payloads shorter than their layout
+static std::string randomBody(unsigned int seed, unsigned int commands) {
+  static const BodyCommand TYPES[] = { BodyCommand::MOVE, BodyCommand::INTERACT, BodyCommand::BUILD,
+    BodyCommand::TRAIN, BodyCommand::RESEARCH, BodyCommand::STOP, BodyCommand::DELETE, BodyCommand::SELL };
+  Lcg lcg(seed);
+  BodyWriter body;
+  for (unsigned int n = 0; n < commands; ++n) {
+    if (lcg.next(3) == 0) {
+      body.sync(lcg.next(3) == 0 ? 0 : 1 + lcg.next(2000));
+    }
+    std::vector<unsigned char> payload;
+    unsigned int kind = lcg.next(10);
+    if (kind < 8) {
+      payload.push_back(static_cast<unsigned char>(TYPES[kind]));
+      payload.push_back(static_cast<unsigned char>(lcg.next(9)));
+      payload.insert(payload.end(), 2, 0);
+      unsigned int units = lcg.next(20);
+      if (lcg.next(4) != 0) {
+        putInt32(payload, 1000 + static_cast<int>(lcg.next(5000)));
+        payload.push_back(static_cast<unsigned char>(units));
+        payload.insert(payload.end(), 3, 0);
+        putInt32(payload, static_cast<int>(lcg.next(0xFFFFFFFFu)));
+        putInt32(payload, static_cast<int>(lcg.next(0xFFFFFFFFu)));
+        for (unsigned int i = 0; i < units; ++i) {
+          putInt32(payload, 2000 + static_cast<int>(lcg.next(100000)));
+        }
+      }
+      // cut anywhere, the rest column has to cover whatever the layout does not
+      if (lcg.next(5) == 0) {
+        payload.resize(1 + lcg.next(static_cast<unsigned int>(payload.size())));
+      }
+    } else {
+      payload.push_back(static_cast<unsigned char>(lcg.next(256)));
+      for (unsigned int i = 0, size = lcg.next(64); i < size; ++i) {
+        payload.push_back(static_cast<unsigned char>(lcg.next(256)));
+      }
+    }
+    body.command(payload);
+  }
+  return body.data();
+}
+
+// As the log returns them: it keeps a player index in a byte, larger ones (RESEARCH
+// reads it from a 16-bit field) come back unattributed
+static std::vector<StoredCommand> parseBody(const std::string& fileName) {
+  BodyParser parser(fileName);
+  Collector collector;
+  parser.parse(collector);
+  for (auto it = collector.commands.begin(); it != collector.commands.end(); ++it) {
+    if (it->player >= 255) {
+      it->player = -1;
+    }
+  }
+  return collector.commands;
+}
+
+static std::vector<StoredCommand> replayLog(CommandLog& log, unsigned int fromTime = 0) {
+  Collector collector;
+  CHECK(log.replay(collector, fromTime));
+  return collector.commands;
+}
+
+static std::vector<unsigned char> extractLog(const std::string& fileName, unsigned int blockSize) {
+  CommandLogWriter writer(blockSize);
+  writer.extract(fileName);
+  std::vector<unsigned char> log;
+  writer.finish(log);
+  return log;
+}
+
+static void testRoundTrip(const std::string& bodyName, const std::string& logName) {
+  const unsigned int blockSizes[] = { 1, 7, CommandLogWriter::DEFAULT_BLOCK_SIZE };
+  const unsigned int commandCounts[] = { 0, 1, 3000 };
+  for (unsigned int commands : commandCounts) {
+    writeFile(bodyName, randomBody(commands + 1, commands));
+    std::vector<StoredCommand> expected = parseBody(bodyName);
+    CHECK(expected.size() == commands);
+    for (unsigned int blockSize : blockSizes) {
+      CommandLog log;
+      log.assign(extractLog(bodyName, blockSize));
+      CHECK(log.size() == commands);
+      CHECK(log.blockCount() == (commands + blockSize - 1) / blockSize);
+      CHECK(replayLog(log) == expected);
+      // and again, decoding is not affected by the block decoded before
+      CHECK(replayLog(log) == expected);
+
+      CommandLogWriter writer(blockSize);
+      writer.extract(bodyName);
+      writer.save(logName);
+      CommandLog loaded;
+      loaded.load(logName);
+      CHECK(replayLog(loaded) == expected);
+    }
+  }
+}
+
+static void testSeek(const std::string& bodyName) {
+  writeFile(bodyName, randomBody(42, 2000));
+  std::vector<StoredCommand> expected = parseBody(bodyName);
+  CommandLog log;
+  log.assign(extractLog(bodyName, 64));
+  const unsigned int times[] = { 0, 1, 5000, 100000, expected.back().time, expected.back().time + 1 };
+  for (unsigned int time : times) {
+    std::vector<StoredCommand> tail;
+    for (auto it = expected.cbegin(); it != expected.cend(); ++it) {
+      if (it->time >= time) {
+        tail.push_back(*it);
+      }
+    }
+    CHECK(replayLog(log, time) == tail);
+    size_t block = log.findBlock(time);
+    CHECK(block <= log.blockCount());
+    if (block < log.blockCount() && !log.decodeBlock(block).empty()) {
+      CHECK(log.decodeBlock(block).front().time <= time || block == 0);
+    }
+  }
+}
+
+static void putUInt32(std::vector<unsigned char>& log, std::size_t offset, unsigned int value) {
+  std::memcpy(&log[offset], &value, 4);
+}
+
+static bool assignsAndDecodes(const std::vector<unsigned char>& log) {
+  CommandLog reader;
+  reader.assign(log);
+  Collector collector;
+  reader.replay(collector);
+  return true;
+}
+
+// Layout: magic, version, count, blocks, block size at 0..19, then 12 bytes of
+// first time, offset and count per block
+static void testMalformed(const std::string& bodyName) {
+  writeFile(bodyName, randomBody(3, 20));
+  std::vector<unsigned char> valid = extractLog(bodyName, 16);
+  CHECK(valid.size() > 20 + 2 * 12);
+  checkTruncations(std::string(valid.begin(), valid.end()), [](const std::string& image) {
+    return assignsAndDecodes(std::vector<unsigned char>(image.begin(), image.end()));
+  });
+
+  std::vector<unsigned char> log = valid;
+  putUInt32(log, 0, 0x4C434153);
+  CHECK_THROWS(assignsAndDecodes(log));
+  log = valid;
+  putUInt32(log, 4, 1);  // the version before the field columns
+  CHECK_THROWS(assignsAndDecodes(log));
+
+  // counts the image cannot hold are rejected before anything is sized by them
+  log = valid;
+  putUInt32(log, 8, 0x7FFFFFFF);
+  putUInt32(log, 16, 0x7FFFFFFF);
+  putUInt32(log, 20 + 8, 0x7FFFFFFF - 4);
+  CHECK_THROWS(assignsAndDecodes(log));
+  log = valid;
+  putUInt32(log, 12, 0x7FFFFFFF);
+  CHECK_THROWS(assignsAndDecodes(log));
+
+  // block counts that do not add up, or exceed the block size
+  log = valid;
+  putUInt32(log, 8, 21);
+  CHECK_THROWS(assignsAndDecodes(log));
+  log = valid;
+  putUInt32(log, 20 + 8, 17);
+  putUInt32(log, 20 + 12 + 8, 3);
+  CHECK_THROWS(assignsAndDecodes(log));
+  log = valid;
+  putUInt32(log, 20 + 8, 0);
+  putUInt32(log, 20 + 12 + 8, 20);
+  CHECK_THROWS(assignsAndDecodes(log));
+
+  // a consistent index whose last block starts at the last data byte
+  log = valid;
+  putUInt32(log, 20 + 12 + 4, static_cast<unsigned int>(log.size() - 20 - 2 * 12 - 1));
+  CHECK_THROWS(assignsAndDecodes(log));
+  log = valid;
+  putUInt32(log, 20 + 12 + 4, static_cast<unsigned int>(log.size()));
+  CHECK_THROWS(assignsAndDecodes(log));
+}
+
+int main() {
+  std::string bodyName = tempPath("commandlog.mgx");
+  std::string logName = tempPath("commandlog.racl");
+  try {
+    testRoundTrip(bodyName, logName);
+    testSeek(bodyName);
+    testMalformed(bodyName);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(bodyName.c_str());
+  std::remove(logName.c_str());
+  return testResult("commandlogtest");
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// LiveAnalyst: refreshes of a file that grows between them, and a refresh that
+// meets a malformed operation.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../liveanalyst.h"
+#include "bodywriter.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+static std::vector<unsigned char> tribute(int from, int to, float amount) {
+  std::vector<unsigned char> payload(12, 0);
+  float fee = 0.3f;
+  payload[0] = static_cast<unsigned char>(BodyCommand::TRIBUTE);
+  payload[1] = static_cast<unsigned char>(from);
+  payload[2] = static_cast<unsigned char>(to);
+  payload[3] = static_cast<unsigned char>(Resource::GOLD);
+  std::memcpy(&payload[4], &amount, sizeof(amount));
+  std::memcpy(&payload[8], &fee, sizeof(fee));
+  return payload;
+}
+
+static std::vector<unsigned char> research(int player, int id) {
+  std::vector<unsigned char> payload(16, 0);
+  payload[0] = static_cast<unsigned char>(BodyCommand::RESEARCH);
+  payload[8] = static_cast<unsigned char>(player);
+  payload[10] = static_cast<unsigned char>(id & 0xFF);
+  payload[11] = static_cast<unsigned char>(id >> 8);
+  return payload;
+}
+
+static void append(const std::string& fileName, const std::string& data) {
+  std::FILE* file = std::fopen(fileName.c_str(), "ab");
+  std::fwrite(data.data(), 1, data.size(), file);
+  std::fclose(file);
+}
+
+static void testGrowing(const std::string& fileName) {
+  BodyWriter body;
+  body.sync(100);
+  body.chat("@#1gl hf");
+  std::size_t first = body.data().size();
+  body.command(tribute(1, 2, 100.0f));
+  body.sync(100);
+  body.command(research(2, 101));  // Feudal Age
+  std::size_t second = body.data().size();
+  body.sync(100);
+  body.chat("no prefix");
+  std::string data = body.data();
+
+  writeFile(fileName, data.substr(0, first + 5));  // the tribute cut off
+  LiveAnalyst analyst(fileName);
+  std::vector<LiveDelta> deltas;
+  analyst.subscribe([&deltas](const LiveDelta& delta) { deltas.push_back(delta); });
+  CHECK(analyst.refresh() == first - 12);  // after the header
+  CHECK(analyst.position() == first && analyst.time() == 100);
+  CHECK(deltas.size() == 1 && deltas[0].time == 100 && deltas[0].chatMessages.size() == 1);
+  CHECK(analyst.inGameChatMessages().size() == 1);
+  CHECK(analyst.inGameChatMessages()[0].player == 1 && analyst.inGameChatMessages()[0].msg == "gl hf");
+
+  // nothing new, nothing published
+  CHECK(analyst.refresh() == 0);
+  CHECK(deltas.size() == 1);
+
+  append(fileName, data.substr(first + 5, second - first - 5));
+  CHECK(analyst.refresh() == second - first);
+  CHECK(deltas.size() == 2 && deltas[1].time == 200);
+  CHECK(deltas[1].chatMessages.empty() && deltas[1].tributes.size() == 1 && deltas[1].researches.size() == 1);
+  CHECK(deltas[1].ageUps.size() == 1 && deltas[1].ageUps[0].age == StartingAge::FEUDAL_AGE);
+  const LiveTribute& sent = analyst.tributes().at(0);
+  CHECK(sent.playerFrom == 1 && sent.playerTo == 2 && sent.resource == Resource::GOLD && sent.amount == 100);
+  CHECK(analyst.researches().size() == 1 && analyst.researches()[0].id == 101 &&
+    analyst.researches()[0].player == 2 && analyst.researches()[0].time == 200);
+
+  append(fileName, data.substr(second));
+  CHECK(analyst.refresh() == data.size() - second);
+  CHECK(analyst.time() == 300 && analyst.position() == data.size());
+  CHECK(analyst.inGameChatMessages().size() == 2 && analyst.inGameChatMessages()[1].player == 0);
+  CHECK(analyst.tributes().size() == 1 && analyst.ageUps().size() == 1);
+}
+
+// What came before a malformed operation is kept and handed out before the throw
+static void testMalformed(const std::string& fileName) {
+  BodyWriter body;
+  body.sync(100);
+  body.chat("@#2before");
+  std::size_t good = body.data().size();
+  body.putInt32(9);  // no such operation
+  body.putInt32(0);
+  writeFile(fileName, body.data());
+
+  LiveAnalyst analyst(fileName);
+  std::vector<LiveDelta> deltas;
+  analyst.subscribe([&deltas](const LiveDelta& delta) { deltas.push_back(delta); });
+  CHECK_THROWS(analyst.refresh());
+  CHECK(analyst.position() == good && analyst.time() == 100);
+  CHECK(analyst.inGameChatMessages().size() == 1 && analyst.inGameChatMessages()[0].msg == "before");
+  CHECK(deltas.size() == 1 && deltas[0].chatMessages.size() == 1);
+
+  // the same operation again, nothing new to hand out
+  CHECK_THROWS(analyst.refresh());
+  CHECK(analyst.inGameChatMessages().size() == 1 && deltas.size() == 1);
+}
+
+int main() {
+  std::string fileName = tempPath("liveanalyst.mgx");
+  try {
+    testGrowing(fileName);
+    testMalformed(fileName);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(fileName.c_str());
+  return testResult("liveanalysttest");
+}
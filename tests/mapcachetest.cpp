@@ -0,0 +1,141 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// MapCache: both tiers, reuse of a directory, eviction, images removed behind the
+// cache's back and writes a previous run did not finish.
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "../mapcache.h"
+#include "testutil.h"
+
+namespace fs = std::filesystem;
+
+using namespace RecAnalystWrapper;
+
+static std::vector<char> image(std::size_t size, char fill) {
+  return std::vector<char>(size, fill);
+}
+
+static std::string entryName(ReplayHash hash, int width, int height) {
+  return replayHashToString(hash) + "_" + std::to_string(width) + "x" + std::to_string(height) + ".png";
+}
+
+static void testTiers(const std::string& directory) {
+  ReplayHash a = hashReplayData("a", 1);
+  ReplayHash b = hashReplayData("b", 1);
+  std::vector<char> png;
+  {
+    MapCache cache(directory, 1000);
+    CHECK(!cache.lookup(a, 100, 100, png));
+    cache.store(a, 100, 100, image(100, 'a'));
+    cache.store(a, 200, 200, image(200, 'A'));
+    CHECK(cache.lookup(a, 100, 100, png) && png == image(100, 'a'));
+    CHECK(cache.lookup(a, 200, 200, png) && png == image(200, 'A'));
+    CHECK(!cache.lookup(b, 100, 100, png));
+    // a second store replaces the image
+    cache.store(a, 100, 100, image(150, 'x'));
+    CHECK(cache.lookup(a, 100, 100, png) && png == image(150, 'x'));
+    MapCacheStats stats = cache.stats();
+    CHECK(stats.memoryHits == 3 && stats.diskHits == 0 && stats.misses == 2);
+    CHECK(stats.diskBytes == 350 && stats.memoryBytes == 350);
+  }
+
+  // a new cache on the same directory serves the images from disk
+  MapCache cache(directory, 1000);
+  CHECK(cache.stats().diskBytes == 350);
+  CHECK(cache.lookup(a, 100, 100, png) && png == image(150, 'x'));
+  CHECK(cache.lookup(a, 100, 100, png));
+  MapCacheStats stats = cache.stats();
+  CHECK(stats.diskHits == 1 && stats.memoryHits == 1 && stats.bytesServed == 300);
+  cache.clear();
+  CHECK(cache.stats().diskBytes == 0 && !cache.lookup(a, 200, 200, png));
+  CHECK(fs::is_empty(directory));
+}
+
+static void testEviction(const std::string& directory) {
+  MapCache cache(directory, 250, 0);  // disk only
+  ReplayHash hashes[3] = { hashReplayData("1", 1), hashReplayData("2", 1), hashReplayData("3", 1) };
+  std::vector<char> png;
+  cache.store(hashes[0], 10, 10, image(100, '1'));
+  cache.store(hashes[1], 10, 10, image(100, '2'));
+  CHECK(cache.lookup(hashes[0], 10, 10, png));  // the second is now the oldest used
+  cache.store(hashes[2], 10, 10, image(100, '3'));
+  CHECK(cache.stats().evictions == 1 && cache.stats().diskBytes == 200);
+  CHECK(!fs::exists(fs::path(directory) / entryName(hashes[1], 10, 10)));
+  CHECK(!cache.lookup(hashes[1], 10, 10, png));
+  CHECK(cache.lookup(hashes[0], 10, 10, png) && cache.lookup(hashes[2], 10, 10, png));
+
+  // larger than the whole store, not kept
+  cache.store(hashes[1], 10, 10, image(300, '2'));
+  CHECK(!cache.lookup(hashes[1], 10, 10, png) && cache.stats().diskBytes == 200);
+  cache.clear();
+}
+
+// An image that disappears is a miss and leaves the index, a new store brings it back
+static void testRemoved(const std::string& directory) {
+  MapCache cache(directory, 1000, 0);
+  ReplayHash hash = hashReplayData("r", 1);
+  std::vector<char> png;
+  cache.store(hash, 10, 10, image(100, 'r'));
+  fs::remove(fs::path(directory) / entryName(hash, 10, 10));
+  CHECK(!cache.lookup(hash, 10, 10, png));
+  CHECK(cache.stats().diskBytes == 0 && cache.stats().misses == 1);
+  cache.store(hash, 10, 10, image(100, 'r'));
+  CHECK(cache.lookup(hash, 10, 10, png) && png == image(100, 'r'));
+  CHECK(cache.stats().diskBytes == 100);
+
+  // an empty file is unreadable too
+  writeFile((fs::path(directory) / entryName(hash, 10, 10)).string(), "");
+  CHECK(!cache.lookup(hash, 10, 10, png));
+  CHECK(cache.stats().diskBytes == 0 && !fs::exists(fs::path(directory) / entryName(hash, 10, 10)));
+  cache.clear();
+}
+
+static void testUnfinished(const std::string& directory) {
+  ReplayHash hash = hashReplayData("u", 1);
+  fs::path unfinished = fs::path(directory) / (entryName(hash, 10, 10) + ".7.tmp");
+  fs::path other = fs::path(directory) / "notes.tmp";
+  writeFile(unfinished.string(), std::string(100, 'u'));
+  writeFile(other.string(), "kept");
+  MapCache cache(directory, 1000);
+  CHECK(!fs::exists(unfinished));
+  CHECK(fs::exists(other));
+  CHECK(cache.stats().diskBytes == 0);
+  std::vector<char> png;
+  CHECK(!cache.lookup(hash, 10, 10, png));
+  fs::remove(other);
+}
+
+int main() {
+  std::string directory = tempPath("mapcache");
+  std::error_code ec;
+  fs::remove_all(directory, ec);
+  try {
+    testTiers(directory);
+    testEviction(directory);
+    testRemoved(directory);
+    testUnfinished(directory);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  fs::remove_all(directory, ec);
+  return testResult("mapcachetest");
+}
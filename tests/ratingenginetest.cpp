@@ -0,0 +1,218 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// RatingEngine: rating rules, options, snapshots and malformed snapshots.
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <string>
+#include "../ratingengine.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+static const unsigned int FULL_GAME = 30 * 60 * 1000;
+
+static RatingOutcome duel(RatingEngine& engine, const char* winner, const char* loser,
+    unsigned int playTime = FULL_GAME) {
+  MatchPlayer players[2] = { { engine.playerId(winner), 1, true }, { engine.playerId(loser), 2, false } };
+  return engine.addMatch(players, 2, playTime);
+}
+
+static bool sameEngine(const RatingEngine& a, const RatingEngine& b) {
+  if (a.players() != b.players() || a.matches() != b.matches()) {
+    return false;
+  }
+  for (std::uint32_t id = 1; id <= a.players(); ++id) {
+    const PlayerRating* other = b.rating(a.playerName(id));
+    const PlayerRating& rating = a.rating(id);
+    if (other == NULL || other->rating != rating.rating || other->games != rating.games ||
+        other->wins != rating.wins) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void testRating() {
+  RatingEngine engine;
+  CHECK(duel(engine, "a", "b") == RatingOutcome::RATED);
+  const PlayerRating* a = engine.rating("a");
+  const PlayerRating* b = engine.rating("b");
+  CHECK(a != NULL && b != NULL);
+  // equal ratings, provisional K: half of it either way
+  CHECK(a != NULL && std::fabs(a->rating - 1524.0) < 1e-9 && a->games == 1 && a->wins == 1);
+  CHECK(b != NULL && std::fabs(b->rating - 1476.0) < 1e-9 && b->games == 1 && b->wins == 0);
+  CHECK(engine.matches() == 1 && engine.players() == 2);
+  CHECK(engine.rating("c") == NULL);
+
+  // a game at the midpoint of the weighting window counts half
+  RatingOptions options;
+  RatingEngine weighted(options);
+  CHECK(duel(weighted, "a", "b", (options.minPlayTime + options.fullWeightTime) / 2) == RatingOutcome::RATED);
+  CHECK(std::fabs(weighted.rating("a")->rating - 1512.0) < 1e-9);
+
+  CHECK(duel(engine, "a", "b", options.minPlayTime - 1) == RatingOutcome::SKIPPED_SHORT);
+  MatchPlayer sameTeam[2] = { { engine.playerId("a"), 1, true }, { engine.playerId("b"), 1, false } };
+  CHECK(engine.addMatch(sameTeam, 2, FULL_GAME) == RatingOutcome::SKIPPED_ONE_TEAM);
+  MatchPlayer noWinner[2] = { { engine.playerId("a"), 1, false }, { engine.playerId("b"), 2, false } };
+  CHECK(engine.addMatch(noWinner, 2, FULL_GAME) == RatingOutcome::SKIPPED_NO_RESULT);
+  CHECK(engine.matches() == 1);
+
+  // the unnamed player takes part in the team rating but is never rated
+  MatchPlayer unnamed[2] = { { 0, 1, true }, { engine.playerId("b"), 2, false } };
+  CHECK(engine.addMatch(unnamed, 2, FULL_GAME) == RatingOutcome::RATED);
+  CHECK(engine.rating(0).games == 0 && engine.rating(0).rating == options.initialRating);
+
+  GameSettings gameSettings;
+  gameSettings.playTime = FULL_GAME;
+  Teams teams;
+  CHECK(engine.addMatch(gameSettings, teams) == RatingOutcome::SKIPPED_NO_RESULT);
+}
+
+static void testOptions() {
+  RatingOptions options;
+  options.fullWeightTime = options.minPlayTime - 1;
+  CHECK_THROWS(RatingEngine engine(options));
+  options = RatingOptions();
+  options.kFactor = -1.0;
+  CHECK_THROWS(RatingEngine engine(options));
+  options = RatingOptions();
+  options.provisionalKFactor = std::numeric_limits<double>::quiet_NaN();
+  CHECK_THROWS(RatingEngine engine(options));
+  options = RatingOptions();
+  options.initialRating = std::numeric_limits<double>::infinity();
+  CHECK_THROWS(RatingEngine engine(options));
+  options = RatingOptions();
+  options.fullWeightTime = options.minPlayTime;
+  RatingEngine engine(options);
+  CHECK(duel(engine, "a", "b", options.minPlayTime) == RatingOutcome::RATED);
+  CHECK(std::isfinite(engine.rating("a")->rating));
+}
+
+static void testNames() {
+  RatingEngine engine;
+  std::string longName(RatingEngine::MAX_NAME_SIZE + 1, 'x');
+  CHECK(engine.playerId(longName) == 0);
+  CHECK(engine.players() == 0);
+  std::string maxName(RatingEngine::MAX_NAME_SIZE, 'x');
+  std::uint32_t id = engine.playerId(maxName);
+  CHECK(id == 1 && engine.playerId(maxName) == id && engine.playerName(id) == maxName);
+}
+
+static void fillEngine(RatingEngine& engine, unsigned int seed) {
+  Lcg lcg(seed);
+  for (int n = 0; n < 2000; ++n) {
+    std::string a = "player" + std::to_string(lcg.next(300));
+    std::string b = "player" + std::to_string(lcg.next(300));
+    if (a != b) {
+      duel(engine, a.c_str(), b.c_str(), FULL_GAME / 2 + lcg.next(FULL_GAME));
+    }
+  }
+  engine.playerId(std::string(RatingEngine::MAX_NAME_SIZE, 'y'));
+}
+
+static void testSnapshot() {
+  RatingEngine engine;
+  fillEngine(engine, 1);
+  std::stringstream stream;
+  engine.snapshot(stream);
+  RatingEngine restored;
+  CHECK(restored.restore(stream));
+  CHECK(sameEngine(engine, restored));
+  // and rating goes on the same from there
+  duel(engine, "player1", "player2");
+  duel(restored, "player1", "player2");
+  CHECK(sameEngine(engine, restored));
+
+  RatingEngine empty;
+  std::stringstream emptyStream;
+  empty.snapshot(emptyStream);
+  CHECK(restored.restore(emptyStream));
+  CHECK(restored.players() == 0 && restored.matches() == 0);
+}
+
+static bool restores(const std::string& image) {
+  std::istringstream input(image);
+  RatingEngine restored;
+  restored.playerId("kept");  // a failed restore leaves nothing behind either
+  bool ok = restored.restore(input);
+  CHECK(ok || (restored.players() == 0 && restored.matches() == 0));
+  return ok;
+}
+
+// Layout: magic, matches, player count, then per player name size and name, rating,
+// games and wins
+static void testMalformed() {
+  RatingEngine engine;
+  fillEngine(engine, 2);
+  std::stringstream stream;
+  engine.snapshot(stream);
+  std::string image = stream.str();
+  CHECK(restores(image));
+  checkTruncations(image, restores);
+
+  std::string bad = image;
+  bad[7] = '2';
+  CHECK(!restores(bad));
+  // name sizes outside 1..MAX_NAME_SIZE
+  unsigned int size = 0;
+  bad = image;
+  bad.replace(20, sizeof(size), reinterpret_cast<const char*>(&size), sizeof(size));
+  CHECK(!restores(bad));
+  size = static_cast<unsigned int>(RatingEngine::MAX_NAME_SIZE) + 1;
+  bad = image;
+  bad.replace(20, sizeof(size), reinterpret_cast<const char*>(&size), sizeof(size));
+  bad.append(size, 'x');  // the bytes are there, the size is still refused
+  CHECK(!restores(bad));
+
+  // a player count the stream cannot hold is rejected before anything is reserved
+  std::string huge = image.substr(0, 16);
+  unsigned int players = 0xFFFFFFFFu;
+  huge.append(reinterpret_cast<const char*>(&players), sizeof(players));
+  std::istringstream hugeInput(huge);
+  RatingEngine restored;
+  CHECK(!restored.restore(hugeInput));
+
+  // the same name twice
+  RatingEngine twice;
+  twice.playerId("a");
+  std::stringstream twiceStream;
+  twice.snapshot(twiceStream);
+  std::string duplicate = twiceStream.str();
+  std::string record = duplicate.substr(20);
+  duplicate.replace(16, 4, std::string("\x02\0\0\0", 4));
+  duplicate += record;
+  std::istringstream duplicateInput(duplicate);
+  CHECK(!restored.restore(duplicateInput));
+}
+
+int main() {
+  try {
+    testRating();
+    testOptions();
+    testNames();
+    testSnapshot();
+    testMalformed();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  return testResult("ratingenginetest");
+}
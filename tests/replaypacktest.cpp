@@ -0,0 +1,288 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// ReplayPack round trips: lookup, reads, sequential scans and deduplication, with and
+// without compression where zstd is built in, and malformed packs.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "../recfile.h"
+#include "../replaypack.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+struct Replay {
+  std::string name;
+  std::vector<unsigned char> data;
+};
+
+// Sizes from empty to a few hundred KB, similar replays compress with a dictionary
+static std::vector<Replay> randomReplays(unsigned int count) {
+  static const char* const EXTENSIONS[] = { ".mgx", ".mgl", ".mgz", ".mgx2" };
+  Lcg lcg(count);
+  std::vector<Replay> replays;
+  for (unsigned int n = 0; n < count; ++n) {
+    Replay replay;
+    replay.name = "game" + std::to_string(n) + EXTENSIONS[n % 4];
+    std::size_t size = (n == 0) ? 0 : (n % 7 == 0) ? 200000 + lcg.next(200000) : lcg.next(20000);
+    for (std::size_t i = 0; i < size; ++i) {
+      replay.data.push_back(static_cast<unsigned char>(i % 64 < 48 ? "header"[i % 6] : lcg.next(256)));
+    }
+    if (size >= 4) {
+      unsigned int headerLength = static_cast<unsigned int>(size / 2);
+      std::memcpy(replay.data.data(), &headerLength, 4);
+    }
+    replays.push_back(replay);
+  }
+  return replays;
+}
+
+static void writePack(const std::string& fileName, const std::vector<Replay>& replays,
+    const ReplayPackOptions& options) {
+  ReplayPackWriter writer(fileName, options);
+  for (auto it = replays.cbegin(); it != replays.cend(); ++it) {
+    CHECK(writer.add(it->name, it->data.data(), it->data.size()));
+  }
+  // the same content under another name is stored once
+  if (!replays.empty()) {
+    CHECK(!writer.add("copy.mgx", replays.back().data.data(), replays.back().data.size()));
+  }
+  CHECK(writer.size() == replays.size());
+  writer.finish();
+}
+
+static void checkPack(const std::string& fileName, const std::vector<Replay>& replays, bool compressed) {
+  ReplayPack pack(fileName);
+  const std::vector<ReplayPackEntry>& entries = pack.entries();
+  CHECK(entries.size() == replays.size());
+  for (std::size_t i = 1; i < entries.size(); ++i) {
+    CHECK(entries[i - 1].hash < entries[i].hash);
+  }
+  std::map<ReplayHash, const Replay*> byHash;
+  std::vector<unsigned char> data;
+  for (auto it = replays.cbegin(); it != replays.cend(); ++it) {
+    ReplayHash hash = hashReplayData(it->data.data(), it->data.size());
+    const ReplayPackEntry* entry = pack.find(hash);
+    CHECK(entry != NULL);
+    if (entry == NULL) {
+      continue;
+    }
+    CHECK(entry->size == it->data.size());
+    RecFormat format = RecFormat::MGX;
+    RecFile::formatFromFileName(it->name, format);
+    CHECK(entry->format == format);
+    CHECK(entry->probe == validateRecData(it->name, it->data.data(), it->data.size()));
+    CHECK(compressed || !entry->compressed);
+    pack.read(*entry, data);
+    CHECK(data == it->data);
+    byHash[hash] = &*it;
+  }
+  ReplayHash unknown = hashReplayData("unknown", 7);
+  CHECK(pack.find(unknown) == NULL);
+  RecAnalyst recAnalyst;
+  CHECK(pack.analyze(unknown, recAnalyst).code() == RECANALYST_FILEOPEN);
+
+  // in the order added, whatever the block size
+  const std::size_t blockSizes[] = { 1, 4096, 8 * 1024 * 1024 };
+  for (std::size_t blockSize : blockSizes) {
+    std::vector<const Replay*> scanned;
+    bool same = true;
+    pack.scan([&](const ReplayPackEntry& entry, const unsigned char* bytes, std::size_t size) {
+      const Replay* replay = byHash[entry.hash];
+      scanned.push_back(replay);
+      same = same && replay != NULL && size == replay->data.size() &&
+        std::equal(bytes, bytes + size, replay->data.begin());
+    }, blockSize);
+    CHECK(same);
+    CHECK(scanned.size() == replays.size());
+    for (std::size_t i = 0; i < scanned.size() && i < replays.size(); ++i) {
+      CHECK(scanned[i] == &replays[i]);
+    }
+  }
+}
+
+static void testRoundTrip(const std::string& fileName) {
+  std::vector<Replay> replays = randomReplays(40);
+  ReplayPackOptions stored;
+  stored.compress = false;
+  writePack(fileName, replays, stored);
+  checkPack(fileName, replays, false);
+
+  ReplayPackOptions compressed;
+  compressed.trainingSamples = 8;
+  compressed.dictionarySize = 4096;
+  writePack(fileName, replays, compressed);
+  checkPack(fileName, replays, true);
+
+  ReplayPackOptions noDictionary;
+  noDictionary.dictionarySize = 0;
+  writePack(fileName, replays, noDictionary);
+  checkPack(fileName, replays, true);
+
+  // fewer replays than the training samples, the dictionary is trained on finish()
+  std::vector<Replay> few(replays.begin(), replays.begin() + 3);
+  writePack(fileName, few, ReplayPackOptions());
+  checkPack(fileName, few, true);
+
+  writePack(fileName, std::vector<Replay>(), ReplayPackOptions());
+  checkPack(fileName, std::vector<Replay>(), true);
+}
+
+// Replays that failed the probe are rejected with its error, without a parse
+static void testProbe(const std::string& fileName) {
+  std::vector<Replay> replays = randomReplays(3);
+  writePack(fileName, replays, ReplayPackOptions());
+  ReplayPack pack(fileName);
+  RecAnalyst recAnalyst;
+  for (auto it = pack.entries().cbegin(); it != pack.entries().cend(); ++it) {
+    if (it->probe != RECANALYST_OK) {
+      CHECK(pack.analyze(it->hash, recAnalyst).code() == it->probe);
+    }
+  }
+}
+
+static void testUnfinished(const std::string& fileName) {
+  std::remove(fileName.c_str());
+  {
+    ReplayPackWriter writer(fileName);
+    std::vector<Replay> replays = randomReplays(2);
+    writer.add(replays[1].name, replays[1].data.data(), replays[1].data.size());
+  }
+  CHECK(readFile(fileName).empty());
+  CHECK(readFile(fileName + ".tmp").empty());
+  CHECK_THROWS(ReplayPack pack(fileName));
+}
+
+template <typename T>
+static void patch(std::string& image, std::size_t offset, T value) {
+  image.replace(offset, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool opens(const std::string& fileName, const std::string& image) {
+  writeFile(fileName, image);
+  try {
+    ReplayPack pack(fileName);
+    std::vector<unsigned char> data;
+    for (auto it = pack.entries().cbegin(); it != pack.entries().cend(); ++it) {
+      pack.read(*it, data);
+      CHECK(data.size() == it->size);
+    }
+  } catch (const ERecAnalystException&) {
+    return false;
+  }
+  return true;
+}
+
+// Header: magic, compression at 8, entries at 16, index, dictionary offset and size from 24.
+// Index entries: hash, offset at 32, stored size at 40, size at 44, format at 56 and
+// compressed flag at 57.
+static void testMalformed(const std::string& fileName) {
+  std::vector<Replay> replays = randomReplays(12);
+  ReplayPackOptions stored;
+  stored.compress = false;
+  writePack(fileName, replays, stored);
+  std::string image = readFile(fileName);
+  unsigned long long indexOffset;
+  std::memcpy(&indexOffset, &image[24], sizeof(indexOffset));
+  const std::size_t ENTRY = static_cast<std::size_t>(indexOffset) + 64;  // the second
+  CHECK(opens(fileName, image));
+  checkTruncations(image, [&fileName](const std::string& truncated) { return opens(fileName, truncated); });
+
+  std::string bad = image;
+  patch<std::uint32_t>(bad, 8, 2);  // unknown compression
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  patch<unsigned long long>(bad, 16, replays.size() + 1);
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  patch<unsigned long long>(bad, 16, 1ULL << 60);
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  patch<unsigned long long>(bad, 32, 0);  // dictionary over the header
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  patch<unsigned long long>(bad, ENTRY + 32, indexOffset);  // replay inside the index
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  patch<unsigned long long>(bad, ENTRY + 32, 0);
+  CHECK(!opens(fileName, bad));
+  std::uint32_t size;
+  std::memcpy(&size, &bad[ENTRY + 44], sizeof(size));
+  bad = image;
+  patch<std::uint32_t>(bad, ENTRY + 44, size + 1);  // stored, so the sizes must match
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  patch<std::uint8_t>(bad, ENTRY + 57, 1);  // compressed in a stored pack
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  std::string first = bad.substr(static_cast<std::size_t>(indexOffset), 64);
+  bad.replace(static_cast<std::size_t>(indexOffset), 64, bad, ENTRY, 64);
+  bad.replace(ENTRY, 64, first);
+  CHECK(!opens(fileName, bad));  // hashes out of order
+  bad = image;
+  patch<std::uint8_t>(bad, ENTRY + 56, 200);  // the format is informational only
+  CHECK(opens(fileName, bad));
+
+#ifdef RECANALYST_HAVE_ZSTD
+  // a compressed frame that does not decode to the recorded size
+  ReplayPackOptions compressed;
+  compressed.trainingSamples = 4;
+  compressed.dictionarySize = 2048;
+  writePack(fileName, replays, compressed);
+  image = readFile(fileName);
+  std::size_t entry = 0;
+  unsigned long long offset = 0;
+  {
+    ReplayPack pack(fileName);
+    for (; entry < pack.entries().size() && !pack.entries()[entry].compressed; ++entry) {
+    }
+    CHECK(entry < pack.entries().size());
+    if (entry == pack.entries().size()) {
+      return;
+    }
+    offset = pack.entries()[entry].offset;
+    size = pack.entries()[entry].size;
+  }
+  std::memcpy(&indexOffset, &image[24], sizeof(indexOffset));
+  bad = image;
+  patch<std::uint32_t>(bad, static_cast<std::size_t>(indexOffset) + entry * 64 + 44, size + 1);
+  CHECK(!opens(fileName, bad));
+  bad = image;
+  bad[static_cast<std::size_t>(offset)] ^= 0x55;  // the frame magic
+  CHECK(!opens(fileName, bad));
+#endif
+}
+
+int main() {
+  std::string fileName = tempPath("replaypack.rapack");
+  try {
+    testRoundTrip(fileName);
+    testProbe(fileName);
+    testUnfinished(fileName);
+    testMalformed(fileName);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(fileName.c_str());
+  return testResult("replaypacktest");
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Builds every test with the stand-in library in bench/fakerecanalyst.cpp and runs it.
+# usage: tests/run.sh [test...], every tests/*test.cpp by default
+# CXX, CXXFLAGS and LIBS come from the environment, e.g.
+#   CXXFLAGS="-g -fsanitize=address,undefined" tests/run.sh
+#   CXXFLAGS=-DRECANALYST_HAVE_ZSTD LIBS="-lzstd -lz -lpthread" tests/run.sh replaypacktest
+# The programs go to tests/build, the exit status is nonzero if any test failed.
+
+cd "$(dirname "$0")/.." || exit 1
+CXX=${CXX:-c++}
+CXXFLAGS=${CXXFLAGS:--O1}
+LIBS=${LIBS:--lz -lpthread}
+BUILD=tests/build
+COMMON="bench/fakerecanalyst.cpp recanalystwrap.cpp transcode.cpp inflate.cpp mapdata.cpp
+  maprenderer.cpp recfile.cpp trace.cpp metrics.cpp histogram.cpp fileutil.cpp"
+
+sources() {
+  case $1 in
+    activityprofiletest) echo activityprofile.cpp bodyparser.cpp ;;
+    analyzetest) echo ;;
+    bodyparsertest) echo bodyparser.cpp ;;
+    chatindextest) echo chatindex.cpp replayhash.cpp ;;
+    commandlogtest) echo bodyparser.cpp commandlog.cpp ;;
+    liveanalysttest) echo liveanalyst.cpp bodyparser.cpp ;;
+    mapcachetest) echo mapcache.cpp replayhash.cpp ;;
+    ratingenginetest) echo ratingengine.cpp compactplayer.cpp ;;
+    replaypacktest) echo replaypack.cpp replayhash.cpp ;;
+    similaritytest) echo similarity.cpp replayhash.cpp ;;
+    statsaggregatortest) echo statsaggregator.cpp ;;
+    transcodetest) echo ;;
+    *) return 1 ;;
+  esac
+}
+
+TESTS=${*:-$(cd tests && ls ./*test.cpp | sed 's|^\./||; s|\.cpp$||')}
+mkdir -p "$BUILD" || exit 1
+failed=0
+for test in $TESTS; do
+  if ! extra=$(sources "$test"); then
+    echo "$test: unknown test"
+    failed=$((failed + 1))
+    continue
+  fi
+  # shellcheck disable=SC2086
+  if ! $CXX -std=c++17 $CXXFLAGS -o "$BUILD/$test" "tests/$test.cpp" $extra $COMMON $LIBS; then
+    echo "$test: build failed"
+    failed=$((failed + 1))
+    continue
+  fi
+  "$BUILD/$test" || failed=$((failed + 1))
+done
+if [ "$failed" -ne 0 ]; then
+  echo "$failed of $(echo $TESTS | wc -w) tests failed"
+  exit 1
+fi
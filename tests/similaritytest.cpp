@@ -0,0 +1,267 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// SimilarityIndex: clustered search against brute force, players added after a build,
+// the binary form and malformed input.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../similarity.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+static const std::size_t D = SimilarityIndex::DIMENSIONS;
+
+static ReplayHash replayHash(unsigned int n) {
+  return hashReplayData(&n, sizeof(n));
+}
+
+// Points around a few centers, like players of a few styles
+static std::vector<float> randomVectors(unsigned int count, unsigned int seed) {
+  Lcg lcg(seed);
+  std::vector<float> centers(8 * D);
+  for (auto it = centers.begin(); it != centers.end(); ++it) {
+    *it = static_cast<float>(lcg.next(1000));
+  }
+  std::vector<float> vectors(count * D);
+  for (unsigned int n = 0; n < count; ++n) {
+    const float* center = &centers[lcg.next(8) * D];
+    for (std::size_t i = 0; i < D; ++i) {
+      vectors[n * D + i] = center[i] + static_cast<float>(lcg.next(10000)) / 100.0f;
+    }
+  }
+  return vectors;
+}
+
+static void fill(SimilarityIndex& index, const std::vector<float>& vectors, unsigned int first = 0) {
+  for (std::size_t n = 0; n < vectors.size() / D; ++n) {
+    index.add(replayHash(first + static_cast<unsigned int>(n)), static_cast<int>(n % 8), &vectors[n * D]);
+  }
+}
+
+static bool sameHits(const std::vector<SimilarityHit>& a, const std::vector<SimilarityHit>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (a[i].replay != b[i].replay || a[i].player != b[i].player || a[i].distance != b[i].distance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool sorted(const std::vector<SimilarityHit>& hits) {
+  for (std::size_t i = 1; i < hits.size(); ++i) {
+    if (hits[i - 1].distance > hits[i].distance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void testSearch() {
+  std::vector<float> vectors = randomVectors(3000, 1);
+  SimilarityIndex brute;
+  fill(brute, vectors);
+  CHECK_THROWS(brute.nearest(&vectors[0], 5));
+  brute.build();
+  CHECK(brute.built() && brute.lists() == 0 && brute.size() == 3000);
+
+  SimilarityOptions options;
+  options.lists = 16;
+  options.threads = 2;
+  SimilarityIndex clustered;
+  fill(clustered, vectors);
+  clustered.build(options);
+  CHECK(clustered.lists() == 16);
+
+  for (unsigned int n = 0; n < 3000; n += 97) {
+    const float* query = &vectors[n * D];
+    std::vector<SimilarityHit> hits = brute.nearest(query, 10);
+    CHECK(hits.size() == 10 && sorted(hits));
+    // the player itself first, apart from an exact duplicate
+    CHECK(!hits.empty() && hits[0].distance == 0.0f);
+    CHECK(!hits.empty() && (hits[0].replay == replayHash(n) || hits[1].distance == 0.0f));
+    // every list probed is the brute force search
+    CHECK(sameHits(clustered.nearest(query, 10, 0), hits));
+    CHECK(sameHits(clustered.nearest(query, 10, 16), hits));
+    std::vector<SimilarityHit> probed = clustered.nearest(query, 10, 2);
+    CHECK(probed.size() == 10 && sorted(probed) && probed[0].distance == 0.0f);
+  }
+  CHECK(brute.nearest(&vectors[0], 0).empty());
+  CHECK(brute.nearest(&vectors[0], 5000).size() == 3000);
+}
+
+static void testAddAfterBuild() {
+  std::vector<float> vectors = randomVectors(500, 2);
+  SimilarityOptions options;
+  options.lists = 4;
+  SimilarityIndex index;
+  fill(index, vectors);
+  index.build(options);
+  std::vector<float> more = randomVectors(50, 3);
+  fill(index, more, 1000);
+  CHECK(index.size() == 550);
+  // found with a single probe, unclustered players are always scanned
+  std::vector<SimilarityHit> hits = index.nearest(&more[7 * D], 1, 1);
+  CHECK(hits.size() == 1 && hits[0].replay == replayHash(1007) && hits[0].distance == 0.0f);
+  index.build(options);
+  CHECK(index.nearest(&more[7 * D], 1, 0)[0].replay == replayHash(1007));
+}
+
+static void testPlayer() {
+  Player player;
+  player.index = 3;
+  player.feudalTime = 600000;
+  player.castleTime = 1100000;
+  player.achievement.totalScore = 5000;
+  player.achievement.militaryStats.unitsKilled = 40;
+  float features[D];
+  float again[D];
+  SimilarityIndex::playerFeatures(player, features);
+  SimilarityIndex::playerFeatures(player, again);
+  CHECK(std::equal(features, features + D, again));
+
+  SimilarityIndex index;
+  std::vector<float> vectors = randomVectors(100, 4);
+  fill(index, vectors);
+  index.add(replayHash(5000), player);
+  index.build();
+  std::vector<SimilarityHit> hits = index.nearest(player, 1);
+  CHECK(hits.size() == 1 && hits[0].replay == replayHash(5000) && hits[0].player == 3);
+}
+
+static void testRoundTrip(const std::string& fileName) {
+  std::vector<float> vectors = randomVectors(1000, 5);
+  SimilarityOptions options;
+  options.lists = 8;
+  SimilarityIndex index;
+  fill(index, vectors);
+  index.build(options);
+  fill(index, randomVectors(20, 6), 2000);  // not clustered yet
+  index.save(fileName);
+  SimilarityIndex loaded;
+  loaded.load(fileName);
+  CHECK(loaded.size() == index.size() && loaded.lists() == index.lists());
+  for (unsigned int n = 0; n < 1000; n += 111) {
+    CHECK(sameHits(loaded.nearest(&vectors[n * D], 5, 2), index.nearest(&vectors[n * D], 5, 2)));
+  }
+
+  // an index that was never built stays unbuilt
+  SimilarityIndex unbuilt;
+  fill(unbuilt, vectors);
+  std::stringstream stream;
+  unbuilt.write(stream);
+  CHECK(loaded.read(stream));
+  CHECK(loaded.size() == 1000 && !loaded.built());
+  CHECK_THROWS(loaded.load(fileName + ".missing"));
+}
+
+template <typename T>
+static void patch(std::string& image, std::size_t offset, T value) {
+  image.replace(offset, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool readsBack(const std::string& image) {
+  std::istringstream input(image);
+  SimilarityIndex read;
+  bool ok = read.read(input);
+  CHECK(ok || (read.size() == 0 && !read.built()));
+  return ok;
+}
+
+// Drops count elements of an array at offset and lowers its count to match
+static std::string shrink(const std::string& image, std::size_t offset, std::size_t elementSize,
+    std::size_t count) {
+  std::string shrunk = image;
+  unsigned long long size;
+  std::memcpy(&size, &shrunk[offset], sizeof(size));
+  patch<unsigned long long>(shrunk, offset, size - count);
+  shrunk.erase(offset + 8, count * elementSize);
+  return shrunk;
+}
+
+// Layout: magic, then replay hashes, players, vectors, mean, scale, centroids and list
+// offsets, each a count and its elements
+static void testMalformed() {
+  const std::size_t N = 200;
+  SimilarityOptions options;
+  options.lists = 4;
+  SimilarityIndex index;
+  fill(index, randomVectors(N, 7));
+  index.build(options);
+  std::stringstream stream;
+  index.write(stream);
+  std::string image = stream.str();
+  const std::size_t PLAYERS = 8 + 8 + 32 * N;
+  const std::size_t VECTORS = PLAYERS + 8 + N;
+  const std::size_t MEAN = VECTORS + 8 + 4 * N * D;
+  const std::size_t SCALE = MEAN + 8 + 4 * D;
+  const std::size_t CENTROIDS = SCALE + 8 + 4 * D;
+  const std::size_t LISTS = CENTROIDS + 8 + 4 * 4 * D;
+  CHECK(image.size() == LISTS + 8 + 4 * 5);
+  CHECK(readsBack(image));
+  checkTruncations(image, readsBack);
+
+  std::string bad = image;
+  patch<unsigned long long>(bad, 8, 1ULL << 40);
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<unsigned long long>(bad, PLAYERS, N + 1);  // more players than replays
+  CHECK(!readsBack(bad));
+  CHECK(!readsBack(shrink(image, PLAYERS, 1, 1)));
+  CHECK(!readsBack(shrink(image, VECTORS, 4, D)));
+  CHECK(!readsBack(shrink(image, MEAN, 4, D)));  // a scale without a mean
+  CHECK(!readsBack(shrink(image, MEAN, 4, 1)));
+  CHECK(!readsBack(shrink(image, CENTROIDS, 4, D)));  // three centroids for four lists
+  // list offsets start at 0, do not go back and stay within the replays
+  bad = image;
+  patch<std::uint32_t>(bad, LISTS + 8, 1);
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<std::uint32_t>(bad, LISTS + 8 + 4, 150);
+  patch<std::uint32_t>(bad, LISTS + 8 + 8, 100);
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<std::uint32_t>(bad, LISTS + 8 + 16, N + 1);
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<std::uint32_t>(bad, LISTS + 8 + 16, N - 10);  // the last ten were added after the build
+  CHECK(readsBack(bad));
+}
+
+int main() {
+  std::string fileName = tempPath("similarity.rasimil");
+  try {
+    testSearch();
+    testAddAfterBuild();
+    testPlayer();
+    testRoundTrip(fileName);
+    testMalformed();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  std::remove(fileName.c_str());
+  return testResult("similaritytest");
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// StatsAggregator: aggregation, merging, the binary form and malformed input.
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include "../statsaggregator.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+static bool sameHistogram(const SparseHistogram& a, const SparseHistogram& b) {
+  return a.count() == b.count() && a.sum() == b.sum() && a.min() == b.min() && a.max() == b.max() &&
+    a.buckets() == b.buckets();
+}
+
+static bool sameStats(const CivStats& a, const CivStats& b) {
+  bool same = a.players == b.players && a.wins == b.wins && a.losses == b.losses &&
+    sameHistogram(a.feudalTime, b.feudalTime) && sameHistogram(a.castleTime, b.castleTime) &&
+    sameHistogram(a.imperialTime, b.imperialTime);
+  for (int i = 0; same && i < static_cast<int>(StatsScore::COUNT); ++i) {
+    same = sameHistogram(a.scores[i], b.scores[i]);
+  }
+  return same;
+}
+
+static bool sameAggregate(const StatsAggregator& a, const StatsAggregator& b) {
+  if (a.games() != b.games() || a.cells().size() != b.cells().size()) {
+    return false;
+  }
+  for (auto it = a.cells().cbegin(); it != a.cells().cend(); ++it) {
+    const CivStats* other = b.find(it->first);
+    if (other == NULL || !sameStats(it->second, *other)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static const char* const MAPS[] = { "Arabia", "Black Forest", "Islands", "" };
+
+static void addGame(StatsAggregator& aggregator, Lcg& lcg) {
+  GameSettings gameSettings;
+  gameSettings.map = MAPS[lcg.next(4)];
+  gameSettings.gameVersion = lcg.next(2) ? GameVersion::AOC : GameVersion::AOK;
+  gameSettings.extra.hasData = lcg.next(4) != 0;
+  Players players;
+  for (int index = 1, count = 2 + lcg.next(7); index <= count; ++index) {
+    Player& player = players[index];
+    player.index = index;
+    player.human = lcg.next(5) != 0;
+    player.civId = static_cast<Civilization>(lcg.next(18));
+    player.feudalTime = lcg.next(3) ? 500000 + lcg.next(300000) : 0;
+    player.castleTime = player.feudalTime && lcg.next(2) ? player.feudalTime + lcg.next(600000) : 0;
+    player.imperialTime = player.castleTime && lcg.next(2) ? player.castleTime + lcg.next(900000) : 0;
+    player.achievement.result = lcg.next(2) ? GameResult::WIN : GameResult::LOSS;
+    player.achievement.totalScore = lcg.next(20000);
+    player.achievement.militaryStats.militaryScore = lcg.next(8000);
+    player.achievement.economyStats.economyScore = lcg.next(8000);
+    player.achievement.technologyStats.technologyScore = lcg.next(8000);
+    player.achievement.societyStats.societyScore = lcg.next(8000);
+  }
+  aggregator.add(gameSettings, players);
+}
+
+static void testAdd() {
+  StatsAggregator humans;
+  StatsAggregator everyone(false);
+  GameSettings gameSettings;
+  gameSettings.map = "Arabia";
+  gameSettings.gameVersion = GameVersion::AOC;
+  gameSettings.extra.hasData = true;
+  Players players;
+  players[1].human = true;
+  players[1].civId = Civilization::FRANKS;
+  players[1].feudalTime = 600000;
+  players[1].achievement.victory = true;
+  players[1].achievement.totalScore = 3000;
+  players[2].human = false;
+  players[2].civId = Civilization::FRANKS;
+  humans.add(gameSettings, players);
+  everyone.add(gameSettings, players);
+
+  StatsKey key = { Civilization::FRANKS, "Arabia", GameVersion::AOC };
+  const CivStats* stats = humans.find(key);
+  CHECK(humans.games() == 1 && stats != NULL);
+  CHECK(stats != NULL && stats->players == 1 && stats->wins == 1 && stats->losses == 0);
+  CHECK(stats != NULL && stats->feudalTime.count() == 1 && stats->castleTime.count() == 0);
+  CHECK(stats != NULL && stats->score(StatsScore::TOTAL).sum() == 3000);
+  stats = everyone.find(key);
+  CHECK(stats != NULL && stats->players == 2 && stats->wins == 1 && stats->losses == 1);
+  key.map = "Islands";
+  CHECK(humans.find(key) == NULL);
+
+  // without achievements only appearances and age times count
+  gameSettings.extra.hasData = false;
+  humans.add(gameSettings, players);
+  key.map = "Arabia";
+  stats = humans.find(key);
+  CHECK(stats != NULL && stats->players == 2 && stats->wins == 1 && stats->losses == 0);
+  CHECK(stats != NULL && stats->score(StatsScore::TOTAL).count() == 1);
+
+  CivStats franks = humans.combine([](const StatsKey& k) { return k.civ == Civilization::FRANKS; });
+  CHECK(franks.players == 2);
+}
+
+static void testMerge() {
+  StatsAggregator all;
+  StatsAggregator a;
+  StatsAggregator b;
+  Lcg lcgAll(1);
+  Lcg lcgSplit(1);
+  for (int n = 0; n < 500; ++n) {
+    addGame(all, lcgAll);
+    addGame(n % 3 ? a : b, lcgSplit);
+  }
+  StatsAggregator ab;
+  ab.merge(a);
+  ab.merge(b);
+  StatsAggregator ba;
+  ba.merge(b);
+  ba.merge(a);
+  CHECK(sameAggregate(ab, all));
+  CHECK(sameAggregate(ba, all));
+}
+
+static void testRoundTrip() {
+  StatsAggregator aggregator;
+  Lcg lcg(2);
+  for (int n = 0; n < 300; ++n) {
+    addGame(aggregator, lcg);
+  }
+  std::stringstream stream;
+  aggregator.write(stream);
+  StatsAggregator read;
+  CHECK(read.read(stream));
+  CHECK(sameAggregate(read, aggregator));
+
+  StatsAggregator empty;
+  std::stringstream emptyStream;
+  empty.write(emptyStream);
+  CHECK(read.read(emptyStream));
+  CHECK(read.games() == 0 && read.cells().empty());
+}
+
+template <typename T>
+static void patch(std::string& image, std::size_t offset, T value) {
+  image.replace(offset, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool readsBack(const std::string& image) {
+  std::istringstream input(image);
+  StatsAggregator read;
+  bool ok = read.read(input);
+  CHECK(ok || (read.games() == 0 && read.cells().empty()));  // nothing half read is kept
+  return ok;
+}
+
+// Layout: magic, games, cells, then per cell civ, version, map size and name, players,
+// wins, losses and the histograms as sum, min, max, bucket count and (index, count) pairs
+static void testMalformed() {
+  StatsAggregator aggregator;
+  GameSettings gameSettings;
+  gameSettings.map = "Arabia";
+  Players players;
+  players[1].human = true;
+  players[1].feudalTime = 600000;
+  players[2].human = true;
+  players[2].feudalTime = 900000;  // another bucket
+  aggregator.add(gameSettings, players);
+  std::stringstream stream;
+  aggregator.write(stream);
+  std::string image = stream.str();
+  const std::size_t MAP_SIZE = 32;
+  const std::size_t FEUDAL = 36 + 6 + 24;
+  const std::size_t BUCKETS = FEUDAL + 28;
+  unsigned int feudalBuckets;
+  std::memcpy(&feudalBuckets, &image[FEUDAL + 24], sizeof(feudalBuckets));
+  CHECK(feudalBuckets == 2);
+  CHECK(readsBack(image));
+  checkTruncations(image, readsBack);
+
+  std::string bad = image;
+  bad[7] = '2';
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<unsigned long long>(bad, 16, 1ULL << 60);  // cells the stream does not have
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<unsigned int>(bad, MAP_SIZE, 65537);
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<unsigned int>(bad, FEUDAL + 24, 0xFFFFFFFFu);  // buckets the stream does not have
+  CHECK(!readsBack(bad));
+  // bucket indexes ascending and below the bucket count
+  int first;
+  std::memcpy(&first, &image[BUCKETS], sizeof(first));
+  bad = image;
+  patch<int>(bad, BUCKETS + 12, first);
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<int>(bad, BUCKETS + 12, Histogram::BUCKET_COUNT);
+  CHECK(!readsBack(bad));
+  bad = image;
+  patch<int>(bad, BUCKETS, -5);
+  CHECK(!readsBack(bad));
+}
+
+int main() {
+  try {
+    testAdd();
+    testMerge();
+    testRoundTrip();
+    testMalformed();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  return testResult("statsaggregatortest");
+}
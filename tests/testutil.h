@@ -0,0 +1,100 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Checks shared by the tests. Every test is a program of its own built like the
+// benches, against bench/fakerecanalyst.cpp instead of the import library. It prints
+// the failed checks and exits nonzero if there were any, tests/run.sh runs them all.
+
+#ifndef _TESTUTIL_H_
+#define _TESTUTIL_H_
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include "../recanalystwrap.h"
+#include "../bench/fakerecanalyst.h"
+
+inline int gFailures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++gFailures; \
+    } \
+  } while (0)
+
+// expression must throw ERecAnalystException, anything else fails the test
+#define CHECK_THROWS(expression) \
+  do { \
+    bool thrown = false; \
+    try { \
+      expression; \
+    } catch (const RecAnalystWrapper::ERecAnalystException&) { \
+      thrown = true; \
+    } \
+    if (!thrown) { \
+      std::fprintf(stderr, "%s:%d: CHECK_THROWS(%s) did not throw\n", __FILE__, __LINE__, #expression); \
+      ++gFailures; \
+    } \
+  } while (0)
+
+// Unique per test program, removed by the caller
+inline std::string tempPath(const std::string& name) {
+  return (std::filesystem::temp_directory_path() / ("recanalyst-test-" + name)).string();
+}
+
+inline void writeFile(const std::string& fileName, const std::string& data) {
+  std::ofstream stream(fileName, std::ios::binary | std::ios::trunc);
+  stream.write(data.data(), data.size());
+}
+
+inline std::string readFile(const std::string& fileName) {
+  std::ifstream stream(fileName, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+// Every proper prefix of a valid image must be rejected: load() returns false or
+// throws ERecAnalystException for it. Large images are cut at every step-th byte.
+template <typename Load>
+void checkTruncations(const std::string& image, Load load) {
+  std::size_t step = image.size() / 512 + 1;
+  for (std::size_t size = 0; size < image.size(); size += step) {
+    bool rejected = false;
+    try {
+      rejected = !load(image.substr(0, size));
+    } catch (const RecAnalystWrapper::ERecAnalystException&) {
+      rejected = true;
+    }
+    if (!rejected) {
+      std::fprintf(stderr, "truncated to %zu of %zu bytes: accepted\n", size, image.size());
+      ++gFailures;
+    }
+  }
+}
+
+inline int testResult(const char* name) {
+  if (gFailures > 0) {
+    std::fprintf(stderr, "%s: %d checks failed\n", name, gFailures);
+    return 1;
+  }
+  std::printf("%s: ok\n", name);
+  return 0;
+}
+
+#endif  //_TESTUTIL_H_
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Utf8Transcoder: the code page tables, the AUTO fallback, UTF-8 validation and
+// the 16 byte blocks of the SSE2 path against the byte by byte one.
+
+#include <algorithm>
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include "../transcode.h"
+#include "testutil.h"
+
+using namespace RecAnalystWrapper;
+
+// Encoded into a buffer of exactly encodedSize() bytes, so ASan sees any write past it
+static std::string encode(const Utf8Transcoder& transcoder, const std::string& text) {
+  std::size_t size = transcoder.encodedSize(text.data(), text.size());
+  if (size == 0) {
+    return std::string();  // no buffer to write to
+  }
+  std::vector<char> out(size);
+  char* end = transcoder.encode(text.data(), text.size(), out.data());
+  CHECK(end == out.data() + size);
+  return std::string(out.data(), size);
+}
+
+static void testTables() {
+  struct Byte {
+    CodePage codePage;
+    unsigned char c;
+    const char* utf8;
+  };
+  static const Byte BYTES[] = {
+    { CodePage::WINDOWS_1250, 0x80, "\xE2\x82\xAC" },  // euro sign
+    { CodePage::WINDOWS_1250, 0x8A, "\xC5\xA0" },      // S with caron
+    { CodePage::WINDOWS_1250, 0xB9, "\xC4\x85" },      // a with ogonek
+    { CodePage::WINDOWS_1250, 0xF8, "\xC5\x99" },      // r with caron
+    { CodePage::WINDOWS_1250, 0x81, "\xC2\x81" },      // undefined, the C1 control
+    { CodePage::WINDOWS_1251, 0xC0, "\xD0\x90" },      // cyrillic A
+    { CodePage::WINDOWS_1251, 0xFF, "\xD1\x8F" },      // cyrillic ya
+    { CodePage::WINDOWS_1251, 0xA8, "\xD0\x81" },      // cyrillic Io
+    { CodePage::WINDOWS_1251, 0x88, "\xE2\x82\xAC" },
+    { CodePage::WINDOWS_1251, 0x98, "\xC2\x98" },
+    { CodePage::WINDOWS_1252, 0x80, "\xE2\x82\xAC" },
+    { CodePage::WINDOWS_1252, 0x9F, "\xC5\xB8" },      // Y with diaeresis
+    { CodePage::WINDOWS_1252, 0xE9, "\xC3\xA9" },      // e with acute
+    { CodePage::WINDOWS_1252, 0xA0, "\xC2\xA0" },      // no-break space
+    { CodePage::WINDOWS_1252, 0x8D, "\xC2\x8D" },
+  };
+  for (const Byte& byte : BYTES) {
+    Utf8Transcoder transcoder(byte.codePage);
+    std::string text = "a" + std::string(1, static_cast<char>(byte.c)) + "b";
+    CHECK(transcoder.needsEncoding(text.data(), text.size()));
+    CHECK(encode(transcoder, text) == "a" + std::string(byte.utf8) + "b");
+  }
+
+  // every byte of every table is well formed UTF-8 of one to three bytes
+  const CodePage codePages[] = { CodePage::WINDOWS_1250, CodePage::WINDOWS_1251, CodePage::WINDOWS_1252 };
+  for (CodePage codePage : codePages) {
+    Utf8Transcoder transcoder(codePage);
+    for (int c = 0x80; c < 0x100; ++c) {
+      std::string utf8 = encode(transcoder, std::string(1, static_cast<char>(c)));
+      CHECK(utf8.size() >= 2 && utf8.size() <= 3 && isValidUtf8(utf8.data(), utf8.size()));
+    }
+  }
+
+  Utf8Transcoder ascii(CodePage::WINDOWS_1251);
+  CHECK(!ascii.needsEncoding("plain", 5));
+  CHECK(encode(ascii, "plain") == "plain");
+  CHECK(encode(ascii, "") == "");
+}
+
+static void testAuto() {
+  Utf8Transcoder transcoder;
+  CHECK(transcoder.codePage() == CodePage::AUTO);
+  std::string utf8 = "caf\xC3\xA9 \xD0\x90 \xE2\x82\xAC \xF0\x9F\x98\x80";
+  CHECK(!transcoder.needsEncoding(utf8.data(), utf8.size()));
+  CHECK(encode(transcoder, utf8) == utf8);
+  // anything that is not UTF-8 is read as windows-1252, as a whole
+  CHECK(encode(transcoder, "caf\xE9") == "caf\xC3\xA9");
+  CHECK(encode(transcoder, "\xC3\xA9 caf\xE9") == "\xC3\x83\xC2\xA9 caf\xC3\xA9");
+  CHECK(encode(transcoder, "\xC0\xAF") == "\xC3\x80\xC2\xAF");  // overlong
+
+  Utf8Transcoder passThrough(CodePage::UTF8);
+  CHECK(!passThrough.needsEncoding("caf\xE9", 4));
+  CHECK(encode(passThrough, "caf\xE9") == "caf\xE9");
+
+  // borrow() hands back its input when it needs no encoding
+  std::pmr::monotonic_buffer_resource resource;
+  std::string_view borrowed = transcoder.borrow(utf8, &resource);
+  CHECK(borrowed.data() == utf8.data() && borrowed.size() == utf8.size());
+  std::string latin = "caf\xE9";
+  borrowed = transcoder.borrow(latin, &resource);
+  CHECK(borrowed.data() != latin.data() && borrowed == "caf\xC3\xA9");
+  std::string_view copied = transcoder.copy(utf8, &resource);
+  CHECK(copied.data() != utf8.data() && copied == utf8);
+}
+
+static bool valid(const char* text) {
+  return isValidUtf8(text, std::char_traits<char>::length(text));
+}
+
+static void testValidation() {
+  CHECK(valid(""));
+  CHECK(valid("ascii"));
+  CHECK(valid("\xC2\x80"));
+  CHECK(valid("\xDF\xBF"));
+  CHECK(valid("\xE0\xA0\x80"));
+  CHECK(valid("\xED\x9F\xBF"));          // U+D7FF, just below the surrogates
+  CHECK(valid("\xEE\x80\x80"));          // U+E000, just above them
+  CHECK(valid("\xF0\x90\x80\x80"));
+  CHECK(valid("\xF4\x8F\xBF\xBF"));      // U+10FFFF
+  // overlong forms
+  CHECK(!valid("\xC0\xAF"));
+  CHECK(!valid("\xC1\xBF"));
+  CHECK(!valid("\xE0\x80\xAF"));
+  CHECK(!valid("\xE0\x9F\xBF"));
+  CHECK(!valid("\xF0\x80\x80\xAF"));
+  CHECK(!valid("\xF0\x8F\xBF\xBF"));
+  // surrogates and code points above U+10FFFF
+  CHECK(!valid("\xED\xA0\x80"));
+  CHECK(!valid("\xED\xBF\xBF"));
+  CHECK(!valid("\xF4\x90\x80\x80"));
+  CHECK(!valid("\xF5\x80\x80\x80"));
+  CHECK(!valid("\xFF"));
+  // stray and missing continuation bytes
+  CHECK(!valid("\x80"));
+  CHECK(!valid("a\xBF"));
+  CHECK(!valid("\xE2\x82"));
+  CHECK(!valid("\xE2\x82" "a"));
+  CHECK(!valid("\xF0\x9F\x98"));
+
+  CHECK(detectCodePage("just ascii") == CodePage::WINDOWS_1252);
+  CHECK(detectCodePage("just ascii", CodePage::WINDOWS_1250) == CodePage::WINDOWS_1250);
+  CHECK(detectCodePage("caf\xC3\xA9") == CodePage::UTF8);
+  CHECK(detectCodePage("\xCF\xF0\xE8\xE2\xE5\xF2 \xEC\xE8\xF0") == CodePage::WINDOWS_1251);
+  CHECK(detectCodePage("\x8Akoda \xB9 \x9C") == CodePage::WINDOWS_1250);
+  CHECK(detectCodePage("caf\xE9 na\xEFve") == CodePage::WINDOWS_1252);
+}
+
+// The SSE2 path stores 16 bytes, or four per byte, and stops 19 bytes before the end;
+// every length and position of a high byte around those bounds must match the byte by
+// byte encoding of the same text
+static void testBlocks() {
+  Utf8Transcoder transcoder(CodePage::WINDOWS_1251);
+  std::vector<std::string> single(256);
+  for (int c = 0; c < 256; ++c) {
+    single[c] = encode(transcoder, std::string(1, static_cast<char>(c)));
+  }
+  Lcg lcg(1);
+  for (std::size_t size = 1; size <= 70; ++size) {
+    for (std::size_t high = 0; high < size; ++high) {
+      std::string text;
+      for (std::size_t i = 0; i < size; ++i) {
+        text += static_cast<char>('a' + lcg.next(26));
+      }
+      text[high] = static_cast<char>(0x80 + lcg.next(128));
+      if (size > 40 && high % 3 == 0) {
+        text[size - 1] = '\x88';  // three bytes out, in the scalar tail
+        text[high / 2] = '\xFF';
+      }
+      std::string expected;
+      for (char c : text) {
+        expected += single[static_cast<unsigned char>(c)];
+      }
+      CHECK(asciiPrefix(text.data(), text.size()) == std::min(high, text.find_first_of("\xFF")));
+      CHECK(encode(transcoder, text) == expected);
+    }
+  }
+
+  // all high bytes, the output three times the input
+  std::string euros(100, '\x88');
+  CHECK(encode(transcoder, euros).size() == 300);
+}
+
+int main() {
+  try {
+    testTables();
+    testAuto();
+    testValidation();
+    testBlocks();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+    ++gFailures;
+  }
+  return testResult("transcodetest");
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sharded batch analysis of a replay manifest.
+// usage: recbatch plan manifest hashed-manifest
+//        recbatch run [-workers n] [-buffers n] manifest shard shards partial
+//        recbatch merge output partial...
+//        recbatch local manifest shards output
+//        recbatch pack [-store] manifest pack
+// plan hashes the replays once so the nodes only read their own shard, run
+// analyzes one shard, merge combines the partial files of all shards and local
+// runs every shard as a separate process of this program and merges them.
+// run prints the read-ahead pipeline's per stage report to stderr. pack stores the
+// replays of a manifest in one pack file, zstd compressed unless -store is given.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#endif
+#include "../batch.h"
+#include "../recanalystwrap.h"
+#include "../replaypack.h"
+
+#ifndef _WIN32
+extern char** environ;
+#endif
+
+using namespace RecAnalystWrapper;
+
+static int usage() {
+  std::fprintf(stderr, "usage: recbatch plan manifest hashed-manifest\n"
+    "       recbatch run [-workers n] [-buffers n] manifest shard shards partial\n"
+    "       recbatch merge output partial...\n"
+    "       recbatch local manifest shards output\n"
+    "       recbatch pack [-store] manifest pack\n");
+  return 1;
+}
+
+#ifdef _WIN32
+// Quotes an argument the way the C runtime splits a command line, no shell is involved
+static std::string commandLineArgument(const std::string& arg) {
+  if (!arg.empty() && arg.find_first_of(" \t\n\v\"") == std::string::npos) {
+    return arg;
+  }
+  std::string quoted = "\"";
+  std::size_t backslashes = 0;
+  for (auto it = arg.cbegin(); it != arg.cend(); ++it) {
+    if (*it == '\\') {
+      ++backslashes;
+      continue;
+    }
+    quoted.append((*it == '"') ? backslashes * 2 + 1 : backslashes, '\\');
+    quoted += *it;
+    backslashes = 0;
+  }
+  quoted.append(backslashes * 2, '\\');
+  return quoted + "\"";
+}
+
+// Starts one shard, returns its process handle or NULL
+static HANDLE spawnShard(const char* program, const std::string& manifest, unsigned int shard,
+    unsigned int shards, const std::string& partial) {
+  char path[MAX_PATH];
+  DWORD length = GetModuleFileNameA(NULL, path, sizeof(path));
+  std::string application = (length > 0 && length < sizeof(path)) ? std::string(path, length) : program;
+  std::string commandLine = commandLineArgument(application) + " run " + commandLineArgument(manifest) +
+    " " + std::to_string(shard) + " " + std::to_string(shards) + " " + commandLineArgument(partial);
+  STARTUPINFOA startup;
+  ZeroMemory(&startup, sizeof(startup));
+  startup.cb = sizeof(startup);
+  PROCESS_INFORMATION child;
+  if (!CreateProcessA(application.c_str(), &commandLine[0], NULL, NULL, FALSE, 0, NULL, NULL, &startup,
+      &child)) {
+    return NULL;
+  }
+  CloseHandle(child.hThread);
+  return child.hProcess;
+}
+
+// Waits for every child and returns the number that did not exit with 0
+static unsigned int waitShards(const std::vector<HANDLE>& children, const std::vector<unsigned int>& shards) {
+  for (std::size_t i = 0; i < children.size(); i += MAXIMUM_WAIT_OBJECTS) {
+    std::size_t count = std::min<std::size_t>(children.size() - i, MAXIMUM_WAIT_OBJECTS);
+    WaitForMultipleObjects(static_cast<DWORD>(count), &children[i], TRUE, INFINITE);
+  }
+  unsigned int failed = 0;
+  for (std::size_t i = 0; i < children.size(); ++i) {
+    DWORD code;
+    if (!GetExitCodeProcess(children[i], &code) || code != 0) {
+      std::fprintf(stderr, "recbatch: shard %u failed\n", shards[i]);
+      ++failed;
+    }
+    CloseHandle(children[i]);
+  }
+  return failed;
+}
+#else
+// Starts one shard, returns its process id or -1
+static pid_t spawnShard(const char* program, const std::string& manifest, unsigned int shard,
+    unsigned int shards, const std::string& partial) {
+  std::string shardText = std::to_string(shard);
+  std::string shardsText = std::to_string(shards);
+  char* args[] = { const_cast<char*>(program), const_cast<char*>("run"), const_cast<char*>(manifest.c_str()),
+    &shardText[0], &shardsText[0], const_cast<char*>(partial.c_str()), NULL };
+  pid_t pid;
+  int error = posix_spawnp(&pid, program, NULL, NULL, args, environ);
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return pid;
+}
+
+// Waits for every child and returns the number that did not exit with 0
+static unsigned int waitShards(const std::vector<pid_t>& children, const std::vector<unsigned int>& shards) {
+  unsigned int failed = 0;
+  for (std::size_t i = 0; i < children.size(); ++i) {
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(children[i], &status, 0)) == -1 && errno == EINTR) {
+    }
+    if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::fprintf(stderr, "recbatch: shard %u failed\n", shards[i]);
+      ++failed;
+    }
+  }
+  return failed;
+}
+#endif
+
+static int runLocal(const char* program, const std::string& manifest, unsigned int shards,
+    const std::string& output) {
+  std::vector<std::string> partials;
+  for (unsigned int shard = 0; shard < shards; ++shard) {
+    partials.push_back(output + ".part" + std::to_string(shard));
+    // a partial left by an earlier run must not be merged in place of a shard that fails
+    std::remove(partials.back().c_str());
+  }
+  // one child per shard, every exit status is checked before merging
+#ifdef _WIN32
+  std::vector<HANDLE> children;
+#else
+  std::vector<pid_t> children;
+#endif
+  std::vector<unsigned int> started;
+  unsigned int failed = 0;
+  for (unsigned int shard = 0; shard < shards; ++shard) {
+    auto child = spawnShard(program, manifest, shard, shards, partials[shard]);
+#ifdef _WIN32
+    bool spawned = child != NULL;
+#else
+    bool spawned = child != -1;
+#endif
+    if (!spawned) {
+      std::fprintf(stderr, "recbatch: cannot start shard %u\n", shard);
+      ++failed;
+      continue;
+    }
+    children.push_back(child);
+    started.push_back(shard);
+  }
+  failed += waitShards(children, started);
+  if (failed > 0) {
+    std::fprintf(stderr, "recbatch: %u of %u shards failed\n", failed, shards);
+    return 1;
+  }
+  mergePartials(partials, output);
+  for (auto it = partials.cbegin(); it != partials.cend(); ++it) {
+    std::remove(it->c_str());
+  }
+  return 0;
+}
+
+static int pack(const Manifest& manifest, const std::string& fileName, const ReplayPackOptions& options) {
+  ReplayPackWriter writer(fileName, options);
+  unsigned int failed = 0;
+  for (auto it = manifest.cbegin(); it != manifest.cend(); ++it) {
+    try {
+      writer.add(it->path);
+    } catch (const ERecAnalystException& e) {
+      std::fprintf(stderr, "recbatch: %s: %s\n", it->path.c_str(), e.what());
+      ++failed;
+    }
+  }
+  writer.finish();
+  std::fprintf(stderr, "recbatch: %zu replays packed, %u unreadable\n", writer.size(), failed);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    return usage();
+  }
+  try {
+    if (std::strcmp(argv[1], "plan") == 0 && argc == 4) {
+      Manifest manifest = readManifest(argv[2]);
+      hashManifest(manifest);
+      writeManifest(argv[3], manifest);
+    } else if (std::strcmp(argv[1], "run") == 0) {
+      PrefetchOptions options;
+      int i = 2;
+      for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (std::strcmp(argv[i], "-workers") == 0) {
+          options.workers = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "-buffers") == 0) {
+          options.buffers = std::atoi(argv[i + 1]);
+        } else {
+          return usage();
+        }
+      }
+      if (argc - i != 4) {
+        return usage();
+      }
+      PrefetchReport report;
+      runShard(readManifest(argv[i]), std::atoi(argv[i + 1]), std::atoi(argv[i + 2]), argv[i + 3],
+        options, &report);
+      writePrefetchReport(std::cerr, report);
+    } else if (std::strcmp(argv[1], "merge") == 0 && argc >= 4) {
+      mergePartials(std::vector<std::string>(argv + 3, argv + argc), argv[2]);
+    } else if (std::strcmp(argv[1], "pack") == 0 && (argc == 4 ||
+        (argc == 5 && std::strcmp(argv[2], "-store") == 0))) {
+      ReplayPackOptions options;
+      options.compress = argc == 4;
+      return pack(readManifest(argv[argc - 2]), argv[argc - 1], options);
+    } else if (std::strcmp(argv[1], "local") == 0 && argc == 5 && std::atoi(argv[3]) > 0) {
+      return runLocal(argv[0], argv[2], std::atoi(argv[3]), argv[4]);
+    } else {
+      return usage();
+    }
+  } catch (const ERecAnalystException& e) {
+    std::fprintf(stderr, "recbatch: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+#include "recanalystwrap.h"
+
+namespace RecAnalystWrapper {
+
+std::atomic<bool> gTraceEnabled(false);
+
+static const size_t TRACE_CHUNK_SIZE = 4096;
+
+struct TraceChunk {
+  TraceEvent events[TRACE_CHUNK_SIZE];
+  std::atomic<TraceChunk*> next;
+  TraceChunk() : next(NULL) {}
+};
+
+// Written only by its thread, readers see the events published by mCount
+class TraceBuffer {
+public:
+  TraceBuffer(int threadId) : finished(false), exported(false), mThreadId(threadId), mHead(new TraceChunk()),
+    mTail(mHead), mCount(0) {}
+  ~TraceBuffer() {
+    for (TraceChunk* chunk = mHead; chunk != NULL; ) {
+      TraceChunk* next = chunk->next.load(std::memory_order_relaxed);
+      delete chunk;
+      chunk = next;
+    }
+  }
+  void push(const TraceEvent& event) {
+    size_t count = mCount.load(std::memory_order_relaxed);
+    size_t slot = count % TRACE_CHUNK_SIZE;
+    if (count > 0 && slot == 0) {
+      TraceChunk* chunk = mTail->next.load(std::memory_order_relaxed);
+      if (chunk == NULL) {
+        chunk = new TraceChunk();
+        mTail->next.store(chunk, std::memory_order_release);
+      }
+      mTail = chunk;
+    }
+    mTail->events[slot] = event;
+    mCount.store(count + 1, std::memory_order_release);
+  }
+  template <typename F>
+  void forEach(F f) const {
+    size_t count = mCount.load(std::memory_order_acquire);
+    const TraceChunk* chunk = mHead;
+    for (size_t i = 0; i < count; ++i) {
+      if (i > 0 && i % TRACE_CHUNK_SIZE == 0) {
+        chunk = chunk->next.load(std::memory_order_acquire);
+      }
+      f(chunk->events[i % TRACE_CHUNK_SIZE]);
+    }
+  }
+  // chunks are kept for reuse
+  void clear() {
+    mTail = mHead;
+    mCount.store(0, std::memory_order_release);
+  }
+  bool empty() const { return mCount.load(std::memory_order_acquire) == 0; }
+  int threadId() const { return mThreadId; }
+  // guarded by the registry
+  std::string threadName;
+  bool finished;  // its thread exited
+  bool exported;  // written since its thread exited
+private:
+  int mThreadId;
+  TraceChunk* mHead;
+  TraceChunk* mTail;
+  std::atomic<size_t> mCount;
+};
+
+// Buffers outlive their threads so that a trace can be written after a batch ends. The
+// buffer of an exited thread is handed to a new thread once its events were written or
+// cleared, so short-lived threads do not grow the registry.
+class TraceRegistry {
+public:
+  TraceBuffer* acquire(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mBuffers.begin(); it != mBuffers.end(); ++it) {
+      TraceBuffer& buffer = **it;
+      if (buffer.finished && (buffer.exported || buffer.empty())) {
+        buffer.clear();
+        buffer.finished = false;
+        buffer.exported = false;
+        buffer.threadName = name;
+        return &buffer;
+      }
+    }
+    mBuffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer(static_cast<int>(mBuffers.size()) + 1)));
+    mBuffers.back()->threadName = name;
+    return mBuffers.back().get();
+  }
+  void release(TraceBuffer& buffer) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    buffer.finished = true;
+  }
+  void rename(TraceBuffer& buffer, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    buffer.threadName = name;
+  }
+  template <typename F>
+  void forEach(F f) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mBuffers.begin(); it != mBuffers.end(); ++it) {
+      f(**it);
+    }
+  }
+private:
+  std::mutex mMutex;
+  std::vector<std::unique_ptr<TraceBuffer>> mBuffers;
+};
+
+static TraceRegistry& traceRegistry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+// The calling thread's buffer, taken on the first recorded event and given back when the
+// thread exits. A name set before that is kept until then.
+class ThreadTrace {
+public:
+  ThreadTrace() : mBuffer(NULL) {}
+  ~ThreadTrace() {
+    if (mBuffer != NULL) {
+      traceRegistry().release(*mBuffer);
+    }
+  }
+  TraceBuffer& buffer() {
+    if (mBuffer == NULL) {
+      mBuffer = traceRegistry().acquire(mName);
+    }
+    return *mBuffer;
+  }
+  void rename(const std::string& name) {
+    mName = name;
+    if (mBuffer != NULL) {
+      traceRegistry().rename(*mBuffer, name);
+    }
+  }
+private:
+  TraceBuffer* mBuffer;
+  std::string mName;
+};
+
+static ThreadTrace& threadTrace() {
+  static thread_local ThreadTrace trace;
+  return trace;
+}
+
+void setTracingEnabled(bool enabled) {
+  gTraceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void setTraceThreadName(const std::string& name) {
+  threadTrace().rename(name);
+}
+
+unsigned long long traceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void recordTraceEvent(const TraceEvent& event) {
+  threadTrace().buffer().push(event);
+}
+
+void TraceScope::finish() {
+  unsigned long long end = traceNow();
+  mEvent.start = mStart;
+  mEvent.duration = end - mStart;
+  for (int i = mArgCount; i < 2; ++i) {
+    mEvent.argNames[i] = NULL;
+  }
+  recordTraceEvent(mEvent);
+}
+
+void clearTrace() {
+  traceRegistry().forEach([](TraceBuffer& b) { b.clear(); });
+}
+
+static void writeJsonString(std::ostream& stream, const char* s) {
+  stream << '"';
+  for (; *s != '\0'; ++s) {
+    if (*s == '"' || *s == '\\') {
+      stream << '\\' << *s;
+    } else if (static_cast<unsigned char>(*s) >= 0x20) {
+      stream << *s;
+    }
+  }
+  stream << '"';
+}
+
+// Chrome trace-event format, complete ("X") events with timestamps in microseconds
+void writeChromeTrace(std::ostream& stream) {
+  unsigned long long origin = ~0ULL;
+  traceRegistry().forEach([&origin](TraceBuffer& b) {
+    b.forEach([&origin](const TraceEvent& e) {
+      if (e.start < origin) {
+        origin = e.start;
+      }
+    });
+  });
+  bool first = true;
+  stream << "{\"traceEvents\":[";
+  traceRegistry().forEach([&](TraceBuffer& b) {
+    b.exported = b.finished;
+    if (!b.threadName.empty()) {
+      stream << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+        << b.threadId() << ",\"args\":{\"name\":";
+      writeJsonString(stream, b.threadName.c_str());
+      stream << "}}";
+      first = false;
+    }
+    b.forEach([&](const TraceEvent& e) {
+      char times[64];
+      std::snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", (e.start - origin) / 1000.0,
+        e.duration / 1000.0);
+      stream << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << b.threadId()
+        << ",\"name\":";
+      writeJsonString(stream, e.name);
+      stream << ',' << times;
+      if (e.argNames[0] != NULL) {
+        stream << ",\"args\":{";
+        for (int i = 0; i < 2 && e.argNames[i] != NULL; ++i) {
+          if (i > 0) {
+            stream << ',';
+          }
+          writeJsonString(stream, e.argNames[i]);
+          stream << ':' << e.args[i];
+        }
+        stream << '}';
+      }
+      stream << '}';
+      first = false;
+    });
+  });
+  stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void saveChromeTrace(const std::string& fileName) {
+  std::ofstream stream(fileName);
+  if (!stream) {
+    throw ERecAnalystException("Unable to create trace file: " + fileName);
+  }
+  writeChromeTrace(stream);
+}
+
+} // namespace
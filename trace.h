@@ -0,0 +1,94 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include <atomic>
+#include <ostream>
+#include <string>
+
+namespace RecAnalystWrapper {
+
+// Span recorded by TraceScope, names must be string literals
+struct TraceEvent {
+  const char* name;
+  unsigned long long start;  // steady clock, ns
+  unsigned long long duration;
+  const char* argNames[2];
+  long long args[2];
+};
+
+extern std::atomic<bool> gTraceEnabled;
+
+inline bool tracingEnabled() {
+#ifdef RECANALYST_NO_TRACE
+  return false;
+#else
+  return gTraceEnabled.load(std::memory_order_relaxed);
+#endif
+}
+
+void setTracingEnabled(bool enabled);
+void setTraceThreadName(const std::string& name);  // shown for the calling thread
+unsigned long long traceNow();
+void recordTraceEvent(const TraceEvent& event);
+// Events are kept in per-thread buffers until cleared, those of an exited thread
+// only until they were written once. clearTrace() must not race with threads that
+// record.
+void clearTrace();
+void writeChromeTrace(std::ostream& stream);
+void saveChromeTrace(const std::string& fileName);
+
+// Records the lifetime of the scope if tracing was enabled when it was entered
+class TraceScope {
+public:
+  explicit TraceScope(const char* name) : mStart(tracingEnabled() ? traceNow() : 0), mArgCount(0) {
+    mEvent.name = name;
+  }
+  ~TraceScope() {
+    if (mStart != 0) {
+      finish();
+    }
+  }
+  bool active() const { return mStart != 0; }
+  void setArg(const char* name, long long value) {
+    if (mArgCount < 2) {
+      mEvent.argNames[mArgCount] = name;
+      mEvent.args[mArgCount++] = value;
+    }
+  }
+private:
+  TraceScope(const TraceScope&);
+  TraceScope& operator=(const TraceScope&);
+  void finish();
+  TraceEvent mEvent;
+  unsigned long long mStart;
+  int mArgCount;
+};
+
+} // namespace
+
+#define RECANALYST_TRACE_CONCAT_(a, b) a##b
+#define RECANALYST_TRACE_CONCAT(a, b) RECANALYST_TRACE_CONCAT_(a, b)
+
+#ifdef RECANALYST_NO_TRACE
+#define RECANALYST_TRACE_SCOPE(name) ((void)0)
+#else
+#define RECANALYST_TRACE_SCOPE(name) \
+  ::RecAnalystWrapper::TraceScope RECANALYST_TRACE_CONCAT(traceScope, __LINE__)(name)
+#endif
+
+#endif  //_TRACE_H_
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECANALYST_SSE2
+#include <emmintrin.h>
+#endif
+#include <cstring>
+#include "transcode.h"
+
+namespace RecAnalystWrapper {
+
+// Code points of bytes 0x80-0xFF
+static const unsigned short WINDOWS_1250_TABLE[128] = {
+  0x20AC, 0x0081, 0x201A, 0x0083, 0x201E, 0x2026, 0x2020, 0x2021,
+  0x0088, 0x2030, 0x0160, 0x2039, 0x015A, 0x0164, 0x017D, 0x0179,
+  0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+  0x0098, 0x2122, 0x0161, 0x203A, 0x015B, 0x0165, 0x017E, 0x017A,
+  0x00A0, 0x02C7, 0x02D8, 0x0141, 0x00A4, 0x0104, 0x00A6, 0x00A7,
+  0x00A8, 0x00A9, 0x015E, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x017B,
+  0x00B0, 0x00B1, 0x02DB, 0x0142, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+  0x00B8, 0x0105, 0x015F, 0x00BB, 0x013D, 0x02DD, 0x013E, 0x017C,
+  0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+  0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+  0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+  0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+  0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+  0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+  0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+  0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9,
+};
+
+static const unsigned short WINDOWS_1251_TABLE[128] = {
+  0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+  0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+  0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+  0x0098, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+  0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+  0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+  0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+  0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+  0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+  0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+  0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+  0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+  0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+  0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+  0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+  0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+};
+
+static const unsigned short WINDOWS_1252_TABLE[128] = {
+  0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+  0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+  0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+  0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+  0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+  0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+  0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+  0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+  0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+  0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+  0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+  0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+  0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+  0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+  0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+  0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF,
+};
+
+std::size_t asciiPrefix(const char* text, std::size_t size) {
+  std::size_t i = 0;
+#ifdef RECANALYST_SSE2
+  for (; i + 16 <= size; i += 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)));
+    if (mask != 0) {
+      while ((mask & 1) == 0) {
+        mask >>= 1;
+        ++i;
+      }
+      return i;
+    }
+  }
+#endif
+  while (i < size && static_cast<unsigned char>(text[i]) < 0x80) {
+    ++i;
+  }
+  return i;
+}
+
+// Length of the UTF-8 sequence at text, 0 when it is malformed
+static std::size_t utf8SequenceLength(const unsigned char* text, std::size_t size) {
+  unsigned char c = text[0];
+  std::size_t length;
+  unsigned char min = 0x80;
+  unsigned char max = 0xBF;
+  if (c >= 0xC2 && c <= 0xDF) {
+    length = 2;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    length = 3;
+    if (c == 0xE0) {
+      min = 0xA0;  // overlong
+    } else if (c == 0xED) {
+      max = 0x9F;  // surrogates
+    }
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    length = 4;
+    if (c == 0xF0) {
+      min = 0x90;
+    } else if (c == 0xF4) {
+      max = 0x8F;  // above U+10FFFF
+    }
+  } else {
+    return 0;
+  }
+  if (length > size || text[1] < min || text[1] > max) {
+    return 0;
+  }
+  for (std::size_t i = 2; i < length; ++i) {
+    if (text[i] < 0x80 || text[i] > 0xBF) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+bool isValidUtf8(const char* text, std::size_t size) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(text);
+  std::size_t i = 0;
+  while (i < size) {
+    i += asciiPrefix(text + i, size - i);
+    if (i == size) {
+      break;
+    }
+    std::size_t length = utf8SequenceLength(p + i, size - i);
+    if (length == 0) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+CodePage detectCodePage(std::string_view sample, CodePage fallback) {
+  std::size_t ascii = asciiPrefix(sample.data(), sample.size());
+  if (ascii == sample.size()) {
+    return fallback;
+  }
+  if (isValidUtf8(sample.data() + ascii, sample.size() - ascii)) {
+    return CodePage::UTF8;
+  }
+  std::size_t letters = 0;
+  std::size_t high = 0;
+  std::size_t upperHalf = 0;  // 0xC0-0xFF, all letters in windows-1251
+  std::size_t central = 0;    // letters in windows-1250, symbols in windows-1252
+  for (auto it = sample.cbegin() + ascii; it != sample.cend(); ++it) {
+    unsigned char c = static_cast<unsigned char>(*it);
+    if (c < 0x80) {
+      if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') {
+        ++letters;
+      }
+      continue;
+    }
+    ++high;
+    if (c >= 0xC0) {
+      ++upperHalf;
+    }
+    switch (c) {
+      case 0x8C: case 0x8F: case 0x9C: case 0x9F: case 0xA3: case 0xA5: case 0xAA:
+      case 0xAF: case 0xB3: case 0xB9: case 0xBA: case 0xBC: case 0xBE: case 0xBF:
+        ++central;
+        break;
+    }
+  }
+  // cyrillic words are all high bytes, latin ones mostly ASCII with a few accents
+  if (high > letters && upperHalf * 5 >= high * 4) {
+    return CodePage::WINDOWS_1251;
+  }
+  if (central * 4 >= high) {
+    return CodePage::WINDOWS_1250;
+  }
+  return CodePage::WINDOWS_1252;
+}
+
+Utf8Transcoder::Utf8Transcoder(CodePage codePage) : mCodePage(codePage) {
+  const unsigned short* table;
+  switch (codePage) {
+    case CodePage::WINDOWS_1250:
+      table = WINDOWS_1250_TABLE;
+      break;
+    case CodePage::WINDOWS_1251:
+      table = WINDOWS_1251_TABLE;
+      break;
+    default:
+      table = WINDOWS_1252_TABLE;
+      break;
+  }
+  for (int c = 0; c < 0x100; ++c) {
+    char* sequence = mSequence[c];
+    unsigned int cp = (c < 0x80) ? c : table[c - 0x80];
+    sequence[1] = sequence[2] = sequence[3] = 0;
+    if (cp < 0x80) {
+      mExtra[c] = 0;
+      sequence[0] = static_cast<char>(cp);
+    } else if (cp < 0x800) {
+      mExtra[c] = 1;
+      sequence[0] = static_cast<char>(0xC0 | (cp >> 6));
+      sequence[1] = static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      mExtra[c] = 2;
+      sequence[0] = static_cast<char>(0xE0 | (cp >> 12));
+      sequence[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      sequence[2] = static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+}
+
+std::size_t Utf8Transcoder::encodingStart(const char* text, std::size_t size) const {
+  std::size_t ascii = asciiPrefix(text, size);
+  if (ascii == size || mCodePage == CodePage::UTF8 ||
+      (mCodePage == CodePage::AUTO && isValidUtf8(text + ascii, size - ascii))) {
+    return PASS_THROUGH;
+  }
+  return ascii;
+}
+
+bool Utf8Transcoder::needsEncoding(const char* text, std::size_t size) const {
+  return encodingStart(text, size) != PASS_THROUGH;
+}
+
+std::size_t Utf8Transcoder::encodedSize(const char* text, std::size_t size) const {
+  std::size_t ascii = encodingStart(text, size);
+  return (ascii == PASS_THROUGH) ? size : encodedSize(text, size, ascii);
+}
+
+std::size_t Utf8Transcoder::encodedSize(const char* text, std::size_t size, std::size_t ascii) const {
+  std::size_t encoded = size;
+  for (std::size_t i = ascii; i < size; ++i) {
+    encoded += mExtra[static_cast<unsigned char>(text[i])];
+  }
+  return encoded;
+}
+
+inline char* Utf8Transcoder::encodeByte(unsigned char c, char* out) const {
+  if (c < 0x80) {
+    *out++ = static_cast<char>(c);
+    return out;
+  }
+  const char* sequence = mSequence[c];
+  out[0] = sequence[0];
+  out[1] = sequence[1];
+  if (mExtra[c] == 2) {
+    out[2] = sequence[2];
+  }
+  return out + 1 + mExtra[c];
+}
+
+char* Utf8Transcoder::encode(const char* text, std::size_t size, char* out) const {
+  std::size_t ascii = encodingStart(text, size);
+  if (ascii == PASS_THROUGH) {
+    std::memcpy(out, text, size);
+    return out + size;
+  }
+  return encode(text, size, ascii, out);
+}
+
+char* Utf8Transcoder::encode(const char* text, std::size_t size, std::size_t ascii, char* out) const {
+  std::size_t i = ascii;
+  std::memcpy(out, text, i);
+  out += i;
+#ifdef RECANALYST_SSE2
+  // ASCII blocks are stored whole, the output left is never shorter than the input left
+  for (; i + 16 + 3 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+    if (_mm_movemask_epi8(block) == 0) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+      out += 16;
+      continue;
+    }
+    // four bytes are stored per byte without branching, the input left after the
+    // block leaves room for the unused ones
+    for (std::size_t j = i; j < i + 16; ++j) {
+      unsigned char c = static_cast<unsigned char>(text[j]);
+      std::memcpy(out, mSequence[c], 4);
+      out += 1 + mExtra[c];
+    }
+  }
+#endif
+  for (; i < size; ++i) {
+    out = encodeByte(static_cast<unsigned char>(text[i]), out);
+  }
+  return out;
+}
+
+std::string_view Utf8Transcoder::copy(std::string_view text, std::pmr::memory_resource* resource) const {
+  if (text.empty()) {
+    return std::string_view();
+  }
+  std::size_t ascii = encodingStart(text.data(), text.size());
+  std::size_t size = (ascii == PASS_THROUGH) ? text.size() : encodedSize(text.data(), text.size(), ascii);
+  char* out = static_cast<char*>(resource->allocate(size, 1));
+  if (ascii == PASS_THROUGH) {
+    std::memcpy(out, text.data(), size);
+  } else {
+    encode(text.data(), text.size(), ascii, out);
+  }
+  return std::string_view(out, size);
+}
+
+std::string_view Utf8Transcoder::borrow(std::string_view text, std::pmr::memory_resource* resource) const {
+  std::size_t ascii = encodingStart(text.data(), text.size());
+  if (ascii == PASS_THROUGH) {
+    return text;
+  }
+  std::size_t size = encodedSize(text.data(), text.size(), ascii);
+  char* out = static_cast<char*>(resource->allocate(size, 1));
+  encode(text.data(), text.size(), ascii, out);
+  return std::string_view(out, size);
+}
+
+} // namespace
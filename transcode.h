@@ -0,0 +1,86 @@
+/*
+ * Copyright 2013 biegleux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _TRANSCODE_H_
+#define _TRANSCODE_H_
+#include <cstddef>
+#include <memory_resource>
+#include <string_view>
+
+namespace RecAnalystWrapper {
+
+  // Source encoding of the text the library returns
+  enum class CodePage {
+    AUTO = 0,  // valid UTF-8 passes through, anything else is read as windows-1252
+    WINDOWS_1250 = 1250,  // central european
+    WINDOWS_1251 = 1251,  // cyrillic
+    WINDOWS_1252 = 1252,  // western
+    UTF8 = 65001
+  };
+
+// Number of leading bytes below 0x80, 16 at a time with SSE2
+std::size_t asciiPrefix(const char* text, std::size_t size);
+bool isValidUtf8(const char* text, std::size_t size);
+// Guesses the code page of a text sample (player names and chat of a replay), ASCII only
+// samples give fallback. A heuristic: the longer the sample the better.
+CodePage detectCodePage(std::string_view sample, CodePage fallback = CodePage::WINDOWS_1252);
+
+// Code page to UTF-8 transcoding. ASCII runs are copied as is, the other bytes are looked
+// up in a table of their UTF-8 sequences. Bytes a code page leaves undefined map to the
+// C1 control of the same value, like MultiByteToWideChar does.
+class Utf8Transcoder {
+public:
+  explicit Utf8Transcoder(CodePage codePage = CodePage::AUTO);
+  CodePage codePage() const { return mCodePage; }
+  // false when text comes out byte for byte
+  bool needsEncoding(const char* text, std::size_t size) const;
+  std::size_t encodedSize(const char* text, std::size_t size) const;
+  // writes encodedSize(text, size) bytes, returns the end of the output
+  char* encode(const char* text, std::size_t size, char* out) const;
+  template <typename String>
+  void assign(String& out, std::string_view text) const;
+  // text encoded into memory from resource
+  std::string_view copy(std::string_view text, std::pmr::memory_resource* resource) const;
+  // text itself when it needs no encoding, else copy()
+  std::string_view borrow(std::string_view text, std::pmr::memory_resource* resource) const;
+private:
+  CodePage mCodePage;
+  unsigned char mExtra[256];  // UTF-8 length of each byte minus one
+  char mSequence[256][4];
+  static const std::size_t PASS_THROUGH = static_cast<std::size_t>(-1);
+  // Length of the ASCII prefix of text that needs encoding, PASS_THROUGH for text that
+  // comes out byte for byte. The only scan of the input, the overloads below take its result.
+  std::size_t encodingStart(const char* text, std::size_t size) const;
+  std::size_t encodedSize(const char* text, std::size_t size, std::size_t ascii) const;
+  char* encode(const char* text, std::size_t size, std::size_t ascii, char* out) const;
+  char* encodeByte(unsigned char c, char* out) const;
+};
+
+template <typename String>
+void Utf8Transcoder::assign(String& out, std::string_view text) const {
+  std::size_t ascii = encodingStart(text.data(), text.size());
+  if (ascii == PASS_THROUGH) {
+    out.assign(text.data(), text.size());
+    return;
+  }
+  out.resize(encodedSize(text.data(), text.size(), ascii));
+  encode(text.data(), text.size(), ascii, &out[0]);
+}
+
+} // namespace
+
+#endif  //_TRANSCODE_H_